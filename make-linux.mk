@@ -223,6 +223,14 @@ linux_static_lib: pico $(OBJS)
 	ar -rcs build/libzt.a picotcp.o proxy.o tap.o one.o OneService.o service.o sockets.o rpc.o intercept.o $(OBJS)
 
 # Builds zts_* library tests
+linux_static_lib_tests_4:
+	mkdir -p $(TEST_OBJDIR)
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.idleconns4.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.idleconns4.out -Lbuild -lzt -ldl
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.directecho4.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.directecho4.out -Lbuild -lzt -ldl -lpthread
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.bulkconns4.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.bulkconns4.out -Lbuild -lzt -ldl -lpthread
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.churn4.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.churn4.out -Lbuild -lzt -ldl -lpthread
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.latency4.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.latency4.out -Lbuild -lzt -ldl
+
 linux_static_lib_tests_6:
 	mkdir -p $(TEST_OBJDIR)
 	$(CXX) $(CXXFLAGS) $(LDFLAGS) $(INCLUDES) $(STACK_FLAGS) $(DEFS) -DSDK_SERVICE -DSDK -DSDK_BUNDLED -Isrc tests/zts/zts.udpserver6.c -o $(TEST_OBJDIR)/$(OSTYPE).zts.udpserver6.out -Lbuild -lzt -ldl
@@ -7,6 +7,7 @@ OBJS=\
 	zto/node/CertificateOfOwnership.o \
 	zto/node/Cluster.o \
 	zto/node/Identity.o \
+	zto/node/IdentityValidator.o \
 	zto/node/IncomingPacket.o \
 	zto/node/InetAddress.o \
 	zto/node/Membership.o \
@@ -32,22 +32,52 @@
 
 // picoTCP 
 #define MAX_PICO_FRAME_RX_BUF_SZ        ZT_MAX_MTU * 128
+// Most picoTCP instances a tap will run when ZT_SDK_STACK_SHARDS asks for more than one
+#define SDK_MAX_STACK_SHARDS            8
 
 // General
+// Most frames a FrameBatch holds before handing them to the core
+#define SDK_TX_BATCH_FRAMES             64
+// Connections are carved out of slabs of this many slots, see slabpool.hpp
+#define SDK_SLAB_OBJS                   64
+
 // TCP Buffer sizes
 #define DEFAULT_TCP_TX_BUF_SZ           1024 * 1024
 #define DEFAULT_TCP_RX_BUF_SZ           1024 * 1024
 
+// Connection buffers grow in chunks from a pool shared by all Connections, up to the
+// sizes above. The pool keeps at most SDK_BUF_POOL_MAX_IDLE unused chunks for reuse
+#define SDK_BUF_CHUNK_SZ                16384
+#define SDK_BUF_POOL_MAX_IDLE           256
+
 // TCP RX/TX buffer soft boundaries
 #define DEFAULT_TCP_TX_BUF_SOFTMAX      DEFAULT_TCP_TX_BUF_SZ * 0.80
 #define DEFAULT_TCP_TX_BUF_SOFTMIN      DEFAULT_TCP_TX_BUF_SZ * 0.20
 #define DEFAULT_TCP_RX_BUF_SOFTMAX      DEFAULT_TCP_RX_BUF_SZ * 0.80
 #define DEFAULT_TCP_RX_BUF_SOFTMIN      DEFAULT_TCP_RX_BUF_SZ * 0.20
 
+// Smallest buffer SO_SNDBUF/SO_RCVBUF may shrink a Connection's TX/RX buffer to
+#define SDK_MIN_SOCK_BUF_SZ             ZT_MAX_MTU
+
+// Keepalive timing applied when an app turns on SO_KEEPALIVE (picoTCP, in ms)
+#define SDK_TCP_KEEPIDLE                7200000
+#define SDK_TCP_KEEPINTVL               75000
+#define SDK_TCP_KEEPCNT                 9
+
 // UDP Buffer sizes (should be about the size of your MTU)
 #define DEFAULT_UDP_TX_BUF_SZ           ZT_MAX_MTU
 #define DEFAULT_UDP_RX_BUF_SZ           ZT_MAX_MTU * 10
 
+// Largest datagram payload carried over the app<->service datagram channel
+#define SDK_DGRAM_MAX_PAYLOAD           ZT_MAX_MTU
+// Max iovecs per datagram, and datagrams per sendmmsg()/recvmmsg() call
+#define SDK_DGRAM_MAX_IOV               8
+#define SDK_DGRAM_MMSG_BATCH            64
+
+// Descriptors below this are tracked in the client's fd map, one byte each. Pages
+// never written to cost nothing, so it can match Linux's default fs.nr_open
+#define SDK_FD_MAP_SZ                   1048576
+
 // lwIP
 #define APPLICATION_POLL_FREQ           2
 #define ZT_LWIP_TCP_TIMER_INTERVAL      50
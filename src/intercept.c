@@ -66,6 +66,11 @@ pthread_key_t thr_id_key;
     #if !defined(__ANDROID__)
         int (*realsyscall)(SYSCALL_SIG) = 0;
     #endif
+    #if defined(_GNU_SOURCE)
+        int (*realsendmmsg)(SENDMMSG_SIG) = 0;
+        int (*realrecvmmsg)(RECVMMSG_SIG) = 0;
+        int (*realdup3)(DUP3_SIG) = 0;
+    #endif
 #endif
 
 #if !defined(__ANDROID__)
@@ -83,6 +88,8 @@ pthread_key_t thr_id_key;
      int (*realgetsockopt)(GETSOCKOPT_SIG) = 0;
      int (*realclose)(CLOSE_SIG);
      int (*realgetsockname)(GETSOCKNAME_SIG) = 0;
+     int (*realdup)(DUP_SIG) = 0;
+     int (*realdup2)(DUP2_SIG) = 0;
 
     // ------------------------------------------------------------------------------
     // --------------------- Get Original socket API pointers -----------------------
@@ -97,6 +104,11 @@ pthread_key_t thr_id_key;
     #if !defined(__ANDROID__)
         realsyscall = dlsym(RTLD_NEXT, "syscall");
     #endif
+    #if defined(_GNU_SOURCE)
+        realsendmmsg = (int(*)(SENDMMSG_SIG))dlsym(RTLD_NEXT, "sendmmsg");
+        realrecvmmsg = (int(*)(RECVMMSG_SIG))dlsym(RTLD_NEXT, "recvmmsg");
+        realdup3 = (int(*)(DUP3_SIG))dlsym(RTLD_NEXT, "dup3");
+    #endif
 #endif
 
         realsetsockopt = (int(*)(SETSOCKOPT_SIG))dlsym(RTLD_NEXT, "setsockopt");
@@ -107,10 +119,13 @@ pthread_key_t thr_id_key;
         reallisten = (int(*)(LISTEN_SIG))dlsym(RTLD_NEXT, "listen");
         realclose = (int(*)(CLOSE_SIG))dlsym(RTLD_NEXT, "close");
         realgetsockname = (int(*)(GETSOCKNAME_SIG))dlsym(RTLD_NEXT, "getsockname");
+        realdup = (int(*)(DUP_SIG))dlsym(RTLD_NEXT, "dup");
+        realdup2 = (int(*)(DUP2_SIG))dlsym(RTLD_NEXT, "dup2");
     #if !defined(__ANDROID__)
         realbind = (int(*)(BIND_SIG))dlsym(RTLD_NEXT, "bind");
         realsendto = (ssize_t(*)(int, const void *, size_t, int, const struct sockaddr *, socklen_t))dlsym(RTLD_NEXT, "sendto");
         realrecvfrom = (int(*)(RECVFROM_SIG))dlsym(RTLD_NEXT, "recvfrom");
+        realsendmsg = (int(*)(SENDMSG_SIG))dlsym(RTLD_NEXT, "sendmsg");
         realrecvmsg = (int(*)(RECVMSG_SIG))dlsym(RTLD_NEXT, "recvmsg");
     #endif
     }
@@ -137,26 +152,12 @@ pthread_key_t thr_id_key;
     #endif
     }
 
-    // ------------------------------------------------------------------------------
-    // ------------------------- connected_to_service() -----------------------------
-    // ------------------------------------------------------------------------------
-    // Check whether or not the socket is mapped to the service. We
-    // need to know if this is a regular AF_LOCAL socket or an end of a socketpair
-    // that the service uses. We don't want to keep state in the intercept, so
-    // we simply ask the service via an RPC
-
-    int connected_to_service(int sockfd)
+    // SOCK_STREAM or SOCK_DGRAM if the service handed us fd, 0 if it's the kernel's.
+    // The service never hands out a descriptor the fd map can't record, so a plain
+    // AF_LOCAL socket of the app's own is never mistaken for one of ours
+    static int service_fd_type(int fd)
     {
-        struct sockaddr_storage addr;
-        socklen_t len = sizeof addr;
-        struct sockaddr_un * addr_un;
-        getpeername(sockfd, (struct sockaddr*)&addr, &len);
-        if (addr.ss_family == AF_LOCAL || addr.ss_family == AF_LOCAL) {
-            addr_un = (struct sockaddr_un*)&addr;
-            return strcmp(addr_un->sun_path, api_netpath) == 0;
-        }
-        DEBUG_ERROR("not connected to service");
-        return 0;
+        return get_fd_type(fd);
     }
     
     // ------------------------------------------------------------------------------
@@ -169,7 +170,7 @@ pthread_key_t thr_id_key;
     ssize_t sendto(SENDTO_SIG)
     {
         DEBUG_INFO("fd=%d, len=%d", fd, (int)len);
-        if (!check_intercept_enabled())
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
             return realsendto(fd, buf, len, flags, addr, addrlen);
         return zts_sendto(fd, buf, len, flags, addr, addrlen);
     }
@@ -184,9 +185,9 @@ pthread_key_t thr_id_key;
     ssize_t sendmsg(SENDMSG_SIG)
     {
         DEBUG_INFO("fd=%d", fd);
-        //if(!check_intercept_enabled())
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
             return realsendmsg(fd, msg, flags);
-        zts_sendmsg(fd, msg, flags);
+        return zts_sendmsg(fd, msg, flags);
     }
 #endif
     
@@ -200,8 +201,8 @@ pthread_key_t thr_id_key;
     ssize_t recvfrom(RECVFROM_SIG)
     {
         DEBUG_INFO("fd=%d", fd);
-        //if(!check_intercept_enabled())
-        //    return realrecvfrom(fd, buf, len, flags, addr, addrlen);
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
+            return realrecvfrom(fd, buf, len, flags, addr, addrlen);
         return zts_recvfrom(fd, buf, len, flags, addr, addrlen);
     }
 #endif
@@ -215,12 +216,35 @@ pthread_key_t thr_id_key;
     ssize_t recvmsg(RECVMSG_SIG)
     {
         DEBUG_INFO("fd=%d", fd);
-        //if(!check_intercept_enabled())
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
             return realrecvmsg(fd, msg, flags);
         return zts_recvmsg(fd, msg, flags);
     }
 #endif
 
+    // ------------------------------------------------------------------------------
+    // -------------------------- sendmmsg() / recvmmsg() ---------------------------
+    // ------------------------------------------------------------------------------
+    // int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags [, struct timespec *timeout]
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    int sendmmsg(SENDMMSG_SIG)
+    {
+        DEBUG_INFO("fd=%d, vlen=%u", fd, vlen);
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
+            return realsendmmsg(fd, msgvec, vlen, flags);
+        return zts_sendmmsg(fd, msgvec, vlen, flags);
+    }
+
+    int recvmmsg(RECVMMSG_SIG)
+    {
+        DEBUG_INFO("fd=%d, vlen=%u", fd, vlen);
+        if (!check_intercept_enabled() || !is_dgram_channel(fd))
+            return realrecvmmsg(fd, msgvec, vlen, flags, timeout);
+        return zts_recvmmsg(fd, msgvec, vlen, flags, timeout);
+    }
+#endif
+
     // ------------------------------------------------------------------------------
     // --------------------------------- setsockopt() -------------------------------
     // ------------------------------------------------------------------------------
@@ -237,11 +261,19 @@ pthread_key_t thr_id_key;
         if(level == SOL_IP && (optname == IP_TTL || optname == IP_TOS))
             return 0;
     #endif
-        if(level == IPPROTO_TCP || (level == SOL_SOCKET && optname == SO_KEEPALIVE))
-            return 0;
+        int type = service_fd_type(fd);
+        if(level == IPPROTO_TCP) {
+            if(type != SOCK_STREAM)
+                return realsetsockopt(fd, level, optname, optval, optlen);
+            if(!is_stack_sockopt(level, optname))
+                return 0; // No counterpart in the stack
+            return zts_setsockopt(fd, level, optname, optval, optlen);
+        }
+        if(is_stack_sockopt(level, optname) && type)
+            return zts_setsockopt(fd, level, optname, optval, optlen);
         if(realsetsockopt(fd, level, optname, optval, optlen) < 0)
             perror("setsockopt():\n");
-        return zts_setsockopt(fd, level, optname, optval, optlen);
+        return 0;
     }
 
     // ------------------------------------------------------------------------------
@@ -252,7 +284,10 @@ pthread_key_t thr_id_key;
     int getsockopt(GETSOCKOPT_SIG)
     {
         DEBUG_INFO("fd=%d", fd);
-        if (!check_intercept_enabled() || !connected_to_service(fd))
+        if (!check_intercept_enabled())
+            return realgetsockopt(fd, level, optname, optval, optlen);
+        int type = service_fd_type(fd);
+        if(level == IPPROTO_TCP ? type != SOCK_STREAM : !type)
             return realgetsockopt(fd, level, optname, optval, optlen);
         return zts_getsockopt(fd, level, optname, optval, optlen);
     }
@@ -272,6 +307,7 @@ pthread_key_t thr_id_key;
             }
             else {
                 DEBUG_BLANK("realsocket(): fd=%d", err);
+                set_fd_type(err, 0);
                 return err;
             }
         }
@@ -283,6 +319,7 @@ pthread_key_t thr_id_key;
            || socket_family == AF_UNIX) {
             err = realsocket(socket_family, socket_type, protocol);
             DEBUG_BLANK("realsocket(): fd=%d", err);
+            set_fd_type(err, 0);
             return err;
         }
         return zts_socket(socket_family, socket_type, protocol);
@@ -429,6 +466,11 @@ pthread_key_t thr_id_key;
 #if defined(__linux__)
     int accept4(ACCEPT4_SIG) {
         DEBUG_ATTN("fd=%d", fd);
+        if (!check_intercept_enabled() || service_fd_type(fd) != SOCK_STREAM || fd <= 2) {
+            int err = realaccept4(fd, addr, addrlen, flags);
+            set_fd_type(err, 0);
+            return err;
+        }
         return zts_accept4(fd, addr, addrlen, flags);
     }
 #endif
@@ -438,39 +480,22 @@ pthread_key_t thr_id_key;
     // ------------------------------------------------------------------------------
     // int fd struct sockaddr *addr, socklen_t *addrlen
 
+    // Kernel sockets accepted here are cleared in the fd map, the number may have
+    // been one of ours that was closed behind our back
+    static int kernel_accept(ACCEPT_SIG) {
+        int err = realaccept(fd, addr, addrlen);
+        set_fd_type(err, 0);
+        return err;
+    }
+
     int accept(ACCEPT_SIG) {
         DEBUG_ATTN("fd=%d", fd);
-        if (!check_intercept_enabled())
-            return realaccept(fd, addr, addrlen);
+        if (!check_intercept_enabled() || service_fd_type(fd) != SOCK_STREAM)
+            return kernel_accept(fd, addr, addrlen);
 
-        // Check that this is a valid fd
-        if(fcntl(fd, F_GETFD) < 0) {
-            return -1;
-            errno = EBADF;
-            DEBUG_ERROR("EBADF");
-            return -1;
-        }
-        /*
-        int opt;
-        socklen_t opt_len;
-        if(getsockopt(fd, SOL_SOCKET, SO_TYPE, (void *) &opt, &opt_len) < 0) {
-            errno = ENOTSOCK;
-            return -1;
-        }
-        // Check that this socket supports accept()
-        if((opt != SOCK_STREAM) && (opt != SOCK_SEQPACKET)) {
-            errno = EOPNOTSUPP;
-            return -1;
-        }
-        */
-        // Check that we haven't hit the soft-limit file descriptors allowed
-        struct rlimit rl;
-        getrlimit(RLIMIT_NOFILE, &rl);
-        if(fd >= rl.rlim_cur){
-            errno = EMFILE;
-            DEBUG_ERROR("EMFILE");
-            return -1;
-        }
+        // The fd map already vouched for fd, and a bad descriptor fails the read in
+        // zts_accept() with EBADF. The old fcntl()/getrlimit() checks cost two system
+        // calls per connection
         // Check address length
         if(addrlen < 0) {
             errno = EINVAL;
@@ -480,7 +505,7 @@ pthread_key_t thr_id_key;
         // redirect calls for standard I/O descriptors to kernel
         if(fd == 0 || fd == 1 || fd == 2){
             DEBUG_BLANK("realaccept(): ");
-            return(realaccept(fd, addr, addrlen));
+            return kernel_accept(fd, addr, addrlen);
         }
 
         return zts_accept(fd, addr, addrlen);
@@ -494,7 +519,7 @@ pthread_key_t thr_id_key;
     int listen(LISTEN_SIG)
     {
         DEBUG_ATTN("fd=%d", fd);
-        if (!check_intercept_enabled() || !connected_to_service(fd))
+        if (!check_intercept_enabled() || service_fd_type(fd) != SOCK_STREAM)
             return reallisten(fd, backlog);
         // make sure we don't touch any standard outputs
         if(fd == 0 || fd == 1 || fd == 2)
@@ -509,11 +534,54 @@ pthread_key_t thr_id_key;
 
     int close(CLOSE_SIG) {
         DEBUG_EXTRA("fd=%d", fd);
-        if(!check_intercept_enabled())
+        if(!check_intercept_enabled()) {
+            set_fd_type(fd, 0); // Whichever thread closes it, the number will be reused
             return realclose(fd);
+        }
         return zts_close(fd);
     }
 
+    // ------------------------------------------------------------------------------
+    // ------------------------------ dup() / dup2() --------------------------------
+    // ------------------------------------------------------------------------------
+    // int oldfd [, int newfd [, int flags]]
+    // A copy of one of our descriptors is ours as well. dup2() closes whatever was
+    // at newfd, so newfd's entry always follows oldfd's
+
+    int dup(DUP_SIG)
+    {
+        if(!realdup)
+            load_symbols();
+        int newfd = realdup(oldfd);
+        if(newfd >= 0)
+            set_fd_type(newfd, service_fd_type(oldfd));
+        return newfd;
+    }
+
+    int dup2(DUP2_SIG)
+    {
+        if(!realdup2)
+            load_symbols();
+        int type = service_fd_type(oldfd);
+        int err = realdup2(oldfd, newfd);
+        if(err >= 0)
+            set_fd_type(newfd, type);
+        return err;
+    }
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    int dup3(DUP3_SIG)
+    {
+        if(!realdup3)
+            load_symbols();
+        int type = service_fd_type(oldfd);
+        int err = realdup3(oldfd, newfd, flags);
+        if(err >= 0)
+            set_fd_type(newfd, type);
+        return err;
+    }
+#endif
+
     // ------------------------------------------------------------------------------
     // -------------------------------- getsockname() -------------------------------
     // ------------------------------------------------------------------------------
@@ -527,7 +595,7 @@ pthread_key_t thr_id_key;
             return realgetsockname(fd, addr, addrlen);
     #endif
         DEBUG_INFO("fd=%d", fd);
-        if(!connected_to_service(fd)) {
+        if(!service_fd_type(fd)) {
             DEBUG_ERROR("fd=%d not used by service", fd);
             return realgetsockname(fd, addr, addrlen);
         }
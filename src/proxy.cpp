@@ -185,8 +185,7 @@ namespace ZeroTier
         {
         	if(len) {
 	            DEBUG_INFO("len=%lu\n", len);
-	            memcpy((&conn->txbuf)+(conn->txsz), buf, len);
-	   			conn->txsz += len;
+	            conn->txbuf.write(buf, len);
 	   			handleWrite(conn);
    			}
         }
@@ -414,6 +413,10 @@ namespace ZeroTier
 	{
 		DEBUG_INFO("sock=%p", (void*)&sockN);
 		Connection *newConn = new Connection();
+		if(!newConn) {
+			_phy.close(sockN);
+			return;
+		}
 		newConn->sock = sockN;
 		_phy.setNotifyWritable(sockN, false);
 		_Connections.push_back(newConn);
@@ -435,8 +438,7 @@ namespace ZeroTier
                 return;
             }
             unsigned char *buf = (unsigned char*)data;
-			memcpy((&conn->txbuf)+(conn->txsz), buf, len);
-			conn->txsz += len;
+			conn->txbuf.write(buf, len);
 			handleWrite(conn);
 		}
 	}
@@ -0,0 +1,233 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#ifndef _SDK_RINGBUFFER_HPP_
+#define _SDK_RINGBUFFER_HPP_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "Mutex.hpp"
+#include "defs.h"
+
+namespace ZeroTier {
+
+	/*
+	 * A process-wide cache of SDK_BUF_CHUNK_SZ buffer chunks shared by every
+	 * Connection. Chunks nobody asked for between two trim() calls go back to
+	 * the system, so the cache follows load down as well as up
+	 */
+	class ChunkPool
+	{
+	public:
+		// Never destroyed, Connections may outlive static destructors at exit
+		static ChunkPool &shared()
+		{
+			static ChunkPool *pool = new ChunkPool();
+			return *pool;
+		}
+
+		// Returns NULL only if the system is out of memory
+		unsigned char *get()
+		{
+			Mutex::Lock _l(_lock);
+			unsigned char *c;
+			if(_free.empty()) {
+				if(!(c = (unsigned char *)malloc(SDK_BUF_CHUNK_SZ)))
+					return NULL;
+			} else {
+				c = _free.back();
+				_free.pop_back();
+				_minFree = std::min(_minFree, _free.size());
+			}
+			++_inUse;
+			return c;
+		}
+
+		void put(unsigned char *c)
+		{
+			Mutex::Lock _l(_lock);
+			--_inUse;
+			if(_free.size() >= SDK_BUF_POOL_MAX_IDLE)
+				free(c);
+			else
+				_free.push_back(c);
+		}
+
+		// Call periodically. Frees as many cached chunks as sat idle since the last call
+		void trim()
+		{
+			Mutex::Lock _l(_lock);
+			for(;_minFree && !_free.empty();--_minFree) {
+				free(_free.back());
+				_free.pop_back();
+			}
+			_minFree = _free.size();
+		}
+
+		inline size_t inUse() { Mutex::Lock _l(_lock); return _inUse; }
+		inline size_t cached() { Mutex::Lock _l(_lock); return _free.size(); }
+
+	private:
+		ChunkPool() : _inUse(0), _minFree(0) {}
+
+		std::vector<unsigned char *> _free;
+		size_t _inUse;
+		size_t _minFree; // Fewest chunks _free held since the last trim()
+		Mutex _lock;
+	};
+
+	/*
+	 * A byte FIFO made of ChunkPool chunks. It holds no memory while empty,
+	 * takes chunks as data is written and returns each one as soon as it has
+	 * been read, so data is never shifted. Not thread-safe, callers already
+	 * hold the locks that guarded the old fixed buffers
+	 */
+	class RingBuffer
+	{
+	public:
+		RingBuffer() : _head(0), _tail(0), _size(0) {}
+		~RingBuffer() { clear(); }
+
+		inline int size() const { return _size; }
+		inline size_t allocated() const { return _chunks.size() * SDK_BUF_CHUNK_SZ; }
+
+		/*
+		 * Contiguous free space at the end, taking a chunk if the last one is full.
+		 * Fill up to room bytes, then commit() what was actually written
+		 */
+		unsigned char *writePtr(int &room)
+		{
+			if(_chunks.empty() || _tail == SDK_BUF_CHUNK_SZ) {
+				unsigned char *c = ChunkPool::shared().get();
+				if(!c) {
+					room = 0;
+					return NULL;
+				}
+				_chunks.push_back(c);
+				_tail = 0;
+			}
+			room = SDK_BUF_CHUNK_SZ - _tail;
+			return _chunks.back() + _tail;
+		}
+
+		void commit(int n)
+		{
+			_tail += n;
+			_size += n;
+			if(!_size)
+				clear(); // writePtr() took a chunk that nothing went into
+		}
+
+		// Appends len bytes, fewer only if the system is out of memory
+		int write(const void *data, int len)
+		{
+			int n = 0;
+			while(n < len) {
+				int room;
+				unsigned char *p = writePtr(room);
+				if(!p)
+					break;
+				int c = std::min(room, len - n);
+				memcpy(p, (const unsigned char *)data + n, c);
+				commit(c);
+				n += c;
+			}
+			return n;
+		}
+
+		// Contiguous data at the front, len is 0 when empty
+		const unsigned char *readPtr(int &len) const
+		{
+			if(!_size) {
+				len = 0;
+				return NULL;
+			}
+			len = (_chunks.size() == 1 ? _tail : SDK_BUF_CHUNK_SZ) - _head;
+			return _chunks.front() + _head;
+		}
+
+		// Drops n bytes from the front, returning chunks that have been read
+		void consume(int n)
+		{
+			n = std::min(n, _size);
+			while(n > 0) {
+				int len;
+				readPtr(len);
+				int c = std::min(len, n);
+				_head += c;
+				_size -= c;
+				n -= c;
+				if(!_size) {
+					clear();
+				} else if(_head == SDK_BUF_CHUNK_SZ) {
+					ChunkPool::shared().put(_chunks.front());
+					_chunks.erase(_chunks.begin());
+					_head = 0;
+				}
+			}
+		}
+
+		// Copies out and consumes up to len bytes
+		int read(void *buf, int len)
+		{
+			int n = 0;
+			while(n < len && _size) {
+				int seg;
+				const unsigned char *p = readPtr(seg);
+				int c = std::min(seg, len - n);
+				memcpy((unsigned char *)buf + n, p, c);
+				consume(c);
+				n += c;
+			}
+			return n;
+		}
+
+		void clear()
+		{
+			for(size_t i=0;i<_chunks.size();++i)
+				ChunkPool::shared().put(_chunks[i]);
+			_chunks.clear();
+			_head = _tail = _size = 0;
+		}
+
+	private:
+		RingBuffer(const RingBuffer &);
+		RingBuffer &operator=(const RingBuffer &);
+
+		std::vector<unsigned char *> _chunks;
+		int _head; // Read offset into the first chunk
+		int _tail; // Write offset into the last chunk
+		int _size;
+	};
+
+} // namespace ZeroTier
+
+#endif
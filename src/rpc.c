@@ -231,15 +231,25 @@ int rpc_send_command(char *path, int cmd, int forfd, void *data, int len)
   int ret = ERR_OK;
   if(n_write > 0) {
     if(cmdbuf[CMD_ID_IDX]==RPC_SOCKET) {
+      // The service reports EMFILE/ENOBUFS when it couldn't back the socket
+      if(get_retval(rpc_sock) < 0) {
+        int err = errno;
+        close(rpc_sock);
+        pthread_mutex_unlock(&lock);
+        errno = err;
+        return -1;
+      }
       pthread_mutex_unlock(&lock);
       return rpc_sock; // Used as new socket
     }
     if(cmdbuf[CMD_ID_IDX]==RPC_CONNECT
       || cmdbuf[CMD_ID_IDX]==RPC_BIND
-      || cmdbuf[CMD_ID_IDX]==RPC_LISTEN) {
+      || cmdbuf[CMD_ID_IDX]==RPC_LISTEN
+      || cmdbuf[CMD_ID_IDX]==RPC_SETSOCKOPT) {
       ret = get_retval(rpc_sock);
     }
-    if(cmdbuf[CMD_ID_IDX]==RPC_GETSOCKNAME || cmdbuf[CMD_ID_IDX]==RPC_GETPEERNAME) {
+    if(cmdbuf[CMD_ID_IDX]==RPC_GETSOCKNAME || cmdbuf[CMD_ID_IDX]==RPC_GETPEERNAME
+      || cmdbuf[CMD_ID_IDX]==RPC_GETSOCKOPT) {
       pthread_mutex_unlock(&lock);
       return rpc_sock; // Don't close rpc here, we'll use it to read getsockopt_st
     }
@@ -339,7 +349,83 @@ ssize_t sock_fd_read(int sock, void *buf, ssize_t bufsize, int *fd)
   }
   return size;
 }
-    
+
+/*
+ * Send a batch of up to SDK_ACCEPT_BATCH file descriptors, one byte for each
+ */
+ssize_t sock_fds_write(int sock, const int *fds, int nfds)
+{
+  char buf[SDK_ACCEPT_BATCH];
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr cmsghdr;
+    char control[CMSG_SPACE(sizeof(int) * SDK_ACCEPT_BATCH)];
+  } cmsgu;
+  struct cmsghdr *cmsg;
+  if (nfds < 1 || nfds > SDK_ACCEPT_BATCH) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(buf, 0, nfds);
+  iov.iov_base = buf;
+  iov.iov_len = nfds;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsgu.control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+#if defined(MSG_NOSIGNAL)
+  return sendmsg(sock, &msg, MSG_NOSIGNAL); // The app may be gone
+#else
+  return sendmsg(sock, &msg, 0);
+#endif
+}
+
+/*
+ * Read one byte of a batch. The first byte brings every descriptor in the
+ * batch with it, *nfds is 0 for the rest
+ */
+ssize_t sock_fds_read(int sock, int *fds, int *nfds, int flags)
+{
+  char c;
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr cmsghdr;
+    char control[CMSG_SPACE(sizeof(int) * SDK_ACCEPT_BATCH)];
+  } cmsgu;
+  struct cmsghdr *cmsg;
+  ssize_t size;
+  *nfds = 0;
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsgu.control;
+  msg.msg_controllen = sizeof(cmsgu.control);
+  if ((size = recvmsg(sock, &msg, flags)) <= 0)
+    return size;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (n > SDK_ACCEPT_BATCH - *nfds)
+        n = SDK_ACCEPT_BATCH - *nfds;
+      memcpy(fds + *nfds, CMSG_DATA(cmsg), sizeof(int) * n);
+      *nfds += n;
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC)
+    DEBUG_ERROR("descriptors were dropped, batch larger than SDK_ACCEPT_BATCH");
+  return size;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,7 @@
 #define __RPCLIB_H_
 
 #include <sys/socket.h>
+#include <stdint.h>
 
 #define CANARY_SZ               sizeof(uint64_t)
 #define PADDING_SZ              12
@@ -50,6 +51,19 @@
 
 #define BUF_SZ                  512
 
+/* Datagram sockets get their own message-preserving channel to the service.
+   Each message is a dgram_hdr followed by exactly one datagram payload. */
+#if defined(__APPLE__)
+    #define SDK_DGRAM_CHANNEL_TYPE  SOCK_DGRAM
+#else
+    #define SDK_DGRAM_CHANNEL_TYPE  SOCK_SEQPACKET
+#endif
+#define DGRAM_HDR_SZ            sizeof(struct dgram_hdr)
+
+/* Accepted connections reach the app in batches of up to SDK_ACCEPT_BATCH
+   descriptors per message, with one byte of payload for each descriptor */
+#define SDK_ACCEPT_BATCH        32
+
 #define ERR_OK                  0
 
 /* RPC codes */
@@ -68,6 +82,11 @@
 #define RPC_GETPEERNAME         12
 #define RPC_RETVAL              13
 #define RPC_IS_CONNECTED		14
+#define RPC_SETSOCKOPT          15
+#define RPC_GETSOCKOPT          16
+
+// Large enough for an int or a struct linger
+#define SOCKOPT_VAL_SZ          16
 
 
 #ifdef __cplusplus
@@ -81,6 +100,8 @@ int rpc_send_command(char *path, int cmd, int forfd, void *data, int len);
 int get_new_fd(int sock);
 ssize_t sock_fd_write(int sock, int fd);
 ssize_t sock_fd_read(int sock, void *buf, ssize_t bufsize, int *fd);
+ssize_t sock_fds_write(int sock, const int *fds, int nfds);
+ssize_t sock_fds_read(int sock, int *fds, int *nfds, int flags);
 
 void rpc_mutex_destroy();
 void rpc_mutex_init();
@@ -131,6 +152,27 @@ struct shutdown_st {
 	int how;
 };
 
+/* Prefixes every message on a datagram channel. On the way to the service it
+   names the destination (family 0 means "use the connected peer"), on the way
+   back it names the source. addr holds a raw IPv4 or IPv6 address and port is
+   in network byte order. Its size differs from the canary message so the two
+   can never be confused. */
+struct dgram_hdr {
+	uint16_t len;
+	uint16_t family;
+	uint16_t port;
+	uint16_t reserved;
+	uint8_t addr[16];
+};
+
+struct sockopt_st {
+	int fd;
+	int level;
+	int optname;
+	socklen_t optlen;
+	char optval[SOCKOPT_VAL_SZ];
+};
+
 struct getsockname_st {
 	int fd;
 	struct sockaddr_storage addr;
@@ -80,6 +80,11 @@
 #define GETPEERNAME_SIG int fd, struct sockaddr *addr, socklen_t *addrlen
 #define FCNTL_SIG int fd, int cmd, int flags
 #define SYSCALL_SIG long number, ...
+#define SENDMMSG_SIG int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags
+#define RECVMMSG_SIG int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout
+#define DUP_SIG int oldfd
+#define DUP2_SIG int oldfd, int newfd
+#define DUP3_SIG int oldfd, int newfd, int flags
 
 #if defined(__ANDROID__)
     #include <jni.h>
@@ -106,6 +111,11 @@ extern char *debug_logfile;
 	#if !defined(__ANDROID__)
 		extern int (*realsyscall)(SYSCALL_SIG);
 	#endif
+	#if defined(_GNU_SOURCE)
+		extern int (*realsendmmsg)(SENDMMSG_SIG);
+		extern int (*realrecvmmsg)(RECVMMSG_SIG);
+		extern int (*realdup3)(DUP3_SIG);
+	#endif
 #endif
 
 #if !defined(__ANDROID__)
@@ -124,11 +134,22 @@ extern char *debug_logfile;
 	extern int (*realgetsockopt)(GETSOCKOPT_SIG);
 	extern int (*realclose)(CLOSE_SIG);
 	extern int (*realgetsockname)(GETSOCKNAME_SIG);  
+	extern int (*realdup)(DUP_SIG);
+	extern int (*realdup2)(DUP2_SIG);
    
     // ------------------------------------------------------------------------------
     // ---------------------------- Direct API call section -------------------------
     // ------------------------------------------------------------------------------
 
+// Memory held for one network's sockets, see zts_get_memory_usage()
+struct zts_memory_usage {
+	size_t connections; // Open sockets
+	size_t buffered;    // Bytes waiting in their TX/RX buffers
+	size_t allocated;   // Connection objects plus the buffer chunks they hold
+	size_t pooled;      // Idle chunks cached for reuse, shared by all networks
+	size_t slots;       // Connection slots the slab pool holds, shared by all networks
+};
+
 // SOCKS5 Proxy Controls
 int zts_start_proxy_server(const char *homepath, const char * nwid, struct sockaddr_storage * addr);
 int zts_stop_proxy_server(const char *nwid);
@@ -147,6 +168,8 @@ void zts_leave_network(const char * nwid);
 void zts_get_ipv4_address(const char *nwid, char *addrstr);
 void zts_get_ipv6_address(const char *nwid, char *addrstr);
 bool zts_has_address(const char *nwid);
+int zts_get_memory_usage(const char *nwid, struct zts_memory_usage *usage);
+int zts_set_max_sockets(const char *nwid, int max);
 int zts_get_device_id(char *devID);
 int zts_get_device_id_from_file(const char *filepath, char *devID);
 char *zts_get_homepath();
@@ -171,6 +194,30 @@ ssize_t zts_sendto(SENDTO_SIG);
 ssize_t zts_sendmsg(SENDMSG_SIG);
 ssize_t zts_recvfrom(RECVFROM_SIG);
 ssize_t zts_recvmsg(RECVMSG_SIG);
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	int zts_sendmmsg(SENDMMSG_SIG);
+	int zts_recvmmsg(RECVMMSG_SIG);
+#endif
+// In-process TCP sockets for apps linked with the service (libztlinkedsdk). Calls go
+// straight to the network stack, no socketpair or RPC. Every call is non-blocking and
+// fails with EAGAIN when it would block, poll() the handle for POLLIN and retry. The
+// handle isn't a socket, only pass it to these calls. zts_direct_connect() fails with
+// EINPROGRESS, then EALREADY while connecting, and returns 0 once connected
+int zts_direct_socket(const char *nwid);
+int zts_direct_bind(int handle, const struct sockaddr *addr, socklen_t addrlen);
+int zts_direct_listen(int handle, int backlog);
+int zts_direct_accept(int handle);
+int zts_direct_connect(int handle, const struct sockaddr *addr, socklen_t addrlen);
+ssize_t zts_direct_send(int handle, const void *buf, size_t len);
+ssize_t zts_direct_recv(int handle, void *buf, size_t len);
+int zts_direct_close(int handle);
+// Whether fd is the app end of a datagram channel to the service
+int is_dgram_channel(int fd);
+// SOCK_STREAM or SOCK_DGRAM for fds the service handed us, 0 for anything else
+int get_fd_type(int fd);
+void set_fd_type(int fd, int type);
+// Whether a socket option is applied by the service to the stack's socket
+int is_stack_sockopt(int level, int optname);
 #if defined(__UNITY_3D__)
     ssize_t zts_recv(int fd, void *buf, int len);
     ssize_t zts_send(int fd, void *buf, int len);
@@ -233,6 +233,106 @@ void zts_get_ipv6_address(const char *nwid, char *addrstr)
         memcpy(addrstr, "-1.-1.-1.-1/-1", 14);
     }
 }
+// Get memory held for sockets on given network
+int zts_get_memory_usage(const char *nwid, struct zts_memory_usage *usage)
+{
+    uint64_t nwid_int = strtoull(nwid, NULL, 16);
+    ZeroTier::NetconEthernetTap *tap = zt1Service ? zt1Service->getTap(nwid_int) : NULL;
+    if(!tap || !usage)
+        return -1;
+    tap->getMemoryUsage(usage->connections, usage->buffered, usage->allocated);
+    usage->pooled = ZeroTier::ChunkPool::shared().cached() * SDK_BUF_CHUNK_SZ;
+    usage->slots = ZeroTier::SlabPool<ZeroTier::Connection>::shared().slots();
+    return 0;
+}
+// Caps the sockets open on one network, past it socket() fails with EMFILE and
+// incoming connections are refused. 0 removes the cap
+int zts_set_max_sockets(const char *nwid, int max)
+{
+    uint64_t nwid_int = strtoull(nwid, NULL, 16);
+    ZeroTier::NetconEthernetTap *tap = zt1Service ? zt1Service->getTap(nwid_int) : NULL;
+    if(!tap || max < 0)
+        return -1;
+    tap->max_sockets = max;
+    return 0;
+}
+// In-process sockets, each handle maps to the tap it was opened on
+static std::map<int, ZeroTier::NetconEthernetTap*> direct_taps;
+static ZeroTier::Mutex direct_taps_m;
+
+static ZeroTier::NetconEthernetTap *direct_tap(int handle)
+{
+    ZeroTier::Mutex::Lock _l(direct_taps_m);
+    std::map<int, ZeroTier::NetconEthernetTap*>::iterator t = direct_taps.find(handle);
+    if(t == direct_taps.end()) {
+        errno = EBADF;
+        return NULL;
+    }
+    return t->second;
+}
+int zts_direct_socket(const char *nwid)
+{
+    uint64_t nwid_int = strtoull(nwid, NULL, 16);
+    ZeroTier::NetconEthernetTap *tap = zt1Service ? zt1Service->getTap(nwid_int) : NULL;
+    if(!tap) {
+        errno = ENETDOWN;
+        return -1;
+    }
+    int handle = tap->directSocket();
+    if(handle >= 0) {
+        ZeroTier::Mutex::Lock _l(direct_taps_m);
+        direct_taps[handle] = tap;
+    }
+    return handle;
+}
+int zts_direct_bind(int handle, const struct sockaddr *addr, socklen_t addrlen)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    return tap ? tap->directBind(handle, addr, addrlen) : -1;
+}
+int zts_direct_listen(int handle, int backlog)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    return tap ? tap->directListen(handle, backlog) : -1;
+}
+int zts_direct_accept(int handle)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    int newHandle = tap ? tap->directAccept(handle) : -1;
+    if(newHandle >= 0) {
+        ZeroTier::Mutex::Lock _l(direct_taps_m);
+        direct_taps[newHandle] = tap;
+    }
+    return newHandle;
+}
+int zts_direct_connect(int handle, const struct sockaddr *addr, socklen_t addrlen)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    return tap ? tap->directConnect(handle, addr, addrlen) : -1;
+}
+ssize_t zts_direct_send(int handle, const void *buf, size_t len)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    return tap ? tap->directSend(handle, buf, len) : -1;
+}
+ssize_t zts_direct_recv(int handle, void *buf, size_t len)
+{
+    ZeroTier::NetconEthernetTap *tap = direct_tap(handle);
+    return tap ? tap->directRecv(handle, buf, len) : -1;
+}
+int zts_direct_close(int handle)
+{
+    ZeroTier::Mutex::Lock _l(direct_taps_m);
+    std::map<int, ZeroTier::NetconEthernetTap*>::iterator t = direct_taps.find(handle);
+    if(t == direct_taps.end()) {
+        errno = EBADF;
+        return -1;
+    }
+    ZeroTier::NetconEthernetTap *tap = t->second;
+    // Dropped first, the handle's number may be reused as soon as the tap closes it
+    direct_taps.erase(t);
+    return tap->directClose(handle);
+}
 // Get device ID (from running service)
 int zts_get_device_id(char *devID) { 
     if(zt1Service) {
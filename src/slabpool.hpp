@@ -0,0 +1,148 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * ZeroTier may be used and distributed under the terms of the GPLv3, which
+ * are available at: http://www.gnu.org/licenses/gpl-3.0.html
+ *
+ * If you would like to embed ZeroTier into a commercial application or
+ * redistribute it in a modified binary form, please contact ZeroTier Networks
+ * LLC. Start here: http://www.zerotier.com/
+ */
+
+#ifndef _SDK_SLABPOOL_HPP_
+#define _SDK_SLABPOOL_HPP_
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Mutex.hpp"
+#include "defs.h"
+
+namespace ZeroTier {
+
+	/*
+	 * Fixed-size slots for objects of type T, carved out of slabs of SDK_SLAB_OBJS
+	 * slots. New objects go in the lowest-addressed slab with room, so opening and
+	 * closing sockets doesn't leave holes all over the heap and the slabs at the
+	 * top empty out as load drops. Like ChunkPool, slabs that sat empty between two
+	 * trim() calls go back to the system. Classes route their operator new/delete here
+	 */
+	template<typename T>
+	class SlabPool
+	{
+	public:
+		// Never destroyed, objects may outlive static destructors at exit
+		static SlabPool &shared()
+		{
+			static SlabPool *pool = new SlabPool();
+			return *pool;
+		}
+
+		// Returns NULL only if the system is out of memory
+		void *get()
+		{
+			Mutex::Lock _l(_lock);
+			Slab *slab = NULL;
+			for(size_t i=0;i<_slabs.size();++i) {
+				if(_slabs[i]->free) {
+					slab = _slabs[i];
+					break;
+				}
+			}
+			if(!slab) {
+				if(!(slab = (Slab *)malloc(sizeof(Slab))))
+					return NULL;
+				slab->free = NULL;
+				slab->used = 0;
+				for(int i=SDK_SLAB_OBJS-1;i>=0;--i) {
+					slab->slots[i].next = slab->free;
+					slab->free = &slab->slots[i];
+				}
+				_slabs.insert(std::upper_bound(_slabs.begin(), _slabs.end(), slab, std::less<Slab *>()), slab);
+				++_empty;
+			}
+			if(!slab->used++)
+				_minEmpty = std::min(_minEmpty, --_empty);
+			Slot *s = slab->free;
+			slab->free = s->next;
+			++_inUse;
+			return s;
+		}
+
+		void put(void *p)
+		{
+			if(!p)
+				return;
+			Mutex::Lock _l(_lock);
+			Slot *s = (Slot *)p;
+			// The slab holding s is the last one that starts at or below it
+			Slab *slab = *(std::upper_bound(_slabs.begin(), _slabs.end(), (Slab *)s, std::less<Slab *>()) - 1);
+			s->next = slab->free;
+			slab->free = s;
+			if(!--slab->used)
+				++_empty;
+			--_inUse;
+		}
+
+		// Call periodically. Frees as many empty slabs as sat unused since the last call
+		void trim()
+		{
+			Mutex::Lock _l(_lock);
+			for(size_t i=_slabs.size();_minEmpty && i>0;--i) {
+				if(!_slabs[i-1]->used) {
+					free(_slabs[i-1]);
+					_slabs.erase(_slabs.begin() + (i-1));
+					--_minEmpty;
+					--_empty;
+				}
+			}
+			_minEmpty = _empty;
+		}
+
+		inline size_t inUse() { Mutex::Lock _l(_lock); return _inUse; }
+		inline size_t slots() { Mutex::Lock _l(_lock); return _slabs.size() * SDK_SLAB_OBJS; }
+
+	private:
+		SlabPool() : _inUse(0), _empty(0), _minEmpty(0) {}
+
+		union Slot
+		{
+			Slot *next; // While free
+			alignas(T) unsigned char obj[sizeof(T)];
+		};
+
+		struct Slab
+		{
+			Slot slots[SDK_SLAB_OBJS]; // First, so a slab's address is its first slot's
+			Slot *free;
+			size_t used;
+		};
+
+		std::vector<Slab *> _slabs; // Sorted by address
+		size_t _inUse;
+		size_t _empty; // Slabs with no slot in use
+		size_t _minEmpty; // Fewest empty slabs since the last trim()
+		Mutex _lock;
+	};
+
+} // namespace ZeroTier
+
+#endif
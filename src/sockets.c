@@ -52,6 +52,7 @@
 #include <sys/poll.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <pthread.h>
 
@@ -139,7 +140,287 @@ int (*realclose)(CLOSE_SIG);
     }
 
     void get_api_netpath() { zts_init_rpc("",""); }
+
+    // ------------------------------------------------------------------------------
+    // ------------------------------------ fd map ----------------------------------
+    // ------------------------------------------------------------------------------
+    // Remembers which descriptors came from the service and what type they are, so
+    // the intercept can tell ours from the kernel's with one load instead of a
+    // system call. Set when zts_socket()/zts_accept() hand out a descriptor, cleared
+    // by zts_close(). A forked child inherits the map along with the descriptors
+
+    static unsigned char fd_map[SDK_FD_MAP_SZ];
+
+    int get_fd_type(int fd)
+    {
+        if(fd < 0 || fd >= SDK_FD_MAP_SZ)
+            return 0;
+        return __atomic_load_n(&fd_map[fd], __ATOMIC_RELAXED);
+    }
+
+    void set_fd_type(int fd, int type)
+    {
+        if(fd >= 0 && fd < SDK_FD_MAP_SZ)
+            __atomic_store_n(&fd_map[fd], (unsigned char)type, __ATOMIC_RELAXED);
+    }
+
+    // ------------------------------------------------------------------------------
+    // ------------------------------- datagram channel -----------------------------
+    // ------------------------------------------------------------------------------
+    // A datagram socket is the app end of a SDK_DGRAM_CHANNEL_TYPE socketpair. Every
+    // message on it is a struct dgram_hdr followed by exactly one datagram, so the
+    // kernel keeps message boundaries for us and small packets stay small
+
+    // Calls the system's sendmsg()/recvmsg() even when they're interposed
+    static ssize_t kernel_sendmsg(int fd, const struct msghdr *msg, int flags)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realsendmsg)
+            load_symbols();
+        return realsendmsg(fd, msg, flags);
+    #else
+        return sendmsg(fd, msg, flags);
+    #endif
+    }
+
+    static ssize_t kernel_recvmsg(int fd, struct msghdr *msg, int flags)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realrecvmsg)
+            load_symbols();
+        return realrecvmsg(fd, msg, flags);
+    #else
+        return recvmsg(fd, msg, flags);
+    #endif
+    }
+
+    // The map is authoritative: zts_socket() never hands out a channel it can't record
+    int is_dgram_channel(int fd)
+    {
+        return get_fd_type(fd) == SOCK_DGRAM;
+    }
+
+    // Prepends hdr to the caller's iovecs to form one channel message
+    static int dgram_channel_msg(struct msghdr *chan_msg, struct iovec *chan_iov, struct dgram_hdr *hdr,
+        const struct iovec *iov, size_t iovlen)
+    {
+        if(iovlen > SDK_DGRAM_MAX_IOV) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        chan_iov[0].iov_base = hdr;
+        chan_iov[0].iov_len = DGRAM_HDR_SZ;
+        if(iovlen)
+            memcpy(chan_iov + 1, iov, iovlen * sizeof(struct iovec));
+        memset(chan_msg, 0, sizeof(struct msghdr));
+        chan_msg->msg_iov = chan_iov;
+        chan_msg->msg_iovlen = iovlen + 1;
+        return 0;
+    }
+
+    // Fills hdr for an outgoing datagram. A NULL addr means the connected peer
+    static int dgram_hdr_from_addr(struct dgram_hdr *hdr, const struct iovec *iov, size_t iovlen,
+        const struct sockaddr *addr, socklen_t addrlen)
+    {
+        size_t len = 0;
+        for(size_t i=0; i<iovlen; ++i)
+            len += iov[i].iov_len;
+        if(len > SDK_DGRAM_MAX_PAYLOAD) {
+            errno = EMSGSIZE; // Too large to send atomically via underlying protocol
+            return -1;
+        }
+        memset(hdr, 0, sizeof(struct dgram_hdr));
+        hdr->len = (uint16_t)len;
+        if(addr == NULL)
+            return 0;
+        if(addr->sa_family == AF_INET && addrlen >= sizeof(struct sockaddr_in)) {
+            const struct sockaddr_in *in4 = (const struct sockaddr_in *)addr;
+            hdr->family = AF_INET;
+            hdr->port = in4->sin_port;
+            memcpy(hdr->addr, &in4->sin_addr, sizeof(in4->sin_addr));
+            return 0;
+        }
+        if(addr->sa_family == AF_INET6 && addrlen >= sizeof(struct sockaddr_in6)) {
+            const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+            hdr->family = AF_INET6;
+            hdr->port = in6->sin6_port;
+            memcpy(hdr->addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+            return 0;
+        }
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    // Copies the source address of a received datagram out to the caller
+    static void dgram_hdr_to_addr(const struct dgram_hdr *hdr, struct sockaddr *addr, socklen_t *addrlen)
+    {
+        struct sockaddr_storage ss;
+        socklen_t ss_len = 0;
+        if(addr == NULL || addrlen == NULL)
+            return;
+        memset(&ss, 0, sizeof(ss));
+        if(hdr->family == AF_INET) {
+            struct sockaddr_in *in4 = (struct sockaddr_in *)&ss;
+            in4->sin_family = AF_INET;
+            in4->sin_port = hdr->port;
+            memcpy(&in4->sin_addr, hdr->addr, sizeof(in4->sin_addr));
+            ss_len = sizeof(struct sockaddr_in);
+        }
+        else if(hdr->family == AF_INET6) {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&ss;
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = hdr->port;
+            memcpy(&in6->sin6_addr, hdr->addr, sizeof(in6->sin6_addr));
+            ss_len = sizeof(struct sockaddr_in6);
+        }
+        memcpy(addr, &ss, *addrlen < ss_len ? *addrlen : ss_len);
+        *addrlen = ss_len;
+    }
+
+    // Strips the channel header from a received message, returns the payload length
+    static ssize_t dgram_channel_recved(ssize_t n, const struct dgram_hdr *hdr, struct sockaddr *addr, socklen_t *addrlen)
+    {
+        if(n <= 0)
+            return n; // error, or the service closed the channel
+        if(n < (ssize_t)DGRAM_HDR_SZ) {
+            DEBUG_ERROR("short message on datagram channel, n=%d", (int)n);
+            errno = EIO;
+            return -1;
+        }
+        dgram_hdr_to_addr(hdr, addr, addrlen);
+        return n - DGRAM_HDR_SZ;
+    }
         
+    // ------------------------------------------------------------------------------
+    // --------------------------------- accept queue -------------------------------
+    // ------------------------------------------------------------------------------
+    // The service sends accepted connections in batches of up to SDK_ACCEPT_BATCH,
+    // one byte per descriptor with every descriptor riding on the batch's first byte.
+    // Each accept reads one byte and the rest of the batch waits here, so a listener
+    // stays readable for poll()/epoll exactly as long as a connection is waiting.
+    // Reads and queue updates happen under one lock, threads sharing a listener
+    // never see a byte without its descriptor
+
+    struct accept_queue {
+        int fd;
+        int fds[SDK_ACCEPT_BATCH];
+        int head, count;
+        struct accept_queue *next;
+    };
+
+    static struct accept_queue *accept_queues;
+    static pthread_mutex_t accept_queues_m = PTHREAD_MUTEX_INITIALIZER;
+
+    static int kernel_close(int fd)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realclose)
+            load_symbols();
+        return realclose(fd);
+    #else
+        return close(fd);
+    #endif
+    }
+
+    // Records a descriptor the service handed us. One beyond the fd map could only be
+    // recognized with a system call on every operation, so it's refused instead
+    static int claim_fd(int fd, int type)
+    {
+        if(fd >= SDK_FD_MAP_SZ) {
+            kernel_close(fd);
+            errno = EMFILE;
+            return -1;
+        }
+        set_fd_type(fd, type);
+        return fd;
+    }
+
+    // Caller holds accept_queues_m
+    static struct accept_queue *get_accept_queue(int fd)
+    {
+        struct accept_queue *q;
+        for(q = accept_queues; q; q = q->next) {
+            if(q->fd == fd)
+                return q;
+        }
+        if(!(q = (struct accept_queue *)calloc(1, sizeof(struct accept_queue))))
+            return NULL;
+        q->fd = fd;
+        q->next = accept_queues;
+        accept_queues = q;
+        return q;
+    }
+
+    // Closes connections the app never accepted, called when the listener closes
+    static void drop_accept_queue(int fd)
+    {
+        pthread_mutex_lock(&accept_queues_m);
+        struct accept_queue **p = &accept_queues;
+        while(*p && (*p)->fd != fd)
+            p = &(*p)->next;
+        if(*p) {
+            struct accept_queue *q = *p;
+            *p = q->next;
+            for(int i=0; i<q->count; i++)
+                kernel_close(q->fds[(q->head + i) % SDK_ACCEPT_BATCH]);
+            free(q);
+        }
+        pthread_mutex_unlock(&accept_queues_m);
+    }
+
+    // Next connection accepted on listener fd, or -1 with errno set. A non-blocking
+    // listener with nothing pending fails with EAGAIN like a kernel socket does
+    static int accept_next(int fd, int flags)
+    {
+        int fds[SDK_ACCEPT_BATCH], nfds, newfd = -1, fl;
+        if((fl = fcntl(fd, F_GETFL)) < 0)
+            return -1;
+        for(;;) {
+            pthread_mutex_lock(&accept_queues_m);
+            ssize_t n = sock_fds_read(fd, fds, &nfds, MSG_DONTWAIT);
+            if(n > 0) {
+                struct accept_queue *q = get_accept_queue(fd);
+                for(int i=0; i<nfds; i++) {
+                    if(q && q->count < SDK_ACCEPT_BATCH)
+                        q->fds[(q->head + q->count++) % SDK_ACCEPT_BATCH] = fds[i];
+                    else
+                        kernel_close(fds[i]);
+                }
+                if(q && q->count) {
+                    newfd = q->fds[q->head];
+                    q->head = (q->head + 1) % SDK_ACCEPT_BATCH;
+                    q->count--;
+                }
+                else
+                    errno = ECONNABORTED; // The service lost track of the batch
+            }
+            pthread_mutex_unlock(&accept_queues_m);
+            if(n > 0)
+                break;
+            if(n == 0) {
+                errno = ECONNABORTED; // The service closed the listener
+                return -1;
+            }
+            if((errno != EAGAIN && errno != EWOULDBLOCK) || (fl & O_NONBLOCK))
+                return -1;
+            // Wait outside the lock so other threads can take what arrives first
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, -1) < 0)
+                return -1;
+        }
+        if(newfd < 0)
+            return -1;
+    #if defined(__linux__)
+        if(flags & SOCK_NONBLOCK)
+            fcntl(newfd, F_SETFL, O_NONBLOCK);
+        if(flags & SOCK_CLOEXEC)
+            fcntl(newfd, F_SETFD, FD_CLOEXEC);
+    #endif
+        return claim_fd(newfd, SOCK_STREAM);
+    }
+
     // ------------------------------------------------------------------------------
     // ------------------------------------ send() ----------------------------------
     // ------------------------------------------------------------------------------
@@ -195,31 +476,23 @@ int (*realclose)(CLOSE_SIG);
         ssize_t zts_sendto(SENDTO_SIG) // Used as internal implementation 
     #endif
         {
-            if(len > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
-                errno = EMSGSIZE; // Msg is too large
-                return -1;
-            }
-            int socktype = 0;
-            socklen_t socktype_len;
-            getsockopt(fd,SOL_SOCKET, SO_TYPE, (void*)&socktype, &socktype_len);
-
-            if((socktype & SOCK_STREAM) || (socktype & SOCK_SEQPACKET)) {
-                if(addr == NULL || flags != 0) {
-                    errno = EISCONN;
+            if(!is_dgram_channel(fd)) {
+                if(addr != NULL) {
+                    errno = EISCONN; // Stream sockets are always connected
                     return -1;
                 }
+                return write(fd, buf, len);
             }
-            // EMSGSIZE should be returned if the message is too long to be passed atomically through
-            // the underlying protocol, in our case MTU?
-            // TODO: More efficient solution
-            // This connect call is used to get the address info to the stack for sending the packet
-            int err;
-            if((err = zts_connect(fd, addr, addrlen)) < 0) {
-                DEBUG_ERROR("unknown problem passing address info to stack");
-                errno = EISCONN; // double-check this is correct
+            struct dgram_hdr hdr;
+            struct iovec iov, chan_iov[2];
+            struct msghdr chan_msg;
+            iov.iov_base = (void *)buf;
+            iov.iov_len = len;
+            if(dgram_hdr_from_addr(&hdr, &iov, 1, addr, addrlen) < 0)
                 return -1;
-            }
-            return write(fd, buf, len);
+            dgram_channel_msg(&chan_msg, chan_iov, &hdr, &iov, 1);
+            ssize_t n = kernel_sendmsg(fd, &chan_msg, flags);
+            return n < 0 ? n : n - (ssize_t)DGRAM_HDR_SZ;
         }
 //#endif
 
@@ -235,38 +508,18 @@ int (*realclose)(CLOSE_SIG);
         ssize_t zts_sendmsg(SENDMSG_SIG)
     #endif
         {
-            //DEBUG_EXTRA("fd=%d",fd);
-            char * p, * buf;
-            size_t tot_len = 0;
-            size_t err;
-            struct iovec * iov = msg->msg_iov;
-            for(int i=0; i<msg->msg_iovlen; ++i)
-                tot_len += iov[i].iov_len;
-            if(tot_len > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
-                errno = EMSGSIZE; // Message too large to send atomically via underlying protocol, don't send
+            if(!is_dgram_channel(fd))
+                return kernel_sendmsg(fd, msg, flags);
+            struct dgram_hdr hdr;
+            struct iovec chan_iov[SDK_DGRAM_MAX_IOV + 1];
+            struct msghdr chan_msg;
+            if(dgram_hdr_from_addr(&hdr, msg->msg_iov, msg->msg_iovlen, 
+                (const struct sockaddr *)msg->msg_name, msg->msg_namelen) < 0)
                 return -1;
-            }
-            buf = (char *)malloc(tot_len);
-            if(tot_len != 0 && buf == NULL) {
-                errno = ENOMEM; // Unable to allocate space for message
+            if(dgram_channel_msg(&chan_msg, chan_iov, &hdr, msg->msg_iov, msg->msg_iovlen) < 0)
                 return -1;
-            }
-            p = buf;
-            for(int i=0; i < msg->msg_iovlen; ++i) {
-                memcpy(p, iov[i].iov_base, iov[i].iov_len);
-                p += iov[i].iov_len;
-            }
-            #if defined(__cplusplus)
-                #if defined(__APPLE__)
-                    err = sendto(fd, buf, tot_len, flags, (const struct sockaddr *)(msg->msg_name), msg->msg_namelen);
-                #elif defined (__linux__)
-                    err = sendto(fd, buf, tot_len, flags, (__CONST_SOCKADDR_ARG)(msg->msg_name), msg->msg_namelen);
-                #endif
-            #else
-                err = sendto(fd, buf, tot_len, flags, msg->msg_name, msg->msg_namelen);
-            #endif
-            free(buf);
-            return err;
+            ssize_t n = kernel_sendmsg(fd, &chan_msg, flags);
+            return n < 0 ? n : n - (ssize_t)DGRAM_HDR_SZ;
         }
 #endif
     
@@ -282,12 +535,9 @@ int (*realclose)(CLOSE_SIG);
         JNIEnv *env, jobject thisObj, jint fd, jbyteArray buf, jint len, jint flags, jobject ztaddr)
     {
         struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
         jbyte *body = (*env)->GetByteArrayElements(env, buf, 0);
-        unsigned char buffer[SDK_MTU];
-        int payload_offset = sizeof(int) + sizeof(struct sockaddr_storage);
-        int rxbytes = zts_recvfrom(fd, &buffer, len, flags, &addr, sizeof(struct sockaddr_storage));
-        if(rxbytes > 0)
-            memcpy(body, (jbyte*)buffer + payload_offset, rxbytes);
+        int rxbytes = zts_recvfrom(fd, body, len, flags, (struct sockaddr *)&addr, &addrlen);
         (*env)->ReleaseByteArrayElements(env, buf, body, 0);
         // Update fields of Java ZTAddress object
         jfieldID fid;
@@ -307,45 +557,16 @@ int (*realclose)(CLOSE_SIG);
         ssize_t zts_recvfrom(RECVFROM_SIG)
     #endif
         {
-            int read_chunk_sz = 0, payload_offset, tmpsz=0, pnum=0; // payload size
-            char tmpbuf[SDK_MTU];
-            memset(tmpbuf, 0, SDK_MTU);
-            
-            // Attempt to read SDK_MTU sized chunk
-            int total_read = 0, n=0;
-
-            // Read the entire SDK_MTU-sized chunk from the service socket
-            while(total_read < SDK_MTU) {
-                n = read(fd, tmpbuf+total_read, SDK_MTU);
-                
-                if(n>0) {
-                    total_read += n;
-                }
-                else if (n < 0)
-                    return n;
-            }
-
-            if(n > 0) {                
-                // TODO: case for address size mismatch?
-                memcpy(addr, tmpbuf, *addrlen);
-                memcpy(&tmpsz, tmpbuf + sizeof(struct sockaddr_storage), sizeof(tmpsz));
-                memcpy(&pnum, tmpbuf + sizeof(struct sockaddr_storage) + sizeof(int), sizeof(int));
-                if(tmpsz > SDK_MTU || tmpsz < 0) {
-                    DEBUG_ERROR("An error occured somewhere in the SDK, read=%d", n);
-                    return -1;
-                }
-                payload_offset = sizeof(int) + sizeof(struct sockaddr_storage);
-
-                // No matter how much we read from the service, only copy 'read_chunk_sz'
-                // into the app's buffer
-                read_chunk_sz = len < SDK_MTU ? len : SDK_MTU;
-                read_chunk_sz = tmpsz < read_chunk_sz ? tmpsz : read_chunk_sz; // FIXME
-                memcpy(buf, tmpbuf + payload_offset, read_chunk_sz);
-            }
-            else {
-                return -1;
-            }
-            return read_chunk_sz;
+            if(!is_dgram_channel(fd))
+                return recv(fd, buf, len, flags);
+            struct dgram_hdr hdr;
+            struct iovec iov, chan_iov[2];
+            struct msghdr chan_msg;
+            iov.iov_base = buf;
+            iov.iov_len = len;
+            dgram_channel_msg(&chan_msg, chan_iov, &hdr, &iov, 1);
+            // Anything past len is discarded by the kernel, as with a UDP socket
+            return dgram_channel_recved(kernel_recvmsg(fd, &chan_msg, flags), &hdr, addr, addrlen);
         }
 //#endif
 
@@ -361,44 +582,107 @@ int (*realclose)(CLOSE_SIG);
         ssize_t zts_recvmsg(RECVMSG_SIG)
     #endif
         {
-            //DEBUG_EXTRA("fd=%d", fd);
-            ssize_t err, n, tot_len = 0;
-            char *buf, *p;
-            struct iovec *iov = msg->msg_iov;
-            
-            for(int i = 0; i < msg->msg_iovlen; ++i)
-                tot_len += iov[i].iov_len;
-            buf = (char *)malloc(tot_len);
-            if(tot_len != 0 && buf == NULL) {
-                errno = ENOMEM;
+            if(!is_dgram_channel(fd))
+                return kernel_recvmsg(fd, msg, flags);
+            struct dgram_hdr hdr;
+            struct iovec chan_iov[SDK_DGRAM_MAX_IOV + 1];
+            struct msghdr chan_msg;
+            if(dgram_channel_msg(&chan_msg, chan_iov, &hdr, msg->msg_iov, msg->msg_iovlen) < 0)
                 return -1;
+            ssize_t n = dgram_channel_recved(kernel_recvmsg(fd, &chan_msg, flags), 
+                &hdr, (struct sockaddr *)msg->msg_name, &msg->msg_namelen);
+            msg->msg_flags = chan_msg.msg_flags; // MSG_TRUNC if the payload didn't fit
+            msg->msg_controllen = 0;
+            return n;
+        }
+#endif
+
+    // ------------------------------------------------------------------------------
+    // -------------------------- sendmmsg() / recvmmsg() ---------------------------
+    // ------------------------------------------------------------------------------
+    // Moves up to SDK_DGRAM_MMSG_BATCH datagrams per system call. A short count is
+    // returned for larger vectors, which callers of sendmmsg()/recvmmsg() expect
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    static int kernel_sendmmsg(int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realsendmmsg)
+            load_symbols();
+        return realsendmmsg(fd, msgvec, vlen, flags);
+    #else
+        return sendmmsg(fd, msgvec, vlen, flags);
+    #endif
+    }
+
+    static int kernel_recvmmsg(int fd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realrecvmmsg)
+            load_symbols();
+        return realrecvmmsg(fd, msgvec, vlen, flags, timeout);
+    #else
+        return recvmmsg(fd, msgvec, vlen, flags, timeout);
+    #endif
+    }
+
+    #ifdef DYNAMIC_LIB
+        int zt_sendmmsg(SENDMMSG_SIG)
+    #else
+        int zts_sendmmsg(SENDMMSG_SIG)
+    #endif
+        {
+            if(!is_dgram_channel(fd))
+                return kernel_sendmmsg(fd, msgvec, vlen, flags);
+            struct dgram_hdr hdr[SDK_DGRAM_MMSG_BATCH];
+            struct iovec chan_iov[SDK_DGRAM_MMSG_BATCH][SDK_DGRAM_MAX_IOV + 1];
+            struct mmsghdr chan_msgvec[SDK_DGRAM_MMSG_BATCH];
+            unsigned int i;
+            if(vlen > SDK_DGRAM_MMSG_BATCH)
+                vlen = SDK_DGRAM_MMSG_BATCH;
+            for(i=0; i<vlen; ++i) {
+                struct msghdr *msg = &msgvec[i].msg_hdr;
+                if(dgram_hdr_from_addr(&hdr[i], msg->msg_iov, msg->msg_iovlen, 
+                    (const struct sockaddr *)msg->msg_name, msg->msg_namelen) < 0
+                    || dgram_channel_msg(&chan_msgvec[i].msg_hdr, chan_iov[i], &hdr[i], msg->msg_iov, msg->msg_iovlen) < 0)
+                    break;
             }
-            #if defined(__cplusplus)
-                #if defined(__APPLE__)
-                    n = err = recvfrom(fd, buf, tot_len, flags, (struct sockaddr * __restrict)(msg->msg_name), &msg->msg_namelen);
-                #elif defined(__linux__)
-                    n = err = recvfrom(fd, buf, tot_len, flags, (__SOCKADDR_ARG)(msg->msg_name), &msg->msg_namelen);
-                #endif
-            #else
-                n = err = recvfrom(fd, buf, tot_len, flags, msg->msg_name, &msg->msg_namelen);
-            #endif
-            p = buf;
-            
-            // According to: http://pubs.opengroup.org/onlinepubs/009695399/functions/recvmsg.html
-            if(err > msg->msg_controllen && !( msg->msg_flags & MSG_PEEK)) {
-                // excess data should be disgarded
-                msg->msg_flags |= MSG_TRUNC; // Indicate that the buffer has been truncated
+            if(i == 0)
+                return -1; // errno set by the first bad message
+            int n = kernel_sendmmsg(fd, chan_msgvec, i, flags);
+            for(int j=0; j<n; ++j)
+                msgvec[j].msg_len = chan_msgvec[j].msg_len - DGRAM_HDR_SZ;
+            return n;
+        }
+
+    #ifdef DYNAMIC_LIB
+        int zt_recvmmsg(RECVMMSG_SIG)
+    #else
+        int zts_recvmmsg(RECVMMSG_SIG)
+    #endif
+        {
+            if(!is_dgram_channel(fd))
+                return kernel_recvmmsg(fd, msgvec, vlen, flags, timeout);
+            struct dgram_hdr hdr[SDK_DGRAM_MMSG_BATCH];
+            struct iovec chan_iov[SDK_DGRAM_MMSG_BATCH][SDK_DGRAM_MAX_IOV + 1];
+            struct mmsghdr chan_msgvec[SDK_DGRAM_MMSG_BATCH];
+            if(vlen > SDK_DGRAM_MMSG_BATCH)
+                vlen = SDK_DGRAM_MMSG_BATCH;
+            for(unsigned int i=0; i<vlen; ++i) {
+                struct msghdr *msg = &msgvec[i].msg_hdr;
+                if(dgram_channel_msg(&chan_msgvec[i].msg_hdr, chan_iov[i], &hdr[i], msg->msg_iov, msg->msg_iovlen) < 0)
+                    return -1;
             }
-            
-            while (n > 0) {
-                ssize_t count = n < iov->iov_len ? n : iov->iov_len;
-                memcpy (iov->iov_base, p, count);
-                p += count;
-                n -= count;
-                ++iov;
+            int n = kernel_recvmmsg(fd, chan_msgvec, vlen, flags, timeout);
+            for(int i=0; i<n; ++i) {
+                struct msghdr *msg = &msgvec[i].msg_hdr;
+                ssize_t len = dgram_channel_recved(chan_msgvec[i].msg_len, &hdr[i], 
+                    (struct sockaddr *)msg->msg_name, &msg->msg_namelen);
+                msgvec[i].msg_len = len < 0 ? 0 : len;
+                msg->msg_flags = chan_msgvec[i].msg_hdr.msg_flags;
+                msg->msg_controllen = 0;
             }
-            free(buf);
-            return err;
+            return n;
         }
 #endif
 
@@ -458,14 +742,70 @@ int (*realclose)(CLOSE_SIG);
     }
 #endif
 
+    // Calls the system's setsockopt()/getsockopt() even when they're interposed
+    static int kernel_setsockopt(SETSOCKOPT_SIG)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realsetsockopt)
+            load_symbols();
+        return realsetsockopt(fd, level, optname, optval, optlen);
+    #else
+        return setsockopt(fd, level, optname, optval, optlen);
+    #endif
+    }
+
+    static int kernel_getsockopt(GETSOCKOPT_SIG)
+    {
+    #if defined(SDK_INTERCEPT)
+        if(!realgetsockopt)
+            load_symbols();
+        return realgetsockopt(fd, level, optname, optval, optlen);
+    #else
+        return getsockopt(fd, level, optname, optval, optlen);
+    #endif
+    }
+
+    // Options the service applies to the stack's socket rather than to our descriptor
+    int is_stack_sockopt(int level, int optname)
+    {
+        if(level == IPPROTO_TCP)
+            return optname == TCP_NODELAY;
+        if(level == SOL_SOCKET)
+            return optname == SO_SNDBUF || optname == SO_RCVBUF || optname == SO_KEEPALIVE
+                || optname == SO_REUSEADDR || optname == SO_LINGER;
+        return 0;
+    }
+
     #ifdef DYNAMIC_LIB
     int zt_setsockopt(SETSOCKOPT_SIG)
     #else
     int zts_setsockopt(SETSOCKOPT_SIG)
     #endif
     {
-        DEBUG_INFO("fd=%d", fd);
-        return 0;
+        DEBUG_INFO("fd=%d, level=%d, optname=%d", fd, level, optname);
+        if(!is_stack_sockopt(level, optname)) {
+            // Timeouts and the like belong to the descriptor the app reads and writes,
+            // anything else has no counterpart in the stack and is quietly accepted
+            if(level == SOL_SOCKET)
+                return kernel_setsockopt(fd, level, optname, optval, optlen);
+            return 0;
+        }
+        if(!optval || optlen < sizeof(int) || optlen > SOCKOPT_VAL_SZ) {
+            errno = EINVAL;
+            return -1;
+        }
+        // Our descriptor buffers data on its way to and from the stack, keep it in step
+        if(level == SOL_SOCKET && (optname == SO_SNDBUF || optname == SO_RCVBUF))
+            kernel_setsockopt(fd, level, optname, optval, optlen);
+        get_api_netpath();
+        struct sockopt_st rpc_st;
+        memset(&rpc_st, 0, sizeof(rpc_st));
+        rpc_st.fd = fd;
+        rpc_st.level = level;
+        rpc_st.optname = optname;
+        rpc_st.optlen = optlen;
+        memcpy(rpc_st.optval, optval, optlen);
+        return rpc_send_command(api_netpath, RPC_SETSOCKOPT, fd, &rpc_st, sizeof(struct sockopt_st));
     }
     
     // ------------------------------------------------------------------------------
@@ -486,12 +826,45 @@ int (*realclose)(CLOSE_SIG);
     int zts_getsockopt(GETSOCKOPT_SIG)
 #endif
     {
-        DEBUG_INFO("fd=%d", fd);
-        if(optname == SO_TYPE) {
+        DEBUG_INFO("fd=%d, level=%d, optname=%d", fd, level, optname);
+        if(level == SOL_SOCKET && optname == SO_TYPE) {
             int* val = (int*)optval;
-            *val = 2;
-            optval = (void*)val;
+            *val = is_dgram_channel(fd) ? SOCK_DGRAM : SOCK_STREAM;
+            *optlen = sizeof(int);
+            return 0;
+        }
+        if(!is_stack_sockopt(level, optname)) {
+            if(level == SOL_SOCKET)
+                return kernel_getsockopt(fd, level, optname, optval, optlen);
+            return 0;
+        }
+        if(!optval || !optlen) {
+            errno = EFAULT;
+            return -1;
+        }
+        get_api_netpath();
+        struct sockopt_st rpc_st;
+        memset(&rpc_st, 0, sizeof(rpc_st));
+        rpc_st.fd = fd;
+        rpc_st.level = level;
+        rpc_st.optname = optname;
+        rpc_st.optlen = *optlen;
+        int rpcfd = rpc_send_command(api_netpath, RPC_GETSOCKOPT, fd, &rpc_st, sizeof(struct sockopt_st));
+        if(rpcfd < 0)
+            return -1;
+        // A return value, then the option itself if the service found it
+        int err = get_retval(rpcfd);
+        if(err == ERR_OK && read(rpcfd, &rpc_st, sizeof(rpc_st)) != sizeof(rpc_st)) {
+            errno = EIO;
+            err = -1;
         }
+        close(rpcfd);
+        if(err < 0)
+            return -1;
+        if(rpc_st.optlen > SOCKOPT_VAL_SZ)
+            rpc_st.optlen = SOCKOPT_VAL_SZ;
+        *optlen = rpc_st.optlen < *optlen ? rpc_st.optlen : *optlen;
+        memcpy(optval, rpc_st.optval, *optlen);
         return 0;
     }
     
@@ -542,7 +915,25 @@ int (*realclose)(CLOSE_SIG);
         // -1 is passed since we we're generating the new socket in this call
         int err = rpc_send_command(api_netpath, RPC_SOCKET, -1, &rpc_st, sizeof(struct socket_st));
         DEBUG_INFO("err=%d", err);
-        return err;
+        if(err < 0)
+            return err;
+        if(socket_type != SOCK_DGRAM)
+            return claim_fd(err, SOCK_STREAM);
+        // The service follows up with the app end of this socket's datagram channel
+        int fd = get_new_fd(err);
+        close(err);
+        if(fd < 0) {
+            DEBUG_ERROR("unable to receive datagram channel from service");
+            errno = ENOBUFS;
+            return -1;
+        }
+#if defined(__linux__) && !defined(__ANDROID__)
+        if(flags & SOCK_NONBLOCK)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if(flags & SOCK_CLOEXEC)
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+        return claim_fd(fd, SOCK_DGRAM);
     }
 
     // ------------------------------------------------------------------------------
@@ -636,14 +1027,12 @@ int (*realclose)(CLOSE_SIG);
         {
             get_api_netpath();
             DEBUG_INFO("fd=%d", fd);
-        #if !defined(__ANDROID__)
-            if ((flags & SOCK_CLOEXEC))
-                fcntl(fd, F_SETFL, FD_CLOEXEC);
-            if ((flags & SOCK_NONBLOCK))
-               fcntl(fd, F_SETFL, O_NONBLOCK);
+        #if !defined(__UNITY_3D__)
+            if(addr)
+                addr->sa_family = AF_INET;
         #endif
-            addrlen = !addr ? 0 : addrlen;
-            return accept(fd, addr, addrlen);
+            // The flags belong to the new connection, not the listener
+            return accept_next(fd, flags);
         }
 #endif
     
@@ -675,15 +1064,9 @@ int (*realclose)(CLOSE_SIG);
         if(addr)
             addr->sa_family = AF_INET;
     #endif
-        int new_fd = get_new_fd(fd);
+        int new_fd = accept_next(fd, 0);
         DEBUG_INFO("newfd=%d", new_fd);
-
-        if(new_fd > 0) {
-            errno = ERR_OK;
-            return new_fd;
-        }
-        errno = EAGAIN;
-        return -EAGAIN;
+        return new_fd;
     }
     
     // ------------------------------------------------------------------------------
@@ -730,6 +1113,10 @@ int (*realclose)(CLOSE_SIG);
     {
         get_api_netpath();
         DEBUG_INFO("fd=%d", fd);
+        // Before the kernel can hand the number out again
+        if(get_fd_type(fd) == SOCK_STREAM && accept_queues)
+            drop_accept_queue(fd);
+        set_fd_type(fd, 0);
         return realclose(fd);
     }
     
@@ -34,6 +34,14 @@
 
 namespace ZeroTier
 {
+    // The callback arg for conn's PCBs, kept in the Connection rather than allocated per call
+    static inline Larg *lwip_arg(NetconEthernetTap *tap, Connection *conn)
+    {
+        conn->larg.tap = tap;
+        conn->larg.conn = conn;
+        return &conn->larg;
+    }
+
     void lwip_init_interface(NetconEthernetTap *tap, const InetAddress &ip)
     {
         DEBUG_INFO();
@@ -118,13 +126,15 @@ namespace ZeroTier
             // Connection prunning
             if (since_status >= STATUS_TMR_INTERVAL) {
                 prev_status_time = now;
+                ChunkPool::shared().trim();
+                SlabPool<Connection>::shared().trim();
                 for(size_t i=0;i<tap->_Connections.size();++i) {
                     if(!tap->_Connections[i]->sock || tap->_Connections[i]->type != SOCK_STREAM)
                         continue;
                     int fd = tap->_phy.getDescriptor(tap->_Connections[i]->sock);
                     // DEBUG_INFO(" tap_thread(): tcp\\jobs = {%d, %d}\n", _Connection.size(), jobmap.size());
                     // If there's anything on the RX buf, set to notify in case we stalled
-                    if(tap->_Connections[i]->rxsz > 0)
+                    if(tap->_Connections[i]->rxbuf.size() > 0)
                         tap->_phy.setNotifyWritable(tap->_Connections[i]->sock, true);
                     fcntl(fd, F_SETFL, O_NONBLOCK);
                     unsigned char tmpbuf[BUF_SZ];
@@ -145,12 +155,13 @@ namespace ZeroTier
             }
             // Main TCP/ETHARP timer section
             if (since_tcp >= ZT_LWIP_TCP_TIMER_INTERVAL) {
+                FrameBatch batch(tap); // Retransmits and the writes below go out together
                 prev_tcp_time = now;
                 stack->__tcp_tmr();
                 // FIXME: could be removed or refactored?
                 // Makeshift poll
                 for(size_t i=0;i<tap->_Connections.size();++i) {
-                    if(tap->_Connections[i]->txsz > 0){
+                    if(tap->_Connections[i]->txbuf.size() > 0){
                         lwip_handleWrite(tap, tap->_Connections[i]);
                     }
                 }
@@ -209,6 +220,7 @@ namespace ZeroTier
             return;
         }
         {
+            FrameBatch batch(tap); // An ACK can let a whole window of segments out
             #if defined(SDK_IPV6)
                 if(tap->interface6.input(p, &(tap->interface6)) != ERR_OK) {
                     DEBUG_ERROR("error while feeding frame into stack interface6");
@@ -242,20 +254,26 @@ namespace ZeroTier
         else if(socket_rpc->socket_type == SOCK_RAW) {
             DEBUG_ERROR("SOCK_RAW, not currently supported.");
         }
-        if(new_udp_PCB || new_tcp_PCB) {
-            Connection * newConn = new Connection();
+        Connection *newConn = (new_udp_PCB || new_tcp_PCB) ? new Connection() : NULL;
+        if(newConn) {
             *uptr = newConn;
             newConn->type = socket_rpc->socket_type;
             newConn->sock = sock;
-            newConn->local_addr = NULL;
-            newConn->peer_addr = NULL;
-            if(newConn->type == SOCK_DGRAM) newConn->UDP_pcb = new_udp_PCB;
+            if(newConn->type == SOCK_DGRAM) {
+                newConn->UDP_pcb = new_udp_PCB;
+                // sendto() on an unbound socket binds implicitly, so replies must be caught from the start
+                stack->__udp_recv(new_udp_PCB, nc_udp_recved, lwip_arg(tap, newConn));
+            }
             if(newConn->type == SOCK_STREAM) newConn->TCP_pcb = new_tcp_PCB;
+            Mutex::Lock _l(tap->_tcpconns_m); // zts_direct_socket() adds to it from other threads
             tap->_Connections.push_back(newConn);
             return newConn;
         }
         DEBUG_ERROR(" memory not available for new PCB");
-        tap->sendReturnValue(tap->_phy.getDescriptor(sock), -1, ENOMEM);
+        if(new_udp_PCB)
+            stack->__udp_remove(new_udp_PCB);
+        if(new_tcp_PCB)
+            stack->__tcp_close(new_tcp_PCB);
         return NULL;
     }
 
@@ -284,8 +302,6 @@ namespace ZeroTier
         if(new_udp_PCB || new_tcp_PCB) {
             conn->sock = sock;
             conn->type = socket_type;
-            conn->local_addr = NULL;
-            conn->peer_addr = NULL;
             if(conn->type == SOCK_DGRAM) conn->UDP_pcb = new_udp_PCB;
             if(conn->type == SOCK_STREAM) conn->TCP_pcb = new_tcp_PCB;
             DEBUG_INFO(" updated sock=%p", (void*)&sock);
@@ -335,7 +351,7 @@ namespace ZeroTier
             // Generates no network traffic
             if((err = stack->__udp_connect(conn->UDP_pcb,(ip_addr_t *)&ba,port)) < 0)
                 DEBUG_ERROR("error while connecting to with UDP");
-            stack->__udp_recv(conn->UDP_pcb, nc_udp_recved, new Larg(tap, conn));
+            stack->__udp_recv(conn->UDP_pcb, nc_udp_recved, lwip_arg(tap, conn));
             tap->sendReturnValue(tap->_phy.getDescriptor(rpcSock), 0, ERR_OK);
             return;
         }
@@ -344,7 +360,7 @@ namespace ZeroTier
             stack->__tcp_recv(conn->TCP_pcb, nc_recved);
             stack->__tcp_err(conn->TCP_pcb, nc_err);
             stack->__tcp_poll(conn->TCP_pcb, nc_poll, APPLICATION_POLL_FREQ);
-            stack->__tcp_arg(conn->TCP_pcb, new Larg(tap, conn));
+            stack->__tcp_arg(conn->TCP_pcb, lwip_arg(tap, conn));
                 
             DEBUG_EXTRA(" pcb->state=%x", conn->TCP_pcb->state);
             if(conn->TCP_pcb->state != CLOSED) {
@@ -413,7 +429,7 @@ namespace ZeroTier
             // Generates no network traffic
             if((err = lwipstack->__udp_connect(conn->UDP_pcb,&connAddr,port)) < 0)
                 DEBUG_INFO("error while connecting to with UDP (sock=%p)", (void*)&sock);
-            lwipstack->__udp_recv(conn->UDP_pcb, nc_udp_recved, new Larg(this, conn));
+            lwipstack->__udp_recv(conn->UDP_pcb, nc_udp_recved, lwip_arg(this, conn));
             errno = ERR_OK;
             return 0;
         }
@@ -422,7 +438,7 @@ namespace ZeroTier
             lwipstack->__tcp_recv(conn->TCP_pcb, nc_recved);
             lwipstack->__tcp_err(conn->TCP_pcb, nc_err);
             lwipstack->__tcp_poll(conn->TCP_pcb, nc_poll, APPLICATION_POLL_FREQ);
-            lwipstack->__tcp_arg(conn->TCP_pcb, new Larg(this, conn));
+            lwipstack->__tcp_arg(conn->TCP_pcb, lwip_arg(this, conn));
             
             int ip = rawAddr->sin_addr.s_addr;
             unsigned char d[4];
@@ -536,7 +552,7 @@ namespace ZeroTier
                 if(err == ERR_USE) // port in use
                     tap->sendReturnValue(tap->_phy.getDescriptor(rpcSock), -1, EADDRINUSE);
                 else {
-                    stack->__udp_recv(conn->UDP_pcb, nc_udp_recved, new Larg(tap, conn));
+                    stack->__udp_recv(conn->UDP_pcb, nc_udp_recved, lwip_arg(tap, conn));
                     struct sockaddr_in addr_in;
                     memcpy(&addr_in, &bind_rpc->addr, sizeof(addr_in));
                     addr_in.sin_port = Utils::ntoh(conn->UDP_pcb->local_port); // Newly assigned port
@@ -557,7 +573,7 @@ namespace ZeroTier
                         if(err == ERR_BUF)
                             tap->sendReturnValue(tap->_phy.getDescriptor(rpcSock), -1, ENOMEM);
                     } else {
-                        conn->local_addr = (struct sockaddr_storage *) &bind_rpc->addr;
+                        memcpy(&conn->local_addr, &bind_rpc->addr, sizeof(struct sockaddr_storage));
                         tap->sendReturnValue(tap->_phy.getDescriptor(rpcSock), ERR_OK, ERR_OK); // Success
                     }
                 } else {
@@ -604,7 +620,7 @@ namespace ZeroTier
         if(listeningPCB != NULL) {
             conn->TCP_pcb = listeningPCB;
             stack->__tcp_accept(listeningPCB, nc_accept);
-            stack->__tcp_arg(listeningPCB, new Larg(tap, conn));
+            stack->__tcp_arg(listeningPCB, lwip_arg(tap, conn));
             fcntl(tap->_phy.getDescriptor(conn->sock), F_SETFL, O_NONBLOCK);
             conn->listening = true;
             tap->sendReturnValue(tap->_phy.getDescriptor(rpcSock), ERR_OK, ERR_OK);
@@ -623,50 +639,26 @@ namespace ZeroTier
             tap->_rx_buf_m.lock(); 
         }
         Connection *conn = tap->getConnection(sock); 
-        if(conn && conn->rxsz) {
+        if(conn && conn->rxbuf.size()) {
             float max = conn->type == SOCK_STREAM ? (float)DEFAULT_TCP_RX_BUF_SZ : (float)DEFAULT_UDP_RX_BUF_SZ;
-            long n = tap->_phy.streamSend(conn->sock, conn->rxbuf, ZT_MAX_MTU);
-            int payload_sz, addr_sz_offset = sizeof(struct sockaddr_storage);
-            memcpy(&payload_sz, conn->rxbuf + addr_sz_offset, sizeof(int)); // OPT:
-            // extract address
-            struct sockaddr_storage addr;
-            memcpy(&addr, conn->rxbuf, addr_sz_offset);
-            
-            if(n == ZT_MAX_MTU) {
-                if(conn->rxsz-n > 0) // If more remains on buffer
-                    memcpy(conn->rxbuf, conn->rxbuf+ZT_MAX_MTU, conn->rxsz - ZT_MAX_MTU);
-                conn->rxsz -= ZT_MAX_MTU;
-                // DGRAM
-                if(conn->type==SOCK_DGRAM){
-                    tap->_phy.setNotifyWritable(conn->sock, false);
-
-                #if DEBUG_LEVEL >= MSG_TRANSFER
-                    struct sockaddr_in * addr_in2 = (struct sockaddr_in *)&addr;
-                    int port = stack->__lwip_ntohs(addr_in2->sin_port);
-                    int ip = addr_in2->sin_addr.s_addr;
-                    unsigned char d[4];
-                    d[0] = ip & 0xFF;
-                    d[1] = (ip >>  8) & 0xFF;
-                    d[2] = (ip >> 16) & 0xFF;
-                    d[3] = (ip >> 24) & 0xFF;
-                    DEBUG_TRANS("UDP RX <---    :: {TX: %.3f%%, RX: %d, sock=%p} :: payload = %d bytes (src_addr=%d.%d.%d.%d:%d)", 
-                        (float)conn->txsz / max, conn->rxsz/* / max*/, (void*)conn->sock, payload_sz, d[0],d[1],d[2],d[3], port);
-                #endif
-                }
+            int len;
+            const unsigned char *data = conn->rxbuf.readPtr(len);
+            long n = tap->_phy.streamSend(conn->sock, data, len);
+            if(n > 0) {
+                conn->rxbuf.consume(n);
                 // STREAM
                 //DEBUG_INFO("phyOnUnixWritable(): tid = %d\n", pthread_mach_thread_np(pthread_self()));
                 if(conn->type==SOCK_STREAM) { // Only acknolwedge receipt of TCP packets
                     stack->__tcp_recved(conn->TCP_pcb, n);
                     DEBUG_TRANS("TCP RX <---    :: {TX: %.3f%%, RX: %.3f%%, sock=%p} :: %ld bytes",
-                        (float)conn->txsz / max, (float)conn->rxsz / max, (void*)conn->sock, n);
+                        (float)conn->txbuf.size() / max, (float)conn->rxbuf.size() / max, (void*)conn->sock, n);
                 }
             } else {
-                DEBUG_EXTRA(" errno = %d, rxsz = %d", errno, conn->rxsz);
-                tap->_phy.setNotifyWritable(conn->sock, false);
+                DEBUG_EXTRA(" errno = %d, rxsz = %d", errno, conn->rxbuf.size());
             }
         }
         // If everything on the buffer has been written
-        if(conn->rxsz == 0) {
+        if(conn && conn->rxbuf.size() == 0) {
             tap->_phy.setNotifyWritable(conn->sock, false);
         }
         if(!lwip_invoked) {
@@ -690,15 +682,21 @@ namespace ZeroTier
                 return;
             }
             // TODO: Packet re-assembly hasn't yet been tested with lwIP so UDP packets are limited to MTU-sized chunks
-            int udp_trans_len = conn->txsz < ZT_UDP_DEFAULT_PAYLOAD_MTU ? conn->txsz : ZT_UDP_DEFAULT_PAYLOAD_MTU;
+            int seg;
+            const unsigned char *data = conn->txbuf.readPtr(seg);
+            int udp_trans_len = seg < ZT_UDP_DEFAULT_PAYLOAD_MTU ? seg : ZT_UDP_DEFAULT_PAYLOAD_MTU;
             
-            DEBUG_EXTRA(" allocating pbuf chain of size=%d for UDP packet, txsz=%d", udp_trans_len, conn->txsz);
+            DEBUG_EXTRA(" allocating pbuf chain of size=%d for UDP packet, txsz=%d", udp_trans_len, conn->txbuf.size());
             struct pbuf * pb = stack->__pbuf_alloc(PBUF_TRANSPORT, udp_trans_len, PBUF_POOL);
             if(!pb){
-                DEBUG_ERROR(" unable to allocate new pbuf of size=%d", conn->txsz);
+                DEBUG_ERROR(" unable to allocate new pbuf of size=%d", udp_trans_len);
                 return;
             }
-            memcpy(pb->payload, conn->txbuf, udp_trans_len);
+            int copied = 0;
+            for(struct pbuf *q = pb; q != NULL; q = q->next) {
+                memcpy(q->payload, data + copied, q->len);
+                copied += q->len;
+            }
             int err = stack->__udp_send(conn->UDP_pcb, pb);
             
             if(err == ERR_MEM) {
@@ -709,13 +707,10 @@ namespace ZeroTier
                 DEBUG_ERROR(" error sending packet - %d", err);
             } else {
                 // Success
-                int buf_remaining = (conn->txsz)-udp_trans_len;
-                if(buf_remaining)
-                    memmove(&conn->txbuf, (conn->txbuf+udp_trans_len), buf_remaining);
-                conn->txsz -= udp_trans_len;
+                conn->txbuf.consume(udp_trans_len);
 
                 #if DEBUG_LEVEL >= MSG_TRANSFER
-                    struct sockaddr_in * addr_in2 = (struct sockaddr_in *)conn->peer_addr;
+                    struct sockaddr_in * addr_in2 = (struct sockaddr_in *)&conn->peer_addr;
                     int port = stack->__lwip_ntohs(addr_in2->sin_port);
                     int ip = addr_in2->sin_addr.s_addr;
                     unsigned char d[4];
@@ -737,50 +732,133 @@ namespace ZeroTier
             }
             // How much we are currently allowed to write to the connection
             int sndbuf = conn->TCP_pcb->snd_buf;
-            int err, sz, r;
+            int err, r;
         
-            if(!sndbuf) {
-                // PCB send buffer is full, turn off readability notifications for the
-                // corresponding PhySocket until nc_sent() is called and confirms that there is
-                // now space on the buffer
-                if(!conn->probation) {
-                    DEBUG_ERROR(" LWIP stack is full, sndbuf == 0");
-                    tap->_phy.setNotifyReadable(conn->sock, false);
-                    conn->probation = true;
-                }
+            // PCB send buffer is full, the rest waits in TXBUF for nc_sent(). phyOnUnixData()
+            // stops reading from the app if it piles up past softmax
+            if(!sndbuf)
                 return;
-            }
-            if(conn->txsz <= 0)
+            if(conn->txbuf.size() <= 0)
                 return; // Nothing to write
             if(!conn->listening)
                 stack->__tcp_output(conn->TCP_pcb);
 
-            if(conn->sock) {
-                r = conn->txsz < sndbuf ? conn->txsz : sndbuf;
-                // Writes data pulled from the client's socket buffer to LWIP. This merely sends the
-                // data to LWIP to be enqueued and eventually sent to the network.
-                if(r > 0) {
-                    err = stack->__tcp_write(conn->TCP_pcb, &conn->txbuf, r, TCP_WRITE_FLAG_COPY);
-                    stack->__tcp_output(conn->TCP_pcb);
+            if(conn->sock || conn->direct) {
+                // Writes data pulled from the client's socket buffer to LWIP, one contiguous piece
+                // of the ring at a time. This merely sends the data to LWIP to be enqueued and
+                // eventually sent to the network.
+                int total = 0;
+                while(conn->txbuf.size() && (sndbuf = conn->TCP_pcb->snd_buf) > 0) {
+                    int seg;
+                    const unsigned char *data = conn->txbuf.readPtr(seg);
+                    r = seg < sndbuf ? seg : sndbuf;
+                    err = stack->__tcp_write(conn->TCP_pcb, data, r, TCP_WRITE_FLAG_COPY);
                     if(err != ERR_OK) {
                         DEBUG_ERROR(" error while writing to PCB, err=%d", err);
                         if(err == -1)
                             DEBUG_ERROR("out of memory");
-                        return;
-                    } else {
-                        // adjust buffer
-                        sz = (conn->txsz)-r;
-                        if(sz)
-                            memmove(&conn->txbuf, (conn->txbuf+r), sz);
-                        conn->txsz -= r;
-                        int max = conn->type == SOCK_STREAM ? DEFAULT_TCP_TX_BUF_SZ : DEFAULT_UDP_TX_BUF_SZ;
-                        DEBUG_TRANS("[TCP TX] --->    :: {TX: %.3f%%, RX: %.3f%%, sock=%p} :: %d bytes",
-                            (float)conn->txsz / (float)max, (float)conn->rxsz / max, (void*)&conn->sock, r);
-                        return;
+                        break;
                     }
+                    conn->txbuf.consume(r);
+                    total += r;
                 }
+                stack->__tcp_output(conn->TCP_pcb);
+                if(total) {
+                    int max = conn->type == SOCK_STREAM ? DEFAULT_TCP_TX_BUF_SZ : DEFAULT_UDP_TX_BUF_SZ;
+                    DEBUG_TRANS("[TCP TX] --->    :: {TX: %.3f%%, RX: %.3f%%, sock=%p} :: %d bytes",
+                        (float)conn->txbuf.size() / (float)max, (float)conn->rxbuf.size() / max, (void*)&conn->sock, total);
+                }
+            }
+        }
+    }
+
+    // (TX packet) Send one datagram from the app's channel, to hdr's address or the connected peer
+    void lwip_handleWriteTo(NetconEthernetTap *tap, Connection *conn, const struct dgram_hdr *hdr, const void *data)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        if(!conn || !conn->UDP_pcb) {
+            DEBUG_ERROR(" invalid UDP_pcb, type=SOCK_DGRAM");
+            return;
+        }
+        ip_addr_t ba;
+        if(hdr->family) {
+        #if defined(SDK_IPV4)
+            if(hdr->family != AF_INET) {
+                DEBUG_ERROR(" unsupported address family=%d", hdr->family);
+                return;
+            }
+            struct sockaddr_in in4;
+            memset(&in4, 0, sizeof(in4));
+            memcpy(&in4.sin_addr, hdr->addr, sizeof(in4.sin_addr));
+            ba = convert_ip(&in4);
+        #elif defined(SDK_IPV6)
+            if(hdr->family != AF_INET6) {
+                DEBUG_ERROR(" unsupported address family=%d", hdr->family);
+                return;
             }
+            struct sockaddr_in6 in6;
+            memset(&in6, 0, sizeof(in6));
+            memcpy(&in6.sin6_addr, hdr->addr, sizeof(in6.sin6_addr));
+            in6_to_ip6((ip6_addr *)&ba, &in6);
+        #endif
+        }
+        // PBUF_RAM keeps the payload contiguous no matter its size
+        struct pbuf * pb = stack->__pbuf_alloc(PBUF_TRANSPORT, hdr->len, PBUF_RAM);
+        if(!pb){
+            DEBUG_ERROR(" unable to allocate new pbuf of size=%d", hdr->len);
+            return;
+        }
+        memcpy(pb->payload, data, hdr->len);
+        int err = hdr->family
+            ? stack->__udp_sendto(conn->UDP_pcb, pb, &ba, stack->__lwip_ntohs(hdr->port))
+            : stack->__udp_send(conn->UDP_pcb, pb);
+        if(err == ERR_MEM) {
+            DEBUG_ERROR(" error sending packet. out of memory");
+        } else if(err == ERR_RTE) {
+            DEBUG_ERROR(" could not find route to destinations address");
+        } else if(err != ERR_OK) {
+            DEBUG_ERROR(" error sending packet - %d", err);
+        } else {
+            DEBUG_TRANS("[UDP TX] --->    :: {TX: ------, RX: ------, sock=%p} :: %d bytes", (void*)conn->sock, hdr->len);
+        }
+        stack->__pbuf_free(pb);
+    }
+
+    // Maps an option the tap has recorded on the Connection onto the PCB. Buffer sizes
+    // and SO_LINGER are enforced by the driver itself, so there's nothing to do for them
+    int lwip_handleSetsockopt(NetconEthernetTap *tap, Connection *conn, int level, int optname)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        Mutex::Lock _l(stack->_lock);
+        if(conn->type == SOCK_STREAM && conn->TCP_pcb) {
+            struct tcp_pcb *pcb = conn->TCP_pcb;
+            // A listening PCB has no flags, accepted connections pick the option up in nc_accept()
+            if(level == IPPROTO_TCP && optname == TCP_NODELAY && !conn->listening) {
+                if(conn->nodelay)
+                    tcp_nagle_disable(pcb);
+                else
+                    tcp_nagle_enable(pcb);
+            }
+            if(level == SOL_SOCKET && optname == SO_KEEPALIVE) {
+                if(conn->keepalive)
+                    ip_set_option(pcb, SOF_KEEPALIVE);
+                else
+                    ip_reset_option(pcb, SOF_KEEPALIVE);
+            }
+            if(level == SOL_SOCKET && optname == SO_REUSEADDR) {
+                if(conn->reuseaddr)
+                    ip_set_option(pcb, SOF_REUSEADDR);
+                else
+                    ip_reset_option(pcb, SOF_REUSEADDR);
+            }
+        }
+        if(conn->type == SOCK_DGRAM && conn->UDP_pcb && level == SOL_SOCKET && optname == SO_REUSEADDR) {
+            if(conn->reuseaddr)
+                ip_set_option(conn->UDP_pcb, SOF_REUSEADDR);
+            else
+                ip_reset_option(conn->UDP_pcb, SOF_REUSEADDR);
         }
+        return 0;
     }
 
     void lwip_handleClose(NetconEthernetTap *tap, PhySocket *sock, Connection *conn)
@@ -798,6 +876,14 @@ namespace ZeroTier
                 DEBUG_EXTRA("ignoring close request. invalid PCB state for this operation. sock=%p", (void*)&sock);
                 return;
             }   
+            // SO_LINGER with a zero timeout resets the connection instead of closing it
+            if(conn->linger.l_onoff && !conn->linger.l_linger && conn->TCP_pcb->state != LISTEN) {
+                stack->__tcp_arg(conn->TCP_pcb, NULL);
+                stack->__tcp_err(conn->TCP_pcb, NULL);
+                stack->__tcp_abort(conn->TCP_pcb);
+                conn->TCP_pcb = NULL;
+                return;
+            }
             // DEBUG_BLANK("__tcp_close(...)");
             if(stack->__tcp_close(conn->TCP_pcb) == ERR_OK) {
                 // Unregister callbacks for this PCB
@@ -813,6 +899,127 @@ namespace ZeroTier
         }
     }
 
+    // Reads an address passed to the in-process API, false if it's not our family
+    static bool lwip_directAddr(lwIP_stack *stack, const struct sockaddr *addr, ip_addr_t *ba, int *port)
+    {
+    #if defined(SDK_IPV4)
+        if(addr->sa_family != AF_INET)
+            return false;
+        *ba = convert_ip((struct sockaddr_in *)addr);
+        *port = stack->__lwip_ntohs(((struct sockaddr_in *)addr)->sin_port);
+    #elif defined(SDK_IPV6)
+        if(addr->sa_family != AF_INET6)
+            return false;
+        in6_to_ip6((ip6_addr *)ba, (struct sockaddr_in6 *)addr);
+        *port = stack->__lwip_ntohs(((struct sockaddr_in6 *)addr)->sin6_port);
+    #endif
+        return true;
+    }
+
+    // The lwip_direct*() calls back NetconEthernetTap's in-process API. The caller holds
+    // _tcpconns_m, they return 0 or an errno
+    int lwip_directSocket(NetconEthernetTap *tap, Connection *conn)
+    {
+        conn->TCP_pcb = tap->lwipstack->__tcp_new();
+        return conn->TCP_pcb ? 0 : ENOMEM;
+    }
+
+    int lwip_directBind(NetconEthernetTap *tap, Connection *conn, const struct sockaddr *addr)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        ip_addr_t ba;
+        int port;
+        if(!lwip_directAddr(stack, addr, &ba, &port))
+            return EAFNOSUPPORT;
+        if(!conn->TCP_pcb || conn->TCP_pcb->state != CLOSED)
+            return EINVAL;
+        err_t err = stack->__tcp_bind(conn->TCP_pcb, &ba, port);
+        if(err == ERR_USE)
+            return EADDRINUSE;
+        return err == ERR_OK ? 0 : ENOMEM;
+    }
+
+    int lwip_directListen(NetconEthernetTap *tap, Connection *conn, int backlog)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        struct tcp_pcb *listeningPCB;
+        if(!conn->TCP_pcb)
+            return EINVAL;
+        if(conn->TCP_pcb->state == LISTEN)
+            return 0;
+        #ifdef TCP_LISTEN_BACKLOG
+            listeningPCB = stack->__tcp_listen_with_backlog(conn->TCP_pcb, backlog);
+        #else
+            listeningPCB = stack->__tcp_listen(conn->TCP_pcb);
+        #endif
+        if(!listeningPCB)
+            return ENOMEM;
+        conn->TCP_pcb = listeningPCB;
+        stack->__tcp_accept(listeningPCB, nc_accept);
+        stack->__tcp_arg(listeningPCB, lwip_arg(tap, conn));
+        return 0;
+    }
+
+    int lwip_directConnect(NetconEthernetTap *tap, Connection *conn, const struct sockaddr *addr)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        ip_addr_t ba;
+        int port;
+        if(!lwip_directAddr(stack, addr, &ba, &port))
+            return EAFNOSUPPORT;
+        if(!conn->TCP_pcb || conn->TCP_pcb->state != CLOSED)
+            return EISCONN;
+        stack->__tcp_sent(conn->TCP_pcb, nc_sent);
+        stack->__tcp_recv(conn->TCP_pcb, nc_recved);
+        stack->__tcp_err(conn->TCP_pcb, nc_err);
+        stack->__tcp_poll(conn->TCP_pcb, nc_poll, APPLICATION_POLL_FREQ);
+        stack->__tcp_arg(conn->TCP_pcb, lwip_arg(tap, conn));
+        switch(stack->__tcp_connect(conn->TCP_pcb, &ba, port, nc_connected)) {
+            case ERR_OK:
+                return 0;
+            case ERR_ISCONN:
+                return EISCONN;
+            case ERR_USE:
+                return EADDRINUSE;
+            case ERR_VAL:
+                return EINVAL;
+            case ERR_RTE:
+                return ENETUNREACH;
+            default:
+                return EAGAIN;
+        }
+    }
+
+    // Tells lwIP the app has taken n bytes, opening the receive window again
+    void lwip_directRecved(NetconEthernetTap *tap, Connection *conn, int n)
+    {
+        if(conn->TCP_pcb)
+            tap->lwipstack->__tcp_recved(conn->TCP_pcb, n);
+    }
+
+    // Detaches the Connection from its PCB for good, it's deleted right after this
+    void lwip_directClose(NetconEthernetTap *tap, Connection *conn)
+    {
+        lwIP_stack *stack = tap->lwipstack;
+        struct tcp_pcb *pcb = conn->TCP_pcb;
+        if(!pcb)
+            return; // nc_err() already saw it go
+        conn->TCP_pcb = NULL;
+        stack->__tcp_arg(pcb, NULL);
+        if(pcb->state == LISTEN) {
+            stack->__tcp_close(pcb);
+            return;
+        }
+        stack->__tcp_recv(pcb, NULL);
+        stack->__tcp_err(pcb, NULL);
+        stack->__tcp_sent(pcb, NULL);
+        stack->__tcp_poll(pcb, NULL, 1);
+        // SO_LINGER with a zero timeout resets, as does anything lwIP can't close cleanly
+        bool reset = conn->linger.l_onoff && !conn->linger.l_linger;
+        if(pcb->state == SYN_SENT || reset || stack->__tcp_close(pcb) != ERR_OK)
+            stack->__tcp_abort(pcb);
+    }
+
     /*------------------------------------------------------------------------------
     -------------------------------- lwIP Callbacks --------------------------------
     ------------------------------------------------------------------------------*/
@@ -851,8 +1058,8 @@ namespace ZeroTier
         src_mac.setTo(ethhdr->src.addr, 6);
         dest_mac.setTo(ethhdr->dest.addr, 6);
 
-        tap->_handler(tap->_arg,tap->_nwid,src_mac,dest_mac,
-            Utils::ntoh((uint16_t)ethhdr->type),0,buf + sizeof(struct eth_hdr),totalLength - sizeof(struct eth_hdr));
+        tap->sendFrame(src_mac,dest_mac,
+            Utils::ntoh((uint16_t)ethhdr->type),buf + sizeof(struct eth_hdr),totalLength - sizeof(struct eth_hdr));
         return ERR_OK;
     }
 
@@ -870,6 +1077,12 @@ namespace ZeroTier
             return ERR_OK; 
         }
         if(p == NULL) {
+            if(l->conn->direct) {
+                // The app sees EOF once it has read what's buffered, and closes it itself
+                l->conn->eof = true;
+                l->tap->signalDirect(l->conn);
+                return ERR_OK;
+            }
             if(l->conn->TCP_pcb->state == CLOSE_WAIT){
                 l->tap->closeConnection(l->conn->sock);
                 return ERR_ABRT;
@@ -877,21 +1090,23 @@ namespace ZeroTier
             return err;
         }
         Mutex::Lock _l2(l->tap->_rx_buf_m);
+        // Past SO_RCVBUF, refuse the data. lwIP holds on to it and offers it again later
+        if(l->conn->rxbufLimit() - l->conn->rxbuf.size() < p->tot_len)
+            return ERR_MEM;
         // Cycle through pbufs and write them to the RX buffer
         // The RX buffer will be emptied via phyOnUnixWritable()
         while(p != NULL) {
             if(p->len <= 0)
                 break;
-            int avail = DEFAULT_TCP_RX_BUF_SZ - l->conn->rxsz;
             int len = p->len;
-            if(avail < len)
-                DEBUG_ERROR("not enough room (%d bytes) on RX buffer", avail);
-            memcpy(l->conn->rxbuf + (l->conn->rxsz), p->payload, len);
-            l->conn->rxsz += len;
+            if(l->conn->rxbuf.write(p->payload, len) != len)
+                DEBUG_ERROR("out of memory, dropped %d bytes", len);
             p = p->next;
             tot += len;
         }
-        if(tot) {
+        if(tot && l->conn->direct)
+            l->tap->signalDirect(l->conn);
+        else if(tot) {
             //#if defined(USE_SOCKS_PROXY)
             //  l->tap->phyOnTcpWritable(l->conn->sock, NULL, true);
             //#else
@@ -915,30 +1130,57 @@ namespace ZeroTier
             return -1;
         if(conn->type==SOCK_DGRAM)
             return -1;
-        if(!conn->sock)
+        if(!conn->sock && !conn->direct)
             return -1;
-        int fd = tap->_phy.getDescriptor(conn->sock);
+        if(tap->socketLimitReached())
+            return ERR_MEM; // lwIP resets the connection
 
         if(conn) {
-            // create new socketpair
             ZT_PHY_SOCKFD_TYPE fds[2];
-            if(socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
-                if(errno < 0) {
-                    // sendReturnValue(conn, -1, errno);
-                    DEBUG_ERROR("unable to create socketpair");
+            Connection *newTcpConn;
+            if(conn->direct) {
+                // Accepted onto an in-process listener, the app picks it up with zts_direct_accept()
+                if(!(newTcpConn = tap->newDirectConnection()))
+                    return ERR_MEM;
+                newTcpConn->connected = true;
+            }
+            else {
+                // create new socketpair
+                if(socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
+                    if(errno < 0) {
+                        // sendReturnValue(conn, -1, errno);
+                        DEBUG_ERROR("unable to create socketpair");
+                        return ERR_MEM;
+                    }
+                }
+                // create and populate new Connection
+                if(!(newTcpConn = new Connection())) {
+                    close(fds[0]);
+                    close(fds[1]);
                     return ERR_MEM;
                 }
+                l->tap->_Connections.push_back(newTcpConn);
+                newTcpConn->type = SOCK_STREAM;
+                newTcpConn->sock = tap->_phy.wrapSocket(fds[0], newTcpConn);
             }
-            // create and populate new Connection
-            Connection *newTcpConn = new Connection();
-            l->tap->_Connections.push_back(newTcpConn);
             newTcpConn->TCP_pcb = newPCB;
-            newTcpConn->type = SOCK_STREAM;
-            newTcpConn->sock = tap->_phy.wrapSocket(fds[0], newTcpConn);
+            // Options set on the listening socket carry over, lwIP only copies so_options
+            newTcpConn->nodelay = conn->nodelay;
+            newTcpConn->keepalive = conn->keepalive;
+            newTcpConn->reuseaddr = conn->reuseaddr;
+            newTcpConn->linger = conn->linger;
+            newTcpConn->txbuf_sz = conn->txbuf_sz;
+            newTcpConn->rxbuf_sz = conn->rxbuf_sz;
+            if(newTcpConn->nodelay)
+                tcp_nagle_disable(newPCB);
 
-            if(sock_fd_write(fd, fds[1]) < 0)
-                return -1;
-            tap->lwipstack->__tcp_arg(newPCB, new Larg(tap, newTcpConn));
+            if(conn->direct) {
+                conn->accepted_conns.push_back(newTcpConn);
+                tap->signalDirect(conn);
+            }
+            else
+                tap->queueAcceptedFd(conn, fds[1]);
+            tap->lwipstack->__tcp_arg(newPCB, lwip_arg(tap, newTcpConn));
             tap->lwipstack->__tcp_recv(newPCB, nc_recved);
             tap->lwipstack->__tcp_err(newPCB, nc_err);
             tap->lwipstack->__tcp_sent(newPCB, nc_sent);
@@ -952,68 +1194,40 @@ namespace ZeroTier
         return -1;
     }
         
-    //
+    // Delivers each datagram to the app as its own message on the datagram channel
     void nc_udp_recved(void * arg, struct udp_pcb * upcb, struct pbuf * p, ip_addr_t * addr, u16_t port)
     {
         Larg *l = (Larg*)arg;
         DEBUG_EXTRA("nc_udp_recved(conn=%p,pcb=%p,port=%d)\n", (void*)&(l->conn), (void*)&upcb, port);
-        /*
-        int tot = 0;
-        unsigned char *addr_pos, *sz_pos, *payload_pos;
-        struct pbuf* q = p;
-        struct sockaddr_storage sockaddr_big;
-
-    #if defined(LWIP_IPV6)
-        struct sockaddr_in6 addr_in;
-        addr_in.sin6_addr.s6_addr = addr->u_addr.ip6.addr;
-        addr_in.sin6_port = port;
-    #else // ipv4
-        struct sockaddr_in *addr_in = (struct sockaddr_in *)&sockaddr_big;
+        if(!p)
+            return;
+        struct sockaddr_storage from;
+        memset(&from, 0, sizeof(from));
+    #if defined(SDK_IPV4)
+        struct sockaddr_in *addr_in = (struct sockaddr_in *)&from;
+        addr_in->sin_family = AF_INET;
         addr_in->sin_addr.s_addr = addr->addr;
-        addr_in->sin_port = port;
+        addr_in->sin_port = htons(port);
+    #elif defined(SDK_IPV6)
+        struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)&from;
+        addr_in6->sin6_family = AF_INET6;
+        memcpy(&addr_in6->sin6_addr, addr, sizeof(addr_in6->sin6_addr));
+        addr_in6->sin6_port = htons(port);
     #endif
-
-        // TODO: Finish address treatment
-
-        Mutex::Lock _l2(l->tap->_rx_buf_m);
-        // Cycle through pbufs and write them to the RX buffer
-        // The RX "buffer" will be emptied via phyOnUnixWritable()
-        if(p) {
-            // Intra-API "packetization" scheme: [addr_len|addr|payload_len|payload]
-            if(l->conn->rxsz == DEFAULT_UDP_RX_BUF_SZ) { // if UDP buffer full
-                DEBUG_INFO("UDP RX buffer full. Discarding oldest payload segment");
-                memmove(l->conn->rxbuf, l->conn->rxbuf + ZT_MAX_MTU, DEFAULT_UDP_RX_BUF_SZ - ZT_MAX_MTU);
-                addr_pos = l->conn->rxbuf + (DEFAULT_UDP_RX_BUF_SZ - ZT_MAX_MTU); // TODO:
-                sz_pos = addr_pos + sizeof(struct sockaddr_storage);
-                l->conn->rxsz -= ZT_MAX_MTU;
-            }
-            else {
-                addr_pos = l->conn->rxbuf + l->conn->rxsz; // where we'll prepend the size of the address
-                sz_pos = addr_pos + sizeof(struct sockaddr_storage);
-            }
-            payload_pos = addr_pos + sizeof(struct sockaddr_storage) + sizeof(tot); // where we'll write the payload
-            // write remote host address
-            memcpy(addr_pos, &addr_in, sizeof(struct sockaddr_storage));
-        }
-        while(p != NULL) {
-            if(p->len <= 0)
-                break;
-            int len = p->len;
-            memcpy(payload_pos, p->payload, len);
-            payload_pos = payload_pos + len;
-            p = p->next;
-            tot += len;
-        }
-        if(tot) {
-            l->conn->rxsz += ZT_MAX_MTU;
-            memcpy(sz_pos, &tot, sizeof(tot));
-            //DEBUG_EXTRA(" nc_udp_recved(): data_len = %d, rxsz = %d, addr_info_len = %d\n", 
-            //  tot, l->conn->rxsz, sizeof(u32_t) + sizeof(u16_t));
-            l->tap->phyOnUnixWritable(l->conn->sock, NULL, true);
-            l->tap->_phy.setNotifyWritable(l->conn->sock, true);
+        // Hand the pbuf chain to the channel as-is instead of flattening it first
+        struct iovec iov[SDK_DGRAM_MAX_IOV];
+        int iovlen = 0;
+        struct pbuf *q;
+        for(q = p; q != NULL && iovlen < SDK_DGRAM_MAX_IOV; q = q->next) {
+            iov[iovlen].iov_base = q->payload;
+            iov[iovlen].iov_len = q->len;
+            iovlen++;
         }
-        l->tap->lwipstack->__pbuf_free(q);
-        */
+        if(q == NULL)
+            l->tap->sendDatagram(l->conn, (struct sockaddr *)&from, iov, iovlen);
+        else
+            DEBUG_ERROR("pbuf chain too long, dropping datagram of size=%d", p->tot_len);
+        l->tap->lwipstack->__pbuf_free(p);
     }
        
     //
@@ -1022,16 +1236,18 @@ namespace ZeroTier
         DEBUG_EXTRA("pcb=%p", (void*)&PCB);
         Larg *l = (Larg*)arg;
         Mutex::Lock _l(l->tap->_tcpconns_m);
-        if(l->conn->probation && l->conn->txsz == 0){
-            l->conn->probation = false; // TX buffer now empty, removing from probation
-        }
-        if(l && l->conn && len && !l->conn->probation) {
-            int softmax = l->conn->type == SOCK_STREAM ? DEFAULT_TCP_TX_BUF_SZ : DEFAULT_UDP_TX_BUF_SZ;
-            if(l->conn->txsz < softmax) {
-                l->tap->_phy.setNotifyReadable(l->conn->sock, true);
-                l->tap->_phy.whack();
+        if(l->conn->direct) {
+            if(l->conn->tx_blocked && l->conn->txbuf.size() < l->conn->txbufLimit()) {
+                l->conn->tx_blocked = false;
+                l->tap->signalDirect(l->conn);
             }
+            return ERR_OK;
         }
+        // Refill the send buffer the ACK just freed rather than wait for the next timer,
+        // then let the app write again if that took TXBUF down far enough
+        if(len && l->conn->txbuf.size())
+            lwip_handleWrite(l->tap, l->conn);
+        l->tap->resumeAppWrites(l->conn);
         return ERR_OK;
     }
 
@@ -1047,7 +1263,12 @@ namespace ZeroTier
     {
         DEBUG_ATTN("pcb=%p", (void*)&PCB);
         Larg *l = (Larg*)arg;
-        if(l && l->conn)
+        if(l && l->conn && l->conn->direct) {
+            Mutex::Lock _l(l->tap->_tcpconns_m);
+            l->conn->connected = true;
+            l->tap->signalDirect(l->conn);
+        }
+        else if(l && l->conn)
             l->tap->sendReturnValue(l->tap->_phy.getDescriptor(l->conn->rpcSock), ERR_OK, 0);
         return ERR_OK;
     }
@@ -1067,6 +1288,20 @@ namespace ZeroTier
 
         if(!l->conn)
             DEBUG_ERROR("conn==NULL");
+        if(l->conn->direct) {
+            // lwIP has already freed the PCB. The app learns why from its next call
+            l->conn->TCP_pcb = NULL;
+            if(err == ERR_TIMEOUT)
+                l->conn->direct_err = ETIMEDOUT;
+            else if(err == ERR_RTE)
+                l->conn->direct_err = ENETUNREACH;
+            else if(err == ERR_MEM || err == ERR_BUF)
+                l->conn->direct_err = ENOMEM;
+            else
+                l->conn->direct_err = l->conn->connected ? ECONNRESET : ECONNREFUSED;
+            l->tap->signalDirect(l->conn);
+            return;
+        }
         int fd = l->tap->_phy.getDescriptor(l->conn->sock);
         switch(err)
         {
@@ -63,7 +63,15 @@ namespace ZeroTier {
     void lwip_handleListen(NetconEthernetTap *tap, PhySocket *sock, PhySocket *rpcSock, void **uptr, struct listen_st *listen_rpc);
     void lwip_handleRead(NetconEthernetTap *tap, PhySocket *sock, void **uptr, bool lwip_invoked);
     void lwip_handleWrite(NetconEthernetTap *tap, Connection *conn);
+    void lwip_handleWriteTo(NetconEthernetTap *tap, Connection *conn, const struct dgram_hdr *hdr, const void *data);
+    int lwip_handleSetsockopt(NetconEthernetTap *tap, Connection *conn, int level, int optname);
     void lwip_handleClose(NetconEthernetTap *tap, PhySocket *sock, Connection *conn);
+    int lwip_directSocket(NetconEthernetTap *tap, Connection *conn);
+    int lwip_directBind(NetconEthernetTap *tap, Connection *conn, const struct sockaddr *addr);
+    int lwip_directListen(NetconEthernetTap *tap, Connection *conn, int backlog);
+    int lwip_directConnect(NetconEthernetTap *tap, Connection *conn, const struct sockaddr *addr);
+    void lwip_directRecved(NetconEthernetTap *tap, Connection *conn, int n);
+    void lwip_directClose(NetconEthernetTap *tap, Connection *conn);
 
 
 
@@ -27,6 +27,10 @@
 
 #if defined(SDK_PICOTCP)
 
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
 #include "tap.hpp"
 
 #include "picotcp.hpp"
@@ -48,15 +52,86 @@ namespace ZeroTier {
 	// In future releases this will be replaced with a new structure of static pointers that 
 	// will make it easier to maintain multiple active tap interfaces
 	NetconEthernetTap *picotap;
-	struct pico_device picodev;
 
     int pico_eth_send(struct pico_device *dev, void *buf, int len);
     int pico_eth_poll(struct pico_device *dev, int loop_score);
 
+    // The shard a Connection's picosock lives on, and its stack
+    static inline PicoShard *pico_shard(Connection *conn) { return picotap->picoshards[conn->shard]; }
+    static inline picoTCP_stack *pico_stack(Connection *conn) { return pico_shard(conn)->stack; }
+
+    // The shard s lives on, s may be one of a listener's sockets on the other shards
+    static int pico_socket_shard(Connection *conn, struct pico_socket *s)
+    {
+    	for(size_t i=1;i<conn->listen_picosocks.size();++i) {
+    		if(conn->listen_picosocks[i] == s)
+    			return (int)i;
+    	}
+    	return conn->shard;
+    }
+
+    // Picks the shard for a TCP flow from the remote address and port and the local port,
+    // all in network byte order. pico_rx() and pico_shard_connect() have to agree on it
+    static int pico_flow_shard(uint32_t raddr, uint16_t rport, uint16_t lport, int shards)
+    {
+    	uint32_t h = raddr ^ (((uint32_t)rport << 16) | lport);
+    	h *= 0x9e3779b1; // Spreads sequential ports over the top bits
+    	return (int)((h >> 16) % (uint32_t)shards);
+    }
+
+    // Takes a shard's stack lock from a handler that already holds _tcpconns_m. The shard's
+    // callbacks take the stack lock first, so we let go of _tcpconns_m while we wait. Only
+    // the tap thread deletes Connections, so the caller's are still there afterwards
+    static void pico_lock_shard(PicoShard *shard)
+    {
+    	picotap->_tcpconns_m.unlock();
+    	shard->stack->_lock.lock();
+    	picotap->_tcpconns_m.lock();
+    }
+
+    // Leaves a Connection for its shard's thread to write and read, see PicoShard::pending
+    static void pico_shard_pending(Connection *conn)
+    {
+    	PicoShard *shard = pico_shard(conn);
+    	if(conn->shard_pending)
+    		return;
+    	conn->shard_pending = true;
+    	shard->pending.push_back(conn);
+    	if(shard->pending.size() == 1)
+    		shard->wake();
+    }
+
+    // Leaves a Connection for the tap thread to finish, see PicoShard::ready
+    static void pico_shard_ready(Connection *conn)
+    {
+    	PicoShard *shard = pico_shard(conn);
+    	if(conn->shard_ready)
+    		return;
+    	conn->shard_ready = true;
+    	shard->ready.push_back(conn);
+    	if(shard->ready.size() == 1)
+    		picotap->_phy.whack();
+    }
+
+    // Options set on a listening socket carry over to the connections it accepts
+    static void pico_inherit_sockopts(Connection *listener, Connection *conn)
+    {
+		conn->nodelay = listener->nodelay;
+		conn->keepalive = listener->keepalive;
+		conn->reuseaddr = listener->reuseaddr;
+		conn->linger = listener->linger;
+		conn->txbuf_sz = listener->txbuf_sz;
+		conn->rxbuf_sz = listener->rxbuf_sz;
+		if(conn->picosock) {
+			pico_apply_sockopt(conn, IPPROTO_TCP, TCP_NODELAY);
+			pico_apply_sockopt(conn, SOL_SOCKET, SO_KEEPALIVE);
+			pico_apply_sockopt(conn, SOL_SOCKET, SO_LINGER);
+		}
+    }
+
     // Initialize network stack's interfaces and assign addresses
 	void pico_init_interface(NetconEthernetTap *tap, const InetAddress &ip)
 	{
-		picoTCP_stack *stack = tap->picostack;		
 		if (std::find(picotap->_ips.begin(),picotap->_ips.end(),ip) == picotap->_ips.end()) {
 			picotap->_ips.push_back(ip);
 			std::sort(picotap->_ips.begin(),picotap->_ips.end());
@@ -69,33 +144,40 @@ namespace ZeroTier {
 			    uint8_t mac[PICO_SIZE_ETH];
 			    picotap->_mac.copyTo(mac, PICO_SIZE_ETH);
 			    DEBUG_ATTN("mac = %s", picotap->_mac.toString().c_str());
-			    picodev.send = pico_eth_send; // tx
-			    picodev.poll = pico_eth_poll; // rx
-			    picodev.mtu = picotap->_mtu;
-			    if( 0 != stack->__pico_device_init(&(picodev), "p0", mac)) {
-			        DEBUG_ERROR("device init failed");
-			        return;
-			    }
-			    stack->__pico_ipv4_link_add(&(picodev), ipaddr, netmask);
+			    // Every shard gets the same device, pico_rx() decides which one sees a frame
+			    for(size_t i=0;i<tap->picoshards.size();++i) {
+			    	PicoShard *shard = tap->picoshards[i];
+			    	Mutex::Lock _l(shard->stack->_lock);
+				    shard->dev.send = pico_eth_send; // tx
+				    shard->dev.poll = pico_eth_poll; // rx
+				    shard->dev.mtu = picotap->_mtu;
+				    if( 0 != shard->stack->_pico_device_init(&(shard->dev), "p0", mac)) {
+				        DEBUG_ERROR("device init failed");
+				        return;
+				    }
+				    shard->stack->_pico_ipv4_link_add(&(shard->dev), ipaddr, netmask);
+				}
 			    // DEBUG_INFO("device initialized as ipv4_addr = %s", ipv4_str);
 			   	// picostack->__pico_icmp4_ping("10.8.8.1", 20, 1000, 10000, 64, cb_ping);
 			}
 		#elif defined(SDK_IPV6)
 			if(ip.isV6())
 			{
+				picoTCP_stack *stack = tap->picostack; // IPv6 isn't sharded
 				struct pico_ip6 ipaddr, netmask;
 				char ipv6_str[INET6_ADDRSTRLEN], nm_str[INET6_ADDRSTRLEN];
 				inet_ntop(AF_INET6, ip.rawIpData(), ipv6_str, INET6_ADDRSTRLEN);
 				inet_ntop(AF_INET6, ip.netmask().rawIpData(), nm_str, INET6_ADDRSTRLEN);
 		    	stack->__pico_string_to_ipv6(ipv6_str, ipaddr.addr);
 		    	stack->__pico_string_to_ipv6(nm_str, netmask.addr);
-			    stack->__pico_ipv6_link_add(&(picodev), ipaddr, netmask);
-			    picodev.send = pico_eth_send; // tx
-			    picodev.poll = pico_eth_poll; // rx
+			    struct pico_device *dev = &tap->picoshards[0]->dev; // IPv6 isn't sharded
+			    stack->__pico_ipv6_link_add(dev, ipaddr, netmask);
+			    dev->send = pico_eth_send; // tx
+			    dev->poll = pico_eth_poll; // rx
 			    uint8_t mac[PICO_SIZE_ETH];
 			    picotap->_mac.copyTo(mac, PICO_SIZE_ETH);
 			    DEBUG_ATTN("mac = %s", picotap->_mac.toString().c_str());
-			    if( 0 != stack->__pico_device_init(&(picodev), "p0", mac)) {
+			    if( 0 != stack->__pico_device_init(dev, "p0", mac)) {
 			        DEBUG_ERROR("device init failed");
 			        return;
 			    }
@@ -105,16 +187,189 @@ namespace ZeroTier {
 		}
 	}
 	
-	// Main stack loop
+	// Hands a connection another shard has accepted to its listener's app, or drops it
+	// when the listener or the connection went away in the meantime
+	static void pico_wrap_accepted(NetconEthernetTap *tap, Connection *listener, Connection *conn)
+	{
+		ZT_PHY_SOCKFD_TYPE fds[2];
+		if(!listener || conn->eof || socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
+			DEBUG_EXTRA("dropping accepted connection, picosock=%p", conn->picosock);
+			for(size_t i=0;i<tap->_Connections.size();++i) {
+				if(tap->_Connections[i] == conn) {
+					tap->_Connections.erase(tap->_Connections.begin() + i);
+					break;
+				}
+			}
+			delete conn;
+			return;
+		}
+		conn->sock = tap->_phy.wrapSocket(fds[0], conn);
+		if(conn->rxbuf.size())
+			tap->_phy.setNotifyWritable(conn->sock, true);
+		tap->queueAcceptedFd(listener, fds[1]);
+	}
+
+	// Does what the other shards can't do from their own threads: wakes the app sockets
+	// they've received data for or drained TXBUF for, closes the ones they've closed and wraps the ones
+	// they've accepted. Ready goes first, a connection that's accepted and closed
+	// before we get here is never handed to the app
+	static void pico_collect_shards(NetconEthernetTap *tap)
+	{
+		Mutex::Lock _l(tap->_tcpconns_m);
+		for(size_t i=1;i<tap->picoshards.size();++i) {
+			PicoShard *shard = tap->picoshards[i];
+			std::vector<Connection*> ready;
+			std::vector<std::pair<Connection*, Connection*> > accepted;
+			ready.swap(shard->ready);
+			for(size_t j=0;j<ready.size();++j) {
+				Connection *conn = ready[j];
+				conn->shard_ready = false;
+				if(conn->eof && conn->sock)
+					tap->closeConnection(conn->sock);
+				else if(conn->sock) {
+					tap->resumeAppWrites(conn);
+					if(conn->rxbuf.size())
+						tap->_phy.setNotifyWritable(conn->sock, true);
+				}
+			}
+			// Closing a listener above clears it from shard->accepted, so take those only now
+			accepted.swap(shard->accepted);
+			for(size_t j=0;j<accepted.size();++j)
+				pico_wrap_accepted(tap, accepted[j].first, accepted[j].second);
+		}
+	}
+
+	// Main stack loop, ticks shard 0. The other shards tick themselves in PicoShard::threadMain()
 	void pico_loop(NetconEthernetTap *tap)
 	{
+		uint64_t prev_status_time = 0;
 		while(tap->_run)
 		{
 			tap->_phy.poll(ZT_PHY_POLL_INTERVAL); // in ms
-	        tap->picostack->__pico_stack_tick();
+			{
+				FrameBatch batch(tap); // A tick's frames go to the core together
+	        	tap->picostack->__pico_stack_tick();
+	        }
+	        if(tap->picoshards.size() > 1)
+	        	pico_collect_shards(tap);
+	        uint64_t now = OSUtils::now();
+	        if(now - prev_status_time >= STATUS_TMR_INTERVAL) {
+	        	prev_status_time = now;
+	        	ChunkPool::shared().trim();
+	        	SlabPool<Connection>::shared().trim();
+	        }
+		}
+	}
+
+	PicoShard::PicoShard(NetconEthernetTap *tap, int index, picoTCP_stack *stack) :
+		tap(tap),
+		index(index),
+		stack(stack),
+		frame_rxbuf(new unsigned char[MAX_PICO_FRAME_RX_BUF_SZ]),
+		frame_rxbuf_tot(0),
+		_run(false)
+	{
+		memset(&dev, 0, sizeof(dev));
+		_wakefds[0] = _wakefds[1] = -1;
+	}
+
+	PicoShard::~PicoShard()
+	{
+		stop();
+		if(_wakefds[0] >= 0) {
+			::close(_wakefds[0]);
+			::close(_wakefds[1]);
+		}
+		delete [] frame_rxbuf;
+	}
+
+	void PicoShard::start()
+	{
+		if(pipe(_wakefds) < 0) {
+			DEBUG_ERROR("unable to create wake pipe for shard %d", index);
+			return;
+		}
+		fcntl(_wakefds[0], F_SETFL, O_NONBLOCK);
+		fcntl(_wakefds[1], F_SETFL, O_NONBLOCK);
+		_run = true;
+		_thread = Thread::start(this);
+	}
+
+	void PicoShard::stop()
+	{
+		if(!_run)
+			return;
+		_run = false;
+		wake();
+		Thread::join(_thread);
+	}
+
+	void PicoShard::wake()
+	{
+		char c = 0;
+		if(_wakefds[1] >= 0)
+			write(_wakefds[1], &c, 1);
+	}
+
+	static void pico_write_txbuf(Connection *conn);
+
+	// A shard's own loop. It sleeps until pico_rx() or the tap thread has something for it,
+	// or it's time for a tick, then does the tap thread's writes and reads and ticks
+	void PicoShard::threadMain()
+		throw()
+	{
+		struct pollfd pfd;
+		char buf[64];
+		pfd.fd = _wakefds[0];
+		pfd.events = POLLIN;
+		while(_run) {
+			int backlog;
+			{
+				Mutex::Lock _l(frame_rxbuf_m);
+				backlog = frame_rxbuf_tot;
+			}
+			poll(&pfd, 1, backlog ? 0 : ZT_PHY_POLL_INTERVAL);
+			while(read(_wakefds[0], buf, sizeof(buf)) > 0)
+				;
+			FrameBatch batch(tap); // Sent after the stack lock is let go
+			Mutex::Lock _l(stack->_lock);
+			{
+				Mutex::Lock _l2(tap->_tcpconns_m);
+				std::vector<Connection*> conns;
+				conns.swap(pending);
+				for(size_t i=0;i<conns.size();++i) {
+					Connection *conn = conns[i];
+					conn->shard_pending = false;
+					if(!conn->picosock)
+						continue;
+					if(conn->txbuf.size())
+						pico_write_txbuf(conn);
+					if(conn->rxbuf.size() < conn->rxbufLimit())
+						pico_cb_tcp_read(tap, conn->picosock);
+				}
+			}
+			stack->_pico_stack_tick();
 		}
 	}
 
+	// Hands the app what's on RXBUF now rather than after the next poll() finds its socket
+	// writable. What doesn't fit stays there for pico_handleRead(), which also deals with
+	// errors, Phy's close handler can't run inside the tick. Tap thread only,
+	// returns whether it made room
+	static bool pico_push_rxbuf(NetconEthernetTap *tap, Connection *conn)
+	{
+		int len, flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+		flags |= MSG_NOSIGNAL;
+#endif
+		const unsigned char *data = conn->rxbuf.readPtr(len);
+		ssize_t n = data ? send(tap->_phy.getDescriptor(conn->sock), data, len, flags) : 0;
+		if(n > 0)
+			conn->rxbuf.consume(n);
+		tap->_phy.setNotifyWritable(conn->sock, conn->rxbuf.size() > 0);
+		return n > 0;
+	}
+
 	// RX packets from [ZT->STACK] onto RXBUF
 	// Also notify the tap service that data can be read:
 	// [RXBUF -> (ZTSOCK->APP)]
@@ -125,10 +380,12 @@ namespace ZeroTier {
     // |         |<-----------------|          | RX
     // ----------------------------------------- 
     // After this step, buffer will be emptied periodically by pico_handleRead()
+
 	void pico_cb_tcp_read(NetconEthernetTap *tap, struct pico_socket *s)
 	{
 		Connection *conn = tap->getConnection(s);
 		if(conn) {
+			picoTCP_stack *stack = pico_stack(conn);
 			int r;				
 			uint16_t port = 0;
 			union {
@@ -136,123 +393,151 @@ namespace ZeroTier {
 		        struct pico_ip6 ip6;
 		    } peer;
 
+			bool pushed;
 			do {
-				int avail = DEFAULT_TCP_RX_BUF_SZ - conn->rxsz;
-				if(avail) {
-		            r = tap->picostack->__pico_socket_recvfrom(s, conn->rxbuf + (conn->rxsz), SDK_MTU, (void *)&peer.ip4.addr, &port);
-		            // DEBUG_ATTN("received packet (%d byte) from %08X:%u", r, long_be2(peer.ip4.addr), short_be(port));
-		            tap->_phy.setNotifyWritable(conn->sock, true);
-		            if (r > 0)
-		                conn->rxsz += r;
-	        	}
-	        	else
-	        		DEBUG_ERROR("not enough space left on I/O RX buffer for pico_socket(%p)", s);
-            }
-        	while(r > 0);
+				do {
+					// Whatever doesn't fit under SO_RCVBUF stays in the pico_socket for now
+					int avail = conn->rxbufLimit() - conn->rxbuf.size(), room = 0;
+					unsigned char *dst = avail > 0 ? conn->rxbuf.writePtr(room) : NULL;
+					r = 0;
+					if(dst) {
+						int len = std::min(std::min(avail, room), SDK_MTU);
+			            r = stack->__pico_socket_recvfrom(s, dst, len, (void *)&peer.ip4.addr, &port);
+			            // DEBUG_ATTN("received packet (%d byte) from %08X:%u", r, long_be2(peer.ip4.addr), short_be(port));
+			            if(r > 0) {
+				            if(conn->direct)
+				            	tap->signalDirect(conn);
+				            else if(conn->shard)
+				            	pico_shard_ready(conn); // The tap thread owns _phy
+				        }
+			            conn->rxbuf.commit(r > 0 ? r : 0);
+		        	}
+		        	else
+		        		DEBUG_EXTRA("RX buffer full (%d bytes) for pico_socket(%p)", conn->rxbuf.size(), s);
+	            }
+	        	while(r > 0);
+				// Hand it over right away, and go back for more while that makes room
+				pushed = !conn->direct && !conn->shard && conn->sock && conn->rxbuf.size()
+					&& pico_push_rxbuf(tap, conn);
+			} while(pushed);
         	return;
         }
 		DEBUG_ERROR("invalid connection");
 	}
 
-	// RX packets from the stack onto internal buffer
-	// Also notifies the tap service that data can be read
+	// RX datagrams from the stack straight onto the app's datagram channel
    	// -----------------------------------------
 	// | TAP <-> MEM BUFFER <-> STACK <-> APP  |
     // |                                       | 
     // | APP <-> I/O BUFFER <-> STACK <-> TAP  |
-    // |         |<-----------------|          | RX
+    // | |<-------------------------|          | RX
     // ----------------------------------------- 
-    // After this step, buffer will be emptied periodically by pico_handleRead()
-    // Read payload is encapsulated as such:
-    //
-    // [addr|payload_len|payload]
-    //
+    // Each datagram is sent as its own message, see NetconEthernetTap::sendDatagram()
 	void pico_cb_udp_read(NetconEthernetTap *tap, struct pico_socket *s)
 	{
 		Connection *conn = tap->getConnection(s);
-		if(conn) {
-
-			uint16_t port = 0;
-			union {
-		        struct pico_ip4 ip4;
-		        struct pico_ip6 ip6;
-		    } peer;
-
-		    char tmpbuf[SDK_MTU];
-        	unsigned char *addr_pos, *sz_pos, *payload_pos;
-			struct sockaddr_in addr_in;
-			addr_in.sin_addr.s_addr = peer.ip4.addr;
-        	addr_in.sin_port = port;
-			
-        	// RX
-        	int r = tap->picostack->__pico_socket_recvfrom(s, tmpbuf, SDK_MTU, (void *)&peer.ip4.addr, &port);
-            //DEBUG_FLOW(" [  RXBUF <- STACK] Receiving (%d) from stack, copying to receving buffer", r);
-
-			// Mutex::Lock _l2(tap->_rx_buf_m);
-			// struct sockaddr_in6 addr_in6;
-        	// addr_in6.sin6_addr.s6_addr;
-        	// addr_in6.sin6_port = Utils::ntoh(s->remote_port);
-			// DEBUG_ATTN("remote_port=%d, local_port=%d", s->remote_port, Utils::ntoh(s->local_port));
-            picotap->_rx_buf_m.lock(); 
-			if(conn->rxsz == DEFAULT_UDP_RX_BUF_SZ) { // if UDP buffer full
-                //DEBUG_FLOW(" [  RXBUF <- STACK] UDP RX buffer full. Discarding oldest payload segment");
-                memmove(conn->rxbuf, conn->rxbuf + SDK_MTU, DEFAULT_UDP_RX_BUF_SZ - SDK_MTU);
-                addr_pos = conn->rxbuf + (DEFAULT_UDP_RX_BUF_SZ - SDK_MTU); // TODO:
-                sz_pos = addr_pos + sizeof(struct sockaddr_storage);
-                conn->rxsz -= SDK_MTU;
-            }
-            else {
-                addr_pos = conn->rxbuf + conn->rxsz; // where we'll prepend the size of the address
-                sz_pos = addr_pos + sizeof(struct sockaddr_storage);
-            }
-            payload_pos = addr_pos + sizeof(struct sockaddr_storage) + sizeof(r);
-           	memcpy(addr_pos, &addr_in, sizeof(struct sockaddr_storage));
-
-        	memcpy(payload_pos, tmpbuf, r); // write payload to app's socket
-
-            // Adjust buffer size
-			if(r) {
-	            conn->rxsz += SDK_MTU;
-	            memcpy(sz_pos, &r, sizeof(r));
-	        }
-	        if (r < 0) {
-            	DEBUG_ERROR("unable to read from picosock=%p", s);
-    		} 
-	        picotap->_rx_buf_m.unlock(); 
-
-	        // TODO: Revisit logic
-	        if(r)
-	            tap->phyOnUnixWritable(conn->sock, NULL, true);
-        	//DEBUG_EXTRA(" Copied onto rxbuf (%d) from stack socket", r);
-        	return;
+		if(!conn) {
+			DEBUG_ERROR("invalid connection");
+			return;
 		}
+		int r;
+		uint16_t port = 0;
+		union {
+	        struct pico_ip4 ip4;
+	        struct pico_ip6 ip6;
+	    } peer;
+	    char tmpbuf[SDK_DGRAM_MAX_PAYLOAD];
+	    struct sockaddr_storage from;
+	    struct iovec iov;
+
+	    // Drain every datagram queued on this pico_socket
+	    while((r = tap->picostack->__pico_socket_recvfrom(s, tmpbuf, SDK_DGRAM_MAX_PAYLOAD, (void *)&peer, &port)) > 0) {
+	    	memset(&from, 0, sizeof(from));
+		#if defined(SDK_IPV4)
+			struct sockaddr_in *in4 = (struct sockaddr_in *)&from;
+			in4->sin_family = AF_INET;
+			in4->sin_addr.s_addr = peer.ip4.addr;
+			in4->sin_port = port; // already in network byte order
+		#elif defined(SDK_IPV6)
+			struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&from;
+			in6->sin6_family = AF_INET6;
+			memcpy(&in6->sin6_addr, peer.ip6.addr, sizeof(peer.ip6.addr));
+			in6->sin6_port = port;
+		#endif
+	    	iov.iov_base = tmpbuf;
+	    	iov.iov_len = r;
+	    	tap->sendDatagram(conn, (struct sockaddr *)&from, &iov, 1);
+	    }
+	    if(r < 0)
+	    	DEBUG_ERROR("unable to read from picosock=%p", s);
 	}
 
 	// TX packets from internal buffer to network
 	void pico_cb_tcp_write(NetconEthernetTap *tap, struct pico_socket *s)
 	{
 		Connection *conn = tap->getConnection(s);
-		if(!conn)
+		if(!conn) {
 			DEBUG_ERROR("invalid connection");
-		if(!conn->txsz)
 			return;
+		}
 		// Only called from a locked context, no need to lock anything
-		if(conn->txsz > 0) {
-			int r, max_write_len = conn->txsz < SDK_MTU ? conn->txsz : SDK_MTU;
-			if((r = tap->picostack->__pico_socket_write(s, &conn->txbuf, max_write_len)) < 0) {
-				DEBUG_ERROR("unable to write to picosock=%p", s);
-				return;
+		if(conn->txbuf.size())
+			pico_write_txbuf(conn);
+	}
+
+	// Socket events for in-process Connections. Nothing is closed here, the app finds
+	// out on its next call and closes the Connection itself with zts_direct_close()
+	void pico_cb_direct_activity(uint16_t ev, struct pico_socket *s, Connection *conn)
+	{
+		if (ev & PICO_SOCK_EV_CONN) {
+			if(!conn->listening) {
+				conn->connected = true;
+				picotap->signalDirect(conn);
+			}
+			else {
+				uint32_t peer;
+				uint16_t port;
+				struct pico_socket *client;
+				while((client = picotap->picostack->__pico_socket_accept(s, &peer, &port))) {
+					Connection *newTcpConn = picotap->newDirectConnection();
+					if(!newTcpConn) {
+						picotap->picostack->__pico_socket_close(client);
+						break;
+					}
+					newTcpConn->picosock = client;
+					newTcpConn->connected = true;
+					newTcpConn->nodelay = conn->nodelay;
+					newTcpConn->keepalive = conn->keepalive;
+					newTcpConn->reuseaddr = conn->reuseaddr;
+					newTcpConn->linger = conn->linger;
+					newTcpConn->txbuf_sz = conn->txbuf_sz;
+					newTcpConn->rxbuf_sz = conn->rxbuf_sz;
+					pico_apply_sockopt(newTcpConn, IPPROTO_TCP, TCP_NODELAY);
+					pico_apply_sockopt(newTcpConn, SOL_SOCKET, SO_KEEPALIVE);
+					pico_apply_sockopt(newTcpConn, SOL_SOCKET, SO_LINGER);
+					conn->accepted_conns.push_back(newTcpConn);
+				}
+				picotap->signalDirect(conn);
 			}
-			int sz = (conn->txsz)-r;
-            if(sz)
-                memmove(&conn->txbuf, (conn->txbuf+r), sz);
-            conn->txsz -= r;
-#if DEBUG_LEVEL >= MSG_TRANSFER
-            int max = conn->type == SOCK_STREAM ? DEFAULT_TCP_TX_BUF_SZ : DEFAULT_UDP_TX_BUF_SZ;
-            DEBUG_TRANS("[TCP TX] --->    :: {TX: %.3f%%, RX: %.3f%%, physock=%p} :: %d bytes",
-                (float)conn->txsz / (float)max, (float)conn->rxsz / max, conn->sock, r);
-#endif /* DEBUG_LEVEL >= MSG_TRANSFER */
-            return;
+		}
+		if (ev & PICO_SOCK_EV_RD)
+			pico_cb_tcp_read(picotap, s);
+		if (ev & PICO_SOCK_EV_WR) {
+			pico_cb_tcp_write(picotap, s);
+			if(conn->tx_blocked && conn->txbuf.size() < conn->txbufLimit()) {
+				conn->tx_blocked = false;
+				picotap->signalDirect(conn);
+			}
+		}
+		if (ev & PICO_SOCK_EV_ERR) {
+			conn->direct_err = conn->connected ? ECONNRESET : ECONNREFUSED;
+			picotap->signalDirect(conn);
+		}
+		if (ev & (PICO_SOCK_EV_FIN | PICO_SOCK_EV_CLOSE)) {
+			if (ev & PICO_SOCK_EV_FIN)
+				conn->picosock = NULL; // picoTCP frees it after this
+			conn->eof = true;
+			picotap->signalDirect(conn);
 		}
 	}
 
@@ -264,15 +549,49 @@ namespace ZeroTier {
         Connection *conn = picotap->getConnection(s);
         if(!conn) {
         	DEBUG_ERROR("invalid connection");
+        	return;
+        }
+        if(conn->direct) {
+        	pico_cb_direct_activity(ev, s, conn);
+        	return;
         }
+        int shard = pico_socket_shard(conn, s);
+        picoTCP_stack *stack = picotap->picoshards[shard]->stack;
         // Accept connection (analogous to lwip_nc_accept)
-        if (ev & PICO_SOCK_EV_CONN) {
+        if ((ev & PICO_SOCK_EV_CONN) && shard) {
+        	// We're on the shard's thread, pico_collect_shards() gives it to the app
+            uint32_t peer;
+			uint16_t port;
+            struct pico_socket *client;
+            while((client = stack->__pico_socket_accept(s, &peer, &port))) {
+				Connection *newTcpConn = picotap->socketLimitReached() ? NULL : new Connection();
+				if(!newTcpConn) {
+					stack->__pico_socket_close(client);
+					continue;
+				}
+				picotap->_Connections.push_back(newTcpConn);
+				newTcpConn->type = SOCK_STREAM;
+				newTcpConn->picosock = client;
+				newTcpConn->shard = shard;
+				pico_inherit_sockopts(conn, newTcpConn);
+				picotap->picoshards[shard]->accepted.push_back(std::make_pair(conn, newTcpConn));
+			}
+			picotap->_phy.whack();
+        }
+        else if (ev & PICO_SOCK_EV_CONN) {
             DEBUG_INFO("connection established with server, picosock=%p",(conn->picosock));
             uint32_t peer;
 			uint16_t port;
-            struct pico_socket *client = picotap->picostack->__pico_socket_accept(s, &peer, &port);
+            struct pico_socket *client = stack->__pico_socket_accept(s, &peer, &port);
             if(!client) {
 				DEBUG_EXTRA("unable to accept conn. (event might not be incoming, not necessarily an error), picosock=%p", (conn->picosock));
+				return;
+			}
+			Connection *newTcpConn = picotap->socketLimitReached() ? NULL : new Connection();
+			if(!newTcpConn) {
+				DEBUG_ERROR("refusing connection, out of sockets");
+				stack->__pico_socket_close(client);
+				return;
 			}
 			ZT_PHY_SOCKFD_TYPE fds[2];
 			if(socketpair(PF_LOCAL, SOCK_STREAM, 0, fds) < 0) {
@@ -280,18 +599,18 @@ namespace ZeroTier {
 					// FIXME: Return a value to the client
 					//picotap->sendReturnValue(conn, -1, errno);
 					DEBUG_ERROR("unable to create socketpair");
+					delete newTcpConn;
+					stack->__pico_socket_close(client);
 					return;
 				}
 			}
-			Connection *newTcpConn = new Connection();
 			picotap->_Connections.push_back(newTcpConn);
 			newTcpConn->type = SOCK_STREAM;
 			newTcpConn->sock = picotap->_phy.wrapSocket(fds[0], newTcpConn);
 			newTcpConn->picosock = client;
-			int fd = picotap->_phy.getDescriptor(conn->sock);
-			if(sock_fd_write(fd, fds[1]) < 0) {
-				DEBUG_ERROR("error sending new fd to client application");
-			}
+			// We're inside the stack's tick here
+			pico_inherit_sockopts(conn, newTcpConn);
+			picotap->queueAcceptedFd(conn, fds[1]);
 			DEBUG_EXTRA("conn=%p, physock=%p, listen_picosock=%p, new_picosock=%p, fd=%d", newTcpConn, newTcpConn->sock, s, client, fds[1]);
         }
         if (ev & PICO_SOCK_EV_FIN) {
@@ -302,10 +621,19 @@ namespace ZeroTier {
             DEBUG_INFO("socket error received" /*, strerror(pico_err)*/);
         }
         if (ev & PICO_SOCK_EV_CLOSE) {
-            err = picotap->picostack->__pico_socket_close(s);
+            err = stack->__pico_socket_close(s);
             DEBUG_INFO("socket closure = %d, picosock=%p", err, s);
             if(err==0) {
-            	picotap->closeConnection(conn->sock);
+            	if(s != conn->picosock)
+            		conn->listen_picosocks[shard] = NULL; // The listener lives on elsewhere
+            	else if(shard) {
+            		// The tap thread closes it, see pico_collect_shards()
+            		conn->picosock = NULL;
+            		conn->eof = true;
+            		pico_shard_ready(conn);
+            	}
+            	else
+            		picotap->closeConnection(conn->sock);
             }
             return;
         }
@@ -355,11 +683,60 @@ namespace ZeroTier {
         src_mac.setTo(ethhdr->saddr, 6);
         dest_mac.setTo(ethhdr->daddr, 6);
 
-        picotap->_handler(picotap->_arg,picotap->_nwid,src_mac,dest_mac,
-            Utils::ntoh((uint16_t)ethhdr->proto),0, ((char*)buf) + sizeof(struct pico_eth_hdr),len - sizeof(struct pico_eth_hdr));
+        picotap->sendFrame(src_mac,dest_mac,
+            Utils::ntoh((uint16_t)ethhdr->proto),((char*)buf) + sizeof(struct pico_eth_hdr),len - sizeof(struct pico_eth_hdr));
         return len;
     }
 
+    // Picks the shard an incoming frame belongs to, -1 for all of them. IPv4 TCP segments go
+    // to the shard their flow hashes to, ARP replies go everywhere since any shard may have
+    // asked, and everything else (ARP requests, ICMP, UDP, fragments) is left to shard 0
+    static int pico_frame_shard(NetconEthernetTap *tap, unsigned int etherType, const void *data, unsigned int len)
+    {
+    	const unsigned char *p = (const unsigned char *)data;
+    	int shards = (int)tap->picoshards.size();
+    	if(shards == 1)
+    		return 0;
+    	if(etherType == ZT_ETHERTYPE_ARP)
+    		return (len >= 8 && p[6] == 0 && p[7] == 2) ? -1 : 0;
+    	if(etherType != ZT_ETHERTYPE_IPV4 || len < 20 || p[9] != PICO_PROTO_TCP)
+    		return 0;
+    	unsigned int ihl = (p[0] & 0x0f) * 4;
+    	if(len < ihl + 4 || (p[6] & 0x3f) || p[7])
+    		return 0;
+    	uint32_t raddr;
+    	uint16_t rport, lport;
+    	memcpy(&raddr, p + 12, sizeof(raddr));
+    	memcpy(&rport, p + ihl, sizeof(rport));
+    	memcpy(&lport, p + ihl + 2, sizeof(lport));
+    	return pico_flow_shard(raddr, rport, lport, shards);
+    }
+
+    // Since picoTCP only allows the reception of frames from within the polling function, we
+    // must enqueue each frame into a memory structure shared by both threads
+    static void pico_enqueue_frame(PicoShard *shard, const struct pico_eth_hdr &ethhdr, const void *data, unsigned int len)
+    {
+		Mutex::Lock _l(shard->frame_rxbuf_m);
+		int newlen = len + sizeof(int) + sizeof(struct pico_eth_hdr);
+		if(newlen > (MAX_PICO_FRAME_RX_BUF_SZ-shard->frame_rxbuf_tot)) {
+			if(ethhdr.proto != 56710) {
+				DEBUG_FLOW(" [ ZTWIRE -> FBUF ] not enough space left on RX frame buffer, dropping frame");
+				return;
+			}
+			memset(shard->frame_rxbuf,0,MAX_PICO_FRAME_RX_BUF_SZ);
+			shard->frame_rxbuf_tot=0;
+		}
+		bool was_empty = !shard->frame_rxbuf_tot;
+		memcpy(shard->frame_rxbuf + shard->frame_rxbuf_tot, &newlen, sizeof(newlen));                      // size of frame + meta		
+		memcpy(shard->frame_rxbuf + shard->frame_rxbuf_tot + sizeof(newlen), &ethhdr, sizeof(ethhdr));     // new eth header
+		memcpy(shard->frame_rxbuf + shard->frame_rxbuf_tot + sizeof(newlen) + sizeof(ethhdr), data, len);  // frame data
+		shard->frame_rxbuf_tot += newlen;
+		DEBUG_FLOW(" [ ZTWIRE -> FBUF ] Move FRAME(sz=%d) into FBUF(sz=%d), data_len=%d", newlen, shard->frame_rxbuf_tot, len);
+		// Shard 0 is polled by the tap thread anyway, the others sleep until there's work
+		if(was_empty && shard->index)
+			shard->wake();
+    }
+
     // Receives data from the tap device and encapsulates it into a ZeroTier ethernet frame and places it in a locked memory buffer
    	// -----------------------------------------
 	// | TAP <-> MEM BUFFER <-> STACK <-> APP  |
@@ -370,35 +747,19 @@ namespace ZeroTier {
     // It will then periodically be transfered into the network stack via pico_eth_poll()
     void pico_rx(NetconEthernetTap *tap, const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 	{
-		// Since picoTCP only allows the reception of frames from within the polling function, we
-		// must enqueue each frame into a memory structure shared by both threads. This structure will
-		Mutex::Lock _l(tap->_pico_frame_rxbuf_m);
-
 		// assemble new eth header
 		struct pico_eth_hdr ethhdr;
 		from.copyTo(ethhdr.saddr, 6);
 		to.copyTo(ethhdr.daddr, 6);
 		ethhdr.proto = Utils::hton((uint16_t)etherType);
-		int newlen = len + sizeof(int) + sizeof(struct pico_eth_hdr);
 
-		int mylen;
-		while(newlen > (MAX_PICO_FRAME_RX_BUF_SZ-tap->pico_frame_rxbuf_tot) && ethhdr.proto == 56710)
-		{
-			mylen = 0;
-			//DEBUG_FLOW(" [ ZTWIRE -> FBUF ] not enough space left on RX frame buffer, dropping oldest packet in buffer");
-			/*
-        	memcpy(&mylen, picotap->pico_frame_rxbuf, sizeof(len));
-			memmove(tap->pico_frame_rxbuf, tap->pico_frame_rxbuf + mylen, MAX_PICO_FRAME_RX_BUF_SZ-mylen); // shift buffer
-			picotap->pico_frame_rxbuf_tot-=mylen;
-			*/
-			memset(tap->pico_frame_rxbuf,0,MAX_PICO_FRAME_RX_BUF_SZ);
-			picotap->pico_frame_rxbuf_tot=0;
+		int shard = pico_frame_shard(tap, etherType, data, len);
+		if(shard >= 0) {
+			pico_enqueue_frame(tap->picoshards[shard], ethhdr, data, len);
+			return;
 		}
-		memcpy(tap->pico_frame_rxbuf + tap->pico_frame_rxbuf_tot, &newlen, sizeof(newlen));                      // size of frame + meta		
-		memcpy(tap->pico_frame_rxbuf + tap->pico_frame_rxbuf_tot + sizeof(newlen), &ethhdr, sizeof(ethhdr));     // new eth header
-		memcpy(tap->pico_frame_rxbuf + tap->pico_frame_rxbuf_tot + sizeof(newlen) + sizeof(ethhdr), data, len);  // frame data
-		tap->pico_frame_rxbuf_tot += newlen;
-		DEBUG_FLOW(" [ ZTWIRE -> FBUF ] Move FRAME(sz=%d) into FBUF(sz=%d), data_len=%d", newlen, picotap->pico_frame_rxbuf_tot, len);
+		for(size_t i=0;i<tap->picoshards.size();++i)
+			pico_enqueue_frame(tap->picoshards[i], ethhdr, data, len);
 	}
 
 	// Called periodically by the stack, this removes data from the locked memory buffer (FBUF) and feeds it into the stack.
@@ -413,20 +774,27 @@ namespace ZeroTier {
     {
         // OPTIMIZATION: The copy logic and/or buffer structure should be reworked for better performance after the BETA
         // NetconEthernetTap *tap = (NetconEthernetTap*)netif->state;
-        Mutex::Lock _l(picotap->_pico_frame_rxbuf_m);
-        unsigned char frame[SDK_MTU];
+        PicoShard *shard = NULL;
+        for(size_t i=0;i<picotap->picoshards.size() && !shard;++i) {
+        	if(&picotap->picoshards[i]->dev == dev)
+        		shard = picotap->picoshards[i];
+        }
+        if(!shard)
+        	return loop_score;
+        Mutex::Lock _l(shard->frame_rxbuf_m);
+        unsigned char frame[ZT_MAX_MTU + sizeof(struct pico_eth_hdr)];
         int len;
-        while (picotap->pico_frame_rxbuf_tot > 0 && loop_score > 0) {
-        	//DEBUG_FLOW(" [   FBUF -> STACK] Frame buffer SZ=%d", picotap->pico_frame_rxbuf_tot);
+        while (shard->frame_rxbuf_tot > 0 && loop_score > 0) {
+        	//DEBUG_FLOW(" [   FBUF -> STACK] Frame buffer SZ=%d", shard->frame_rxbuf_tot);
             memset(frame, 0, sizeof(frame));
             len = 0;
-            memcpy(&len, picotap->pico_frame_rxbuf, sizeof(len)); // get frame len
+            memcpy(&len, shard->frame_rxbuf, sizeof(len)); // get frame len
             if(len >= 0) {
-            	//DEBUG_FLOW(" [   FBUF -> STACK]   Moving FRAME of size (%d) from FBUF(sz=%d) into stack",len, picotap->pico_frame_rxbuf_tot-len);
-            	memcpy(frame, picotap->pico_frame_rxbuf + sizeof(len), len-(sizeof(len)) ); // get frame data
-            	memmove(picotap->pico_frame_rxbuf, picotap->pico_frame_rxbuf + len, MAX_PICO_FRAME_RX_BUF_SZ-len); // shift buffer
-            	picotap->picostack->__pico_stack_recv(dev, (uint8_t*)frame, (len-sizeof(len))); 
-                picotap->pico_frame_rxbuf_tot-=len;
+            	//DEBUG_FLOW(" [   FBUF -> STACK]   Moving FRAME of size (%d) from FBUF(sz=%d) into stack",len, shard->frame_rxbuf_tot-len);
+            	memcpy(frame, shard->frame_rxbuf + sizeof(len), len-(sizeof(len)) ); // get frame data
+            	memmove(shard->frame_rxbuf, shard->frame_rxbuf + len, MAX_PICO_FRAME_RX_BUF_SZ-len); // shift buffer
+            	shard->stack->__pico_stack_recv(dev, (uint8_t*)frame, (len-sizeof(len))); 
+                shard->frame_rxbuf_tot-=len;
             }
             else {
             	DEBUG_ERROR("Skipping frame of size (%d)",len);
@@ -448,6 +816,8 @@ namespace ZeroTier {
 		#elif defined(SDK_IPV6)
 			protocol_version = PICO_PROTO_IPV6;
 		#endif
+		// zts_direct_*() callers may be inside the stack from other threads
+		Mutex::Lock _l(picotap->picostack->_lock);
 		if(socket_rpc->socket_type == SOCK_DGRAM) {
 			protocol = PICO_PROTO_UDP;
 			psock = picotap->picostack->__pico_socket_open(protocol_version, protocol, &pico_cb_socket_activity);
@@ -460,6 +830,11 @@ namespace ZeroTier {
 		if(psock) {
 			DEBUG_ATTN("physock=%p, picosock=%p", sock, psock);
 			Connection * newConn = new Connection();
+			if(!newConn) {
+				picotap->picostack->__pico_socket_close(psock);
+				errno = ENOBUFS;
+				return NULL;
+			}
 	        *uptr = newConn;
 	        newConn->type = socket_rpc->socket_type;
 	        newConn->sock = sock;
@@ -482,10 +857,9 @@ namespace ZeroTier {
 			// DEBUG_INFO("buflen=%d", sendbuff);
 			*/
 			
-			newConn->local_addr = NULL;
 			newConn->picosock = psock;
+			Mutex::Lock _l2(picotap->_tcpconns_m);
 	        picotap->_Connections.push_back(newConn);
-	        memset(newConn->rxbuf, 0, DEFAULT_UDP_RX_BUF_SZ);
 	        return newConn;
 		}
 		else
@@ -506,12 +880,45 @@ namespace ZeroTier {
 			DEBUG_ERROR(" invalid connection");
 			return;
 		}
+		// Another shard's stack is only called into from its own thread
+		if(conn->shard)
+			pico_shard_pending(conn);
+		else
+			pico_write_txbuf(conn);
+    }
 
-		int max, r, max_write_len = conn->txsz < SDK_MTU ? conn->txsz : SDK_MTU;
-	    if((r = picotap->picostack->__pico_socket_write(conn->picosock, &conn->txbuf, max_write_len)) < 0) {
-	    	DEBUG_ERROR("unable to write to picosock=%p, r=%d", (conn->picosock), r);
-	    	return;
-	    }
+    // Lets the app write again once TXBUF has drained, from the tap thread, which owns _phy
+    static void pico_resume_app_writes(Connection *conn)
+    {
+		if(!conn->probation || conn->txbuf.size() > conn->txbufSoftmin())
+			return;
+		if(conn->shard)
+			pico_shard_ready(conn);
+		else
+			picotap->resumeAppWrites(conn);
+    }
+
+    // Writes TXBUF to the pico_socket until it's empty or the socket's send queue is full,
+    // EV_WR brings us back for the rest
+    static void pico_write_txbuf(Connection *conn)
+    {
+		int max, r = 0, total = 0, max_write_len;
+		const unsigned char *data;
+		while((data = conn->txbuf.readPtr(max_write_len))) {
+			if(max_write_len > SDK_MTU)
+				max_write_len = SDK_MTU;
+		    if((r = pico_stack(conn)->__pico_socket_write(conn->picosock, data, max_write_len)) < 0) {
+		    	DEBUG_ERROR("unable to write to picosock=%p, r=%d", (conn->picosock), r);
+		    	break;
+		    }
+		    conn->txbuf.consume(r);
+		    total += r;
+		    if(r < max_write_len)
+		    	break;
+		}
+		pico_resume_app_writes(conn);
+		if(!total)
+			return;
 	   
 	    // TODO: Errors
 
@@ -534,25 +941,98 @@ namespace ZeroTier {
 			DEBUG_ERROR("PICO_ERR_EAGAIN - resource temporarily unavailable");
 		*/
 
-	    // adjust buffer
-	    int sz = (conn->txsz)-r;
-	   	if(sz)
-	   		memmove(&conn->txbuf, (conn->txbuf+r), sz);
-		conn->txsz -= r;
-	   	
 	   	if(conn->type == SOCK_STREAM) {
 	   		max = DEFAULT_TCP_TX_BUF_SZ;
 	    	DEBUG_TRANS("[TCP TX] --->    :: {TX: %.3f%%, RX: %.3f%%, physock=%p} :: %d bytes",
-	    		(float)conn->txsz / (float)max, (float)conn->rxsz / max, conn->sock, r);
+	    		(float)conn->txbuf.size() / (float)max, (float)conn->rxbuf.size() / max, conn->sock, total);
 	    }
 	   	if(conn->type == SOCK_DGRAM) {
 	   		max = DEFAULT_UDP_TX_BUF_SZ;
 	    	DEBUG_TRANS("[UDP TX] --->    :: {TX: %.3f%%, RX: %.3f%%, physock=%p} :: %d bytes",
-	    		(float)conn->txsz / (float)max, (float)conn->rxsz / max, conn->sock, r);
+	    		(float)conn->txbuf.size() / (float)max, (float)conn->rxbuf.size() / max, conn->sock, total);
 	    }
     }
 
-    // Instructs the stack to connect to a remote host
+    // Sends one datagram from the app's channel, to hdr's address or the connected peer
+    void pico_handleWriteTo(Connection *conn, const struct dgram_hdr *hdr, const void *data)
+    {
+		if(!conn || !conn->picosock) {
+			DEBUG_ERROR(" invalid connection");
+			return;
+		}
+		int r;
+		if(hdr->family) {
+			union {
+		        struct pico_ip4 ip4;
+		        struct pico_ip6 ip6;
+		    } dst;
+		    memcpy(&dst, hdr->addr, sizeof(dst));
+			r = picotap->picostack->__pico_socket_sendto(conn->picosock, data, hdr->len, (void *)&dst, hdr->port);
+		}
+		else
+			r = picotap->picostack->__pico_socket_write(conn->picosock, data, hdr->len);
+		if(r < 0) {
+			DEBUG_ERROR("unable to write to picosock=%p, r=%d", (conn->picosock), r);
+			return;
+		}
+		DEBUG_TRANS("[UDP TX] --->    :: {physock=%p} :: %d bytes", conn->sock, r);
+    }
+
+#if defined(SDK_IPV4)
+    // Connects conn from a local port whose flow hashes to the shard it's on, moving its
+    // socket to another shard first if need be. An unbound socket gets the next shard in
+    // turn and a free port that hashes there. The caller holds _tcpconns_m
+    static int pico_shard_connect(Connection *conn, struct pico_ip4 *zaddr, uint16_t port)
+    {
+    	int shards = (int)picotap->picoshards.size();
+    	struct pico_socket *s = conn->picosock;
+    	struct pico_ip4 laddr = s->local_addr.ip4;
+    	uint16_t lport = s->local_port;
+    	int target = lport ? pico_flow_shard(zaddr->addr, port, lport, shards) : (int)(picotap->next_shard++ % shards);
+    	PicoShard *shard = picotap->picoshards[target];
+    	int ret = -1;
+    	if(target) {
+    		pico_lock_shard(shard);
+    		s = shard->stack->_pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &pico_cb_socket_activity);
+    		if(s && lport && shard->stack->_pico_socket_bind(s, &laddr, &lport) < 0) {
+    			shard->stack->_pico_socket_close(s);
+    			s = NULL;
+    		}
+    	}
+    	if(s && !lport) {
+    		// Ephemeral ports from a random start, about one in every 'shards' hashes here
+    		uint16_t first = (uint16_t)(rand() % 16384);
+    		for(int i=0;i<16384 && !lport;++i) {
+    			uint16_t p = Utils::hton((uint16_t)(49152 + (first + i) % 16384));
+    			if(pico_flow_shard(zaddr->addr, port, p, shards) == target && shard->stack->_pico_socket_bind(s, &laddr, &p) == 0)
+    				lport = p;
+    		}
+    	}
+    	if(s && lport) {
+    		if(target) {
+    			// The old socket on shard 0 was never used, we're on the thread that ticks it
+    			picotap->picostack->_pico_socket_close(conn->picosock);
+	    		conn->picosock = s;
+	    		conn->shard = target;
+	    		pico_apply_sockopt(conn, IPPROTO_TCP, TCP_NODELAY);
+	    		pico_apply_sockopt(conn, SOL_SOCKET, SO_KEEPALIVE);
+	    		pico_apply_sockopt(conn, SOL_SOCKET, SO_LINGER);
+	    		pico_apply_sockopt(conn, SOL_SOCKET, SO_SNDBUF);
+	    		pico_apply_sockopt(conn, SOL_SOCKET, SO_RCVBUF);
+	    	}
+    		ret = shard->stack->_pico_socket_connect(s, zaddr, port);
+    	}
+    	else if(s && target)
+    		shard->stack->_pico_socket_close(s);
+    	if(target)
+    		shard->stack->_lock.unlock();
+    	return ret;
+    }
+#endif
+
+    // Instructs the stack to connect to a remote host. Like the other RPC handlers this runs
+    // on the stack thread under _tcpconns_m, so it uses the unlocked calls. Taking the stack
+    // lock here would invert the order zts_direct_*() callers take the two in
     void pico_handleConnect(PhySocket *sock, PhySocket *rpcSock, Connection *conn, struct connect_st* connect_rpc)
     {
 		if(conn->picosock) {
@@ -562,19 +1042,19 @@ namespace ZeroTier {
 			#if defined(SDK_IPV4)
 				struct pico_ip4 zaddr;
     			struct sockaddr_in *in4 = (struct sockaddr_in*)&connect_rpc->addr;
-    			char ipv4_str[INET_ADDRSTRLEN];
-    			inet_ntop(AF_INET, &(in4->sin_addr), ipv4_str, INET_ADDRSTRLEN);
-				picotap->picostack->__pico_string_to_ipv4(ipv4_str, &(zaddr.addr));
-				//DEBUG_ATTN("addr=%s:%d", ipv4_str, Utils::ntoh(addr->sin_port));
-				ret = picotap->picostack->__pico_socket_connect(conn->picosock, &zaddr, addr->sin_port);
+				zaddr.addr = in4->sin_addr.s_addr;
+				if(picotap->picoshards.size() > 1)
+					ret = pico_shard_connect(conn, &zaddr, addr->sin_port);
+				else
+					ret = picotap->picostack->_pico_socket_connect(conn->picosock, &zaddr, addr->sin_port);
 			#elif defined(SDK_IPV6) // "fd56:5799:d8f6:1238:8c99:9322:30ce:418a"
 				struct pico_ip6 zaddr;
 				struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&connect_rpc->addr;
 				char ipv6_str[INET6_ADDRSTRLEN];
 				inet_ntop(AF_INET6, &(in6->sin6_addr), ipv6_str, INET6_ADDRSTRLEN);
-		    	picotap->picostack->__pico_string_to_ipv6(ipv6_str, zaddr.addr);
+		    	picotap->picostack->_pico_string_to_ipv6(ipv6_str, zaddr.addr);
 		    	//DEBUG_ATTN("addr=%s:%d", ipv6_str, Utils::ntoh(addr->sin_port));
-				ret = picotap->picostack->__pico_socket_connect(conn->picosock, &zaddr, addr->sin_port);
+				ret = picotap->picostack->_pico_socket_connect(conn->picosock, &zaddr, addr->sin_port);
 			#endif
 			
 			memcpy(&(conn->peer_addr), &connect_rpc->addr, sizeof(struct sockaddr_storage));
@@ -604,19 +1084,17 @@ namespace ZeroTier {
 		#if defined(SDK_IPV4)
 			struct pico_ip4 zaddr;
 			struct sockaddr_in *in4 = (struct sockaddr_in*)&bind_rpc->addr;
-			char ipv4_str[INET_ADDRSTRLEN];
-			inet_ntop(AF_INET, &(in4->sin_addr), ipv4_str, INET_ADDRSTRLEN);
-			picotap->picostack->__pico_string_to_ipv4(ipv4_str, &(zaddr.addr));
-			DEBUG_ATTN("addr=%s:%d, physock=%p, picosock=%p", ipv4_str, Utils::ntoh(addr->sin_port), sock, (conn->picosock));
-			ret = picotap->picostack->__pico_socket_bind(conn->picosock, &zaddr, (uint16_t*)&(addr->sin_port));
+			zaddr.addr = in4->sin_addr.s_addr;
+			DEBUG_ATTN("port=%d, physock=%p, picosock=%p", Utils::ntoh(addr->sin_port), sock, (conn->picosock));
+			ret = picotap->picostack->_pico_socket_bind(conn->picosock, &zaddr, (uint16_t*)&(addr->sin_port));
 		#elif defined(SDK_IPV6)
 			struct pico_ip6 zaddr;
 			struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&bind_rpc->addr;
 			char ipv6_str[INET6_ADDRSTRLEN];
 			inet_ntop(AF_INET6, &(in6->sin6_addr), ipv6_str, INET6_ADDRSTRLEN);
-	    	picotap->picostack->__pico_string_to_ipv6(ipv6_str, zaddr.addr);
+	    	picotap->picostack->_pico_string_to_ipv6(ipv6_str, zaddr.addr);
 	    	DEBUG_ATTN("addr=%s:%d, physock=%p, picosock=%p", ipv6_str, Utils::ntoh(addr->sin_port), sock, (conn->picosock));
-			ret = picotap->picostack->__pico_socket_bind(conn->picosock, &zaddr, (uint16_t*)&(addr->sin_port));
+			ret = picotap->picostack->_pico_socket_bind(conn->picosock, &zaddr, (uint16_t*)&(addr->sin_port));
 		#endif
 		if(ret < 0) {
 			DEBUG_ERROR("unable to bind pico_socket(%p), err=%d", (conn->picosock), ret);
@@ -636,6 +1114,27 @@ namespace ZeroTier {
 		picotap->sendReturnValue(picotap->_phy.getDescriptor(rpcSock), ERR_OK, ERR_OK); // success
     }
 
+    // Listens on the same address and port on every other shard, a connection is accepted
+    // by whichever shard its flow hashes to. The caller holds _tcpconns_m
+    static void pico_shard_listen(Connection *conn, int backlog)
+    {
+    	struct pico_ip4 laddr = conn->picosock->local_addr.ip4;
+    	conn->listen_picosocks.assign(picotap->picoshards.size(), NULL);
+    	for(size_t i=1;i<picotap->picoshards.size();++i) {
+    		PicoShard *shard = picotap->picoshards[i];
+    		uint16_t lport = conn->picosock->local_port;
+    		pico_lock_shard(shard);
+    		struct pico_socket *s = shard->stack->_pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &pico_cb_socket_activity);
+    		if(s && (shard->stack->_pico_socket_bind(s, &laddr, &lport) < 0 || shard->stack->_pico_socket_listen(s, backlog) < 0)) {
+    			DEBUG_ERROR("unable to listen on shard %d, picosock=%p", (int)i, s);
+    			shard->stack->_pico_socket_close(s);
+    			s = NULL;
+    		}
+    		conn->listen_picosocks[i] = s;
+    		shard->stack->_lock.unlock();
+    	}
+    }
+
     // Puts a pico_socket into a listening state to receive incoming connection requests
     void pico_handleListen(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct listen_st *listen_rpc)
     {
@@ -646,7 +1145,9 @@ namespace ZeroTier {
     		return;
     	}
     	int ret, backlog = 100;
-    	if((ret = picotap->picostack->__pico_socket_listen(conn->picosock, backlog)) < 0)
+    	if((ret = picotap->picostack->_pico_socket_listen(conn->picosock, backlog)) == 0 && picotap->picoshards.size() > 1)
+    		pico_shard_listen(conn, backlog);
+    	if(ret < 0)
     	{
     		if(ret == PICO_ERR_EINVAL) {
     			DEBUG_ERROR("PICO_ERR_EINVAL - invalid argument");
@@ -676,58 +1177,34 @@ namespace ZeroTier {
             picotap->_rx_buf_m.lock(); 
         }
 
-        int tot = 0, n = -1, write_attempts = 0;
+        int n = -1;
 		
 		Connection *conn = picotap->getConnection(sock);
-		if(conn && conn->rxsz) {
+		if(conn && conn->rxbuf.size()) {
 			//float max = conn->type == SOCK_STREAM ? (float)DEFAULT_TCP_RX_BUF_SZ : (float)DEFAULT_UDP_RX_BUF_SZ;
 			
-			if(conn->type==SOCK_DGRAM) {
-				//DEBUG_ERROR(" [ ZTSOCK <- RXBUF] attempting write, RXBUF(%d)", conn->rxsz);
-				// Try to write SDK_MTU-sized chunk to app socket
-				while(tot < SDK_MTU) {
-					write_attempts++;
-					n = picotap->_phy.streamSend(conn->sock, (conn->rxbuf)+tot, SDK_MTU);
-					tot += n;
-					//DEBUG_ERROR(" [ ZTSOCK <- RXBUF]   wrote = %d, total = %d, errno=%d", n, tot, errno);
-					
-					// If socket is unavailable, attempt to write N times before giving up
-					if(errno==35) {
-						if(write_attempts == 1024) {
-							n = SDK_MTU; // say we wrote it, even though we didn't (drop packet)
-							tot = SDK_MTU;
-						}
-					}
-					
-				}
-				// DEBUG_EXTRA("SOCK_DGRAM, conn=%p, physock=%p", conn, sock);
-				int payload_sz, addr_sz_offset = sizeof(struct sockaddr_storage);
-				memcpy(&payload_sz, conn->rxbuf + addr_sz_offset, sizeof(int));
-				struct sockaddr_storage addr;
-				memcpy(&addr, conn->rxbuf, addr_sz_offset);
-				// adjust buffer
-				//DEBUG_FLOW(" [ ZTSOCK <- RXBUF] Copying data from receiving buffer to ZT-controlled app socket (n=%d, payload_sz=%d)", n, payload_sz);
-				if(conn->rxsz-n > 0) { // If more remains on buffer
-					memcpy(conn->rxbuf, conn->rxbuf+SDK_MTU, conn->rxsz - SDK_MTU);
-					//DEBUG_FLOW(" [ ZTSOCK <- RXBUF]   Data(%d) still on buffer, moving it up by one MTU", conn->rxsz-n);
-					////memset(conn->rxbuf, 0, DEFAULT_UDP_RX_BUF_SZ);
-					////conn->rxsz=SDK_MTU;
-				}
-			  	conn->rxsz -= SDK_MTU;
-			}
-			
+			// Datagrams never touch RXBUF, they go straight to the app's channel
 			if(conn->type==SOCK_STREAM) {
-				n = picotap->_phy.streamSend(conn->sock, conn->rxbuf, conn->rxsz);	
-				if(conn->rxsz-n > 0) // If more remains on buffer
-					memcpy(conn->rxbuf, conn->rxbuf+n, conn->rxsz - n);
-			  	conn->rxsz -= n;
+				bool was_full = conn->rxbufLimit() - conn->rxbuf.size() < SDK_MTU;
+				int len;
+				const unsigned char *data = conn->rxbuf.readPtr(len);
+				n = picotap->_phy.streamSend(conn->sock, data, len);
+				if(n > 0)
+					conn->rxbuf.consume(n);
+			  	// pico_cb_tcp_read() left data in the pico_socket, pull it in now there's room
+			  	if(was_full && n > 0 && conn->picosock) {
+			  		if(conn->shard)
+			  			pico_shard_pending(conn);
+			  		else
+			  			pico_cb_tcp_read(picotap, conn->picosock);
+			  	}
 			}
 			if(n) {
 				if(conn->type==SOCK_STREAM) {
 	            	//DEBUG_TRANS("[TCP RX] <---    :: {TX: %.3f%%, RX: %.3f%%, physock=%p} :: %d bytes",
-	                //	(float)conn->txsz / max, (float)conn->rxsz / max, conn->sock, n);
+	                //	(float)conn->txbuf.size() / max, (float)conn->rxbuf.size() / max, conn->sock, n);
 	        	}
-	        	if(conn->rxsz == 0) {
+	        	if(conn->rxbuf.size() == 0) {
 					picotap->_phy.setNotifyWritable(sock, false);
 				}
 				else {
@@ -743,12 +1220,70 @@ namespace ZeroTier {
             picotap->_rx_buf_m.unlock();
         }
 
-        DEBUG_FLOW(" [ ZTSOCK <- RXBUF] Emitted (%d) from RXBUF(%d) to socket", tot, conn->rxsz);
+        DEBUG_FLOW(" [ ZTSOCK <- RXBUF] Emitted (%d) from RXBUF(%d) to socket", n, conn ? conn->rxbuf.size() : 0);
+    }
+
+    // Maps an option the tap has recorded on the Connection onto its pico_socket. The
+    // caller holds the stack lock. picoTCP has no SO_REUSEADDR, binding doesn't need it
+    int pico_apply_sockopt(Connection *conn, int level, int optname)
+    {
+    	picoTCP_stack *stack = pico_stack(conn);
+    	struct pico_socket *s = conn->picosock;
+    	int err = 0;
+    	if(!s || conn->type != SOCK_STREAM)
+    		return 0;
+    	if(level == IPPROTO_TCP && optname == TCP_NODELAY) {
+    		int val = conn->nodelay;
+    		err = stack->_pico_socket_setoption(s, PICO_TCP_NODELAY, &val);
+    	}
+    	else if(level == SOL_SOCKET && optname == SO_KEEPALIVE) {
+    		uint32_t idle = conn->keepalive ? SDK_TCP_KEEPIDLE : 0; // no idle time turns probes off
+    		uint32_t intvl = SDK_TCP_KEEPINTVL, cnt = SDK_TCP_KEEPCNT;
+    		err |= stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_KEEPINTVL, &intvl);
+    		err |= stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_KEEPCNT, &cnt);
+    		err |= stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_KEEPIDLE, &idle);
+    	}
+    	else if(level == SOL_SOCKET && optname == SO_LINGER) {
+    		uint32_t ms = conn->linger.l_onoff ? conn->linger.l_linger * 1000 : PICO_SOCKET_LINGER_TIMEOUT;
+    		err = stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_LINGER, &ms);
+    	}
+    	else if(level == SOL_SOCKET && optname == SO_SNDBUF) {
+    		uint32_t sz = conn->txbufLimit();
+    		err = stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_SNDBUF, &sz);
+    	}
+    	else if(level == SOL_SOCKET && optname == SO_RCVBUF) {
+    		uint32_t sz = conn->rxbufLimit();
+    		err = stack->_pico_socket_setoption(s, PICO_SOCKET_OPT_RCVBUF, &sz);
+    	}
+    	return err ? EINVAL : 0;
     }
 
-    // Closes a pico_socket
+    // The caller holds _tcpconns_m, see pico_handleConnect()
+    int pico_handleSetsockopt(Connection *conn, int level, int optname)
+    {
+    	if(!conn->shard)
+    		return pico_apply_sockopt(conn, level, optname);
+    	PicoShard *shard = pico_shard(conn);
+    	pico_lock_shard(shard);
+    	int err = pico_apply_sockopt(conn, level, optname);
+    	shard->stack->_lock.unlock();
+    	return err;
+    }
+
+    // Closes a pico_socket. The caller holds _tcpconns_m, the Connection is deleted next
+    // so the shards must forget about it
     void pico_handleClose(PhySocket *sock)
     {
+    	Connection *conn = picotap->getConnection(sock);
+    	for(size_t i=1;conn && i<picotap->picoshards.size();++i) {
+    		PicoShard *shard = picotap->picoshards[i];
+    		shard->pending.erase(std::remove(shard->pending.begin(), shard->pending.end(), conn), shard->pending.end());
+    		shard->ready.erase(std::remove(shard->ready.begin(), shard->ready.end(), conn), shard->ready.end());
+    		for(size_t j=0;j<shard->accepted.size();++j) {
+    			if(shard->accepted[j].first == conn)
+    				shard->accepted[j].first = NULL; // pico_wrap_accepted() drops them
+    		}
+    	}
     	/*
     	int ret;
     	if(conn && conn->picosock) {
@@ -761,6 +1296,82 @@ namespace ZeroTier {
     	DEBUG_ERROR("invalid connection or pico_socket");
     	*/
     }
+
+    // The pico_direct*() calls back NetconEthernetTap's in-process API. The caller holds
+    // the stack lock and then _tcpconns_m, they return 0 or an errno. pico_err isn't
+    // reachable when the stack is loaded with dlopen(), so failures map to the likeliest cause
+    int pico_directSocket(Connection *conn)
+    {
+    	int net = PICO_PROTO_IPV4;
+		#if defined(SDK_IPV6)
+			net = PICO_PROTO_IPV6;
+		#endif
+		conn->picosock = picotap->picostack->_pico_socket_open(net, PICO_PROTO_TCP, &pico_cb_socket_activity);
+		return conn->picosock ? 0 : ENOMEM;
+    }
+
+    // Reads an address passed to the in-process API into zaddr/port, port stays in network order
+    static int pico_directAddr(const struct sockaddr *addr, void *zaddr, uint16_t *port)
+    {
+		#if defined(SDK_IPV4)
+			if(addr->sa_family != AF_INET)
+				return EAFNOSUPPORT;
+			const struct sockaddr_in *in4 = (const struct sockaddr_in *)addr;
+			((struct pico_ip4 *)zaddr)->addr = in4->sin_addr.s_addr;
+			*port = in4->sin_port;
+		#elif defined(SDK_IPV6)
+			if(addr->sa_family != AF_INET6)
+				return EAFNOSUPPORT;
+			const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+			memcpy(((struct pico_ip6 *)zaddr)->addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+			*port = in6->sin6_port;
+		#endif
+		return 0;
+    }
+
+    int pico_directBind(Connection *conn, const struct sockaddr *addr)
+    {
+    	union {
+	        struct pico_ip4 ip4;
+	        struct pico_ip6 ip6;
+	    } zaddr;
+	    uint16_t port;
+	    int err;
+	    if((err = pico_directAddr(addr, &zaddr, &port)))
+	    	return err;
+    	if(picotap->picostack->_pico_socket_bind(conn->picosock, &zaddr, &port) < 0)
+    		return EADDRINUSE;
+    	return 0;
+    }
+
+    int pico_directListen(Connection *conn, int backlog)
+    {
+    	if(picotap->picostack->_pico_socket_listen(conn->picosock, backlog) < 0)
+    		return EINVAL;
+    	return 0;
+    }
+
+    int pico_directConnect(Connection *conn, const struct sockaddr *addr)
+    {
+    	union {
+	        struct pico_ip4 ip4;
+	        struct pico_ip6 ip6;
+	    } zaddr;
+	    uint16_t port;
+	    int err;
+	    if((err = pico_directAddr(addr, &zaddr, &port)))
+	    	return err;
+    	if(picotap->picostack->_pico_socket_connect(conn->picosock, &zaddr, port) < 0)
+    		return EHOSTUNREACH;
+    	return 0;
+    }
+
+    void pico_directClose(Connection *conn)
+    {
+    	if(conn->picosock)
+    		picotap->picostack->_pico_socket_close(conn->picosock);
+    	conn->picosock = NULL;
+    }
 }
 
 #endif // SDK_PICOTCP
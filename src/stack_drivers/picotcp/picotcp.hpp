@@ -33,6 +33,9 @@
 #include <stdio.h>
 #include <dlfcn.h>
 
+#include <vector>
+#include <utility>
+
 #ifdef D_GNU_SOURCE
 #define _GNU_SOURCE
 #endif
@@ -42,6 +45,7 @@
 #include "Mutex.hpp"
 #include "Constants.hpp"
 #include "Phy.hpp"
+#include "Thread.hpp"
  
 #include "debug.h"
 
@@ -97,17 +101,26 @@ namespace ZeroTier {
     void pico_cb_udp_read(NetconEthernetTap *tap, struct pico_socket *s);
     void pico_cb_tcp_write(NetconEthernetTap *tap, struct pico_socket *s);
     void pico_cb_socket_activity(uint16_t ev, struct pico_socket *s);
+    void pico_cb_direct_activity(uint16_t ev, struct pico_socket *s, Connection *conn);
 
     int pico_eth_send(struct pico_device *dev, void *buf, int len);
     void pico_rx(NetconEthernetTap *tap, const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
     int pico_eth_poll(struct pico_device *dev, int loop_score);
     Connection *pico_handleSocket(PhySocket *sock, void **uptr, struct socket_st* socket_rpc);
     void pico_handleWrite(Connection *conn);
+    void pico_handleWriteTo(Connection *conn, const struct dgram_hdr *hdr, const void *data);
     void pico_handleConnect(PhySocket *sock, PhySocket *rpcSock, Connection *conn, struct connect_st* connect_rpc);
     void pico_handleBind(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct bind_st *bind_rpc);
     void pico_handleListen(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct listen_st *listen_rpc);
     void pico_handleRead(PhySocket *sock,void **uptr,bool lwip_invoked);
+    int pico_apply_sockopt(Connection *conn, int level, int optname);
+    int pico_handleSetsockopt(Connection *conn, int level, int optname);
     void pico_handleClose(PhySocket *sock);
+    int pico_directSocket(Connection *conn);
+    int pico_directBind(Connection *conn, const struct sockaddr *addr);
+    int pico_directListen(Connection *conn, int backlog);
+    int pico_directConnect(Connection *conn, const struct sockaddr *addr);
+    void pico_directClose(Connection *conn);
 
 
     /**
@@ -291,7 +304,52 @@ namespace ZeroTier {
         inline struct pico_socket * __pico_socket_accept(PICO_SOCKET_ACCEPT_SIG) throw() { /*DEBUG_ATTN();*/ /*Mutex::Lock _l(_lock);*/ return _pico_socket_accept(s, orig, port); }
         inline int __pico_ipv6_link_add(PICO_IPV6_LINK_ADD_SIG) throw() { /*DEBUG_STACK();*/ Mutex::Lock _l(_lock); return _pico_ipv6_link_add(dev, address, netmask); }
     };
-    
+
+    /**
+     * One picoTCP instance of a tap, with its own device and frame buffer
+     *
+     * A tap runs a single shard unless ZT_SDK_STACK_SHARDS asks for more. Shard 0
+     * is ticked by pico_loop() on the tap's thread like before, every other shard
+     * has a thread of its own. TCP connections are spread over the shards by a
+     * hash of their address/port 4-tuple, see pico_flow_shard()
+     */
+    class PicoShard
+    {
+    public:
+        PicoShard(NetconEthernetTap *tap, int index, picoTCP_stack *stack);
+        ~PicoShard();
+
+        void start();
+        void stop();
+        void wake();
+        void threadMain()
+            throw();
+
+        NetconEthernetTap *tap;
+        int index;
+        picoTCP_stack *stack;
+        struct pico_device dev;
+
+        // Frames pico_rx() has steered to this shard, drained by pico_eth_poll()
+        unsigned char *frame_rxbuf;
+        int frame_rxbuf_tot;
+        Mutex frame_rxbuf_m;
+
+        // Guarded by the tap's _tcpconns_m. The tap thread can't call into this shard's
+        // stack, so it leaves Connections with data to send or room to receive on
+        // 'pending'. The shard can't touch _phy, so it leaves Connections with data to
+        // read or that it has closed on 'ready', and new ones on 'accepted' with
+        // their listener
+        std::vector<Connection*> pending;
+        std::vector<Connection*> ready;
+        std::vector<std::pair<Connection*, Connection*> > accepted;
+
+    private:
+        Thread _thread;
+        int _wakefds[2];
+        volatile bool _run;
+    };
+
 } // namespace ZeroTier
 
 #endif
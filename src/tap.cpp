@@ -28,12 +28,17 @@
 #include <algorithm>
 #include <utility>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/poll.h>
 #include <stdint.h>
 #include <utility>
 #include <string>
 #include <sys/resource.h>
 #include <sys/syscall.h>
+#if defined(__linux__)
+	#include <sys/eventfd.h>
+#endif
 
 #include "tap.hpp"
 #include "sdkutils.hpp"
@@ -102,12 +107,16 @@ NetconEthernetTap::NetconEthernetTap(
 		_nwid(nwid),
 		_handler(handler),
 		_arg(arg),
+		_batchHandler(NULL),
 		_phy(this,false,true),
 		_unixListenSocket((PhySocket *)0),
 		_enabled(true),
 		_run(true)
 {
 	sockstate = -1;
+	// Both stacks allocate PCBs from the heap as they go, this is what caps them
+	const char *max_sockets_env = getenv("ZT_SDK_MAX_SOCKETS");
+	max_sockets = max_sockets_env ? std::max(0, atoi(max_sockets_env)) : 0;
     char sockPath[4096],stackPath[4096];
     Utils::snprintf(sockPath,sizeof(sockPath),"%s%snc_%.16llx",homePath,ZT_PATH_SEPARATOR_S,_nwid,ZT_PATH_SEPARATOR_S,(unsigned long long)nwid);
     _dev = sockPath; // in SDK mode, set device to be just the network ID
@@ -123,15 +132,27 @@ NetconEthernetTap::NetconEthernetTap(
 		lwipstack->__lwip_init();
 		DEBUG_EXTRA("network stack initialized (%p)", lwipstack);
 	#elif defined(SDK_PICOTCP)            
-		pico_frame_rxbuf_tot = 0;
 		Utils::snprintf(stackPath,sizeof(stackPath),"%s%slibpicotcp.so",homePath,ZT_PATH_SEPARATOR_S);
-		picostack = new picoTCP_stack(stackPath);
-		if(!picostack) {
-			DEBUG_ERROR("unable to dynamically load a new instance of (%s) (searched ZeroTier home path)", stackPath);
-			throw std::runtime_error("");
+		// Every dlmopen() gives us another instance of the stack, elsewhere there's only one.
+		// Connections are only spread over IPv4 shards, see pico_rx()
+		int shards = 1;
+		#if defined(__linux__) && !defined(__STATIC_STACK__) && defined(SDK_IPV4)
+			const char *shards_env = getenv("ZT_SDK_STACK_SHARDS");
+			if(shards_env)
+				shards = std::max(1, std::min(atoi(shards_env), SDK_MAX_STACK_SHARDS));
+		#endif
+		next_shard = 0;
+		for(int i=0;i<shards;++i) {
+			picoTCP_stack *stack = new picoTCP_stack(stackPath);
+			if(!stack) {
+				DEBUG_ERROR("unable to dynamically load a new instance of (%s) (searched ZeroTier home path)", stackPath);
+				throw std::runtime_error("");
+			}
+			stack->__pico_stack_init();
+			picoshards.push_back(new PicoShard(this, i, stack));
+			DEBUG_EXTRA("network stack initialized (%p), shard %d", stack, i);
 		}
-		picostack->__pico_stack_init();
-		DEBUG_EXTRA("network stack initialized (%p)", picostack);
+		picostack = picoshards[0]->stack;
 	#elif defined(SDK_JIP)
 		Utils::snprintf(stackPath,sizeof(stackPath),"%s%slibjip.so",homePath,ZT_PATH_SEPARATOR_S);
 		jipstack = new jip_stack(stackPath);
@@ -144,6 +165,10 @@ NetconEthernetTap::NetconEthernetTap(
 		DEBUG_ERROR("unable to bind to: path=%s", sockPath);
 	else
 		DEBUG_INFO("tap initialized on: path=%s", sockPath);
+	#if defined(SDK_PICOTCP)
+		for(size_t i=1;i<picoshards.size();++i)
+			picoshards[i]->start();
+	#endif
      _thread = Thread::start(this);
 }
 
@@ -158,7 +183,12 @@ NetconEthernetTap::~NetconEthernetTap()
 		delete lwipstack;
 	#endif
 	#if defined(SDK_PICOTCP)
-		delete picostack;
+		for(size_t i=1;i<picoshards.size();++i)
+			picoshards[i]->stop();
+		for(size_t i=0;i<picoshards.size();++i) {
+			delete picoshards[i]->stack;
+			delete picoshards[i];
+		}
 	#endif
 	#if defined(SDK_JIP)
 		delete jipstack;
@@ -228,6 +258,68 @@ void NetconEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType
 	#endif
 }
 
+// Frames held by the FrameBatch open on this thread. While they're being handed to the
+// core, which may call back into put(), frames go out one at a time
+struct TxFrames
+{
+	NetconEthernetTap *tap;
+	bool flushing;
+	std::vector<ZT_VirtualNetworkFrame> frames;
+	std::vector<unsigned char> data;
+};
+static thread_local TxFrames txframes;
+
+static void flushFrames(TxFrames &tx)
+{
+	if(tx.frames.empty())
+		return;
+	size_t off = 0;
+	for(size_t i=0;i<tx.frames.size();++i) {
+		tx.frames[i].data = &tx.data[off];
+		off += tx.frames[i].len;
+	}
+	tx.flushing = true;
+	tx.tap->_batchHandler(tx.tap->_arg,tx.tap->_nwid,&tx.frames[0],(unsigned int)tx.frames.size());
+	tx.flushing = false;
+	tx.frames.clear();
+	tx.data.clear();
+}
+
+FrameBatch::FrameBatch(NetconEthernetTap *tap) :
+	_outer(!txframes.tap && tap->_batchHandler)
+{
+	if(_outer)
+		txframes.tap = tap;
+}
+
+FrameBatch::~FrameBatch()
+{
+	if(!_outer)
+		return;
+	flushFrames(txframes);
+	txframes.tap = NULL;
+}
+
+void NetconEthernetTap::sendFrame(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	TxFrames &tx = txframes;
+	if(tx.tap != this || tx.flushing) {
+		_handler(_arg,_nwid,from,to,etherType,0,data,len);
+		return;
+	}
+	if(tx.frames.size() == SDK_TX_BATCH_FRAMES)
+		flushFrames(tx);
+	ZT_VirtualNetworkFrame f;
+	f.sourceMac = from.toInt();
+	f.destMac = to.toInt();
+	f.etherType = etherType;
+	f.vlanId = 0;
+	f.data = NULL; // Points into tx.data once the batch is sent, which may move until then
+	f.len = len;
+	tx.frames.push_back(f);
+	tx.data.insert(tx.data.end(),(const unsigned char *)data,(const unsigned char *)data + len);
+}
+
 std::string NetconEthernetTap::deviceName() const
 {
 	return _dev;
@@ -274,6 +366,8 @@ void NetconEthernetTap::threadMain()
 
 Connection *NetconEthernetTap::getConnection(PhySocket *sock)
 {
+	if(!sock)
+		return NULL; // Direct Connections have no PhySocket
 	for(size_t i=0;i<_Connections.size();++i) {
 		if(_Connections[i]->sock == sock)
 			return _Connections[i];
@@ -286,10 +380,27 @@ Connection *NetconEthernetTap::getConnection(struct pico_socket *sock)
 	for(size_t i=0;i<_Connections.size();++i) {
 		if(_Connections[i]->picosock == sock)
 			return _Connections[i];
+		// A listener's sockets on the other shards
+		for(size_t j=1;j<_Connections[i]->listen_picosocks.size();++j) {
+			if(_Connections[i]->listen_picosocks[j] == sock)
+				return _Connections[i];
+		}
 	}
 	return NULL;
 }
 
+void NetconEthernetTap::getMemoryUsage(size_t &connections, size_t &buffered, size_t &allocated)
+{
+	Mutex::Lock _l(_tcpconns_m);
+	connections = _Connections.size();
+	buffered = 0;
+	allocated = connections * sizeof(Connection);
+	for(size_t i=0;i<_Connections.size();++i) {
+		buffered += _Connections[i]->txbuf.size() + _Connections[i]->rxbuf.size();
+		allocated += _Connections[i]->txbuf.allocated() + _Connections[i]->rxbuf.allocated();
+	}
+}
+
 void NetconEthernetTap::closeConnection(PhySocket *sock)
 {
 	Mutex::Lock _l(_close_m);
@@ -309,6 +420,8 @@ void NetconEthernetTap::closeConnection(PhySocket *sock)
 	#if defined(SDK_LWIP)
 	    lwip_handleClose(this, sock, conn);
 	#endif
+	for(size_t i=0;i<conn->accepted_fds.size();++i)
+		close(conn->accepted_fds[i]);
 	for(size_t i=0;i<_Connections.size();++i) {
 		if(_Connections[i] == conn){
 			_Connections.erase(_Connections.begin() + i);
@@ -350,6 +463,13 @@ void NetconEthernetTap::handleRead(PhySocket *sock,void **uptr,bool lwip_invoked
 void NetconEthernetTap::phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked)
 {
 	handleRead(sock,uptr,lwip_invoked);
+	if(!lwip_invoked)
+		_tcpconns_m.lock();
+	Connection *conn = getConnection(sock);
+	if(conn && !conn->accepted_fds.empty())
+		sendAcceptedFds(conn);
+	if(!lwip_invoked)
+		_tcpconns_m.unlock();
 }
 
 void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data, ssize_t len)
@@ -365,7 +485,9 @@ void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data,
 	std::pair<PhySocket*, void*> sockdata;
 	PhySocket *rpcSock;
 	bool foundJob = false, detected_rpc = false;
-	Connection *conn;
+	int socket_err = 0;
+	FrameBatch batch(this); // Whatever a write makes the stack send goes out together
+	Connection *conn, *new_conn = NULL;
 	// RPC
 	char phrase[RPC_PHRASE_SZ];
 	memset(phrase, 0, RPC_PHRASE_SZ);
@@ -384,10 +506,10 @@ void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data,
 			// Create new lwip socket and associate it with this sock
 			struct socket_st socket_rpc;
 			memcpy(&socket_rpc, &buf[IDX_PAYLOAD+STRUCT_IDX], sizeof(struct socket_st));
-			Connection * new_conn;
 			if((new_conn = handleSocket(sock, uptr, &socket_rpc))) {
 				new_conn->pid = pid; // Merely kept to look up application path/names later, not strictly necessary
 			}
+			socket_err = errno;
 		} else {
 			memcpy(&tmpbuf,data,len);
 			jobmap[CANARY_num] = std::pair<PhySocket*, void*>(sock, tmpbuf);
@@ -398,10 +520,19 @@ void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data,
 #else  /* 0 */
 		write(_phy.getDescriptor(sock), "z", 1); // RPC ACK byte to maintain order
 #endif /* 0 */
+		// socket() waits to hear whether there's a Connection behind its descriptor
+		if(cmd == RPC_SOCKET)
+			sendReturnValue(_phy.getDescriptor(sock), new_conn ? 0 : -1, new_conn ? 0 : socket_err);
+		if(new_conn && new_conn->type == SOCK_DGRAM)
+			openDatagramChannel(sock, new_conn);
+	}
+	// DATAGRAM (a lone canary is the only message shorter than a dgram_hdr)
+	else if((conn = getConnection(sock)) && conn->type == SOCK_DGRAM && len >= (ssize_t)DGRAM_HDR_SZ) {
+		handleDatagram(conn, data, len);
 	}
 	// STREAM
 	else {
-		int data_start = -1, data_end = -1, canary_pos = -1, padding_pos = -1;
+		int canary_pos = -1, padding_pos = -1;
 		// Look for padding
 		std::string padding_pattern(padding, padding+PADDING_SZ);
 		std::string buffer(buf, buf + len);
@@ -419,45 +550,28 @@ void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data,
 					foundJob = true;
 			}
 		}
+		// Stack shards and zts_direct_*() callers use the buffers from their own threads
+		Mutex::Lock _l(_tcpconns_m);
 		conn = getConnection(sock);
 		if(!conn)
 			return;
 
-		if(padding_pos == -1) { // [DATA]
-			memcpy(&conn->txbuf[conn->txsz], buf, wlen);
+		if(padding_pos == -1 || canary_pos < 0) { // [DATA]
+			wlen = conn->txbuf.write(buf, len);
 		} else { // Padding found, implies a canary is present
-			// [CANARY]
-			if(len == CANARY_SZ+PADDING_SZ && canary_pos == 0) {
-				wlen = 0; // Nothing to write
-			} else {
-				// [CANARY] + [DATA]
-				if(len > CANARY_SZ+PADDING_SZ && canary_pos == 0) {
-					wlen = len - CANARY_SZ+PADDING_SZ;
-					data_start = padding_pos+PADDING_SZ;
-					memcpy((&conn->txbuf)+conn->txsz, buf+data_start, wlen);
-				}
-				// [DATA] + [CANARY]
-				if(len > CANARY_SZ+PADDING_SZ && canary_pos > 0 && canary_pos == len - CANARY_SZ+PADDING_SZ) {
-					wlen = len - CANARY_SZ+PADDING_SZ;
-					data_start = 0;
-					memcpy((&conn->txbuf)+conn->txsz, buf+data_start, wlen);												
-				}
-				// [DATA] + [CANARY] + [DATA]
-				if(len > CANARY_SZ+PADDING_SZ && canary_pos > 0 && len > (canary_pos + CANARY_SZ+PADDING_SZ)) {
-					wlen = len - CANARY_SZ+PADDING_SZ;
-					data_start = 0;
-					data_end = padding_pos-CANARY_SZ;
-					memcpy((&conn->txbuf)+conn->txsz, buf+data_start, (data_end-data_start)+1);
-					memcpy((&conn->txbuf)+conn->txsz, buf+(padding_pos+PADDING_SZ), len-(canary_pos+CANARY_SZ+PADDING_SZ));
-				}
-			}
+			// [DATA] + [CANARY] + [DATA], either side may be empty
+			int after = canary_pos + CANARY_SZ + PADDING_SZ;
+			wlen = conn->txbuf.write(buf, canary_pos);
+			if(len > after)
+				wlen += conn->txbuf.write(buf + after, len - after);
 		}
 		
 		// Write data from stream
-        if(wlen) {
-            conn->txsz += wlen;
+        if(wlen)
             handleWrite(conn);
-        }
+		// What the stack couldn't take waits in TXBUF, past softmax the app waits too
+		if(conn->type == SOCK_STREAM && conn->txbuf.size() >= conn->txbufSoftmax())
+			pauseAppWrites(conn);
 	}
 	// Process RPC if we have a corresponding jobmap entry
     if(foundJob) {
@@ -490,6 +604,16 @@ void NetconEthernetTap::phyOnUnixData(PhySocket *sock, void **uptr, void *data,
 		    	memcpy(&getpeername_rpc,  &buf[IDX_PAYLOAD+STRUCT_IDX], sizeof(struct getsockname_st));
 		  		handleGetpeername(sock, rpcSock, uptr, &getpeername_rpc);
 		  		break;
+			case RPC_SETSOCKOPT:
+				struct sockopt_st setsockopt_rpc;
+				memcpy(&setsockopt_rpc,  &buf[IDX_PAYLOAD+STRUCT_IDX], sizeof(struct sockopt_st));
+				handleSetsockopt(sock, rpcSock, uptr, &setsockopt_rpc);
+				break;
+			case RPC_GETSOCKOPT:
+				struct sockopt_st getsockopt_rpc;
+				memcpy(&getsockopt_rpc,  &buf[IDX_PAYLOAD+STRUCT_IDX], sizeof(struct sockopt_st));
+				handleGetsockopt(sock, rpcSock, uptr, &getsockopt_rpc);
+				break;
 			case RPC_CONNECT:
 				//DEBUG_INFO("RPC_CONNECT, physock=%p", sock);
 			    struct connect_st connect_rpc;
@@ -515,39 +639,116 @@ void NetconEthernetTap::handleGetsockname(PhySocket *sock, PhySocket *rpcSock, v
 {
 	Mutex::Lock _l(_tcpconns_m);
 	Connection *conn = getConnection(sock);
-	if(conn->local_addr == NULL){
+	if(!conn->local_addr.ss_family)
 		DEBUG_EXTRA("no address info available. is it bound?");
-		struct sockaddr_storage storage;
-		memset(&storage, 0, sizeof(struct sockaddr_storage));
-		write(_phy.getDescriptor(rpcSock), NULL, sizeof(struct sockaddr_storage));
-		return;
-	}
-	write(_phy.getDescriptor(rpcSock), conn->local_addr, sizeof(struct sockaddr_storage));
+	write(_phy.getDescriptor(rpcSock), &conn->local_addr, sizeof(struct sockaddr_storage));
 }
 
 void NetconEthernetTap::handleGetpeername(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct getsockname_st *getsockname_rpc)
 {
 	Mutex::Lock _l(_tcpconns_m);
 	Connection *conn = getConnection(sock);
-	if(conn->peer_addr == NULL){
+	if(!conn->peer_addr.ss_family)
 		DEBUG_EXTRA("no peer address info available. is it connected?");
-		struct sockaddr_storage storage;
-		memset(&storage, 0, sizeof(struct sockaddr_storage));
-		write(_phy.getDescriptor(rpcSock), NULL, sizeof(struct sockaddr_storage));
+	write(_phy.getDescriptor(rpcSock), &conn->peer_addr, sizeof(struct sockaddr_storage));
+}
+    
+void NetconEthernetTap::handleSetsockopt(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct sockopt_st *sockopt_rpc)
+{
+	Mutex::Lock _l(_tcpconns_m);
+	Connection *conn = getConnection(sock);
+	int err = 0, val = 0;
+	if(!conn) {
+		sendReturnValue(_phy.getDescriptor(rpcSock), -1, EBADF);
+		return;
+	}
+	if(sockopt_rpc->optlen > SOCKOPT_VAL_SZ
+		|| sockopt_rpc->optlen < (sockopt_rpc->optname == SO_LINGER ? sizeof(struct linger) : sizeof(int))) {
+		sendReturnValue(_phy.getDescriptor(rpcSock), -1, EINVAL);
+		return;
+	}
+	memcpy(&val, sockopt_rpc->optval, sizeof(val));
+	// Remember what the app asked for so that getsockopt() and accepted connections
+	// see it, then let the stack apply whatever it has an equivalent for
+	if(sockopt_rpc->level == IPPROTO_TCP && sockopt_rpc->optname == TCP_NODELAY && conn->type == SOCK_STREAM)
+		conn->nodelay = val != 0;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_KEEPALIVE && conn->type == SOCK_STREAM)
+		conn->keepalive = val != 0;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_REUSEADDR)
+		conn->reuseaddr = val != 0;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_LINGER)
+		memcpy(&conn->linger, sockopt_rpc->optval, sizeof(struct linger));
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_SNDBUF)
+		conn->txbuf_sz = std::max(SDK_MIN_SOCK_BUF_SZ, std::min(val, DEFAULT_TCP_TX_BUF_SZ));
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_RCVBUF)
+		conn->rxbuf_sz = std::max(SDK_MIN_SOCK_BUF_SZ, std::min(val, DEFAULT_TCP_RX_BUF_SZ));
+	else
+		err = ENOPROTOOPT;
+	if(!err) {
+		#if defined(SDK_PICOTCP)
+			err = pico_handleSetsockopt(conn, sockopt_rpc->level, sockopt_rpc->optname);
+		#endif
+		#if defined(SDK_LWIP)
+			err = lwip_handleSetsockopt(this, conn, sockopt_rpc->level, sockopt_rpc->optname);
+		#endif
+	}
+	sendReturnValue(_phy.getDescriptor(rpcSock), err ? -1 : ERR_OK, err);
+}
+
+void NetconEthernetTap::handleGetsockopt(PhySocket *sock, PhySocket *rpcSock, void **uptr, struct sockopt_st *sockopt_rpc)
+{
+	Mutex::Lock _l(_tcpconns_m);
+	Connection *conn = getConnection(sock);
+	int val = 0;
+	if(!conn) {
+		sendReturnValue(_phy.getDescriptor(rpcSock), -1, EBADF);
 		return;
 	}
-	write(_phy.getDescriptor(rpcSock), conn->peer_addr, sizeof(struct sockaddr_storage));
+	if(sockopt_rpc->level == IPPROTO_TCP && sockopt_rpc->optname == TCP_NODELAY && conn->type == SOCK_STREAM)
+		val = conn->nodelay;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_KEEPALIVE)
+		val = conn->keepalive;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_REUSEADDR)
+		val = conn->reuseaddr;
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_SNDBUF)
+		val = conn->txbufLimit();
+	else if(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_RCVBUF)
+		val = conn->rxbufLimit();
+	else if(!(sockopt_rpc->level == SOL_SOCKET && sockopt_rpc->optname == SO_LINGER)) {
+		sendReturnValue(_phy.getDescriptor(rpcSock), -1, ENOPROTOOPT);
+		return;
+	}
+	memset(sockopt_rpc->optval, 0, SOCKOPT_VAL_SZ);
+	if(sockopt_rpc->optname == SO_LINGER && sockopt_rpc->level == SOL_SOCKET) {
+		memcpy(sockopt_rpc->optval, &conn->linger, sizeof(struct linger));
+		sockopt_rpc->optlen = sizeof(struct linger);
+	} else {
+		memcpy(sockopt_rpc->optval, &val, sizeof(val));
+		sockopt_rpc->optlen = sizeof(val);
+	}
+	sendReturnValue(_phy.getDescriptor(rpcSock), ERR_OK, ERR_OK);
+	write(_phy.getDescriptor(rpcSock), sockopt_rpc, sizeof(struct sockopt_st));
 }
     
 Connection * NetconEthernetTap::handleSocket(PhySocket *sock, void **uptr, struct socket_st* socket_rpc)
 {
+	Connection *conn = NULL;
+	{
+		Mutex::Lock _l(_tcpconns_m);
+		if(socketLimitReached()) {
+			errno = EMFILE;
+			return NULL;
+		}
+	}
 	#if defined(SDK_PICOTCP)
-		return pico_handleSocket(sock, uptr, socket_rpc);
+		conn = pico_handleSocket(sock, uptr, socket_rpc);
 	#endif
 	#if defined(SDK_LWIP) 
-	    return lwip_handleSocket(this, sock, uptr, socket_rpc);
+	    conn = lwip_handleSocket(this, sock, uptr, socket_rpc);
 	#endif
-    return NULL;
+	if(!conn)
+		errno = ENOBUFS; // Out of PCBs or Connections
+    return conn;
 }
 
 Connection * NetconEthernetTap::handleSocketProxy(PhySocket *sock, int socket_type)
@@ -610,5 +811,482 @@ void NetconEthernetTap::handleWrite(Connection *conn)
 	#endif
 }
 
-} // namespace ZeroTier
+void NetconEthernetTap::pauseAppWrites(Connection *conn)
+{
+	if(conn->probation || !conn->sock)
+		return;
+	_phy.setNotifyReadable(conn->sock, false);
+	conn->probation = true;
+}
+
+void NetconEthernetTap::resumeAppWrites(Connection *conn)
+{
+	if(!conn->probation || !conn->sock || conn->txbuf.size() > conn->txbufSoftmin())
+		return;
+	conn->probation = false;
+	_phy.setNotifyReadable(conn->sock, true);
+	_phy.whack(); // poll() may be asleep without this socket in its set
+}
+
+void NetconEthernetTap::openDatagramChannel(PhySocket *rpcSock, Connection *conn)
+{
+	int fds[2];
+	if(socketpair(PF_LOCAL, SDK_DGRAM_CHANNEL_TYPE, 0, fds) < 0) {
+		DEBUG_ERROR("unable to create datagram channel, errno=%d", errno);
+		sock_fd_write(_phy.getDescriptor(rpcSock), -1); // app sees no fd and fails the socket() call
+		Mutex::Lock _l(_tcpconns_m);
+		closeConnection(rpcSock);
+		return;
+	}
+	// Room for a burst of datagrams before we start dropping them
+	int sndbuf = DEFAULT_UDP_RX_BUF_SZ;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	conn->sock = _phy.wrapSocket(fds[0], conn);
+	sock_fd_write(_phy.getDescriptor(rpcSock), fds[1]);
+	close(fds[1]);
+}
+
+void NetconEthernetTap::queueAcceptedFd(Connection *listener, int fd)
+{
+	listener->accepted_fds.push_back(fd);
+	if(listener->accepted_fds.size() >= SDK_ACCEPT_BATCH) {
+		sendAcceptedFds(listener);
+		return;
+	}
+	if(listener->accepted_fds.size() == 1) {
+		// Sent once the poll loop sees the socket writable. Whatever else is accepted
+		// until then, and during a connection storm that's plenty, goes with it
+		_phy.setNotifyWritable(listener->sock, true);
+		_phy.whack();
+	}
+}
+
+void NetconEthernetTap::sendAcceptedFds(Connection *listener)
+{
+	std::vector<int> &fds = listener->accepted_fds;
+	int fd = _phy.getDescriptor(listener->sock);
+	while(!fds.empty()) {
+		int n = (int)std::min(fds.size(), (size_t)SDK_ACCEPT_BATCH);
+		if(sock_fds_write(fd, &fds[0], n) < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break; // The rest go when the app catches up
+			DEBUG_ERROR("unable to send accepted connections, errno=%d", errno);
+			n = (int)fds.size(); // Closing them closes the connections as well
+		}
+		// The app holds its own copies now
+		for(int i=0;i<n;++i)
+			close(fds[i]);
+		fds.erase(fds.begin(), fds.begin() + n);
+	}
+	_phy.setNotifyWritable(listener->sock, !fds.empty());
+}
+
+void NetconEthernetTap::handleDatagram(Connection *conn, void *data, ssize_t len)
+{
+	struct dgram_hdr hdr;
+	memcpy(&hdr, data, DGRAM_HDR_SZ);
+	if(hdr.len != len - DGRAM_HDR_SZ || hdr.len > SDK_DGRAM_MAX_PAYLOAD) {
+		DEBUG_ERROR("malformed datagram on channel, len=%d, hdr.len=%d", (int)len, hdr.len);
+		return;
+	}
+	void *payload = (char *)data + DGRAM_HDR_SZ;
+	#if defined(SDK_PICOTCP)
+		pico_handleWriteTo(conn, &hdr, payload);
+	#endif
+	#if defined(SDK_LWIP)
+		lwip_handleWriteTo(this, conn, &hdr, payload);
+	#endif
+}
+
+void NetconEthernetTap::sendDatagram(Connection *conn, const struct sockaddr *from, const struct iovec *iov, int iovlen)
+{
+	struct dgram_hdr hdr;
+	struct iovec chan_iov[SDK_DGRAM_MAX_IOV + 1];
+	struct msghdr msg;
+	if(!conn || !conn->sock || iovlen > SDK_DGRAM_MAX_IOV)
+		return;
+	memset(&hdr, 0, sizeof(hdr));
+	for(int i=0;i<iovlen;++i) {
+		hdr.len += iov[i].iov_len;
+		chan_iov[i+1] = iov[i];
+	}
+	if(from->sa_family == AF_INET) {
+		const struct sockaddr_in *in4 = (const struct sockaddr_in *)from;
+		hdr.family = AF_INET;
+		hdr.port = in4->sin_port;
+		memcpy(hdr.addr, &in4->sin_addr, sizeof(in4->sin_addr));
+	}
+	else if(from->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)from;
+		hdr.family = AF_INET6;
+		hdr.port = in6->sin6_port;
+		memcpy(hdr.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+	}
+	chan_iov[0].iov_base = &hdr;
+	chan_iov[0].iov_len = DGRAM_HDR_SZ;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = chan_iov;
+	msg.msg_iovlen = iovlen + 1;
+	int flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+	flags |= MSG_NOSIGNAL;
+#endif
+	if(sendmsg(_phy.getDescriptor(conn->sock), &msg, flags) < 0)
+		DEBUG_EXTRA("dropped datagram of size=%d, errno=%d", hdr.len, errno);
+	else
+		DEBUG_TRANS("[UDP RX] <---    :: {physock=%p} :: %d bytes", (void*)conn->sock, hdr.len);
+}
 
+/*
+ * Held by the zts_direct_*() calls. picoTCP's callbacks run inside the stack's tick,
+ * which holds the stack lock, and then take _tcpconns_m, so we take them in the same
+ * order. lwIP's wrappers lock the stack themselves
+ */
+class DirectLock
+{
+public:
+	DirectLock(NetconEthernetTap *tap) : _tap(tap)
+	{
+		#if defined(SDK_PICOTCP)
+			_tap->picostack->_lock.lock();
+		#endif
+		_tap->_tcpconns_m.lock();
+	}
+	~DirectLock()
+	{
+		_tap->_tcpconns_m.unlock();
+		#if defined(SDK_PICOTCP)
+			_tap->picostack->_lock.unlock();
+		#endif
+	}
+private:
+	NetconEthernetTap *_tap;
+};
+
+// Clears a handle once the app has run out of work, the next signalDirect() sets it again
+static void drainDirect(Connection *conn)
+{
+	uint64_t n;
+	if(!conn->signaled)
+		return;
+	while(read(conn->event_fd, &n, sizeof(n)) > 0)
+		;
+	conn->signaled = false;
+}
+
+// Every caller already holds _tcpconns_m across this and what it does with the result:
+// directSocket() through DirectLock and the stacks' accept callbacks before they look up
+// the listener. It isn't recursive, so it can't be taken again here
+Connection *NetconEthernetTap::newDirectConnection()
+{
+	int fds[2];
+	if(socketLimitReached()) {
+		errno = EMFILE;
+		return NULL;
+	}
+#if defined(__linux__)
+	if((fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		return NULL;
+#else
+	if(pipe(fds) < 0)
+		return NULL;
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+#endif
+	Connection *conn = new Connection();
+	if(!conn) {
+		close(fds[0]);
+		if(fds[1] != fds[0])
+			close(fds[1]);
+		errno = ENOBUFS;
+		return NULL;
+	}
+	conn->direct = true;
+	conn->type = SOCK_STREAM;
+	conn->event_fd = fds[0];
+	conn->event_wfd = fds[1];
+	_Connections.push_back(conn);
+	_directConns[conn->event_fd] = conn;
+	return conn;
+}
+
+void NetconEthernetTap::signalDirect(Connection *conn)
+{
+	uint64_t one = 1;
+	if(conn->signaled)
+		return;
+	conn->signaled = true;
+	write(conn->event_wfd, &one, sizeof(one));
+}
+
+void NetconEthernetTap::closeDirectConnection(Connection *conn)
+{
+	for(size_t i=0;i<conn->accepted_conns.size();++i)
+		closeDirectConnection(conn->accepted_conns[i]);
+	conn->accepted_conns.clear();
+	// Whatever the stack will take now still goes out
+	if(conn->txbuf.size() && (conn->TCP_pcb || conn->picosock))
+		handleWrite(conn);
+	#if defined(SDK_PICOTCP)
+		pico_directClose(conn);
+	#endif
+	#if defined(SDK_LWIP)
+		lwip_directClose(this, conn);
+	#endif
+	_directConns.erase(conn->event_fd);
+	close(conn->event_fd);
+	if(conn->event_wfd != conn->event_fd)
+		close(conn->event_wfd);
+	for(size_t i=0;i<_Connections.size();++i) {
+		if(_Connections[i] == conn) {
+			_Connections.erase(_Connections.begin() + i);
+			break;
+		}
+	}
+	delete conn;
+}
+
+int NetconEthernetTap::directSocket()
+{
+	#if defined(SDK_PICOTCP)
+		// DirectLock only covers shard 0's stack
+		if(picoshards.size() > 1) {
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+	#endif
+	DirectLock _l(this);
+	Connection *conn = newDirectConnection();
+	int err = EOPNOTSUPP;
+	if(!conn)
+		return -1;
+	#if defined(SDK_PICOTCP)
+		err = pico_directSocket(conn);
+	#endif
+	#if defined(SDK_LWIP)
+		err = lwip_directSocket(this, conn);
+	#endif
+	if(err) {
+		closeDirectConnection(conn);
+		errno = err;
+		return -1;
+	}
+	return conn->event_fd;
+}
+
+int NetconEthernetTap::directBind(int handle, const struct sockaddr *addr, socklen_t addrlen)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	int err = EOPNOTSUPP;
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	if(!addr || addrlen < sizeof(struct sockaddr_in)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(!_ips.size()) {
+		// Same as handleBind(), there's nothing to bind to before ZeroTier assigns an address
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+	#if defined(SDK_PICOTCP)
+		err = pico_directBind(c->second, addr);
+	#endif
+	#if defined(SDK_LWIP)
+		err = lwip_directBind(this, c->second, addr);
+	#endif
+	if(err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int NetconEthernetTap::directListen(int handle, int backlog)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	int err = EOPNOTSUPP;
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	#if defined(SDK_PICOTCP)
+		err = pico_directListen(c->second, backlog);
+	#endif
+	#if defined(SDK_LWIP)
+		err = lwip_directListen(this, c->second, backlog);
+	#endif
+	if(err) {
+		errno = err;
+		return -1;
+	}
+	c->second->listening = true;
+	return 0;
+}
+
+int NetconEthernetTap::directAccept(int handle)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	Connection *conn = c->second;
+	if(!conn->listening) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(conn->accepted_conns.empty()) {
+		drainDirect(conn);
+		errno = EAGAIN;
+		return -1;
+	}
+	Connection *newConn = conn->accepted_conns.front();
+	conn->accepted_conns.erase(conn->accepted_conns.begin());
+	return newConn->event_fd;
+}
+
+int NetconEthernetTap::directConnect(int handle, const struct sockaddr *addr, socklen_t addrlen)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	int err = EOPNOTSUPP;
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	Connection *conn = c->second;
+	if(conn->direct_err) {
+		errno = conn->direct_err;
+		return -1;
+	}
+	if(conn->connected)
+		return 0;
+	if(conn->connecting) {
+		drainDirect(conn);
+		errno = EALREADY;
+		return -1;
+	}
+	if(!addr || addrlen < sizeof(struct sockaddr_in)) {
+		errno = EINVAL;
+		return -1;
+	}
+	#if defined(SDK_PICOTCP)
+		err = pico_directConnect(conn, addr);
+	#endif
+	#if defined(SDK_LWIP)
+		err = lwip_directConnect(this, conn, addr);
+	#endif
+	if(err) {
+		errno = err;
+		return -1;
+	}
+	conn->connecting = true;
+	errno = EINPROGRESS;
+	return -1;
+}
+
+ssize_t NetconEthernetTap::directSend(int handle, const void *buf, size_t len)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	Connection *conn = c->second;
+	if(conn->direct_err) {
+		errno = conn->direct_err;
+		return -1;
+	}
+	if(!conn->connected) {
+		if(conn->connecting)
+			drainDirect(conn);
+		errno = conn->connecting ? EAGAIN : ENOTCONN;
+		return -1;
+	}
+	if(!conn->TCP_pcb && !conn->picosock) {
+		errno = EPIPE;
+		return -1;
+	}
+	int room = conn->txbufLimit() - conn->txbuf.size();
+	if(room <= 0) {
+		// nc_sent()/PICO_SOCK_EV_WR signal the handle once there's room again
+		conn->tx_blocked = true;
+		drainDirect(conn);
+		errno = EAGAIN;
+		return -1;
+	}
+	int n = conn->txbuf.write(buf, (int)std::min(len, (size_t)room));
+	if(!n) {
+		errno = ENOMEM;
+		return -1;
+	}
+	// Hand the stack as much as it takes now, the rest goes as it acknowledges data
+	int before;
+	do {
+		before = conn->txbuf.size();
+		handleWrite(conn);
+	} while(conn->txbuf.size() && conn->txbuf.size() < before);
+	#if defined(SDK_PICOTCP)
+		_phy.whack(); // Frames go out on the stack's next tick
+	#endif
+	return n;
+}
+
+ssize_t NetconEthernetTap::directRecv(int handle, void *buf, size_t len)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	Connection *conn = c->second;
+	if(conn->rxbuf.size()) {
+		bool was_full = conn->rxbufLimit() - conn->rxbuf.size() < SDK_MTU;
+		int n = conn->rxbuf.read(buf, (int)std::min(len, (size_t)INT_MAX));
+		#if defined(SDK_PICOTCP)
+			// pico_cb_tcp_read() left data in the pico_socket, pull it in now there's room
+			if(was_full && conn->picosock)
+				pico_cb_tcp_read(this, conn->picosock);
+		#endif
+		#if defined(SDK_LWIP)
+			(void)was_full;
+			lwip_directRecved(this, conn, n);
+		#endif
+		return n;
+	}
+	if(conn->eof)
+		return 0;
+	if(conn->direct_err) {
+		errno = conn->direct_err;
+		return -1;
+	}
+	if(!conn->connected && !conn->connecting) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	drainDirect(conn);
+	errno = EAGAIN;
+	return -1;
+}
+
+int NetconEthernetTap::directClose(int handle)
+{
+	DirectLock _l(this);
+	std::map<int, Connection*>::iterator c = _directConns.find(handle);
+	if(c == _directConns.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	closeDirectConnection(c->second);
+	return 0;
+}
+
+} // namespace ZeroTier
@@ -33,6 +33,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <utility>
 #include <stdexcept>
 #include <stdint.h>
@@ -46,6 +47,8 @@
 
 #include "defs.h"
 #include "rpc.h"
+#include "ringbuffer.hpp"
+#include "slabpool.hpp"
 
 #if defined(SDK_LWIP)
 	#include "netif/etharp.h"
@@ -71,40 +74,86 @@ namespace ZeroTier {
 
 	class NetconEthernetTap;
 	class LWIPStack;
+	class PicoShard;
 
-	extern struct pico_device picodev;
 	extern NetconEthernetTap *picotap;
+
+	struct Connection;
+
+	/*
+	 * A helper for passing a reference to _phy to LWIP callbacks as a "state"
+	 */
+	struct Larg
+	{
+	  NetconEthernetTap *tap;
+	  Connection *conn;
+	  Larg() : tap(NULL), conn(NULL) {}
+	  Larg(NetconEthernetTap *_tap, Connection *conn) : tap(_tap), conn(conn) {}
+	};
 	
 	/*
-	 * TCP connection
+	 * TCP connection. Allocated from a SlabPool, new returns NULL when out of memory
 	 */
 	struct Connection
 	{
+	  static void *operator new(size_t sz) throw() { return SlabPool<Connection>::shared().get(); }
+	  static void operator delete(void *p) { SlabPool<Connection>::shared().put(p); }
+
 	  bool listening, probation, disabled;
-	  int pid, txsz, rxsz, type;
+	  int pid, type;
 	  PhySocket *rpcSock, *sock;
 	  struct tcp_pcb *TCP_pcb;
 	  struct udp_pcb *UDP_pcb;
-	  struct sockaddr_storage *local_addr; // Address we've bound to locally
-	  struct sockaddr_storage *peer_addr; // Address of connection call to remote host
+	  struct sockaddr_storage local_addr; // Address we've bound to locally, ss_family 0 until then
+	  struct sockaddr_storage peer_addr; // Address of connection call to remote host
 	  unsigned short port;
-	  unsigned char txbuf[DEFAULT_TCP_TX_BUF_SZ];
-	  unsigned char rxbuf[DEFAULT_TCP_RX_BUF_SZ];
+	  RingBuffer txbuf, rxbuf; // Empty until there's data to hold
+	  // Socket options set by the app, zeroed by new Connection()
+	  bool nodelay, keepalive, reuseaddr;
+	  struct linger linger;
+	  int txbuf_sz, rxbuf_sz; // SO_SNDBUF/SO_RCVBUF, 0 means the whole buffer
+
+	  inline int txbufLimit() const { return txbuf_sz ? txbuf_sz : DEFAULT_TCP_TX_BUF_SZ; }
+	  inline int rxbufLimit() const { return rxbuf_sz ? rxbuf_sz : DEFAULT_TCP_RX_BUF_SZ; }
+	  // The service stops reading the app's socket once TXBUF reaches softmax, and starts
+	  // again when the stack has taken it down to softmin. Same fractions of SO_SNDBUF
+	  inline int txbufSoftmax() const { return (int)(txbufLimit() * ((float)DEFAULT_TCP_TX_BUF_SOFTMAX / DEFAULT_TCP_TX_BUF_SZ)); }
+	  inline int txbufSoftmin() const { return (int)(txbufLimit() * ((float)DEFAULT_TCP_TX_BUF_SOFTMIN / DEFAULT_TCP_TX_BUF_SZ)); }
+	  // App ends of connections accepted on this socket that haven't been sent yet
+	  std::vector<int> accepted_fds;
+	  // In-process sockets (zts_direct_*) have no PhySocket. The app reads and writes
+	  // the buffers itself and polls event_fd, signaled whenever there's something new
+	  bool direct, connecting, connected, eof, signaled, tx_blocked;
+	  int event_fd, event_wfd, direct_err; // event_wfd is the pipe's other end where there's no eventfd
+	  std::vector<Connection*> accepted_conns; // Accepted but not yet handed to the app
 	  // TODO: necessary still?
 	  int proxy_conn_state;
 
 	  // pico
 	  struct pico_socket *picosock;
+	  // Which of the tap's picoTCP instances owns picosock. A listener also listens on
+	  // every other shard, listen_picosocks[i] is its socket there (i > 0)
+	  int shard;
+	  std::vector<struct pico_socket*> listen_picosocks;
+	  bool shard_pending, shard_ready; // Already on its PicoShard's pending/ready list
+
+	  // lwIP, the callback arg of this Connection's PCB. Lives and dies with it
+	  Larg larg;
 	};
 
 	/*
-	 * A helper for passing a reference to _phy to LWIP callbacks as a "state"
+	 * Holds the frames a stack sends from this thread while it's in scope and hands them
+	 * to the core in one call when it goes out of scope, see NetconEthernetTap::sendFrame().
+	 * Scopes nest, only the outermost one sends
 	 */
-	struct Larg
+	class FrameBatch
 	{
-	  NetconEthernetTap *tap;
-	  Connection *conn;
-	  Larg(NetconEthernetTap *_tap, Connection *conn) : tap(_tap), conn(conn) {}
+	public:
+		FrameBatch(NetconEthernetTap *tap);
+		~FrameBatch();
+
+	private:
+		bool _outer;
 	};
 
 	/*
@@ -135,6 +184,8 @@ namespace ZeroTier {
 		std::vector<InetAddress> _ips;
 
 		void put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+		// Frames from the stack to the network, held while a FrameBatch is open on the thread
+		void sendFrame(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
 		std::string deviceName() const;
 		void setFriendlyName(const char *friendlyName);
 		void scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed);
@@ -151,6 +202,8 @@ namespace ZeroTier {
 	  	uint64_t _nwid;
 	  	void (*_handler)(void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	 	void *_arg;
+		// Set by OneService when it can take a burst of frames in one call, NULL otherwise
+		void (*_batchHandler)(void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int);
 		Phy<NetconEthernetTap *> _phy;
 		PhySocket *_unixListenSocket;
 		volatile bool _enabled;
@@ -180,10 +233,9 @@ namespace ZeroTier {
 		#endif
 		// picoTCP
         #if defined(SDK_PICOTCP)
-            unsigned char pico_frame_rxbuf[MAX_PICO_FRAME_RX_BUF_SZ];
-            int pico_frame_rxbuf_tot;
-            Mutex _pico_frame_rxbuf_m;
-            picoTCP_stack *picostack;
+            std::vector<PicoShard*> picoshards; // One unless ZT_SDK_STACK_SHARDS says otherwise
+            picoTCP_stack *picostack; // picoshards[0]'s
+            unsigned int next_shard; // Where the next outgoing connection goes
         #endif
 
 		/*
@@ -319,11 +371,94 @@ namespace ZeroTier {
 		 */
 		void handleGetpeername(PhySocket *sock, PhySocket *rpcsock, void **uptr, struct getsockname_st *getsockname_rpc);
 		
+		/*
+		 * Applies a socket option to a Connection and its stack socket, and
+		 * sends the app a return value
+		 */
+		void handleSetsockopt(PhySocket *sock, PhySocket *rpcsock, void **uptr, struct sockopt_st *sockopt_rpc);
+
+		/*
+		 * Sends the app a return value followed by the current value of a socket option
+		 */
+		void handleGetsockopt(PhySocket *sock, PhySocket *rpcsock, void **uptr, struct sockopt_st *sockopt_rpc);
+
 		/* 
 	 	 * Writes data from the application's socket to the LWIP connection
 	 	 */
 		void handleWrite(Connection *conn);
 
+		/*
+		 * Flow control between the app and TXBUF. Paused, the app's socket isn't read, so
+		 * its writes block or fail with EAGAIN once the socketpair fills, the way they
+		 * would against a full kernel send buffer. Resuming waits for TXBUF to drain to
+		 * softmin. Either may be called from a stack thread, the caller holds _tcpconns_m
+		 */
+		void pauseAppWrites(Connection *conn);
+		void resumeAppWrites(Connection *conn);
+
+		/*
+		 * Gives the application the other end of a message-preserving channel for a
+		 * datagram socket. Each message on it is a dgram_hdr plus exactly one datagram
+		 */
+		void openDatagramChannel(PhySocket *rpcSock, Connection *conn);
+
+		/*
+		 * Hands the app end of a newly accepted connection to the listening socket's
+		 * application. Descriptors queue up and go out in batches, see sendAcceptedFds()
+		 */
+		void queueAcceptedFd(Connection *listener, int fd);
+
+		/*
+		 * Sends queued descriptors, SDK_ACCEPT_BATCH per message, until the queue is
+		 * empty or the application's socket is full. The caller holds _tcpconns_m
+		 */
+		void sendAcceptedFds(Connection *listener);
+
+		/*
+		 * In-process socket API for apps linked with the service, see zts_direct_socket().
+		 * Each call works on the Connection directly under the stack's locks, no socketpair,
+		 * RPC or descriptor passing. Sockets are TCP and non-blocking, the handle is an
+		 * eventfd that becomes readable when the socket may have changed state. Calls
+		 * return -1 and set errno on failure, EAGAIN means poll the handle and retry
+		 */
+		int directSocket();
+		int directBind(int handle, const struct sockaddr *addr, socklen_t addrlen);
+		int directListen(int handle, int backlog);
+		int directAccept(int handle);
+		int directConnect(int handle, const struct sockaddr *addr, socklen_t addrlen);
+		ssize_t directSend(int handle, const void *buf, size_t len);
+		ssize_t directRecv(int handle, void *buf, size_t len);
+		int directClose(int handle);
+
+		/*
+		 * Creates a Connection for the in-process API along with its handle. The caller
+		 * holds _tcpconns_m
+		 */
+		Connection *newDirectConnection();
+
+		/*
+		 * Wakes anyone polling a direct Connection's handle. Only the first signal since
+		 * the app last ran out of work costs a system call. The caller holds _tcpconns_m
+		 */
+		void signalDirect(Connection *conn);
+
+		/*
+		 * Closes a direct Connection and whatever it accepted that the app never picked up.
+		 * The caller holds _tcpconns_m
+		 */
+		void closeDirectConnection(Connection *conn);
+
+		/*
+		 * Passes one datagram read from an application's channel to the stack
+		 */
+		void handleDatagram(Connection *conn, void *data, ssize_t len);
+
+		/*
+		 * Sends one datagram received by the stack to the application. Dropped,
+		 * as a full UDP socket buffer would, if the application isn't keeping up
+		 */
+		void sendDatagram(Connection *conn, const struct sockaddr *from, const struct iovec *iov, int iovlen);
+
 		// Unused -- no UDP or TCP from this thread/Phy<>
 		void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *local_address, const struct sockaddr *from,void *data,unsigned long len);
 		void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success);
@@ -359,6 +494,19 @@ namespace ZeroTier {
 	 	 */
 		Connection *getConnection(struct pico_socket *socket);
 
+		/*
+		 * Totals memory held by this tap's Connections: the Connection objects,
+		 * bytes waiting in their buffers, and buffer chunks backing those bytes
+		 */
+		void getMemoryUsage(size_t &connections, size_t &buffered, size_t &allocated);
+
+		/*
+		 * True once this tap holds max_sockets Connections. New sockets fail with EMFILE
+		 * and incoming connections are refused until some close. The caller holds _tcpconns_m
+		 */
+		inline bool socketLimitReached() const { return max_sockets && (int)_Connections.size() >= max_sockets; }
+		volatile int max_sockets; // 0 for no limit, set from ZT_SDK_MAX_SOCKETS or zts_set_max_sockets()
+
 		/*
 	 	 * Closes a TcpConnection, associated LWIP PCB strcuture, 
 	 	 * PhySocket, and underlying file descriptor
@@ -366,6 +514,7 @@ namespace ZeroTier {
 		void closeConnection(PhySocket *sock);
 
 		std::vector<Connection*> _Connections;
+		std::map<int, Connection*> _directConns; // By handle, guarded by _tcpconns_m
 
 		std::map<uint64_t, std::pair<PhySocket*, void*> > jobmap;
 		pid_t rpcCounter;
@@ -0,0 +1,168 @@
+/*
+ * acceptbench4.c - connections accepted per second (IPV4)
+ * usage: acceptbench4 server <port>
+ *        acceptbench4 client <host> <port> [count] [batch]
+ *
+ * The server drives a non-blocking listener from poll() and drains accept()
+ * until EAGAIN on every wakeup, the way event-loop servers do, closing each
+ * connection right away. It prints connections/second and how many it took
+ * per wakeup once a second. The client opens [count] connections, [batch] at a
+ * time with non-blocking connect(), and reports its own rate at the end.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#define MAX_BATCH  1024
+
+/*
+ * error - wrapper for perror
+ */
+void error(char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static int server(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        error("ERROR opening socket");
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on binding");
+    if (listen(sock, 128) < 0)
+        error("ERROR on listen");
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0)
+        error("ERROR setting O_NONBLOCK");
+    printf("accepting on port %d\n", port);
+
+    long accepted = 0, wakeups = 0;
+    double mark = now_us();
+    for (;;) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 1000) < 0)
+            error("ERROR on poll");
+        if (pfd.revents & POLLIN) {
+            wakeups++;
+            for (;;) {
+                /* accept4() hands back a non-blocking socket without another fcntl() */
+                int conn = accept4(sock, NULL, NULL, SOCK_NONBLOCK);
+                if (conn < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+                    if (errno == ECONNABORTED || errno == EINTR)
+                        continue;
+                    error("ERROR on accept");
+                }
+                close(conn);
+                accepted++;
+            }
+        }
+        double t = now_us();
+        if (t - mark >= 1000000.0) {
+            if (accepted)
+                printf("%.0f connections/s  %.1f per wakeup\n", accepted / ((t - mark) / 1000000.0),
+                    wakeups ? (double)accepted / wakeups : 0.0);
+            accepted = wakeups = 0;
+            mark = t;
+        }
+    }
+    return 0;
+}
+
+static int client(const char *hostname, int port, int count, int batch) {
+    struct hostent *server = gethostbyname(hostname);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host as %s\n", hostname);
+        exit(1);
+    }
+    struct sockaddr_in serveraddr;
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    memcpy(&serveraddr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serveraddr.sin_port = htons((unsigned short)port);
+
+    struct pollfd pfds[MAX_BATCH];
+    int done = 0, failed = 0;
+    double start = now_us();
+    while (done < count) {
+        int n = count - done < batch ? count - done : batch;
+        for (int i = 0; i < n; i++) {
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (sock < 0)
+                error("ERROR opening socket");
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+            if (connect(sock, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0 && errno != EINPROGRESS)
+                error("ERROR connecting");
+            pfds[i].fd = sock;
+            pfds[i].events = POLLOUT;
+            pfds[i].revents = 0;
+        }
+        /* Wait for the whole batch to finish connecting */
+        int pending = n;
+        while (pending) {
+            if (poll(pfds, n, 5000) <= 0) {
+                fprintf(stderr, "timed out with %d connections pending\n", pending);
+                exit(1);
+            }
+            for (int i = 0; i < n; i++) {
+                if (pfds[i].fd < 0 || !pfds[i].revents)
+                    continue;
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err)
+                    failed++;
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                pending--;
+            }
+        }
+        done += n;
+    }
+    double elapsed = now_us() - start;
+    printf("%d connections (%d failed) in %.2fs  %.0f connections/s\n",
+        count, failed, elapsed / 1000000.0, count / (elapsed / 1000000.0));
+    return failed != 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "server"))
+        return server(atoi(argv[2]));
+    if (argc >= 4 && !strcmp(argv[1], "client")) {
+        int count = argc > 4 ? atoi(argv[4]) : 10000;
+        int batch = argc > 5 ? atoi(argv[5]) : 64;
+        if (count <= 0 || batch <= 0 || batch > MAX_BATCH) {
+            fprintf(stderr, "count must be > 0 and batch between 1 and %d\n", MAX_BATCH);
+            return 1;
+        }
+        return client(argv[2], atoi(argv[3]), count, batch);
+    }
+    fprintf(stderr,"usage: %s server <port>\n", argv[0]);
+    fprintf(stderr,"       %s client <hostname> <port> [count] [batch]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * interceptbench.c - per-call cost of the intercept on sockets it doesn't own
+ * usage: interceptbench [iterations]
+ *
+ * Times hot socket calls on a kernel socketpair through libc, which the
+ * intercept interposes when it's preloaded, and as raw system calls, which it
+ * doesn't. The intercept hands AF_INET sockets to ZeroTier, so an AF_UNIX pair
+ * stands in for the app's other sockets. Run it natively and with the intercept
+ * loaded, the difference between the two columns is what the intercept adds:
+ *
+ *   ./interceptbench
+ *   LD_PRELOAD=libztintercept.so ./interceptbench
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*
+ * error - wrapper for perror
+ */
+void error(char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static int sock, peer, iterations;
+static char payload[64];
+
+/* Each pair does the same thing through libc and through syscall() */
+static void libc_getsockopt() {
+    int val;
+    socklen_t len = sizeof(val);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &val, &len);
+}
+static void raw_getsockopt() {
+    int val;
+    socklen_t len = sizeof(val);
+    syscall(SYS_getsockopt, sock, SOL_SOCKET, SO_RCVBUF, &val, &len);
+}
+static void libc_setsockopt() {
+    int val = 65536;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+}
+static void raw_setsockopt() {
+    int val = 65536;
+    syscall(SYS_setsockopt, sock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+}
+static void libc_getsockname() {
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    getsockname(sock, (struct sockaddr *)&addr, &len);
+}
+static void raw_getsockname() {
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    syscall(SYS_getsockname, sock, (struct sockaddr *)&addr, &len);
+}
+static void libc_sendrecv() {
+    sendto(sock, payload, sizeof(payload), 0, NULL, 0);
+    recvfrom(peer, payload, sizeof(payload), 0, NULL, NULL);
+}
+static void raw_sendrecv() {
+    syscall(SYS_sendto, sock, payload, sizeof(payload), 0, NULL, 0);
+    syscall(SYS_recvfrom, peer, payload, sizeof(payload), 0, NULL, NULL);
+}
+
+static double per_call_ns(void (*fn)()) {
+    for (int i = 0; i < iterations / 10; i++) /* warm up */
+        fn();
+    double start = now_us();
+    for (int i = 0; i < iterations; i++)
+        fn();
+    return (now_us() - start) * 1000.0 / iterations;
+}
+
+static void bench(const char *name, void (*libc_fn)(), void (*raw_fn)()) {
+    double libc_ns = per_call_ns(libc_fn), raw_ns = per_call_ns(raw_fn);
+    printf("%-14s libc=%8.1fns  raw=%8.1fns  overhead=%8.1fns\n", name, libc_ns, raw_ns, libc_ns - raw_ns);
+}
+
+int main(int argc, char **argv) {
+    iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+        error("ERROR opening socketpair");
+    sock = sv[0];
+    peer = sv[1];
+
+    printf("%d iterations on kernel sockets\n", iterations);
+    bench("getsockopt", libc_getsockopt, raw_getsockopt);
+    bench("setsockopt", libc_setsockopt, raw_setsockopt);
+    bench("getsockname", libc_getsockname, raw_getsockname);
+    bench("sendto+recv", libc_sendrecv, raw_sendrecv);
+    close(sock);
+    close(peer);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * tcpnodelay4.c - request/response latency with Nagle on vs. off (IPV4)
+ * usage: tcpnodelay4 server <port>
+ *        tcpnodelay4 client <host> <port> [count] [size]
+ *
+ * The server answers every request with a reply of the same size. The client
+ * sends each request as a small header write followed by the body, the pattern
+ * that stalls behind Nagle's algorithm and delayed ACKs, and reports round-trip
+ * latency once with TCP_NODELAY off and once with it on. It also checks that
+ * getsockopt() reads back what setsockopt() set.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#define MAX_SIZE  4096
+#define HDR_SIZE  4
+
+/*
+ * error - wrapper for perror
+ */
+void error(char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int read_all(int fd, char *buf, int len) {
+    int got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return got;
+}
+
+static int write_all(int fd, const char *buf, int len) {
+    int sent = 0;
+    while (sent < len) {
+        ssize_t n = write(fd, buf + sent, len - sent);
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    return sent;
+}
+
+static int server(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        error("ERROR opening socket");
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on binding");
+    if (listen(sock, 5) < 0)
+        error("ERROR on listen");
+    printf("answering on port %d\n", port);
+
+    char buf[MAX_SIZE];
+    for (;;) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0)
+            error("ERROR on accept");
+        /* Each request is a 4-byte length, then that many bytes */
+        for (;;) {
+            int size;
+            if (read_all(conn, (char *)&size, HDR_SIZE) < 0)
+                break;
+            if (size < 0 || size > MAX_SIZE || read_all(conn, buf, size) < 0)
+                break;
+            if (write_all(conn, buf, size) < 0)
+                break;
+        }
+        close(conn);
+    }
+    return 0;
+}
+
+static void run(struct sockaddr_in *serveraddr, int nodelay, int count, int size) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        error("ERROR opening socket");
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0)
+        error("ERROR setting TCP_NODELAY");
+    int readback = -1;
+    socklen_t readback_len = sizeof(readback);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &readback, &readback_len) < 0)
+        error("ERROR getting TCP_NODELAY");
+    if (!readback != !nodelay) {
+        fprintf(stderr, "TCP_NODELAY reads back as %d after setting it to %d\n", readback, nodelay);
+        exit(1);
+    }
+    if (connect(sock, (struct sockaddr *)serveraddr, sizeof(*serveraddr)) < 0)
+        error("ERROR connecting");
+
+    char body[MAX_SIZE], reply[MAX_SIZE];
+    memset(body, 'r', size);
+    double *rtt = (double *)malloc(sizeof(double) * count);
+    double start = now_us();
+    for (int i = 0; i < count; i++) {
+        double t0 = now_us();
+        /* Two writes on purpose, a single write would hide Nagle */
+        if (write_all(sock, (const char *)&size, HDR_SIZE) < 0 || write_all(sock, body, size) < 0)
+            error("ERROR writing request");
+        if (read_all(sock, reply, size) < 0)
+            error("ERROR reading reply");
+        rtt[i] = now_us() - t0;
+    }
+    double elapsed = now_us() - start;
+    qsort(rtt, count, sizeof(double), cmp_double);
+    printf("TCP_NODELAY=%d  size=%d count=%d  p50=%.1fus p99=%.1fus  %.0f requests/s\n",
+        nodelay, size, count, rtt[count / 2], rtt[(count * 99) / 100], count / (elapsed / 1000000.0));
+    free(rtt);
+    close(sock);
+}
+
+static int client(const char *hostname, int port, int count, int size) {
+    struct hostent *server = gethostbyname(hostname);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host as %s\n", hostname);
+        exit(1);
+    }
+    struct sockaddr_in serveraddr;
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    memcpy(&serveraddr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serveraddr.sin_port = htons((unsigned short)port);
+    run(&serveraddr, 0, count, size);
+    run(&serveraddr, 1, count, size);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "server"))
+        return server(atoi(argv[2]));
+    if (argc >= 4 && !strcmp(argv[1], "client")) {
+        int count = argc > 4 ? atoi(argv[4]) : 1000;
+        int size = argc > 5 ? atoi(argv[5]) : 100;
+        if (count <= 0 || size <= 0 || size > MAX_SIZE) {
+            fprintf(stderr, "count must be > 0 and size between 1 and %d\n", MAX_SIZE);
+            return 1;
+        }
+        return client(argv[2], atoi(argv[3]), count, size);
+    }
+    fprintf(stderr,"usage: %s server <port>\n", argv[0]);
+    fprintf(stderr,"       %s client <hostname> <port> [count] [size]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,223 @@
+/*
+ * udpbench4.c - DNS-style small-packet UDP benchmark (IPV4)
+ * usage: udpbench4 server <port>
+ *        udpbench4 client <host> <port> [count] [size]
+ *
+ * The server echoes every datagram back to its sender. The client first
+ * measures round-trip latency one query at a time, then fires bursts of
+ * queries (with sendmmsg()/recvmmsg() on Linux) and reports packets/second.
+ * Run it once natively and once with the intercept loaded to compare.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#define MAX_SIZE  2048
+#define BATCH     32
+#define TIMEOUT_MS 1000
+
+/*
+ * error - wrapper for perror
+ */
+void error(char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int server(int port) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        error("ERROR opening socket");
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on binding");
+    printf("echoing on port %d\n", port);
+
+#if defined(__linux__)
+    static char bufs[BATCH][MAX_SIZE];
+    struct mmsghdr msgs[BATCH];
+    struct iovec iovs[BATCH];
+    struct sockaddr_in from[BATCH];
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = MAX_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        int n = recvmmsg(sock, msgs, BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0)
+            error("ERROR in recvmmsg");
+        for (int i = 0; i < n; i++)
+            iovs[i].iov_len = msgs[i].msg_len;
+        if (sendmmsg(sock, msgs, n, 0) < 0)
+            error("ERROR in sendmmsg");
+    }
+#else
+    char buf[MAX_SIZE];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        ssize_t n = recvfrom(sock, buf, MAX_SIZE, 0, (struct sockaddr *)&from, &fromlen);
+        if (n < 0)
+            error("ERROR in recvfrom");
+        if (sendto(sock, buf, n, 0, (struct sockaddr *)&from, fromlen) < 0)
+            error("ERROR in sendto");
+    }
+#endif
+    return 0;
+}
+
+static int client(const char *hostname, int port, int count, int size) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        error("ERROR opening socket");
+    struct hostent *server = gethostbyname(hostname);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host as %s\n", hostname);
+        exit(1);
+    }
+    struct sockaddr_in serveraddr;
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    memcpy(&serveraddr.sin_addr.s_addr, server->h_addr, server->h_length);
+    serveraddr.sin_port = htons((unsigned short)port);
+
+    struct timeval tv;
+    tv.tv_sec = TIMEOUT_MS / 1000;
+    tv.tv_usec = (TIMEOUT_MS % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char query[MAX_SIZE], reply[MAX_SIZE];
+    memset(query, 'q', size);
+
+    /* latency: one query in flight at a time */
+    double *rtt = (double *)malloc(sizeof(double) * count);
+    int answered = 0, lost = 0;
+    double start = now_us();
+    for (int i = 0; i < count; i++) {
+        memcpy(query, &i, sizeof(i));
+        double t0 = now_us();
+        if (sendto(sock, query, size, 0, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) != size)
+            error("ERROR in sendto");
+        for (;;) {
+            ssize_t n = recvfrom(sock, reply, MAX_SIZE, 0, NULL, NULL);
+            if (n < 0) {
+                lost++;
+                break;
+            }
+            int id;
+            memcpy(&id, reply, sizeof(id));
+            if (n == size && id == i) {
+                rtt[answered++] = now_us() - t0;
+                break;
+            }
+        }
+    }
+    double elapsed = now_us() - start;
+    if (answered) {
+        qsort(rtt, answered, sizeof(double), cmp_double);
+        printf("latency  size=%d answered=%d lost=%d  p50=%.1fus p99=%.1fus  %.0f queries/s\n",
+            size, answered, lost, rtt[answered / 2], rtt[(answered * 99) / 100],
+            answered / (elapsed / 1000000.0));
+    }
+    free(rtt);
+
+    /* throughput: bursts of BATCH queries */
+    int sent = 0, received = 0;
+    start = now_us();
+    while (sent < count) {
+        int burst = count - sent < BATCH ? count - sent : BATCH;
+#if defined(__linux__)
+        struct mmsghdr msgs[BATCH];
+        struct iovec iovs[BATCH];
+        static char replies[BATCH][MAX_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < burst; i++) {
+            iovs[i].iov_base = query;
+            iovs[i].iov_len = size;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &serveraddr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(serveraddr);
+        }
+        int n = sendmmsg(sock, msgs, burst, 0);
+        if (n < 0)
+            error("ERROR in sendmmsg");
+        sent += n;
+        int pending = n;
+        while (pending > 0) {
+            memset(msgs, 0, sizeof(msgs));
+            for (int i = 0; i < pending; i++) {
+                iovs[i].iov_base = replies[i];
+                iovs[i].iov_len = MAX_SIZE;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int r = recvmmsg(sock, msgs, pending, MSG_WAITFORONE, NULL);
+            if (r <= 0)
+                break; /* timed out, the rest were lost */
+            received += r;
+            pending -= r;
+        }
+#else
+        for (int i = 0; i < burst; i++) {
+            if (sendto(sock, query, size, 0, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) == size)
+                sent++;
+        }
+        for (int i = 0; i < burst; i++) {
+            if (recvfrom(sock, reply, MAX_SIZE, 0, NULL, NULL) < 0)
+                break;
+            received++;
+        }
+#endif
+    }
+    elapsed = now_us() - start;
+    printf("burst    size=%d sent=%d received=%d  %.0f packets/s\n",
+        size, sent, received, (sent + received) / (elapsed / 1000000.0));
+    close(sock);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "server"))
+        return server(atoi(argv[2]));
+    if (argc >= 4 && !strcmp(argv[1], "client")) {
+        int count = argc > 4 ? atoi(argv[4]) : 10000;
+        int size = argc > 5 ? atoi(argv[5]) : 64; /* a typical DNS query */
+        if (count <= 0 || size < (int)sizeof(int) || size > MAX_SIZE) {
+            fprintf(stderr, "count must be > 0 and size between %d and %d\n", (int)sizeof(int), MAX_SIZE);
+            return 1;
+        }
+        return client(argv[2], atoi(argv[3]), count, size);
+    }
+    fprintf(stderr,"usage: %s server <port>\n", argv[0]);
+    fprintf(stderr,"       %s client <hostname> <port> [count] [size]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,187 @@
+// Multi-connection bulk throughput benchmark (IPV4)
+//
+// The client opens <conns> TCP connections and streams data over all of them at
+// once for <seconds>, the server drains them and prints the aggregate rate once a
+// second. Run both sides with ZT_SDK_STACK_SHARDS set to the number of picoTCP
+// instances each tap should spread its connections over and compare the totals:
+//
+//   ZT_SDK_STACK_SHARDS=1 ./bulkconns client 10.9.9.1 8000 ./zt1 <nwid> 16
+//   ZT_SDK_STACK_SHARDS=4 ./bulkconns client 10.9.9.1 8000 ./zt1 <nwid> 16
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdlib>
+
+#include "sdk.h"
+
+#define DEFAULT_CONNS    16
+#define DEFAULT_SECONDS  10
+#define MAX_CONNS        1024
+#define CHUNK_SZ         65536
+
+static volatile long long total_bytes;
+static volatile bool running = true;
+static pthread_mutex_t total_m = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static void add_bytes(long long n)
+{
+    pthread_mutex_lock(&total_m);
+    total_bytes += n;
+    pthread_mutex_unlock(&total_m);
+}
+
+static long long take_bytes()
+{
+    pthread_mutex_lock(&total_m);
+    long long n = total_bytes;
+    total_bytes = 0;
+    pthread_mutex_unlock(&total_m);
+    return n;
+}
+
+// Server: one thread per connection reading until the client closes it
+static void *sink(void *arg)
+{
+    int fd = (int)(long)arg;
+    char buf[CHUNK_SZ];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        add_bytes(n);
+    close(fd);
+    return NULL;
+}
+
+static void *reporter(void *arg)
+{
+    double mark = now_us();
+    while(running) {
+        sleep(1);
+        double t = now_us();
+        long long n = take_bytes();
+        if(n)
+            printf("%.1f MB/s\n", n / ((t - mark) / 1000000.0) / (1024 * 1024));
+        mark = t;
+    }
+    return NULL;
+}
+
+static int server(int port)
+{
+    int sock = zts_socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(sock < 0 || zts_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || zts_listen(sock, 128) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    pthread_t t;
+    pthread_create(&t, NULL, reporter, NULL);
+    printf("receiving on port %d\n", port);
+    for(;;) {
+        int fd = zts_accept(sock, NULL, NULL);
+        if(fd < 0)
+            continue;
+        pthread_create(&t, NULL, sink, (void *)(long)fd);
+        pthread_detach(t);
+    }
+    return 0;
+}
+
+// Client: one thread per connection writing until time's up
+static void *source(void *arg)
+{
+    int fd = (int)(long)arg;
+    char buf[CHUNK_SZ];
+    memset(buf, 'z', sizeof(buf));
+    while(running) {
+        ssize_t n = write(fd, buf, sizeof(buf));
+        if(n <= 0) {
+            perror("write");
+            break;
+        }
+        add_bytes(n);
+    }
+    close(fd);
+    return NULL;
+}
+
+static int client(const char *addr, int port, int conns, int seconds)
+{
+    struct sockaddr_in server;
+    pthread_t threads[MAX_CONNS];
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(addr);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    int fds[MAX_CONNS];
+    for(int i=0; i<conns; i++) {
+        if((fds[i] = zts_socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || zts_connect(fds[i], (struct sockaddr *)&server, sizeof(server)) < 0) {
+            perror("connect");
+            return 1;
+        }
+    }
+    printf("sending over %d connections to %s:%d for %ds\n", conns, addr, port, seconds);
+    double start = now_us();
+    for(int i=0; i<conns; i++)
+        pthread_create(&threads[i], NULL, source, (void *)(long)fds[i]);
+    long long sent = 0;
+    for(int s=0; s<seconds; s++) {
+        sleep(1);
+        long long n = take_bytes();
+        sent += n;
+        printf("%.1f MB/s\n", n / (1024.0 * 1024.0));
+    }
+    running = false;
+    for(int i=0; i<conns; i++)
+        pthread_join(threads[i], NULL);
+    sent += take_bytes();
+    double elapsed = (now_us() - start) / 1000000.0;
+    printf("%d connections: %.1f MB in %.2fs  %.1f MB/s\n", conns, sent / (1024.0 * 1024.0),
+        elapsed, sent / elapsed / (1024 * 1024));
+    return 0;
+}
+
+int main(int argc , char *argv[])
+{
+    bool is_server = argc >= 5 && !strcmp(argv[1], "server");
+    bool is_client = argc >= 6 && !strcmp(argv[1], "client");
+    if(!is_server && !is_client) {
+        printf("usage: bulkconns server <port> <netpath> <nwid>\n");
+        printf("       bulkconns client <addr> <port> <netpath> <nwid> [conns] [seconds]\n");
+        return 1;
+    }
+    int argi = is_server ? 2 : 3;
+    const char *netpath = argv[argi+1], *nwid = argv[argi+2];
+    int port = atoi(argv[argi]);
+    int conns = argc > argi+3 ? atoi(argv[argi+3]) : DEFAULT_CONNS;
+    int seconds = argc > argi+4 ? atoi(argv[argi+4]) : DEFAULT_SECONDS;
+    if(conns <= 0 || conns > MAX_CONNS || seconds <= 0) {
+        printf("conns must be between 1 and %d and seconds > 0\n", MAX_CONNS);
+        return 1;
+    }
+
+    /* Starts ZeroTier core service in separate thread, loads user-space TCP/IP stack
+    and sets up a private AF_UNIX socket between ZeroTier library and your app. The
+    service reads ZT_SDK_STACK_SHARDS when it creates the network's tap */
+    zts_init_rpc(netpath, nwid);
+    while(!zts_has_address(nwid))
+        sleep(1);
+
+    return is_server ? server(port) : client(argv[2], port, conns, seconds);
+}
@@ -0,0 +1,137 @@
+// Connection churn benchmark (IPV4)
+//
+// The client opens a TCP connection, closes it and opens the next one as fast as
+// it can for <seconds>, printing connections per second and what the tap holds for
+// them once a second. The server accepts and closes. A steady "slots" figure means
+// the Connection slab pool is being reused rather than growing. Set
+// ZT_SDK_MAX_SOCKETS on the server to watch connections get refused past the cap:
+//
+//   ./churn server 8000 ./zt2 <nwid>
+//   ./churn client 10.9.9.1 8000 ./zt1 <nwid> 10
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdlib>
+
+#include "sdk.h"
+
+#define DEFAULT_SECONDS  10
+
+static volatile long conns, failures;
+static volatile bool running = true;
+static const char *nwid;
+
+static void *reporter(void *arg)
+{
+    struct zts_memory_usage usage;
+    while(running) {
+        sleep(1);
+        long n = __sync_lock_test_and_set(&conns, 0);
+        long f = __sync_lock_test_and_set(&failures, 0);
+        if(zts_get_memory_usage(nwid, &usage) < 0)
+            memset(&usage, 0, sizeof(usage));
+        printf("%ld conn/s  %ld failed  open=%zu  slots=%zu  allocated=%zu\n",
+            n, f, usage.connections, usage.slots, usage.allocated);
+    }
+    return NULL;
+}
+
+static int server(int port)
+{
+    int sock = zts_socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(sock < 0 || zts_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || zts_listen(sock, 128) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    pthread_t t;
+    pthread_create(&t, NULL, reporter, NULL);
+    printf("accepting on port %d\n", port);
+    for(;;) {
+        int fd = zts_accept(sock, NULL, NULL);
+        if(fd < 0) {
+            __sync_fetch_and_add(&failures, 1);
+            continue;
+        }
+        close(fd);
+        __sync_fetch_and_add(&conns, 1);
+    }
+    return 0;
+}
+
+static int client(const char *addr, int port, int seconds)
+{
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(addr);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    pthread_t t;
+    pthread_create(&t, NULL, reporter, NULL);
+    printf("churning connections to %s:%d for %ds\n", addr, port, seconds);
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    long total = 0;
+    for(;;) {
+        gettimeofday(&now, NULL);
+        if(now.tv_sec - start.tv_sec >= seconds)
+            break;
+        int fd = zts_socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) {
+            // EMFILE past ZT_SDK_MAX_SOCKETS, ENOBUFS when the service is out of memory
+            perror("socket");
+            __sync_fetch_and_add(&failures, 1);
+            usleep(10000);
+            continue;
+        }
+        if(zts_connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0)
+            __sync_fetch_and_add(&failures, 1);
+        else {
+            __sync_fetch_and_add(&conns, 1);
+            total++;
+        }
+        close(fd);
+    }
+    running = false;
+    pthread_join(t, NULL);
+    printf("%ld connections in %ds  %.1f conn/s\n", total, seconds, (double)total / seconds);
+    return 0;
+}
+
+int main(int argc , char *argv[])
+{
+    bool is_server = argc >= 5 && !strcmp(argv[1], "server");
+    bool is_client = argc >= 6 && !strcmp(argv[1], "client");
+    if(!is_server && !is_client) {
+        printf("usage: churn server <port> <netpath> <nwid>\n");
+        printf("       churn client <addr> <port> <netpath> <nwid> [seconds]\n");
+        return 1;
+    }
+    int argi = is_server ? 2 : 3;
+    const char *netpath = argv[argi+1];
+    nwid = argv[argi+2];
+    int port = atoi(argv[argi]);
+    int seconds = argc > argi+3 ? atoi(argv[argi+3]) : DEFAULT_SECONDS;
+    if(seconds <= 0) {
+        printf("seconds must be > 0\n");
+        return 1;
+    }
+
+    /* Starts ZeroTier core service in separate thread, loads user-space TCP/IP stack
+    and sets up a private AF_UNIX socket between ZeroTier library and your app. The
+    service reads ZT_SDK_MAX_SOCKETS when it creates the network's tap */
+    zts_init_rpc(netpath, nwid);
+    while(!zts_has_address(nwid))
+        sleep(1);
+
+    return is_server ? server(port) : client(argv[2], port, seconds);
+}
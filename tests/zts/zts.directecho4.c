@@ -0,0 +1,247 @@
+// In-process socket API echo benchmark (IPV4)
+//
+// Measures request/response round trips through the regular socket API, where
+// every socket is one end of a socketpair with the service, and through the
+// zts_direct_* calls, which go to the stack without one. Run the server on one
+// node and the client on another. The server echoes on <port> through zts_socket()
+// and on <port>+1 through zts_direct_socket(), the client times both
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdlib>
+
+#include "sdk.h"
+
+#define DEFAULT_COUNT  10000
+#define DEFAULT_SIZE   64
+#define MAX_SIZE       65536
+#define MAX_CONNS      64
+
+static double now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+// Waits until the handle is signaled, the call that returned EAGAIN can be retried
+static void direct_wait(int handle)
+{
+    struct pollfd pfd;
+    pfd.fd = handle;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 1000);
+}
+
+// Socket path: one thread per connection echoing whatever arrives
+static void *socket_echo(void *arg)
+{
+    int fd = (int)(long)arg;
+    char buf[MAX_SIZE];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t w = 0, r; w < n; w += r) {
+            if((r = write(fd, buf + w, n - w)) <= 0)
+                break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *socket_server(void *arg)
+{
+    int port = (int)(long)arg;
+    int sock = zts_socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(sock < 0 || zts_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || zts_listen(sock, 16) < 0) {
+        perror("socket server");
+        exit(1);
+    }
+    for(;;) {
+        int fd = zts_accept(sock, NULL, NULL);
+        if(fd < 0)
+            continue;
+        pthread_t t;
+        pthread_create(&t, NULL, socket_echo, (void *)(long)fd);
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+// Direct path: a single poll() loop over the listener and every connection
+static int direct_server(const char *nwid, int port)
+{
+    struct pollfd pfds[MAX_CONNS + 1];
+    int nconns = 0;
+    char buf[MAX_SIZE];
+    int listener = zts_direct_socket(nwid);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(listener < 0 || zts_direct_bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || zts_direct_listen(listener, 16) < 0) {
+        perror("direct server");
+        return 1;
+    }
+    pfds[0].fd = listener;
+    pfds[0].events = POLLIN;
+    for(;;) {
+        poll(pfds, nconns + 1, 1000);
+        int h;
+        while(nconns < MAX_CONNS && (h = zts_direct_accept(listener)) >= 0) {
+            pfds[++nconns].fd = h;
+            pfds[nconns].events = POLLIN;
+        }
+        for(int i = 1; i <= nconns; i++) {
+            ssize_t n;
+            bool closed = false;
+            while((n = zts_direct_recv(pfds[i].fd, buf, sizeof(buf))) > 0) {
+                for(ssize_t w = 0, r; w < n; w += r > 0 ? r : 0) {
+                    if((r = zts_direct_send(pfds[i].fd, buf + w, n - w)) < 0) {
+                        if(errno != EAGAIN) {
+                            closed = true;
+                            break;
+                        }
+                        direct_wait(pfds[i].fd);
+                    }
+                }
+            }
+            if(closed || n == 0 || errno != EAGAIN) {
+                zts_direct_close(pfds[i].fd);
+                pfds[i--] = pfds[nconns--];
+            }
+        }
+    }
+    return 0;
+}
+
+static void report(const char *path, int count, int size, double elapsed)
+{
+    printf("%-7s %d round trips of %d bytes in %.2fs  %.0f/s  %.1fus each\n",
+        path, count, size, elapsed / 1000000.0, count / (elapsed / 1000000.0), elapsed / count);
+}
+
+static int socket_client(struct sockaddr_in *server, int count, int size)
+{
+    char buf[MAX_SIZE];
+    int fd = zts_socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0 || zts_connect(fd, (struct sockaddr *)server, sizeof(*server)) < 0) {
+        perror("socket connect");
+        return 1;
+    }
+    memset(buf, 'z', size);
+    double start = now_us();
+    for(int i = 0; i < count; i++) {
+        if(write(fd, buf, size) != size) {
+            perror("write");
+            return 1;
+        }
+        for(int got = 0, n; got < size; got += n) {
+            if((n = read(fd, buf + got, size - got)) <= 0) {
+                perror("read");
+                return 1;
+            }
+        }
+    }
+    report("socket", count, size, now_us() - start);
+    close(fd);
+    return 0;
+}
+
+static int direct_client(const char *nwid, struct sockaddr_in *server, int count, int size)
+{
+    char buf[MAX_SIZE];
+    int h = zts_direct_socket(nwid);
+    if(h < 0) {
+        perror("direct socket");
+        return 1;
+    }
+    while(zts_direct_connect(h, (struct sockaddr *)server, sizeof(*server)) < 0) {
+        if(errno != EINPROGRESS && errno != EALREADY) {
+            perror("direct connect");
+            return 1;
+        }
+        direct_wait(h);
+    }
+    memset(buf, 'z', size);
+    double start = now_us();
+    for(int i = 0; i < count; i++) {
+        for(int sent = 0, n; sent < size; sent += n > 0 ? n : 0) {
+            if((n = zts_direct_send(h, buf + sent, size - sent)) < 0) {
+                if(errno != EAGAIN) {
+                    perror("direct send");
+                    return 1;
+                }
+                direct_wait(h);
+            }
+        }
+        for(int got = 0, n; got < size; got += n > 0 ? n : 0) {
+            if((n = zts_direct_recv(h, buf + got, size - got)) <= 0) {
+                if(n == 0 || errno != EAGAIN) {
+                    perror("direct recv");
+                    return 1;
+                }
+                direct_wait(h);
+            }
+        }
+    }
+    report("direct", count, size, now_us() - start);
+    zts_direct_close(h);
+    return 0;
+}
+
+int main(int argc , char *argv[])
+{
+    bool is_server = argc >= 5 && !strcmp(argv[1], "server");
+    bool is_client = argc >= 6 && !strcmp(argv[1], "client");
+    if(!is_server && !is_client) {
+        printf("usage: directecho server <port> <netpath> <nwid>\n");
+        printf("       directecho client <addr> <port> <netpath> <nwid> [count] [size]\n");
+        return 1;
+    }
+    int argi = is_server ? 2 : 3;
+    const char *netpath = argv[argi+1], *nwid = argv[argi+2];
+    int port = atoi(argv[argi]);
+    int count = argc > argi+3 ? atoi(argv[argi+3]) : DEFAULT_COUNT;
+    int size = argc > argi+4 ? atoi(argv[argi+4]) : DEFAULT_SIZE;
+    if(count <= 0 || size <= 0 || size > MAX_SIZE) {
+        printf("count must be > 0 and size between 1 and %d\n", MAX_SIZE);
+        return 1;
+    }
+
+    /* Starts ZeroTier core service in separate thread, loads user-space TCP/IP stack
+    and sets up a private AF_UNIX socket between ZeroTier library and your app. The
+    zts_direct_* calls need the service in this process */
+    zts_init_rpc(netpath, nwid);
+    while(!zts_has_address(nwid))
+        sleep(1);
+
+    if(is_server) {
+        pthread_t t;
+        pthread_create(&t, NULL, socket_server, (void *)(long)port);
+        printf("echoing on port %d (socket) and %d (direct)\n", port, port+1);
+        return direct_server(nwid, port+1);
+    }
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(argv[2]);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    if(socket_client(&server, count, size))
+        return 1;
+    server.sin_port = htons(port+1);
+    return direct_client(nwid, &server, count, size);
+}
@@ -0,0 +1,140 @@
+// Idle connection memory test program (IPV4)
+//
+// Opens <count> TCP connections that never carry data and reports how much
+// memory the service holds for them. Run the server on one node and the client
+// on another, each side checks its own numbers. An idle connection should cost
+// its Connection object and nothing else, fails if it holds a buffer chunk
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cstdlib>
+
+#include "sdk.h"
+#include "defs.h"
+
+#define DEFAULT_COUNT  10000
+#define REPORT_EVERY   1000
+
+static int *socks;
+
+static void raise_fd_limit(int count)
+{
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)count * 2 + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            perror("setrlimit");
+        if(rl.rlim_cur < (rlim_t)count * 2 + 64)
+            printf("warning: only %lu descriptors available, run as root or raise the hard limit\n", (unsigned long)rl.rlim_cur);
+    }
+}
+
+// Prints usage for nwid, returns 1 when idle connections are holding buffer chunks
+static int report(const char *nwid, int open)
+{
+    struct zts_memory_usage usage;
+    if(zts_get_memory_usage(nwid, &usage) < 0) {
+        printf("unable to get memory usage for %s\n", nwid);
+        return 1;
+    }
+    size_t per_conn = usage.connections ? usage.allocated / usage.connections : 0;
+    printf("open=%d connections=%lu buffered=%lu allocated=%lu pooled=%lu  %lu bytes/connection\n",
+        open, (unsigned long)usage.connections, (unsigned long)usage.buffered, (unsigned long)usage.allocated,
+        (unsigned long)usage.pooled, (unsigned long)per_conn);
+    return per_conn >= SDK_BUF_CHUNK_SZ;
+}
+
+static int server(int port, const char *nwid, int count)
+{
+    int sock = zts_socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(port);
+    if(zts_bind(sock, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0 || zts_listen(sock, 128) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    printf("holding %d connections on port %d\n", count, port);
+    int failed = 0;
+    for(int i=0; i<count; i++) {
+        if((socks[i] = zts_accept(sock, NULL, NULL)) < 0) {
+            perror("accept");
+            return 1;
+        }
+        if((i+1) % REPORT_EVERY == 0)
+            failed |= report(nwid, i+1);
+    }
+    failed |= report(nwid, count);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    for(int i=0; i<count; i++)
+        close(socks[i]);
+    close(sock);
+    return failed;
+}
+
+static int client(const char *addr, int port, const char *nwid, int count)
+{
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(addr);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    printf("opening %d connections to %s:%d\n", count, addr, port);
+    int failed = 0;
+    for(int i=0; i<count; i++) {
+        if((socks[i] = zts_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+            perror("socket");
+            return 1;
+        }
+        if(zts_connect(socks[i], (struct sockaddr *)&server, sizeof(server)) < 0) {
+            perror("connect");
+            return 1;
+        }
+        if((i+1) % REPORT_EVERY == 0)
+            failed |= report(nwid, i+1);
+    }
+    // Let the handshakes settle, then check again with everything idle
+    sleep(5);
+    failed |= report(nwid, count);
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    for(int i=0; i<count; i++)
+        close(socks[i]);
+    return failed;
+}
+
+int main(int argc , char *argv[])
+{
+    bool is_server = argc >= 5 && !strcmp(argv[1], "server");
+    bool is_client = argc >= 6 && !strcmp(argv[1], "client");
+    if(!is_server && !is_client) {
+        printf("usage: idleconns server <port> <netpath> <nwid> [count]\n");
+        printf("       idleconns client <addr> <port> <netpath> <nwid> [count]\n");
+        return 1;
+    }
+    int argi = is_server ? 2 : 3;
+    const char *netpath = argv[argi+1], *nwid = argv[argi+2];
+    int count = argc > argi+3 ? atoi(argv[argi+3]) : DEFAULT_COUNT;
+    if(count <= 0) {
+        printf("count must be > 0\n");
+        return 1;
+    }
+    raise_fd_limit(count);
+    socks = (int *)malloc(sizeof(int) * count);
+
+    /* Starts ZeroTier core service in separate thread, loads user-space TCP/IP stack
+    and sets up a private AF_UNIX socket between ZeroTier library and your app. The
+    service runs in this process, so zts_get_memory_usage() sees its Connections */
+    zts_init_rpc(netpath, nwid);
+
+    int port = atoi(argv[argi]);
+    return is_server ? server(port, nwid, count) : client(argv[2], port, nwid, count);
+}
@@ -0,0 +1,227 @@
+// Request/response latency benchmark (IPV4), after redis-benchmark
+//
+// Both sides are single-threaded poll() loops over non-blocking sockets, the way
+// event-loop servers drive them. The client keeps one <size>-byte request in flight
+// on each of <conns> connections until <requests> have been answered, then prints
+// throughput and latency percentiles. The server echoes every request back. Stalls
+// show up in the tail, a socket poll() said was ready that wasn't costs a spin:
+//
+//   ./latency server 8000 ./zt2 <nwid>
+//   ./latency client 10.9.9.1 8000 ./zt1 <nwid> 50 100000 64
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <cstdlib>
+#include <algorithm>
+
+#include "sdk.h"
+
+#define DEFAULT_CONNS     50
+#define DEFAULT_REQUESTS  100000
+#define DEFAULT_SIZE      64
+#define MAX_CONNS         1024
+#define MAX_SIZE          65536
+
+static double now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Server: echoes whatever arrives, holding what the client isn't reading yet
+struct echo_conn {
+    char buf[MAX_SIZE];
+    int len;
+};
+
+static int server(int port)
+{
+    int sock = zts_socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(sock < 0 || zts_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || zts_listen(sock, 128) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    set_nonblocking(sock);
+    printf("echoing on port %d\n", port);
+    static struct pollfd pfds[MAX_CONNS+1];
+    static struct echo_conn conns[MAX_CONNS+1];
+    int n = 1;
+    pfds[0].fd = sock;
+    pfds[0].events = POLLIN;
+    for(;;) {
+        if(poll(pfds, n, -1) < 0)
+            continue;
+        if(pfds[0].revents & POLLIN) {
+            int fd;
+            while(n <= MAX_CONNS && (fd = zts_accept(sock, NULL, NULL)) >= 0) {
+                set_nonblocking(fd);
+                pfds[n].fd = fd;
+                pfds[n].events = POLLIN;
+                conns[n].len = 0;
+                n++;
+            }
+        }
+        for(int i=1; i<n; i++) {
+            struct echo_conn *c = &conns[i];
+            bool closed = pfds[i].revents & (POLLHUP | POLLERR);
+            if(pfds[i].revents & POLLIN && c->len < MAX_SIZE) {
+                ssize_t r = read(pfds[i].fd, c->buf + c->len, MAX_SIZE - c->len);
+                if(r > 0)
+                    c->len += r;
+                else if(r == 0 || errno != EAGAIN)
+                    closed = true;
+            }
+            if(c->len) {
+                ssize_t w = write(pfds[i].fd, c->buf, c->len);
+                if(w > 0) {
+                    memmove(c->buf, c->buf + w, c->len - w);
+                    c->len -= w;
+                }
+            }
+            // Only ask to hear about writability while there's something to write
+            pfds[i].events = c->len ? POLLOUT : POLLIN;
+            if(closed) {
+                close(pfds[i].fd);
+                pfds[i] = pfds[n-1];
+                conns[i] = conns[n-1];
+                n--;
+                i--;
+            }
+        }
+    }
+    return 0;
+}
+
+// Client: one request in flight per connection
+struct req_conn {
+    int fd, sent, received;
+    double start;
+};
+
+static int client(const char *addr, int port, int nconns, int requests, int size)
+{
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(addr);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    static struct pollfd pfds[MAX_CONNS];
+    static struct req_conn conns[MAX_CONNS];
+    static char req[MAX_SIZE], resp[MAX_SIZE];
+    double *lat = (double *)malloc(sizeof(double) * requests);
+    memset(req, 'z', sizeof(req));
+    for(int i=0; i<nconns; i++) {
+        if((conns[i].fd = zts_socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || zts_connect(conns[i].fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+            perror("connect");
+            return 1;
+        }
+        set_nonblocking(conns[i].fd);
+        pfds[i].fd = conns[i].fd;
+        pfds[i].events = POLLOUT;
+        conns[i].sent = conns[i].received = 0;
+        conns[i].start = 0;
+    }
+    printf("%d requests of %d bytes over %d connections to %s:%d\n", requests, size, nconns, addr, port);
+    int issued = 0, done = 0;
+    long spins = 0;
+    double start = now_us();
+    while(done < requests) {
+        if(poll(pfds, nconns, 1000) <= 0)
+            continue;
+        for(int i=0; i<nconns; i++) {
+            struct req_conn *c = &conns[i];
+            if(!pfds[i].revents)
+                continue;
+            bool progress = false;
+            if(pfds[i].revents & POLLOUT && c->sent < size) {
+                if(!c->sent) {
+                    if(issued == requests) {
+                        pfds[i].events = 0;
+                        continue;
+                    }
+                    issued++;
+                    c->start = now_us();
+                }
+                ssize_t w = write(c->fd, req + c->sent, size - c->sent);
+                if(w > 0) {
+                    c->sent += w;
+                    progress = true;
+                }
+            }
+            if(pfds[i].revents & POLLIN) {
+                ssize_t r = read(c->fd, resp, size - c->received);
+                if(r > 0) {
+                    c->received += r;
+                    progress = true;
+                } else if(r == 0) {
+                    printf("server closed connection\n");
+                    return 1;
+                }
+            }
+            if(!progress)
+                spins++;
+            if(c->received == size) {
+                lat[done++] = now_us() - c->start;
+                c->sent = c->received = 0;
+            }
+            pfds[i].events = c->sent < size ? POLLOUT : POLLIN;
+        }
+    }
+    double elapsed = (now_us() - start) / 1000000.0;
+    std::sort(lat, lat + done);
+    printf("%d requests in %.2fs  %.0f requests/s  %ld empty wakeups\n", done, elapsed, done / elapsed, spins);
+    printf("latency (ms)  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+        lat[done / 2] / 1000.0, lat[done * 90 / 100] / 1000.0, lat[done * 99 / 100] / 1000.0,
+        lat[done * 999 / 1000] / 1000.0, lat[done - 1] / 1000.0);
+    for(int i=0; i<nconns; i++)
+        close(conns[i].fd);
+    free(lat);
+    return 0;
+}
+
+int main(int argc , char *argv[])
+{
+    bool is_server = argc >= 5 && !strcmp(argv[1], "server");
+    bool is_client = argc >= 6 && !strcmp(argv[1], "client");
+    if(!is_server && !is_client) {
+        printf("usage: latency server <port> <netpath> <nwid>\n");
+        printf("       latency client <addr> <port> <netpath> <nwid> [conns] [requests] [size]\n");
+        return 1;
+    }
+    int argi = is_server ? 2 : 3;
+    const char *netpath = argv[argi+1], *nwid = argv[argi+2];
+    int port = atoi(argv[argi]);
+    int conns = argc > argi+3 ? atoi(argv[argi+3]) : DEFAULT_CONNS;
+    int requests = argc > argi+4 ? atoi(argv[argi+4]) : DEFAULT_REQUESTS;
+    int size = argc > argi+5 ? atoi(argv[argi+5]) : DEFAULT_SIZE;
+    if(conns <= 0 || conns > MAX_CONNS || requests <= 0 || size <= 0 || size > MAX_SIZE) {
+        printf("conns must be between 1 and %d, requests > 0 and size between 1 and %d\n", MAX_CONNS, MAX_SIZE);
+        return 1;
+    }
+
+    /* Starts ZeroTier core service in separate thread, loads user-space TCP/IP stack
+    and sets up a private AF_UNIX socket between ZeroTier library and your app */
+    zts_init_rpc(netpath, nwid);
+    while(!zts_has_address(nwid))
+        sleep(1);
+
+    return is_server ? server(port) : client(argv[2], port, conns, requests, size);
+}
@@ -43,6 +43,7 @@
 #include "../node/CertificateOfMembership.hpp"
 #include "../node/NetworkConfig.hpp"
 #include "../node/Dictionary.hpp"
+#include "../node/Buffer.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/MAC.hpp"
 #include "../node/Address.hpp"
@@ -431,9 +432,37 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 	return false;
 }
 
-EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath) :
+// Returns a serialized network config without its timestamp so a cached copy can be re-stamped
+static std::string _configWithoutTimestamp(const char *d)
+{
+	std::string r;
+	const unsigned int kl = (unsigned int)strlen(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP);
+	while (*d) {
+		const char *eol = d;
+		while ((*eol)&&(*eol != '\n')&&(*eol != '\r'))
+			++eol;
+		if ((eol != d)&&(!((!strncmp(d,ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,kl))&&(d[kl] == '=')))) {
+			r.append(d,eol - d);
+			r.push_back('\n');
+		}
+		d = (*eol) ? (eol + 1) : eol;
+	}
+	return r;
+}
+
+static bool _addConfigCom(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const CertificateOfMembership &com)
+{
+	Buffer<4096> tmp;
+	com.serialize(tmp);
+	return d.add(ZT_NETWORKCONFIG_DICT_KEY_COM,tmp);
+}
+
+EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath,unsigned long dbFlushInterval,bool dbLogStructured) :
+	_threadCount(ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT),
 	_threadsStarted(false),
-	_db(dbPath),
+	_configCacheHits(0),
+	_configCacheMisses(0),
+	_db(dbPath,dbFlushInterval,dbLogStructured),
 	_node(node)
 {
 	OSUtils::mkdir(dbPath);
@@ -444,9 +473,9 @@ EmbeddedNetworkController::~EmbeddedNetworkController()
 {
 	Mutex::Lock _l(_threads_m);
 	if (_threadsStarted) {
-		for(int i=0;i<(ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT*2);++i)
+		for(unsigned long i=0;i<(_threads.size()*2);++i)
 			_queue.post((_RQEntry *)0);
-		for(int i=0;i<ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT;++i)
+		for(unsigned long i=0;i<_threads.size();++i)
 			Thread::join(_threads[i]);
 	}
 }
@@ -470,7 +499,8 @@ void EmbeddedNetworkController::request(
 	{
 		Mutex::Lock _l(_threads_m);
 		if (!_threadsStarted) {
-			for(int i=0;i<ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT;++i)
+			_threads.resize(_threadCount); // Thread copies don't own a pthread_attr_t, so assign into default constructed ones
+			for(unsigned int i=0;i<_threadCount;++i)
 				_threads[i] = Thread::start(this);
 		}
 		_threadsStarted = true;
@@ -500,11 +530,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 			char nwids[24];
 			Utils::snprintf(nwids,sizeof(nwids),"%.16llx",(unsigned long long)nwid);
 
-			json network;
-			{
-				Mutex::Lock _l(_db_m);
-				network = _db.get("network",nwids,ZT_NETCONF_DB_CACHE_TTL);
-			}
+			json network(_dbGetNetwork(nwids));
 			if (!network.size())
 				return 404;
 
@@ -515,11 +541,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 					if (path.size() >= 4) {
 						const uint64_t address = Utils::hexStrToU64(path[3].c_str());
 
-						json member;
-						{
-							Mutex::Lock _l(_db_m);
-							member = _db.get("network",nwids,"member",Address(address).toString(),ZT_NETCONF_DB_CACHE_TTL);
-						}
+						json member(_dbGetMember(nwids,Address(address)));
 						if (!member.size())
 							return 404;
 
@@ -530,7 +552,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 						return 200;
 					} else {
 
-						Mutex::Lock _l(_db_m);
+						RWMutex::WriteLock _l(_db_m);
 
 						responseBody = "{";
 						std::string pfx(std::string("network/") + nwids + "member/");
@@ -554,9 +576,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 			} else {
 
 				const uint64_t now = OSUtils::now();
-				_NetworkMemberInfo nmi;
-				_getNetworkMemberInfo(now,nwid,nmi);
-				_addNetworkNonPersistedFields(network,now,nmi);
+				_addNetworkNonPersistedFields(network,now,*_getNetworkMemberInfo(now,nwid));
 				responseBody = OSUtils::jsonDump(network);
 				responseContentType = "application/json";
 				return 200;
@@ -566,7 +586,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 
 			std::set<std::string> networkIds;
 			{
-				Mutex::Lock _l(_db_m);
+				RWMutex::WriteLock _l(_db_m);
 				_db.filter("network/",120000,[&networkIds](const std::string &n,const json &obj) {
 					if (n.length() == (16 + 8))
 						networkIds.insert(n.substr(8));
@@ -639,11 +659,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					char addrs[24];
 					Utils::snprintf(addrs,sizeof(addrs),"%.10llx",(unsigned long long)address);
 
-					json member;
-					{
-						Mutex::Lock _l(_db_m);
-						member = _db.get("network",nwids,"member",Address(address).toString(),ZT_NETCONF_DB_CACHE_TTL);
-					}
+					json member(_dbGetMember(nwids,Address(address)));
 					json origMember(member); // for detecting changes
 					_initMember(member);
 
@@ -741,9 +757,10 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 						json &revj = member["revision"];
 						member["revision"] = (revj.is_number() ? ((uint64_t)revj + 1ULL) : 1ULL);
 						{
-							Mutex::Lock _l(_db_m);
+							RWMutex::WriteLock _l(_db_m);
 							_db.put("network",nwids,"member",Address(address).toString(),member);
 						}
+						_clearConfigCache(nwid,address);
 						_pushMemberUpdate(now,nwid,member);
 					}
 
@@ -813,7 +830,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 
 				json network;
 				{
-					Mutex::Lock _l(_db_m);
+					RWMutex::WriteLock _l(_db_m);
 
 					// Magic ID ending with ______ picks a random unused network ID
 					if (path[1].substr(10) == "______") {
@@ -1048,21 +1065,20 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					json &revj = network["revision"];
 					network["revision"] = (revj.is_number() ? ((uint64_t)revj + 1ULL) : 1ULL);
 					network["lastModified"] = now;
+					_clearConfigCache(nwid);
 					{
-						Mutex::Lock _l(_db_m);
+						RWMutex::WriteLock _l(_db_m);
 						_db.put("network",nwids,network);
-					}
 
-					// Send an update to all members of the network
-					_db.filter((std::string("network/") + nwids + "/member/"),120000,[this,&now,&nwid](const std::string &n,const json &obj) {
-						_pushMemberUpdate(now,nwid,obj);
-						return true; // do not delete
-					});
+						// Send an update to all members of the network
+						_db.filter((std::string("network/") + nwids + "/member/"),120000,[this,&now,&nwid](const std::string &n,const json &obj) {
+							_pushMemberUpdate(now,nwid,obj);
+							return true; // do not delete
+						});
+					}
 				}
 
-				_NetworkMemberInfo nmi;
-				_getNetworkMemberInfo(now,nwid,nmi);
-				_addNetworkNonPersistedFields(network,now,nmi);
+				_addNetworkNonPersistedFields(network,now,*_getNetworkMemberInfo(now,nwid));
 
 				responseBody = OSUtils::jsonDump(network);
 				responseContentType = "application/json";
@@ -1093,11 +1109,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 
 			char nwids[24];
 			Utils::snprintf(nwids,sizeof(nwids),"%.16llx",nwid);
-			json network;
-			{
-				Mutex::Lock _l(_db_m);
-				network = _db.get("network",nwids,ZT_NETCONF_DB_CACHE_TTL);
-			}
+			json network(_dbGetNetwork(nwids));
 			if (!network.size())
 				return 404;
 
@@ -1105,10 +1117,11 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 				if ((path.size() == 4)&&(path[2] == "member")&&(path[3].length() == 10)) {
 					const uint64_t address = Utils::hexStrToU64(path[3].c_str());
 
-					Mutex::Lock _l(_db_m);
+					RWMutex::WriteLock _l(_db_m);
 
 					json member = _db.get("network",nwids,"member",Address(address).toString(),ZT_NETCONF_DB_CACHE_TTL);
 					_db.erase("network",nwids,"member",Address(address).toString());
+					_clearConfigCache(nwid,address);
 
 					if (!member.size())
 						return 404;
@@ -1117,15 +1130,15 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 					return 200;
 				}
 			} else {
-				Mutex::Lock _l(_db_m);
+				RWMutex::WriteLock _l(_db_m);
 
 				std::string pfx("network/"); pfx.append(nwids);
 				_db.filter(pfx,120000,[](const std::string &n,const json &obj) {
 					return false; // delete
 				});
 
-				Mutex::Lock _l2(_nmiCache_m);
-				_nmiCache.erase(nwid);
+				_clearNetworkMemberInfoCache(nwid);
+				_clearConfigCache(nwid);
 
 				responseBody = OSUtils::jsonDump(network);
 				responseContentType = "application/json";
@@ -1153,12 +1166,22 @@ void EmbeddedNetworkController::threadMain()
 		uint64_t now = OSUtils::now();
 		if ((now - lastCircuitTestCheck) > ZT_EMBEDDEDNETWORKCONTROLLER_CIRCUIT_TEST_EXPIRATION) {
 			lastCircuitTestCheck = now;
-			Mutex::Lock _l(_tests_m);
-			for(std::list< ZT_CircuitTest >::iterator i(_tests.begin());i!=_tests.end();) {
-				if ((now - i->timestamp) > ZT_EMBEDDEDNETWORKCONTROLLER_CIRCUIT_TEST_EXPIRATION) {
-					_node->circuitTestEnd(&(*i));
-					_tests.erase(i++);
-				} else ++i;
+			{
+				Mutex::Lock _l(_tests_m);
+				for(std::list< ZT_CircuitTest >::iterator i(_tests.begin());i!=_tests.end();) {
+					if ((now - i->timestamp) > ZT_EMBEDDEDNETWORKCONTROLLER_CIRCUIT_TEST_EXPIRATION) {
+						_node->circuitTestEnd(&(*i));
+						_tests.erase(i++);
+					} else ++i;
+				}
+			}
+			{
+				Mutex::Lock _l(_configCache_m);
+				for(std::map< std::pair<uint64_t,uint64_t>,_ConfigCacheEntry >::iterator c(_configCache.begin());c!=_configCache.end();) {
+					if ((now - c->second.timestamp) > ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA)
+						_configCache.erase(c++);
+					else ++c;
+				}
 			}
 		}
 	}
@@ -1217,7 +1240,7 @@ void EmbeddedNetworkController::_circuitTestCallback(ZT_Node *node,ZT_CircuitTes
 		reinterpret_cast<const InetAddress *>(&(report->receivedFromRemoteAddress))->toString().c_str(),
 		((double)report->receivedFromLinkQuality / (double)ZT_PATH_LINK_QUALITY_MAX));
 
-	Mutex::Lock _l(self->_db_m);
+	RWMutex::WriteLock _l(self->_db_m);
 	self->_db.writeRaw(id,std::string(tmp));
 }
 
@@ -1243,13 +1266,8 @@ void EmbeddedNetworkController::_request(
 
 	char nwids[24];
 	Utils::snprintf(nwids,sizeof(nwids),"%.16llx",nwid);
-	json network;
-	json member;
-	{
-		Mutex::Lock _l(_db_m);
-		network = _db.get("network",nwids,ZT_NETCONF_DB_CACHE_TTL);
-		member = _db.get("network",nwids,"member",identity.address().toString(),ZT_NETCONF_DB_CACHE_TTL);
-	}
+	json network(_dbGetNetwork(nwids));
+	json member(_dbGetMember(nwids,identity.address()));
 
 	if (!network.size()) {
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_OBJECT_NOT_FOUND);
@@ -1394,7 +1412,7 @@ void EmbeddedNetworkController::_request(
 	if (!authorizedBy) {
 		if (origMember != member) {
 			member["lastModified"] = now;
-			Mutex::Lock _l(_db_m);
+			RWMutex::WriteLock _l(_db_m);
 			_db.put("network",nwids,"member",identity.address().toString(),member);
 		}
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_ACCESS_DENIED);
@@ -1405,16 +1423,14 @@ void EmbeddedNetworkController::_request(
 	// If we made it this far, they are authorized.
 	// -------------------------------------------------------------------------
 
-	NetworkConfig nc;
-	_NetworkMemberInfo nmi;
-	_getNetworkMemberInfo(now,nwid,nmi);
+	std::shared_ptr<const _NetworkMemberInfo> nmi(_getNetworkMemberInfo(now,nwid));
 
 	uint64_t credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
-	if (now > nmi.mostRecentDeauthTime) {
+	if (now > nmi->mostRecentDeauthTime) {
 		// If we recently de-authorized a member, shrink credential TTL/max delta to
 		// be below the threshold required to exclude it. Cap this to a min/max to
 		// prevent jitter or absurdly large values.
-		const uint64_t deauthWindow = now - nmi.mostRecentDeauthTime;
+		const uint64_t deauthWindow = now - nmi->mostRecentDeauthTime;
 		if (deauthWindow < ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA) {
 			credentialtmd = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MIN_MAX_DELTA;
 		} else if (deauthWindow < (ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA + 5000ULL)) {
@@ -1422,6 +1438,65 @@ void EmbeddedNetworkController::_request(
 		}
 	}
 
+	CertificateOfMembership com(now,credentialtmd,nwid,identity.address());
+	if (!com.sign(_signingId)) {
+		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	// Most members re-request every ZT_NETWORK_AUTOCONF_DELAY and get the same config
+	// back, so if nothing that goes into it has changed send the last one rendered
+	// for this member with only a fresh timestamp and COM. Its tags, capabilities
+	// and COO keep their original timestamps, so it is only reused for a fraction
+	// of credentialtmd.
+	const bool sendLegacyFormatConfig = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	unsigned char inputHash[ZT_SHA512_DIGEST_LEN];
+	{
+		char tmp[128];
+		Utils::snprintf(tmp,sizeof(tmp),"%s %s %llu %llu ",nwids,identity.address().toString().c_str(),(unsigned long long)credentialtmd,(unsigned long long)metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0));
+		std::string in(tmp);
+		in.append(network.dump());
+		in.append(member["ipAssignments"].dump());
+		in.append(member["noAutoAssignIps"].dump());
+		in.append(member["tags"].dump());
+		in.append(member["capabilities"].dump());
+		for(std::set<Address>::const_iterator ab(nmi->activeBridges.begin());ab!=nmi->activeBridges.end();++ab)
+			in.append(ab->toString());
+		SHA512::hash(inputHash,in.data(),(unsigned int)in.length());
+	}
+	if (!sendLegacyFormatConfig) {
+		std::string cachedConfig;
+		{
+			Mutex::Lock _l(_configCache_m);
+			std::map< std::pair<uint64_t,uint64_t>,_ConfigCacheEntry >::const_iterator c(_configCache.find(std::pair<uint64_t,uint64_t>(nwid,identity.address().toInt())));
+			if ((c != _configCache.end())&&(!memcmp(c->second.inputHash,inputHash,ZT_SHA512_DIGEST_LEN))&&((now - c->second.timestamp) < (credentialtmd / 4))) {
+				cachedConfig = c->second.dict;
+				++_configCacheHits;
+			}
+		}
+		if (cachedConfig.length() > 0) {
+			if (member != origMember) {
+				member["lastModified"] = now;
+				RWMutex::WriteLock _l(_db_m);
+				_db.put("network",nwids,"member",identity.address().toString(),member);
+			}
+
+			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>(cachedConfig.c_str());
+			try {
+				if ((dconf->add(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,now))&&(_addConfigCom(*dconf,com)))
+					_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*dconf);
+				else _sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
+				delete dconf;
+			} catch ( ... ) {
+				delete dconf;
+				throw;
+			}
+			return;
+		}
+	}
+	bool cacheable = true;
+
+	NetworkConfig nc;
 	nc.networkId = nwid;
 	nc.type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 	nc.timestamp = now;
@@ -1433,7 +1508,7 @@ void EmbeddedNetworkController::_request(
 	Utils::scopy(nc.name,sizeof(nc.name),OSUtils::jsonString(network["name"],"").c_str());
 	nc.multicastLimit = (unsigned int)OSUtils::jsonInt(network["multicastLimit"],32ULL);
 
-	for(std::set<Address>::const_iterator ab(nmi.activeBridges.begin());ab!=nmi.activeBridges.end();++ab) {
+	for(std::set<Address>::const_iterator ab(nmi->activeBridges.begin());ab!=nmi->activeBridges.end();++ab) {
 		nc.addSpecialist(*ab,ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
 	}
 
@@ -1614,121 +1689,146 @@ void EmbeddedNetworkController::_request(
 		ipAssignments = json::array();
 	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv6AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStart(OSUtils::jsonString(pool["ipRangeStart"],""));
-				InetAddress ipRangeEnd(OSUtils::jsonString(pool["ipRangeEnd"],""));
-				if ( (ipRangeStart.ss_family == AF_INET6) && (ipRangeEnd.ss_family == AF_INET6) ) {
-					uint64_t s[2],e[2],x[2],xx[2];
-					memcpy(s,ipRangeStart.rawIpData(),16);
-					memcpy(e,ipRangeEnd.rawIpData(),16);
-					s[0] = Utils::ntoh(s[0]);
-					s[1] = Utils::ntoh(s[1]);
-					e[0] = Utils::ntoh(e[0]);
-					e[1] = Utils::ntoh(e[1]);
-					x[0] = s[0];
-					x[1] = s[1];
-
-					for(unsigned int trialCount=0;trialCount<1000;++trialCount) {
-						if ((trialCount == 0)&&(e[1] > s[1])&&((e[1] - s[1]) >= 0xffffffffffULL)) {
-							// First see if we can just cram a ZeroTier ID into the higher 64 bits. If so do that.
-							xx[0] = Utils::hton(x[0]);
-							xx[1] = Utils::hton(x[1] + identity.address().toInt());
-						} else {
-							// Otherwise pick random addresses -- this technically doesn't explore the whole range if the lower 64 bit range is >= 1 but that won't matter since that would be huge anyway
-							Utils::getSecureRandom((void *)xx,16);
-							if ((e[0] > s[0]))
-								xx[0] %= (e[0] - s[0]);
-							else xx[0] = 0;
-							if ((e[1] > s[1]))
-								xx[1] %= (e[1] - s[1]);
-							else xx[1] = 0;
-							xx[0] = Utils::hton(x[0] + xx[0]);
-							xx[1] = Utils::hton(x[1] + xx[1]);
-						}
+	// Automatic IP assignment is serialized per network. Allocated IPs are
+	// re-read and any new assignment is saved under the same lock so that two
+	// members requesting at the same time can never get the same address.
+	if ( (ipAssignmentPools.is_array()) && (!noAutoAssignIps) && ( ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))&&(!haveManagedIpv6AutoAssignment)) || ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))&&(!haveManagedIpv4AutoAssignment)) ) ) {
+		_NetworkLocks &nl = _networkLocksFor(nwid);
+		Mutex::Lock _al(nl.ipAssignment);
+		nmi = _getNetworkMemberInfo(now,nwid);
+		bool assigned = false;
+		cacheable = false; // the config must not be reused if assignment fails
+
+		if ( (ipAssignmentPools.is_array()) && ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
+			for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv6AutoAssignment));++p) {
+				json &pool = ipAssignmentPools[p];
+				if (pool.is_object()) {
+					InetAddress ipRangeStart(OSUtils::jsonString(pool["ipRangeStart"],""));
+					InetAddress ipRangeEnd(OSUtils::jsonString(pool["ipRangeEnd"],""));
+					if ( (ipRangeStart.ss_family == AF_INET6) && (ipRangeEnd.ss_family == AF_INET6) ) {
+						uint64_t s[2],e[2],x[2],xx[2];
+						memcpy(s,ipRangeStart.rawIpData(),16);
+						memcpy(e,ipRangeEnd.rawIpData(),16);
+						s[0] = Utils::ntoh(s[0]);
+						s[1] = Utils::ntoh(s[1]);
+						e[0] = Utils::ntoh(e[0]);
+						e[1] = Utils::ntoh(e[1]);
+						x[0] = s[0];
+						x[1] = s[1];
+
+						for(unsigned int trialCount=0;trialCount<1000;++trialCount) {
+							if ((trialCount == 0)&&(e[1] > s[1])&&((e[1] - s[1]) >= 0xffffffffffULL)) {
+								// First see if we can just cram a ZeroTier ID into the higher 64 bits. If so do that.
+								xx[0] = Utils::hton(x[0]);
+								xx[1] = Utils::hton(x[1] + identity.address().toInt());
+							} else {
+								// Otherwise pick random addresses -- this technically doesn't explore the whole range if the lower 64 bit range is >= 1 but that won't matter since that would be huge anyway
+								Utils::getSecureRandom((void *)xx,16);
+								if ((e[0] > s[0]))
+									xx[0] %= (e[0] - s[0]);
+								else xx[0] = 0;
+								if ((e[1] > s[1]))
+									xx[1] %= (e[1] - s[1]);
+								else xx[1] = 0;
+								xx[0] = Utils::hton(x[0] + xx[0]);
+								xx[1] = Utils::hton(x[1] + xx[1]);
+							}
 
-						InetAddress ip6((const void *)xx,16,0);
+							InetAddress ip6((const void *)xx,16,0);
 
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = 0;
-						for(unsigned int rk=0;rk<nc.routeCount;++rk) {
-							if ( (!nc.routes[rk].via.ss_family) && (nc.routes[rk].target.ss_family == AF_INET6) && (reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->containsAddress(ip6)) )
-								routedNetmaskBits = reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->netmaskBits();
-						}
+							// Check if this IP is within a local-to-Ethernet routed network
+							int routedNetmaskBits = 0;
+							for(unsigned int rk=0;rk<nc.routeCount;++rk) {
+								if ( (!nc.routes[rk].via.ss_family) && (nc.routes[rk].target.ss_family == AF_INET6) && (reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->containsAddress(ip6)) )
+									routedNetmaskBits = reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->netmaskBits();
+							}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						if ((routedNetmaskBits > 0)&&(!nmi.allocatedIps.count(ip6))) {
-							ipAssignments.push_back(ip6.toIpString());
-							member["ipAssignments"] = ipAssignments;
-							ip6.setPort((unsigned int)routedNetmaskBits);
-							if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
-								nc.staticIps[nc.staticIpCount++] = ip6;
-							haveManagedIpv6AutoAssignment = true;
-							_clearNetworkMemberInfoCache(nwid); // clear cache to prevent IP assignment duplication on many rapid assigns
-							break;
+							// If it's routed, then try to claim and assign it and if successful end loop
+							if ((routedNetmaskBits > 0)&&(!nmi->allocatedIps.count(ip6))) {
+								ipAssignments.push_back(ip6.toIpString());
+								member["ipAssignments"] = ipAssignments;
+								ip6.setPort((unsigned int)routedNetmaskBits);
+								if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
+									nc.staticIps[nc.staticIpCount++] = ip6;
+								haveManagedIpv6AutoAssignment = true;
+								assigned = true;
+								break;
+							}
 						}
 					}
 				}
 			}
 		}
-	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv4AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStartIA(OSUtils::jsonString(pool["ipRangeStart"],""));
-				InetAddress ipRangeEndIA(OSUtils::jsonString(pool["ipRangeEnd"],""));
-				if ( (ipRangeStartIA.ss_family == AF_INET) && (ipRangeEndIA.ss_family == AF_INET) ) {
-					uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
-					uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
-					if ((ipRangeEnd < ipRangeStart)||(ipRangeStart == 0))
-						continue;
-					uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
-
-					// Start with the LSB of the member's address
-					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
-
-					for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
-						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
-						if ((ip & 0x000000ff) == 0x000000ff)
-							continue; // don't allow addresses that end in .255
-
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = -1;
-						for(unsigned int rk=0;rk<nc.routeCount;++rk) {
-							if (nc.routes[rk].target.ss_family == AF_INET) {
-								uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc.routes[rk].target))->sin_addr.s_addr));
-								int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc.routes[rk].target))->sin_port));
-								if ((ip & (0xffffffff << (32 - targetBits))) == targetIp) {
-									routedNetmaskBits = targetBits;
-									break;
+		if ( (ipAssignmentPools.is_array()) && ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
+			for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv4AutoAssignment));++p) {
+				json &pool = ipAssignmentPools[p];
+				if (pool.is_object()) {
+					InetAddress ipRangeStartIA(OSUtils::jsonString(pool["ipRangeStart"],""));
+					InetAddress ipRangeEndIA(OSUtils::jsonString(pool["ipRangeEnd"],""));
+					if ( (ipRangeStartIA.ss_family == AF_INET) && (ipRangeEndIA.ss_family == AF_INET) ) {
+						uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
+						uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
+						if ((ipRangeEnd < ipRangeStart)||(ipRangeStart == 0))
+							continue;
+						uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
+
+						// Start with the LSB of the member's address
+						uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
+
+						for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
+							uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
+							++ipTrialCounter;
+							if ((ip & 0x000000ff) == 0x000000ff)
+								continue; // don't allow addresses that end in .255
+
+							// Check if this IP is within a local-to-Ethernet routed network
+							int routedNetmaskBits = -1;
+							for(unsigned int rk=0;rk<nc.routeCount;++rk) {
+								if (nc.routes[rk].target.ss_family == AF_INET) {
+									uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc.routes[rk].target))->sin_addr.s_addr));
+									int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc.routes[rk].target))->sin_port));
+									if ((ip & (0xffffffff << (32 - targetBits))) == targetIp) {
+										routedNetmaskBits = targetBits;
+										break;
+									}
 								}
 							}
-						}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						const InetAddress ip4(Utils::hton(ip),0);
-						if ((routedNetmaskBits > 0)&&(!nmi.allocatedIps.count(ip4))) {
-							ipAssignments.push_back(ip4.toIpString());
-							member["ipAssignments"] = ipAssignments;
-							if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
-								struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc.staticIps[nc.staticIpCount++]));
-								v4ip->sin_family = AF_INET;
-								v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
-								v4ip->sin_addr.s_addr = Utils::hton(ip);
+							// If it's routed, then try to claim and assign it and if successful end loop
+							const InetAddress ip4(Utils::hton(ip),0);
+							if ((routedNetmaskBits > 0)&&(!nmi->allocatedIps.count(ip4))) {
+								ipAssignments.push_back(ip4.toIpString());
+								member["ipAssignments"] = ipAssignments;
+								if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
+									struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc.staticIps[nc.staticIpCount++]));
+									v4ip->sin_family = AF_INET;
+									v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
+									v4ip->sin_addr.s_addr = Utils::hton(ip);
+								}
+								haveManagedIpv4AutoAssignment = true;
+								assigned = true;
+								break;
 							}
-							haveManagedIpv4AutoAssignment = true;
-							_clearNetworkMemberInfoCache(nwid); // clear cache to prevent IP assignment duplication on many rapid assigns
-							break;
 						}
 					}
 				}
 			}
 		}
+
+		if (assigned) {
+			member["lastModified"] = now;
+			{
+				RWMutex::WriteLock _l(_db_m);
+				_db.put("network",nwids,"member",identity.address().toString(),member);
+			}
+			origMember = member; // already saved, so don't save again below
+
+			// Holding memberInfo waits out any computation that read the DB before the
+			// put above, so no stale info can be cached once this returns.
+			Mutex::Lock _ml(nl.memberInfo);
+			_clearNetworkMemberInfoCache(nwid);
+		}
 	}
 
 	// Issue a certificate of ownership for all static IPs
@@ -1740,82 +1840,130 @@ void EmbeddedNetworkController::_request(
 		nc.certificateOfOwnershipCount = 1;
 	}
 
-	CertificateOfMembership com(now,credentialtmd,nwid,identity.address());
-	if (com.sign(_signingId)) {
-		nc.com = com;
-	} else {
-		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
-		return;
-	}
-
 	if (member != origMember) {
 		member["lastModified"] = now;
-		Mutex::Lock _l(_db_m);
+		RWMutex::WriteLock _l(_db_m);
 		_db.put("network",nwids,"member",identity.address().toString(),member);
 	}
 
-	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),nc,metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	if ((sendLegacyFormatConfig)||(!cacheable)) {
+		nc.com = com;
+		_sender->ncSendConfig(nwid,requestPacketId,identity.address(),nc,sendLegacyFormatConfig);
+	} else {
+		// Serialize without the COM, cache that minus the timestamp, then add the COM and send
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		try {
+			if (nc.toDictionary(*dconf,false)) {
+				{
+					Mutex::Lock _l(_configCache_m);
+					_ConfigCacheEntry &c = _configCache[std::pair<uint64_t,uint64_t>(nwid,identity.address().toInt())];
+					c.timestamp = now;
+					memcpy(c.inputHash,inputHash,ZT_SHA512_DIGEST_LEN);
+					c.dict = _configWithoutTimestamp(dconf->data());
+					++_configCacheMisses;
+				}
+				if (_addConfigCom(*dconf,com))
+					_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*dconf);
+				else _sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
+			}
+			delete dconf;
+		} catch ( ... ) {
+			delete dconf;
+			throw;
+		}
+	}
 }
 
-void EmbeddedNetworkController::_getNetworkMemberInfo(uint64_t now,uint64_t nwid,_NetworkMemberInfo &nmi)
+std::shared_ptr<const EmbeddedNetworkController::_NetworkMemberInfo> EmbeddedNetworkController::_getNetworkMemberInfo(uint64_t now,uint64_t nwid)
 {
-	char pfx[256];
-	Utils::snprintf(pfx,sizeof(pfx),"network/%.16llx/member",nwid);
-
 	{
 		Mutex::Lock _l(_nmiCache_m);
-		std::map<uint64_t,_NetworkMemberInfo>::iterator c(_nmiCache.find(nwid));
-		if ((c != _nmiCache.end())&&((now - c->second.nmiTimestamp) < 1000)) { // a short duration cache but limits CPU use on big networks
-			nmi = c->second;
-			return;
-		}
+		std::map< uint64_t,std::shared_ptr<const _NetworkMemberInfo> >::iterator c(_nmiCache.find(nwid));
+		if ((c != _nmiCache.end())&&((now - c->second->nmiTimestamp) < 1000)) // a short duration cache but limits CPU use on big networks
+			return c->second;
 	}
 
+	// If another thread is already computing this network's info, wait for it and use its result
+	Mutex::Lock _ml(_networkLocksFor(nwid).memberInfo);
 	{
-		Mutex::Lock _l(_db_m);
-		_db.filter(pfx,120000,[&nmi,&now](const std::string &n,const json &member) {
-			try {
-				if (OSUtils::jsonBool(member["authorized"],false)) {
-					++nmi.authorizedMemberCount;
-
-					if (member.count("recentLog")) {
-						const json &mlog = member["recentLog"];
-						if ((mlog.is_array())&&(mlog.size() > 0)) {
-							const json &mlog1 = mlog[0];
-							if (mlog1.is_object()) {
-								if ((now - OSUtils::jsonInt(mlog1["ts"],0ULL)) < ZT_NETCONF_NODE_ACTIVE_THRESHOLD)
-									++nmi.activeMemberCount;
-							}
+		Mutex::Lock _l(_nmiCache_m);
+		std::map< uint64_t,std::shared_ptr<const _NetworkMemberInfo> >::iterator c(_nmiCache.find(nwid));
+		if ((c != _nmiCache.end())&&((c->second->nmiTimestamp >= now)||((now - c->second->nmiTimestamp) < 1000)))
+			return c->second;
+	}
+
+	char pfx[256];
+	Utils::snprintf(pfx,sizeof(pfx),"network/%.16llx/member",nwid);
+
+	std::shared_ptr<_NetworkMemberInfo> nmi(new _NetworkMemberInfo());
+	auto tally = [&nmi,&now](const std::string &n,const json &member) {
+		try {
+			if (OSUtils::jsonBool(member["authorized"],false)) {
+				++nmi->authorizedMemberCount;
+
+				if (member.count("recentLog")) {
+					const json &mlog = member["recentLog"];
+					if ((mlog.is_array())&&(mlog.size() > 0)) {
+						const json &mlog1 = mlog[0];
+						if (mlog1.is_object()) {
+							if ((now - OSUtils::jsonInt(mlog1["ts"],0ULL)) < ZT_NETCONF_NODE_ACTIVE_THRESHOLD)
+								++nmi->activeMemberCount;
 						}
 					}
+				}
 
-					if (OSUtils::jsonBool(member["activeBridge"],false)) {
-						nmi.activeBridges.insert(Address(Utils::hexStrToU64(OSUtils::jsonString(member["id"],"0000000000").c_str())));
-					}
+				if (OSUtils::jsonBool(member["activeBridge"],false)) {
+					nmi->activeBridges.insert(Address(Utils::hexStrToU64(OSUtils::jsonString(member["id"],"0000000000").c_str())));
+				}
 
-					if (member.count("ipAssignments")) {
-						const json &mips = member["ipAssignments"];
-						if (mips.is_array()) {
-							for(unsigned long i=0;i<mips.size();++i) {
-								InetAddress mip(OSUtils::jsonString(mips[i],""));
-								if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
-									nmi.allocatedIps.insert(mip);
-							}
+				if (member.count("ipAssignments")) {
+					const json &mips = member["ipAssignments"];
+					if (mips.is_array()) {
+						for(unsigned long i=0;i<mips.size();++i) {
+							InetAddress mip(OSUtils::jsonString(mips[i],""));
+							if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
+								nmi->allocatedIps.insert(mip);
 						}
 					}
-				} else {
-					nmi.mostRecentDeauthTime = std::max(nmi.mostRecentDeauthTime,OSUtils::jsonInt(member["lastDeauthorizedTime"],0ULL));
 				}
-			} catch ( ... ) {}
+			} else {
+				nmi->mostRecentDeauthTime = std::max(nmi->mostRecentDeauthTime,OSUtils::jsonInt(member["lastDeauthorizedTime"],0ULL));
+			}
+		} catch ( ... ) {}
+	};
+
+	bool tallied;
+	{
+		RWMutex::ReadLock _l(_db_m);
+		tallied = _db.eachCached(pfx,120000,tally);
+	}
+	if (!tallied) {
+		RWMutex::WriteLock _l(_db_m);
+		_db.filter(pfx,120000,[&tally](const std::string &n,const json &member) {
+			tally(n,member);
 			return true;
 		});
 	}
-	nmi.nmiTimestamp = now;
+	nmi->nmiTimestamp = now;
 
 	{
 		Mutex::Lock _l(_nmiCache_m);
 		_nmiCache[nwid] = nmi;
 	}
+
+	return nmi;
+}
+
+json EmbeddedNetworkController::_dbGet(const std::string &n)
+{
+	{
+		RWMutex::ReadLock _l(_db_m);
+		json obj;
+		if (_db.getCached(n,obj,ZT_NETCONF_DB_CACHE_TTL))
+			return obj;
+	}
+	RWMutex::WriteLock _l(_db_m);
+	return _db.get(n,ZT_NETCONF_DB_CACHE_TTL);
 }
 
 void EmbeddedNetworkController::_pushMemberUpdate(uint64_t now,uint64_t nwid,const nlohmann::json &member)
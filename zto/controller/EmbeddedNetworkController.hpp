@@ -26,6 +26,7 @@
 #include <vector>
 #include <set>
 #include <list>
+#include <memory>
 
 #include "../node/Constants.hpp"
 
@@ -34,16 +35,18 @@
 #include "../node/Utils.hpp"
 #include "../node/Address.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/SHA512.hpp"
 
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Thread.hpp"
 #include "../osdep/BlockingQueue.hpp"
+#include "../osdep/RWMutex.hpp"
 
 #include "../ext/json/json.hpp"
 
 #include "JSONDB.hpp"
 
-// Number of background threads to start -- not actually started until needed
+// Default number of background threads to start -- not actually started until needed
 #define ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT 4
 
 // TTL for circuit tests
@@ -59,12 +62,28 @@ public:
 	/**
 	 * @param node Parent node
 	 * @param dbPath Path to store data
+	 * @param dbFlushInterval If nonzero, write database changes behind at this interval in ms (see JSONDB)
+	 * @param dbLogStructured If true, use the append-only log database backend (see JSONDB)
 	 */
-	EmbeddedNetworkController(Node *node,const char *dbPath);
+	EmbeddedNetworkController(Node *node,const char *dbPath,unsigned long dbFlushInterval = 0,bool dbLogStructured = false);
 	virtual ~EmbeddedNetworkController();
 
 	virtual void init(const Identity &signingId,Sender *sender);
 
+	/**
+	 * Set the number of background request threads
+	 *
+	 * This has no effect once the first request has started the threads.
+	 *
+	 * @param n Number of threads (minimum 1)
+	 */
+	inline void setThreadCount(unsigned int n)
+	{
+		Mutex::Lock _l(_threads_m);
+		if (!_threadsStarted)
+			_threadCount = (n > 0) ? n : 1;
+	}
+
 	virtual void request(
 		uint64_t nwid,
 		const InetAddress &fromAddr,
@@ -94,6 +113,17 @@ public:
 		std::string &responseBody,
 		std::string &responseContentType);
 
+	/**
+	 * @param hits Set to number of configs sent from the config cache
+	 * @param misses Set to number of configs rendered and added to the cache
+	 */
+	inline void configCacheStats(uint64_t &hits,uint64_t &misses) const
+	{
+		Mutex::Lock _l(_configCache_m);
+		hits = _configCacheHits;
+		misses = _configCacheMisses;
+	}
+
 	void threadMain()
 		throw();
 
@@ -116,7 +146,8 @@ private:
 	};
 	BlockingQueue<_RQEntry *> _queue;
 
-	Thread _threads[ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT];
+	std::vector<Thread> _threads;
+	unsigned int _threadCount;
 	bool _threadsStarted;
 	Mutex _threads_m;
 
@@ -132,15 +163,52 @@ private:
 		uint64_t mostRecentDeauthTime;
 		uint64_t nmiTimestamp; // time this NMI structure was computed
 	};
-	std::map<uint64_t,_NetworkMemberInfo> _nmiCache;
+	std::map< uint64_t,std::shared_ptr<const _NetworkMemberInfo> > _nmiCache; // shared so requests never copy big networks' IP sets
 	Mutex _nmiCache_m;
-	void _getNetworkMemberInfo(uint64_t now,uint64_t nwid,_NetworkMemberInfo &nmi);
+	std::shared_ptr<const _NetworkMemberInfo> _getNetworkMemberInfo(uint64_t now,uint64_t nwid);
 	inline void _clearNetworkMemberInfoCache(const uint64_t nwid)
 	{
 		Mutex::Lock _l(_nmiCache_m);
 		_nmiCache.erase(nwid);
 	}
 
+	// Serialized configs last sent to each member, without timestamp or COM
+	struct _ConfigCacheEntry
+	{
+		uint64_t timestamp; // when the tags, capabilities, and COO in dict were signed
+		unsigned char inputHash[ZT_SHA512_DIGEST_LEN]; // hash of everything the config was rendered from
+		std::string dict;
+	};
+	std::map< std::pair<uint64_t,uint64_t>,_ConfigCacheEntry > _configCache; // key is network ID and member address
+	uint64_t _configCacheHits;
+	uint64_t _configCacheMisses;
+	Mutex _configCache_m;
+	inline void _clearConfigCache(const uint64_t nwid)
+	{
+		Mutex::Lock _l(_configCache_m);
+		_configCache.erase(_configCache.lower_bound(std::pair<uint64_t,uint64_t>(nwid,0ULL)),_configCache.upper_bound(std::pair<uint64_t,uint64_t>(nwid,0xffffffffffffffffULL)));
+	}
+	inline void _clearConfigCache(const uint64_t nwid,const uint64_t address)
+	{
+		Mutex::Lock _l(_configCache_m);
+		_configCache.erase(std::pair<uint64_t,uint64_t>(nwid,address));
+	}
+
+	// Per-network locks so work that must be serialized within a network does
+	// not also serialize requests for other networks
+	struct _NetworkLocks
+	{
+		Mutex memberInfo; // only one thread recomputes a network's member info at a time
+		Mutex ipAssignment; // held from reading allocated IPs until a new assignment is saved
+	};
+	std::map< uint64_t,_NetworkLocks > _networkLocks;
+	Mutex _networkLocks_m;
+	inline _NetworkLocks &_networkLocksFor(const uint64_t nwid)
+	{
+		Mutex::Lock _l(_networkLocks_m);
+		return _networkLocks[nwid]; // entries are never removed so references stay valid
+	}
+
 	void _pushMemberUpdate(uint64_t now,uint64_t nwid,const nlohmann::json &member);
 
 	// These init objects with default and static/informational fields
@@ -196,8 +264,14 @@ private:
 		member["clock"] = now;
 	}
 
+	// Reads take a shared lock on the database and only fall back to an
+	// exclusive lock if the object must be (re)loaded from disk.
+	nlohmann::json _dbGet(const std::string &n);
+	inline nlohmann::json _dbGetNetwork(const char *nwids) { return _dbGet(std::string("network/") + nwids); }
+	inline nlohmann::json _dbGetMember(const char *nwids,const Address &address) { return _dbGet(std::string("network/") + nwids + "/member/" + address.toString()); }
+
 	JSONDB _db;
-	Mutex _db_m;
+	RWMutex _db_m;
 
 	Node *const _node;
 	std::string _path;
@@ -16,26 +16,241 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef __WINDOWS__
+#include <unistd.h>
+#endif
+
 #include "JSONDB.hpp"
 
+// Granularity at which the flusher thread checks for shutdown
+#define ZT_JSONDB_FLUSHER_SLEEP_PERIOD 100
+
+// Log backend file names under base path
+#define ZT_JSONDB_LOG_FILE "jsondb.log"
+#define ZT_JSONDB_CHECKPOINT_FILE "jsondb.checkpoint"
+#define ZT_JSONDB_COMPACTING_FILE "jsondb.log.compacting"
+
+// Log is compacted when it is larger than this and larger than the last checkpoint
+#define ZT_JSONDB_LOG_COMPACT_MIN_SIZE 16777216ULL
+
+// Log record types
+#define ZT_JSONDB_LOG_RECORD_PUT 'P'
+#define ZT_JSONDB_LOG_RECORD_ERASE 'E'
+
 namespace ZeroTier {
 
 static const nlohmann::json _EMPTY_JSON(nlohmann::json::object());
 
+// Log records are: <[4] length of remainder> <[1] type> <[2] name length> <name> <JSON payload> <[4] FNV-1a of type through payload>
+static uint32_t _logChecksum(const char *p,unsigned long len)
+{
+	uint32_t h = 0x811c9dc5;
+	for(unsigned long i=0;i<len;++i) {
+		h ^= (uint32_t)((const unsigned char *)p)[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static void _appendUInt(std::string &buf,uint32_t i,unsigned int bytes)
+{
+	while (bytes--)
+		buf.push_back((char)((i >> (bytes * 8)) & 0xff));
+}
+
+static void _appendLogRecord(std::string &buf,const char type,const std::string &n,const std::string &payload)
+{
+	const unsigned long start = (unsigned long)buf.length() + 4;
+	_appendUInt(buf,(uint32_t)(1 + 2 + n.length() + payload.length() + 4),4);
+	buf.push_back(type);
+	_appendUInt(buf,(uint32_t)n.length(),2);
+	buf.append(n);
+	buf.append(payload);
+	_appendUInt(buf,_logChecksum(buf.data() + start,(unsigned long)buf.length() - start),4);
+}
+
+// Calls func(type,name,payload) for each intact record and returns the length of the intact prefix of buf
+template<typename F>
+static unsigned long _readLogRecords(const std::string &buf,F func)
+{
+	const unsigned char *const b = reinterpret_cast<const unsigned char *>(buf.data());
+	unsigned long ptr = 0;
+	while ((ptr + 4) <= buf.length()) {
+		const unsigned long len = ((unsigned long)b[ptr] << 24) | ((unsigned long)b[ptr+1] << 16) | ((unsigned long)b[ptr+2] << 8) | (unsigned long)b[ptr+3];
+		if ((len < 7)||((ptr + 4 + len) > buf.length()))
+			break;
+		const unsigned long r = ptr + 4;
+		const unsigned long nlen = ((unsigned long)b[r+1] << 8) | (unsigned long)b[r+2];
+		if ((3 + nlen + 4) > len)
+			break;
+		const unsigned long ce = r + len - 4;
+		const uint32_t cs = ((uint32_t)b[ce] << 24) | ((uint32_t)b[ce+1] << 16) | ((uint32_t)b[ce+2] << 8) | (uint32_t)b[ce+3];
+		if (cs != _logChecksum(buf.data() + r,len - 4))
+			break;
+		func((char)b[r],std::string(buf.data() + r + 3,nlen),std::string(buf.data() + r + 3 + nlen,len - 7 - nlen));
+		ptr = r + len;
+	}
+	return ptr;
+}
+
+JSONDB::JSONDB(const std::string &basePath,unsigned long flushInterval,bool logStructured) :
+	_basePath(basePath),
+	_flushInterval(flushInterval),
+	_run((flushInterval > 0)||(logStructured)),
+	_log(logStructured),
+	_logFile((FILE *)0),
+	_logSize(0),
+	_checkpointSize(0),
+	_logSyncs(0),
+	_compactDue(false)
+{
+	if (_log)
+		_loadLog();
+	else _reload(_basePath);
+	if (_run)
+		_thread = Thread::start(this);
+}
+
+JSONDB::~JSONDB()
+{
+	if (_run) {
+		_run = false;
+		Thread::join(_thread);
+	}
+	flush();
+	if (_logFile)
+		fclose(_logFile);
+}
+
+void JSONDB::reload()
+{
+	flush();
+	_db.clear();
+	if (_log) {
+		Mutex::Lock _cl(_compact_m);
+		Mutex::Lock _fl(_flush_m);
+		if (_logFile)
+			fclose(_logFile);
+		_logFile = (FILE *)0;
+		_logSize = 0;
+		_checkpointSize = 0;
+		_loadLog();
+	} else {
+		_reload(_basePath);
+	}
+}
+
+bool JSONDB::hasLog(const std::string &basePath)
+{
+	return ( (OSUtils::fileExists((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_CHECKPOINT_FILE).c_str())) || (OSUtils::fileExists((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_LOG_FILE).c_str())) || (OSUtils::fileExists((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_COMPACTING_FILE).c_str())) );
+}
+
+bool JSONDB::removeLog(const std::string &basePath)
+{
+	OSUtils::rm((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_CHECKPOINT_FILE).c_str());
+	OSUtils::rm((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_LOG_FILE).c_str());
+	OSUtils::rm((basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_COMPACTING_FILE).c_str());
+	return (!hasLog(basePath));
+}
+
+void JSONDB::flush()
+{
+	Mutex::Lock _fl(_flush_m); // only one flush at a time so writes to the same object stay ordered
+
+	std::map<std::string,_W> batch;
+	{
+		Mutex::Lock _l(_pending_m);
+		if (_pending.empty())
+			return;
+		batch.swap(_pending);
+	}
+
+	if (_log) {
+		// The whole batch goes out as one append and one sync
+		std::string records;
+		for(std::map<std::string,_W>::iterator w(batch.begin());w!=batch.end();++w) {
+			if (w->second.erase)
+				_appendLogRecord(records,ZT_JSONDB_LOG_RECORD_ERASE,w->first,std::string());
+			else _appendLogRecord(records,ZT_JSONDB_LOG_RECORD_PUT,w->first,w->second.obj.dump());
+		}
+		if (!_appendLog(records,true)) {
+			Mutex::Lock _l(_pending_m);
+			for(std::map<std::string,_W>::iterator w(batch.begin());w!=batch.end();++w) {
+				if (_pending.find(w->first) == _pending.end())
+					_pending[w->first] = w->second;
+			}
+		}
+		return;
+	}
+
+	for(std::map<std::string,_W>::iterator w(batch.begin());w!=batch.end();++w) {
+		if (w->second.erase) {
+			const std::string path(_genPath(w->first,false));
+			if (path.length())
+				OSUtils::rm(path.c_str());
+		} else {
+			const std::string path(_genPath(w->first,true));
+			if (!path.length())
+				continue;
+			if (_writeAtomic(path,OSUtils::jsonDump(w->second.obj),true)) {
+				const uint64_t lm = OSUtils::getLastModified(path.c_str());
+				Mutex::Lock _l(_pending_m);
+				_flushed[w->first] = lm;
+			} else {
+				// Put failed writes back unless they have been superseded, and try again next flush
+				Mutex::Lock _l(_pending_m);
+				if (_pending.find(w->first) == _pending.end())
+					_pending[w->first] = w->second;
+			}
+		}
+	}
+}
+
+void JSONDB::threadMain()
+	throw()
+{
+	uint64_t lastFlush = OSUtils::now();
+	while (_run) {
+		Thread::sleep(ZT_JSONDB_FLUSHER_SLEEP_PERIOD);
+		const uint64_t now = OSUtils::now();
+		if ((_flushInterval)&&((now - lastFlush) >= (uint64_t)_flushInterval)) {
+			lastFlush = now;
+			try {
+				flush();
+			} catch ( ... ) {}
+		}
+		if (_compactDue) {
+			try {
+				_compactLog();
+			} catch ( ... ) {}
+		}
+	}
+}
+
 bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
 {
 	if (!_isValidObjectName(n))
 		return false;
 
+	if (_log) {
+		std::string record;
+		_appendLogRecord(record,ZT_JSONDB_LOG_RECORD_PUT,n,obj);
+		{
+			Mutex::Lock _fl(_flush_m);
+			if (!_appendLog(record,false))
+				return false;
+		}
+		_E &e = _db[n];
+		e.obj = _EMPTY_JSON;
+		e.raw = obj;
+		return true;
+	}
+
 	const std::string path(_genPath(n,true));
 	if (!path.length())
 		return false;
 
-	const std::string buf(obj);
-	if (!OSUtils::writeFile(path.c_str(),buf))
-		return false;
-
-	return true;
+	return _writeAtomic(path,obj,false);
 }
 
 bool JSONDB::put(const std::string &n,const nlohmann::json &obj)
@@ -43,12 +258,46 @@ bool JSONDB::put(const std::string &n,const nlohmann::json &obj)
 	if (!_isValidObjectName(n))
 		return false;
 
+	if (_flushInterval) {
+		{
+			Mutex::Lock _l(_pending_m);
+			_W &w = _pending[n];
+			w.obj = obj;
+			w.erase = false;
+		}
+
+		std::map<std::string,_E>::iterator e(_db.find(n));
+		if (e == _db.end()) {
+			e = _db.insert(std::pair<std::string,_E>(n,_E())).first;
+			e->second.lastModifiedOnDisk = 0;
+		}
+		e->second.obj = obj;
+		e->second.raw = std::string();
+		e->second.lastCheck = OSUtils::now();
+
+		return true;
+	}
+
+	if (_log) {
+		std::string record;
+		_appendLogRecord(record,ZT_JSONDB_LOG_RECORD_PUT,n,obj.dump());
+		{
+			Mutex::Lock _fl(_flush_m);
+			if (!_appendLog(record,false))
+				return false;
+		}
+		_E &e = _db[n];
+		e.obj = obj;
+		e.raw = std::string();
+		return true;
+	}
+
 	const std::string path(_genPath(n,true));
 	if (!path.length())
 		return false;
 
 	const std::string buf(OSUtils::jsonDump(obj));
-	if (!OSUtils::writeFile(path.c_str(),buf))
+	if (!_writeAtomic(path,buf,false))
 		return false;
 
 	_E &e = _db[n];
@@ -64,14 +313,42 @@ const nlohmann::json &JSONDB::get(const std::string &n,unsigned long maxSinceChe
 	if (!_isValidObjectName(n))
 		return _EMPTY_JSON;
 
+	std::map<std::string,_E>::iterator e(_db.find(n));
+
+	if (_log) {
+		// Everything is in memory, so this never touches the disk
+		if (e == _db.end())
+			return _EMPTY_JSON;
+		if (e->second.raw.length()) {
+			try {
+				e->second.obj = OSUtils::jsonParse(e->second.raw);
+			} catch ( ... ) {
+				e->second.obj = _EMPTY_JSON;
+			}
+			std::string().swap(e->second.raw);
+		}
+		return e->second.obj;
+	}
+
 	const uint64_t now = OSUtils::now();
 	std::string buf;
-	std::map<std::string,_E>::iterator e(_db.find(n));
 
 	if (e != _db.end()) {
 		if ((now - e->second.lastCheck) <= (uint64_t)maxSinceCheck)
 			return e->second.obj;
 
+		if (_flushInterval) {
+			// Memory is authoritative for objects we have changed but not yet
+			// written, and files we wrote ourselves are not reloaded.
+			uint64_t flm = 0;
+			if (_isPending(n,flm)) {
+				e->second.lastCheck = now;
+				return e->second.obj;
+			}
+			if (flm)
+				e->second.lastModifiedOnDisk = flm;
+		}
+
 		const std::string path(_genPath(n,false));
 		if (!path.length()) // sanity check
 			return _EMPTY_JSON;
@@ -87,10 +364,18 @@ const nlohmann::json &JSONDB::get(const std::string &n,unsigned long maxSinceChe
 					e->second.lastCheck = now;
 				} catch ( ... ) {} // parse errors result in "holding pattern" behavior
 			}
+		} else {
+			e->second.lastCheck = now;
 		}
 
 		return e->second.obj;
 	} else {
+		if (_flushInterval) {
+			uint64_t flm = 0;
+			if (_isPending(n,flm)) // must be a pending erase, since pending puts are always in _db
+				return _EMPTY_JSON;
+		}
+
 		const std::string path(_genPath(n,false));
 		if (!path.length())
 			return _EMPTY_JSON;
@@ -113,11 +398,41 @@ const nlohmann::json &JSONDB::get(const std::string &n,unsigned long maxSinceChe
 	}
 }
 
+bool JSONDB::getCached(const std::string &n,nlohmann::json &obj,unsigned long maxSinceCheck) const
+{
+	std::map<std::string,_E>::const_iterator e(_db.find(n));
+	if ((e == _db.end())||(!_fresh(e->second,OSUtils::now(),maxSinceCheck)))
+		return false;
+	obj = e->second.obj;
+	return true;
+}
+
 void JSONDB::erase(const std::string &n)
 {
 	if (!_isValidObjectName(n))
 		return;
 
+	if (_flushInterval) {
+		{
+			Mutex::Lock _l(_pending_m);
+			_W &w = _pending[n];
+			w.obj = _EMPTY_JSON;
+			w.erase = true;
+			_flushed.erase(n);
+		}
+		_db.erase(n);
+		return;
+	}
+
+	if (_log) {
+		std::string record;
+		_appendLogRecord(record,ZT_JSONDB_LOG_RECORD_ERASE,n,std::string());
+		Mutex::Lock _fl(_flush_m);
+		if (_appendLog(record,false))
+			_db.erase(n);
+		return;
+	}
+
 	std::string path(_genPath(n,true));
 	if (!path.length())
 		return;
@@ -160,6 +475,190 @@ bool JSONDB::_isValidObjectName(const std::string &n)
 	return true;
 }
 
+bool JSONDB::_isPending(const std::string &n,uint64_t &flushedLastModified)
+{
+	Mutex::Lock _l(_pending_m);
+	if (_pending.find(n) != _pending.end())
+		return true;
+	std::map<std::string,uint64_t>::iterator f(_flushed.find(n));
+	if (f != _flushed.end()) {
+		flushedLastModified = f->second;
+		_flushed.erase(f);
+	}
+	return false;
+}
+
+bool JSONDB::_writeAtomic(const std::string &path,const std::string &buf,bool sync)
+{
+	// Write to a temporary file and rename it over the target so a crash or
+	// concurrent reader never sees a partially written object. The flusher and
+	// log compaction and repair sync, but a synchronous put() never has and
+	// still doesn't, with either backend.
+	const std::string tmp(path + ".tmp");
+	FILE *f = fopen(tmp.c_str(),"wb");
+	if (!f)
+		return false;
+	if ((long)fwrite(buf.data(),1,buf.length(),f) != (long)buf.length()) {
+		fclose(f);
+		OSUtils::rm(tmp.c_str());
+		return false;
+	}
+	fflush(f);
+#ifndef __WINDOWS__
+	if (sync)
+		fsync(fileno(f));
+#endif
+	fclose(f);
+#ifdef __WINDOWS__
+	if (MoveFileExA(tmp.c_str(),path.c_str(),MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH) == FALSE) {
+#else
+	if (rename(tmp.c_str(),path.c_str()) != 0) {
+#endif
+		OSUtils::rm(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool JSONDB::compact()
+{
+	if (!_log)
+		return false;
+	return _compactLog();
+}
+
+void JSONDB::_loadLog()
+{
+	OSUtils::mkdir(_basePath);
+
+	std::string buf;
+	const std::string cpPath(_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_CHECKPOINT_FILE);
+	if (OSUtils::readFile(cpPath.c_str(),buf)) {
+		_checkpointSize = _readLogRecords(buf,[this](const char type,const std::string &n,const std::string &payload) {
+			if (type == ZT_JSONDB_LOG_RECORD_PUT) {
+				_E &e = _db[n];
+				e.obj = _EMPTY_JSON;
+				e.raw = payload;
+			}
+		});
+	}
+
+	// Replaying whole logs over the checkpoint is always safe: if we crashed
+	// after writing a checkpoint but before deleting the log it was made from,
+	// that log only repeats changes the checkpoint already contains. A log left
+	// over from an unfinished compaction is older than the current one and is
+	// merged in the background as soon as we start.
+	const auto replay = [this](const char type,const std::string &n,const std::string &payload) {
+		if (type == ZT_JSONDB_LOG_RECORD_PUT) {
+			_E &e = _db[n];
+			e.obj = _EMPTY_JSON;
+			e.raw = payload;
+		} else if (type == ZT_JSONDB_LOG_RECORD_ERASE) {
+			_db.erase(n);
+		}
+	};
+	buf.clear();
+	if (OSUtils::readFile((_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_COMPACTING_FILE).c_str(),buf)) {
+		_readLogRecords(buf,replay);
+		_compactDue = true;
+	}
+	buf.clear();
+	const std::string logPath(_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_LOG_FILE);
+	if (OSUtils::readFile(logPath.c_str(),buf)) {
+		_logSize = _readLogRecords(buf,replay);
+		if (_logSize < (uint64_t)buf.length()) {
+			// Drop a torn or corrupt tail so new records are appended after the last good one
+			buf.resize((unsigned long)_logSize);
+			_writeAtomic(logPath,buf,true);
+		}
+	}
+
+	_logFile = fopen(logPath.c_str(),"ab");
+	if (_logFile)
+		OSUtils::lockDownFile(logPath.c_str(),false);
+}
+
+bool JSONDB::_appendLog(const std::string &records,bool sync)
+{
+	// Caller must hold _flush_m; flush() syncs once for its whole batch
+	if (!records.length())
+		return true;
+	if (!_logFile)
+		return false;
+	if ((long)fwrite(records.data(),1,records.length(),_logFile) != (long)records.length())
+		return false;
+	if (fflush(_logFile))
+		return false;
+	if (sync) {
+#ifndef __WINDOWS__
+		fsync(fileno(_logFile));
+#endif
+		++_logSyncs;
+	}
+	_logSize += (uint64_t)records.length();
+
+	if ((_logSize >= ZT_JSONDB_LOG_COMPACT_MIN_SIZE)&&(_logSize >= _checkpointSize))
+		_compactDue = true; // picked up by the background thread
+
+	return true;
+}
+
+bool JSONDB::_compactLog()
+{
+	// Writers only wait for the current log to be renamed out of the way. The
+	// merge works from the files rather than _db so it runs without the
+	// caller's lock, and appends go to a new log while it runs.
+	Mutex::Lock _cl(_compact_m);
+	const std::string cpPath(_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_CHECKPOINT_FILE);
+	const std::string logPath(_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_LOG_FILE);
+	const std::string compactingPath(_basePath + ZT_PATH_SEPARATOR_S ZT_JSONDB_COMPACTING_FILE);
+
+	if (!OSUtils::fileExists(compactingPath.c_str())) { // else finish the compaction we crashed during
+		Mutex::Lock _fl(_flush_m);
+		_compactDue = false;
+		if (_logFile)
+			fclose(_logFile);
+		if (rename(logPath.c_str(),compactingPath.c_str()) == 0)
+			_logSize = 0;
+		_logFile = fopen(logPath.c_str(),"ab");
+		if (!_logFile)
+			return false;
+		OSUtils::lockDownFile(logPath.c_str(),false);
+	} else {
+		_compactDue = false;
+	}
+
+	std::map<std::string,std::string> live;
+	std::string buf;
+	if (OSUtils::readFile(cpPath.c_str(),buf)) {
+		_readLogRecords(buf,[&live](const char type,const std::string &n,const std::string &payload) {
+			if (type == ZT_JSONDB_LOG_RECORD_PUT)
+				live[n] = payload;
+		});
+	}
+	buf.clear();
+	if (OSUtils::readFile(compactingPath.c_str(),buf)) {
+		_readLogRecords(buf,[&live](const char type,const std::string &n,const std::string &payload) {
+			if (type == ZT_JSONDB_LOG_RECORD_PUT)
+				live[n] = payload;
+			else if (type == ZT_JSONDB_LOG_RECORD_ERASE)
+				live.erase(n);
+		});
+	}
+
+	buf.clear();
+	for(std::map<std::string,std::string>::iterator l(live.begin());l!=live.end();++l)
+		_appendLogRecord(buf,ZT_JSONDB_LOG_RECORD_PUT,l->first,l->second);
+	if (!_writeAtomic(cpPath,buf,true))
+		return false;
+	OSUtils::lockDownFile(cpPath.c_str(),false);
+	OSUtils::rm(compactingPath.c_str());
+
+	Mutex::Lock _fl(_flush_m);
+	_checkpointSize = (uint64_t)buf.length();
+	return true;
+}
+
 std::string JSONDB::_genPath(const std::string &n,bool create)
 {
 	std::vector<std::string> pt(OSUtils::split(n.c_str(),"/","",""));
@@ -32,28 +32,105 @@
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
 #include "../ext/json/json.hpp"
+#include "../node/Mutex.hpp"
 #include "../osdep/OSUtils.hpp"
+#include "../osdep/Thread.hpp"
 
 namespace ZeroTier {
 
 /**
  * Hierarchical JSON store that persists into the filesystem
+ *
+ * If a flush interval is specified the store runs in write-behind mode:
+ * put() and erase() update memory immediately and a background thread
+ * writes changed objects to disk at most every flushInterval milliseconds.
+ * Repeated changes to the same object between flushes are coalesced into
+ * one write. The caller must still serialize access to the store itself,
+ * but getCached() and eachCached() do not modify it and may be called
+ * concurrently by readers holding a shared lock.
+ *
+ * The default backend stores one JSON file per object in a directory tree
+ * under basePath. The log-structured backend instead appends every change
+ * as a record to a single log file and keeps an in-memory index of all
+ * objects, which are parsed lazily on first access. When the log grows
+ * larger than the last checkpoint a background thread moves it aside and
+ * merges it into a new checkpoint containing only live objects, while new
+ * changes go to a fresh log. Startup reads the checkpoint and the logs and
+ * never stats or walks individual object files.
  */
 class JSONDB
 {
 public:
-	JSONDB(const std::string &basePath) :
-		_basePath(basePath)
+	/**
+	 * @param basePath Base path for JSON object files or log and checkpoint
+	 * @param flushInterval Write-behind flush interval in ms or 0 to write synchronously (default)
+	 * @param logStructured If true use the append-only log backend instead of one file per object
+	 */
+	JSONDB(const std::string &basePath,unsigned long flushInterval = 0,bool logStructured = false);
+	~JSONDB();
+
+	/**
+	 * @param basePath Base path to check
+	 * @return True if basePath contains a log-structured database
+	 */
+	static bool hasLog(const std::string &basePath);
+
+	/**
+	 * Delete a log-structured database's files, e.g. after exporting it
+	 *
+	 * @param basePath Base path of database
+	 * @return True if no log database files remain
+	 */
+	static bool removeLog(const std::string &basePath);
+
+	void reload();
+
+	/**
+	 * Write all pending changes to disk now
+	 *
+	 * This does nothing if the store is not in write-behind mode.
+	 */
+	void flush();
+
+	/**
+	 * @return Number of objects with changes not yet written to disk
+	 */
+	inline unsigned long pending() const
 	{
-		_reload(_basePath);
+		Mutex::Lock _l(_pending_m);
+		return (unsigned long)_pending.size();
 	}
 
-	inline void reload()
+	/**
+	 * @return Write-behind flush interval in ms or 0 if writes are synchronous
+	 */
+	inline unsigned long flushInterval() const { return _flushInterval; }
+
+	/**
+	 * @return True if this store uses the log-structured backend
+	 */
+	inline bool logStructured() const { return _log; }
+
+	/**
+	 * @return Number of times the log has been synced, once per write-behind flush
+	 */
+	inline unsigned long logSyncs() const
 	{
-		_db.clear();
-		_reload(_basePath);
+		Mutex::Lock _l(_flush_m);
+		return _logSyncs;
 	}
 
+	/**
+	 * Rewrite the checkpoint from the checkpoint and log and start a new log
+	 *
+	 * This is done automatically in the background as the log grows and does
+	 * nothing if this store does not use the log-structured backend. Writers
+	 * are only blocked while the log is being moved aside.
+	 *
+	 * @return True on success
+	 */
+	bool compact();
+
 	bool writeRaw(const std::string &n,const std::string &obj);
 
 	bool put(const std::string &n,const nlohmann::json &obj);
@@ -70,6 +147,19 @@ public:
 	inline const nlohmann::json &get(const std::string &n1,const std::string &n2,const std::string &n3,const std::string &n4,unsigned long maxSinceCheck = 0) { return this->get((n1 + "/" + n2 + "/" + n3 + "/" + n4),maxSinceCheck); }
 	inline const nlohmann::json &get(const std::string &n1,const std::string &n2,const std::string &n3,const std::string &n4,const std::string &n5,unsigned long maxSinceCheck = 0) { return this->get((n1 + "/" + n2 + "/" + n3 + "/" + n4 + "/" + n5),maxSinceCheck); }
 
+	/**
+	 * Copy an object if it is already in memory and was checked within maxSinceCheck
+	 *
+	 * Unlike get() this never touches the disk or modifies the store. If it
+	 * returns false the caller must fall back to get().
+	 *
+	 * @param n Object name
+	 * @param obj Object to fill
+	 * @param maxSinceCheck Maximum time since object was last checked against disk
+	 * @return True if obj was filled
+	 */
+	bool getCached(const std::string &n,nlohmann::json &obj,unsigned long maxSinceCheck) const;
+
 	void erase(const std::string &n);
 
 	inline void erase(const std::string &n1,const std::string &n2) { this->erase(n1 + "/" + n2); }
@@ -91,26 +181,89 @@ public:
 		}
 	}
 
+	/**
+	 * Call func(name,obj) for every object under a prefix without modifying the store
+	 *
+	 * Nothing is called and false is returned if any matching object would
+	 * have to be loaded or checked against disk, in which case the caller
+	 * must fall back to filter().
+	 *
+	 * @return True if func was called for every matching object
+	 */
+	template<typename F>
+	inline bool eachCached(const std::string &prefix,unsigned long maxSinceCheck,F func) const
+	{
+		const uint64_t now = OSUtils::now();
+		std::map<std::string,_E>::const_iterator i;
+		for(i=_db.lower_bound(prefix);((i!=_db.end())&&(i->first.length() >= prefix.length())&&(!memcmp(i->first.data(),prefix.data(),prefix.length())));++i) {
+			if (!_fresh(i->second,now,maxSinceCheck))
+				return false;
+		}
+		for(i=_db.lower_bound(prefix);((i!=_db.end())&&(i->first.length() >= prefix.length())&&(!memcmp(i->first.data(),prefix.data(),prefix.length())));++i)
+			func(i->first,i->second.obj);
+		return true;
+	}
+
 	inline bool operator==(const JSONDB &db) const { return ((_basePath == db._basePath)&&(_db == db._db)); }
 	inline bool operator!=(const JSONDB &db) const { return (!(*this == db)); }
 
+	void threadMain()
+		throw();
+
 private:
 	void _reload(const std::string &p);
 	bool _isValidObjectName(const std::string &n);
 	std::string _genPath(const std::string &n,bool create);
+	bool _isPending(const std::string &n,uint64_t &flushedLastModified);
+	static bool _writeAtomic(const std::string &path,const std::string &buf,bool sync);
+
+	void _loadLog();
+	bool _appendLog(const std::string &records,bool sync);
+	bool _compactLog();
 
 	struct _E
 	{
 		nlohmann::json obj;
+		std::string raw; // log backend only: unparsed JSON, parsed into obj on first access
 		uint64_t lastModifiedOnDisk;
 		uint64_t lastCheck;
 
-		inline bool operator==(const _E &e) const { return (obj == e.obj); }
-		inline bool operator!=(const _E &e) const { return (obj != e.obj); }
+		inline bool operator==(const _E &e) const { return ((obj == e.obj)&&(raw == e.raw)); }
+		inline bool operator!=(const _E &e) const { return (!(*this == e)); }
+	};
+
+	inline bool _fresh(const _E &e,const uint64_t now,const unsigned long maxSinceCheck) const
+	{
+		if (_log)
+			return (e.raw.length() == 0);
+		return ((now - e.lastCheck) <= (uint64_t)maxSinceCheck);
+	}
+
+	// A change waiting to be written by the flusher (erase is true for deletes)
+	struct _W
+	{
+		nlohmann::json obj;
+		bool erase;
 	};
 
 	std::string _basePath;
 	std::map<std::string,_E> _db;
+
+	const unsigned long _flushInterval;
+	std::map<std::string,_W> _pending;
+	std::map<std::string,uint64_t> _flushed; // last modified times of files written by the flusher, applied to _db on next disk check
+	Mutex _pending_m;
+	Mutex _flush_m; // also guards the log file and its size counters
+	Thread _thread;
+	volatile bool _run;
+
+	const bool _log;
+	FILE *_logFile;
+	uint64_t _logSize;
+	uint64_t _checkpointSize;
+	unsigned long _logSyncs;
+	Mutex _compact_m; // held for a whole compaction, taken before _flush_m
+	volatile bool _compactDue;
 };
 
 } // namespace ZeroTier
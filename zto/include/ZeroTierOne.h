@@ -816,6 +816,42 @@ typedef struct
 	unsigned long adi;
 } ZT_MulticastGroup;
 
+/**
+ * A frame from a virtual network port, one of a burst passed to ZT_Node_processVirtualNetworkFrames()
+ */
+typedef struct
+{
+	/**
+	 * Source MAC address (least significant 48 bits)
+	 */
+	uint64_t sourceMac;
+
+	/**
+	 * Destination MAC address (least significant 48 bits)
+	 */
+	uint64_t destMac;
+
+	/**
+	 * 16-bit Ethernet frame type
+	 */
+	unsigned int etherType;
+
+	/**
+	 * 10-bit VLAN ID or 0 if none
+	 */
+	unsigned int vlanId;
+
+	/**
+	 * Frame payload data
+	 */
+	const void *data;
+
+	/**
+	 * Frame payload length
+	 */
+	unsigned int len;
+} ZT_VirtualNetworkFrame;
+
 /**
  * Virtual network configuration update type
  */
@@ -852,6 +888,33 @@ enum ZT_PeerRole
 	ZT_PEER_ROLE_PLANET = 2      // planetary root
 };
 
+/**
+ * How traffic to a peer is spread over its direct paths
+ */
+enum ZT_BondingPolicy
+{
+	/**
+	 * Send everything over the single best path (default)
+	 */
+	ZT_BONDING_POLICY_NONE = 0,
+
+	/**
+	 * Send each flow (IP addresses, protocol and ports) over one of the alive paths
+	 *
+	 * Flows stay on their path and keep their packet order. Only flows on a
+	 * path that fails are moved.
+	 */
+	ZT_BONDING_POLICY_BALANCE_FLOW = 1,
+
+	/**
+	 * Send frames over all alive paths in turn, weighted by latency and link quality
+	 *
+	 * This can use the bandwidth of all paths for a single flow, but frames
+	 * of a flow may arrive out of order.
+	 */
+	ZT_BONDING_POLICY_BALANCE_RR = 2
+};
+
 /**
  * Vendor ID
  */
@@ -1046,6 +1109,21 @@ typedef struct
 	 */
 	int linkQuality;
 
+	/**
+	 * Smoothed round trip time in milliseconds or -1 if not yet measured
+	 */
+	int latency;
+
+	/**
+	 * Mean deviation of round trip time in milliseconds or -1 if not yet measured
+	 */
+	int jitter;
+
+	/**
+	 * Share of recent ECHO and HELLO probes lost from 0 to 1000
+	 */
+	int packetLoss;
+
 	/**
 	 * Is path expired?
 	 */
@@ -1373,6 +1451,26 @@ typedef struct {
 	 * Cluster member statuses
 	 */
 	ZT_ClusterMemberStatus members[ZT_CLUSTER_MAX_MEMBERS];
+
+	/**
+	 * Total bytes of state messages sent to other members over the backplane
+	 */
+	uint64_t backplaneBytesSent;
+
+	/**
+	 * Total bytes of state messages received from other members over the backplane
+	 */
+	uint64_t backplaneBytesReceived;
+
+	/**
+	 * Backplane bytes sent per second (as of the last statistics update)
+	 */
+	uint64_t backplaneBytesSentPerSecond;
+
+	/**
+	 * Backplane bytes received per second (as of the last statistics update)
+	 */
+	uint64_t backplaneBytesReceivedPerSecond;
 } ZT_ClusterStatus;
 
 /**
@@ -1718,6 +1816,32 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	unsigned int frameLength,
 	volatile uint64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Process a burst of frames from a virtual network port (tap)
+ *
+ * This is equivalent to calling ZT_Node_processVirtualNetworkFrame() for each
+ * frame in order, but looks the network up once for the whole burst. Every
+ * frame is still filtered and encrypted on its own. Wire packets generated by
+ * the burst are handed to the wire packet send function as the frames are
+ * processed, so a caller that wants to batch its sends (e.g. with sendmmsg())
+ * can hold them until this returns.
+ *
+ * @param node Node instance
+ * @param now Current clock in milliseconds
+ * @param nwid ZeroTier 64-bit virtual network ID
+ * @param frames Frames in the order they were sent by the port
+ * @param frameCount Number of frames
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	uint64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
 /**
  * Perform periodic background operations
  *
@@ -1728,6 +1852,38 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
  */
 enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Do a piece of CPU-heavy background work in the calling thread
+ *
+ * Learning a new peer costs a memory-hard hash of its identity and a key
+ * agreement. Hosts that can spare threads should call this in a loop from
+ * one or more threads of their own: once it has been called the node queues
+ * that work for them instead of doing it in whatever thread delivered the
+ * packet, which keeps a flood of new identities from stalling everything
+ * else. Call this from any number of threads at once.
+ *
+ * This blocks until a piece of work is done and returns 1, after which
+ * ZT_Node_processBackgroundTasks() or ZT_Node_processWirePacket() should be
+ * called soon to act on it. It returns 0 once ZT_Node_stopBackgroundWork()
+ * has been called, and the thread should then exit.
+ *
+ * Callbacks are never made from this function.
+ *
+ * @param node Node instance
+ * @return 1 after doing work, 0 if the thread should exit
+ */
+int ZT_Node_processBackgroundWork(ZT_Node *node);
+
+/**
+ * Make current and future calls to ZT_Node_processBackgroundWork() return 0
+ *
+ * Call this and join the threads calling ZT_Node_processBackgroundWork()
+ * before calling ZT_Node_delete().
+ *
+ * @param node Node instance
+ */
+void ZT_Node_stopBackgroundWork(ZT_Node *node);
+
 /**
  * Join a network
  *
@@ -1854,6 +2010,32 @@ void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status);
  */
 ZT_PeerList *ZT_Node_peers(ZT_Node *node);
 
+/**
+ * Get known peers with addresses in a range, lowest address first
+ *
+ * This walks a large peer table a page at a time without copying all of it.
+ * For the next page pass the address of the last peer returned plus one as
+ * start. Fewer than maxPeers results means the range has been exhausted.
+ * Peers learned or forgotten during a walk may or may not be seen.
+ *
+ * If changedSince is nonzero only peers that were learned, or whose remote
+ * version or set of direct paths changed, at or after that time are
+ * returned. Traffic, latency and path expiration are not changes, and
+ * forgotten peers are not reported, so an incremental view should still be
+ * rebuilt from a full walk now and then.
+ *
+ * The pointer returned here must be freed with freeQueryResult()
+ * when you are done with it.
+ *
+ * @param node Node instance
+ * @param start Lowest address to return
+ * @param end Highest address to return (0xffffffffff for no limit)
+ * @param maxPeers Maximum number of peers to return
+ * @param changedSince Time in ms, or 0 to return peers whether changed or not
+ * @return List of peers or NULL on failure
+ */
+ZT_PeerList *ZT_Node_queryPeers(ZT_Node *node,uint64_t start,uint64_t end,unsigned long maxPeers,uint64_t changedSince);
+
 /**
  * Get the status of a virtual network
  *
@@ -2110,6 +2292,20 @@ void ZT_Node_clusterStatus(ZT_Node *node,ZT_ClusterStatus *cs);
  */
 void ZT_Node_setTrustedPaths(ZT_Node *node,const struct sockaddr_storage *networks,const uint64_t *ids,unsigned int count);
 
+/**
+ * Set how frames to peers with more than one direct path are spread over them
+ *
+ * With any policy other than ZT_BONDING_POLICY_NONE, paths that are being
+ * sent over but have not heard anything in a second are sent a HELLO, and
+ * leave the bond if it goes unanswered for another second. Traffic moves to
+ * the paths that remain instead of waiting for the path to time out. Other
+ * traffic (control messages, multicast, relaying) still takes the best path.
+ *
+ * @param node Node instance
+ * @param policy Bonding policy
+ */
+void ZT_Node_setBondingPolicy(ZT_Node *node,enum ZT_BondingPolicy policy);
+
 /**
  * Get ZeroTier One version
  *
@@ -57,6 +57,18 @@ public:
 #endif
 	}
 
+	/**
+	 * @return Current value, which another thread may change right after
+	 */
+	inline int load() const
+	{
+#ifdef __GNUC__
+		return *(reinterpret_cast<const volatile int *>(&_v));
+#else
+		return _v.load();
+#endif
+	}
+
 private:
 #ifdef __GNUC__
 	int _v;
@@ -13,6 +13,8 @@ Derived from public domain code by D. J. Bernstein.
 #include <stdlib.h>
 #include <string.h>
 
+#include <vector>
+
 #include "Constants.hpp"
 #include "C25519.hpp"
 #include "SHA512.hpp"
@@ -22,6 +24,14 @@ Derived from public domain code by D. J. Bernstein.
 #pragma warning(disable: 4146)
 #endif
 
+// The radix 2^51 backend needs 64x64->128 bit multiplies
+#if defined(__SIZEOF_INT128__) && !defined(ZT_C25519_NO_FIELD51)
+#define ZT_C25519_FIELD51 1
+#endif
+
+// Signatures checked together by one batch verification
+#define ZT_C25519_BATCH_MAX 32
+
 namespace ZeroTier {
 
 //////////////////////////////////////////////////////////////////////////////
@@ -2267,13 +2277,1055 @@ static int crypto_sign_open(
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+// Radix 2^51 backend, after ref10 and curve25519-donna-c64. Field elements
+// are five 51-bit limbs multiplied with 64x64->128 bit products, which is far
+// fewer and cheaper multiplies than the 32 byte-sized limbs above. Scalar
+// arithmetic (sc25519) and the window recodings are shared with the code
+// above, so both backends compute exactly the same things.
+
+#ifdef ZT_C25519_FIELD51
+
+typedef unsigned __int128 fe51_uint128;
+
+// Limbs stay below 2^53 between operations. fe51_mul() and fe51_sq() return
+// limbs below 2^51 + 2^13, fe51_add() does not carry so it adds a bit, and
+// fe51_sub() carries so subtracting a sum of two products is always safe.
+typedef struct
+{
+	uint64_t v[5];
+} fe51;
+
+#define FE51_MASK 0x7ffffffffffffULL
+
+static inline uint64_t fe51_load64(const unsigned char *s)
+{
+	return ( ((uint64_t)s[0]) | ((uint64_t)s[1] << 8) | ((uint64_t)s[2] << 16) | ((uint64_t)s[3] << 24) | ((uint64_t)s[4] << 32) | ((uint64_t)s[5] << 40) | ((uint64_t)s[6] << 48) | ((uint64_t)s[7] << 56) );
+}
+
+static inline void fe51_store64(unsigned char *s,uint64_t x)
+{
+	for(unsigned int i=0;i<8;++i) {
+		s[i] = (unsigned char)x;
+		x >>= 8;
+	}
+}
+
+static inline void fe51_0(fe51 *h)
+{
+	h->v[0] = 0; h->v[1] = 0; h->v[2] = 0; h->v[3] = 0; h->v[4] = 0;
+}
+
+static inline void fe51_1(fe51 *h)
+{
+	h->v[0] = 1; h->v[1] = 0; h->v[2] = 0; h->v[3] = 0; h->v[4] = 0;
+}
+
+// The top bit of s[31] is ignored
+static inline void fe51_frombytes(fe51 *h,const unsigned char s[32])
+{
+	const uint64_t x0 = fe51_load64(s);
+	const uint64_t x1 = fe51_load64(s + 8);
+	const uint64_t x2 = fe51_load64(s + 16);
+	const uint64_t x3 = fe51_load64(s + 24);
+	h->v[0] = x0 & FE51_MASK;
+	h->v[1] = ((x0 >> 51) | (x1 << 13)) & FE51_MASK;
+	h->v[2] = ((x1 >> 38) | (x2 << 26)) & FE51_MASK;
+	h->v[3] = ((x2 >> 25) | (x3 << 39)) & FE51_MASK;
+	h->v[4] = (x3 >> 12) & FE51_MASK;
+}
+
+#define FE51_CARRY(t) \
+	t[1] += t[0] >> 51; t[0] &= FE51_MASK; \
+	t[2] += t[1] >> 51; t[1] &= FE51_MASK; \
+	t[3] += t[2] >> 51; t[2] &= FE51_MASK; \
+	t[4] += t[3] >> 51; t[3] &= FE51_MASK; \
+	t[0] += 19ULL * (t[4] >> 51); t[4] &= FE51_MASK
+
+// Always the canonical encoding, fully reduced mod p
+static inline void fe51_tobytes(unsigned char s[32],const fe51 *h)
+{
+	uint64_t t[5];
+	t[0] = h->v[0]; t[1] = h->v[1]; t[2] = h->v[2]; t[3] = h->v[3]; t[4] = h->v[4];
+
+	FE51_CARRY(t);
+	FE51_CARRY(t);
+	// t is now below 2^255, add 19 and see if that carries past 2^255 to find out if t >= p
+	t[0] += 19ULL;
+	FE51_CARRY(t);
+	// Offset by 19 either way, take it back off by adding 2^255 - 19 and dropping 2^255
+	t[0] += 0x8000000000000ULL - 19ULL;
+	t[1] += 0x8000000000000ULL - 1ULL;
+	t[2] += 0x8000000000000ULL - 1ULL;
+	t[3] += 0x8000000000000ULL - 1ULL;
+	t[4] += 0x8000000000000ULL - 1ULL;
+	t[1] += t[0] >> 51; t[0] &= FE51_MASK;
+	t[2] += t[1] >> 51; t[1] &= FE51_MASK;
+	t[3] += t[2] >> 51; t[2] &= FE51_MASK;
+	t[4] += t[3] >> 51; t[3] &= FE51_MASK;
+	t[4] &= FE51_MASK;
+
+	fe51_store64(s,t[0] | (t[1] << 51));
+	fe51_store64(s + 8,(t[1] >> 13) | (t[2] << 38));
+	fe51_store64(s + 16,(t[2] >> 26) | (t[3] << 25));
+	fe51_store64(s + 24,(t[3] >> 39) | (t[4] << 12));
+}
+
+static inline void fe51_add(fe51 *h,const fe51 *f,const fe51 *g)
+{
+	h->v[0] = f->v[0] + g->v[0];
+	h->v[1] = f->v[1] + g->v[1];
+	h->v[2] = f->v[2] + g->v[2];
+	h->v[3] = f->v[3] + g->v[3];
+	h->v[4] = f->v[4] + g->v[4];
+}
+
+// Adds 4p first so limbs of g up to 2^53 don't go below zero
+static inline void fe51_sub(fe51 *h,const fe51 *f,const fe51 *g)
+{
+	uint64_t t[5];
+	t[0] = (f->v[0] + 0x1fffffffffffb4ULL) - g->v[0];
+	t[1] = (f->v[1] + 0x1ffffffffffffcULL) - g->v[1];
+	t[2] = (f->v[2] + 0x1ffffffffffffcULL) - g->v[2];
+	t[3] = (f->v[3] + 0x1ffffffffffffcULL) - g->v[3];
+	t[4] = (f->v[4] + 0x1ffffffffffffcULL) - g->v[4];
+	FE51_CARRY(t);
+	h->v[0] = t[0]; h->v[1] = t[1]; h->v[2] = t[2]; h->v[3] = t[3]; h->v[4] = t[4];
+}
+
+static inline void fe51_neg(fe51 *h,const fe51 *f)
+{
+	fe51 zero;
+	fe51_0(&zero);
+	fe51_sub(h,&zero,f);
+}
+
+#define FE51_REDUCE_WIDE(h,r0,r1,r2,r3,r4) { \
+	uint64_t c; \
+	r1 += (uint64_t)(r0 >> 51); \
+	r2 += (uint64_t)(r1 >> 51); \
+	r3 += (uint64_t)(r2 >> 51); \
+	r4 += (uint64_t)(r3 >> 51); \
+	h->v[0] = ((uint64_t)r0 & FE51_MASK) + (19ULL * (uint64_t)(r4 >> 51)); \
+	h->v[1] = (uint64_t)r1 & FE51_MASK; \
+	h->v[2] = (uint64_t)r2 & FE51_MASK; \
+	h->v[3] = (uint64_t)r3 & FE51_MASK; \
+	h->v[4] = (uint64_t)r4 & FE51_MASK; \
+	c = h->v[0] >> 51; h->v[0] &= FE51_MASK; h->v[1] += c; \
+	c = h->v[1] >> 51; h->v[1] &= FE51_MASK; h->v[2] += c; \
+}
+
+static inline void fe51_mul(fe51 *h,const fe51 *f,const fe51 *g)
+{
+	const uint64_t f0 = f->v[0],f1 = f->v[1],f2 = f->v[2],f3 = f->v[3],f4 = f->v[4];
+	const uint64_t g0 = g->v[0],g1 = g->v[1],g2 = g->v[2],g3 = g->v[3],g4 = g->v[4];
+	const uint64_t g1_19 = 19ULL * g1,g2_19 = 19ULL * g2,g3_19 = 19ULL * g3,g4_19 = 19ULL * g4;
+
+	fe51_uint128 r0 = ((fe51_uint128)f0 * g0) + ((fe51_uint128)f1 * g4_19) + ((fe51_uint128)f2 * g3_19) + ((fe51_uint128)f3 * g2_19) + ((fe51_uint128)f4 * g1_19);
+	fe51_uint128 r1 = ((fe51_uint128)f0 * g1) + ((fe51_uint128)f1 * g0) + ((fe51_uint128)f2 * g4_19) + ((fe51_uint128)f3 * g3_19) + ((fe51_uint128)f4 * g2_19);
+	fe51_uint128 r2 = ((fe51_uint128)f0 * g2) + ((fe51_uint128)f1 * g1) + ((fe51_uint128)f2 * g0) + ((fe51_uint128)f3 * g4_19) + ((fe51_uint128)f4 * g3_19);
+	fe51_uint128 r3 = ((fe51_uint128)f0 * g3) + ((fe51_uint128)f1 * g2) + ((fe51_uint128)f2 * g1) + ((fe51_uint128)f3 * g0) + ((fe51_uint128)f4 * g4_19);
+	fe51_uint128 r4 = ((fe51_uint128)f0 * g4) + ((fe51_uint128)f1 * g3) + ((fe51_uint128)f2 * g2) + ((fe51_uint128)f3 * g1) + ((fe51_uint128)f4 * g0);
+
+	FE51_REDUCE_WIDE(h,r0,r1,r2,r3,r4);
+}
+
+static inline void fe51_sq(fe51 *h,const fe51 *f)
+{
+	const uint64_t f0 = f->v[0],f1 = f->v[1],f2 = f->v[2],f3 = f->v[3],f4 = f->v[4];
+	const uint64_t f0_2 = f0 << 1,f1_2 = f1 << 1;
+	const uint64_t f1_38 = 38ULL * f1,f2_38 = 38ULL * f2,f3_38 = 38ULL * f3;
+	const uint64_t f3_19 = 19ULL * f3,f4_19 = 19ULL * f4;
+
+	fe51_uint128 r0 = ((fe51_uint128)f0 * f0) + ((fe51_uint128)f1_38 * f4) + ((fe51_uint128)f2_38 * f3);
+	fe51_uint128 r1 = ((fe51_uint128)f0_2 * f1) + ((fe51_uint128)f2_38 * f4) + ((fe51_uint128)f3_19 * f3);
+	fe51_uint128 r2 = ((fe51_uint128)f0_2 * f2) + ((fe51_uint128)f1 * f1) + ((fe51_uint128)f3_38 * f4);
+	fe51_uint128 r3 = ((fe51_uint128)f0_2 * f3) + ((fe51_uint128)f1_2 * f2) + ((fe51_uint128)f4_19 * f4);
+	fe51_uint128 r4 = ((fe51_uint128)f0_2 * f4) + ((fe51_uint128)f1_2 * f3) + ((fe51_uint128)f2 * f2);
+
+	FE51_REDUCE_WIDE(h,r0,r1,r2,r3,r4);
+}
+
+static inline void fe51_sqn(fe51 *h,const fe51 *f,unsigned int n)
+{
+	fe51_sq(h,f);
+	while (--n)
+		fe51_sq(h,h);
+}
+
+static inline void fe51_mul121665(fe51 *h,const fe51 *f)
+{
+	fe51_uint128 r0 = (fe51_uint128)f->v[0] * 121665ULL;
+	fe51_uint128 r1 = (fe51_uint128)f->v[1] * 121665ULL;
+	fe51_uint128 r2 = (fe51_uint128)f->v[2] * 121665ULL;
+	fe51_uint128 r3 = (fe51_uint128)f->v[3] * 121665ULL;
+	fe51_uint128 r4 = (fe51_uint128)f->v[4] * 121665ULL;
+	FE51_REDUCE_WIDE(h,r0,r1,r2,r3,r4);
+}
+
+/* Constant-time version of: if(b) f = g */
+static inline void fe51_cmov(fe51 *f,const fe51 *g,unsigned int b)
+{
+	const uint64_t mask = (uint64_t)0 - (uint64_t)b;
+	for(unsigned int i=0;i<5;++i)
+		f->v[i] ^= mask & (f->v[i] ^ g->v[i]);
+}
+
+/* Constant-time version of: if(b) swap(f,g) */
+static inline void fe51_cswap(fe51 *f,fe51 *g,unsigned int b)
+{
+	const uint64_t mask = (uint64_t)0 - (uint64_t)b;
+	for(unsigned int i=0;i<5;++i) {
+		const uint64_t x = mask & (f->v[i] ^ g->v[i]);
+		f->v[i] ^= x;
+		g->v[i] ^= x;
+	}
+}
+
+static inline int fe51_isnegative(const fe51 *f)
+{
+	unsigned char s[32];
+	fe51_tobytes(s,f);
+	return (s[0] & 1);
+}
+
+static inline int fe51_iszero(const fe51 *f)
+{
+	unsigned char s[32];
+	fe51_tobytes(s,f);
+	unsigned char x = 0;
+	for(unsigned int i=0;i<32;++i)
+		x |= s[i];
+	return (x == 0);
+}
+
+/* z^(p-2) */
+static void fe51_invert(fe51 *out,const fe51 *z)
+{
+	fe51 t0,t1,t2,t3;
+	fe51_sq(&t0,z);              /* 2 */
+	fe51_sqn(&t1,&t0,2);         /* 8 */
+	fe51_mul(&t1,z,&t1);         /* 9 */
+	fe51_mul(&t0,&t0,&t1);       /* 11 */
+	fe51_sq(&t2,&t0);            /* 22 */
+	fe51_mul(&t1,&t1,&t2);       /* 2^5 - 2^0 */
+	fe51_sqn(&t2,&t1,5);         /* 2^10 - 2^5 */
+	fe51_mul(&t1,&t2,&t1);       /* 2^10 - 2^0 */
+	fe51_sqn(&t2,&t1,10);        /* 2^20 - 2^10 */
+	fe51_mul(&t2,&t2,&t1);       /* 2^20 - 2^0 */
+	fe51_sqn(&t3,&t2,20);        /* 2^40 - 2^20 */
+	fe51_mul(&t2,&t3,&t2);       /* 2^40 - 2^0 */
+	fe51_sqn(&t2,&t2,10);        /* 2^50 - 2^10 */
+	fe51_mul(&t1,&t2,&t1);       /* 2^50 - 2^0 */
+	fe51_sqn(&t2,&t1,50);        /* 2^100 - 2^50 */
+	fe51_mul(&t2,&t2,&t1);       /* 2^100 - 2^0 */
+	fe51_sqn(&t3,&t2,100);       /* 2^200 - 2^100 */
+	fe51_mul(&t2,&t3,&t2);       /* 2^200 - 2^0 */
+	fe51_sqn(&t2,&t2,50);        /* 2^250 - 2^50 */
+	fe51_mul(&t1,&t2,&t1);       /* 2^250 - 2^0 */
+	fe51_sqn(&t1,&t1,5);         /* 2^255 - 2^5 */
+	fe51_mul(out,&t1,&t0);       /* 2^255 - 21 */
+}
+
+/* z^((p-5)/8) */
+static void fe51_pow22523(fe51 *out,const fe51 *z)
+{
+	fe51 t0,t1,t2;
+	fe51_sq(&t0,z);              /* 2 */
+	fe51_sqn(&t1,&t0,2);         /* 8 */
+	fe51_mul(&t1,z,&t1);         /* 9 */
+	fe51_mul(&t0,&t0,&t1);       /* 11 */
+	fe51_sq(&t0,&t0);            /* 22 */
+	fe51_mul(&t0,&t1,&t0);       /* 2^5 - 2^0 */
+	fe51_sqn(&t1,&t0,5);         /* 2^10 - 2^5 */
+	fe51_mul(&t0,&t1,&t0);       /* 2^10 - 2^0 */
+	fe51_sqn(&t1,&t0,10);        /* 2^20 - 2^10 */
+	fe51_mul(&t1,&t1,&t0);       /* 2^20 - 2^0 */
+	fe51_sqn(&t2,&t1,20);        /* 2^40 - 2^20 */
+	fe51_mul(&t1,&t2,&t1);       /* 2^40 - 2^0 */
+	fe51_sqn(&t1,&t1,10);        /* 2^50 - 2^10 */
+	fe51_mul(&t0,&t1,&t0);       /* 2^50 - 2^0 */
+	fe51_sqn(&t1,&t0,50);        /* 2^100 - 2^50 */
+	fe51_mul(&t1,&t1,&t0);       /* 2^100 - 2^0 */
+	fe51_sqn(&t2,&t1,100);       /* 2^200 - 2^100 */
+	fe51_mul(&t1,&t2,&t1);       /* 2^200 - 2^0 */
+	fe51_sqn(&t1,&t1,50);        /* 2^250 - 2^50 */
+	fe51_mul(&t0,&t1,&t0);       /* 2^250 - 2^0 */
+	fe51_sqn(&t0,&t0,2);         /* 2^252 - 2^2 */
+	fe51_mul(out,&t0,z);         /* 2^252 - 3 */
+}
+
+static inline void fe51_from25519(fe51 *h,const fe25519 *x)
+{
+	unsigned char s[32];
+	fe25519_pack(s,x);
+	fe51_frombytes(h,s);
+}
+
+/* Curve25519 Montgomery ladder, same clamping and result as crypto_scalarmult() */
+static void x25519_51(unsigned char *q,const unsigned char *n,const unsigned char *p)
+{
+	unsigned char e[32];
+	fe51 x1,x2,z2,x3,z3,a,aa,b,bb,ee,c,d,da,cb;
+	unsigned int swap = 0;
+
+	for(unsigned int i=0;i<32;++i)
+		e[i] = n[i];
+	e[0] &= 248;
+	e[31] &= 127;
+	e[31] |= 64;
+
+	fe51_frombytes(&x1,p);
+	x1.v[0] += 19ULL * (p[31] >> 7); // crypto_scalarmult() takes all 256 bits, and 2^255 = 19 mod p
+	fe51_1(&x2);
+	fe51_0(&z2);
+	x3 = x1;
+	fe51_1(&z3);
+
+	for(int pos=254;pos>=0;--pos) {
+		const unsigned int bit = (e[pos >> 3] >> (pos & 7)) & 1;
+		swap ^= bit;
+		fe51_cswap(&x2,&x3,swap);
+		fe51_cswap(&z2,&z3,swap);
+		swap = bit;
+
+		fe51_add(&a,&x2,&z2);
+		fe51_sq(&aa,&a);
+		fe51_sub(&b,&x2,&z2);
+		fe51_sq(&bb,&b);
+		fe51_sub(&ee,&aa,&bb);
+		fe51_add(&c,&x3,&z3);
+		fe51_sub(&d,&x3,&z3);
+		fe51_mul(&da,&d,&a);
+		fe51_mul(&cb,&c,&b);
+		fe51_add(&x3,&da,&cb);
+		fe51_sq(&x3,&x3);
+		fe51_sub(&z3,&da,&cb);
+		fe51_sq(&z3,&z3);
+		fe51_mul(&z3,&z3,&x1);
+		fe51_mul(&x2,&aa,&bb);
+		fe51_mul121665(&z2,&ee);
+		fe51_add(&z2,&z2,&aa);
+		fe51_mul(&z2,&z2,&ee);
+	}
+	fe51_cswap(&x2,&x3,swap);
+	fe51_cswap(&z2,&z3,swap);
+
+	fe51_invert(&z2,&z2);
+	fe51_mul(&x2,&x2,&z2);
+	fe51_tobytes(q,&x2);
+}
+
+// Ed25519 points in ref10's representations: extended (p3), projective (p2),
+// completed (p1p1), and cached forms for additions with a fixed point.
+typedef struct { fe51 X,Y,Z; } ge51_p2;
+typedef struct { fe51 X,Y,Z,T; } ge51_p3;
+typedef struct { fe51 X,Y,Z,T; } ge51_p1p1;
+typedef struct { fe51 yplusx,yminusx,xy2d; } ge51_precomp; // affine
+typedef struct { fe51 YplusX,YminusX,Z,T2d; } ge51_cached;
+
+static inline void ge51_p2_0(ge51_p2 *h)
+{
+	fe51_0(&h->X);
+	fe51_1(&h->Y);
+	fe51_1(&h->Z);
+}
+
+static inline void ge51_p3_0(ge51_p3 *h)
+{
+	fe51_0(&h->X);
+	fe51_1(&h->Y);
+	fe51_1(&h->Z);
+	fe51_0(&h->T);
+}
+
+static inline void ge51_p1p1_to_p2(ge51_p2 *r,const ge51_p1p1 *p)
+{
+	fe51_mul(&r->X,&p->X,&p->T);
+	fe51_mul(&r->Y,&p->Y,&p->Z);
+	fe51_mul(&r->Z,&p->Z,&p->T);
+}
+
+static inline void ge51_p1p1_to_p3(ge51_p3 *r,const ge51_p1p1 *p)
+{
+	fe51_mul(&r->X,&p->X,&p->T);
+	fe51_mul(&r->Y,&p->Y,&p->Z);
+	fe51_mul(&r->Z,&p->Z,&p->T);
+	fe51_mul(&r->T,&p->X,&p->Y);
+}
+
+static inline void ge51_p3_to_cached(ge51_cached *r,const ge51_p3 *p,const fe51 *d2)
+{
+	fe51_add(&r->YplusX,&p->Y,&p->X);
+	fe51_sub(&r->YminusX,&p->Y,&p->X);
+	r->Z = p->Z;
+	fe51_mul(&r->T2d,&p->T,d2);
+}
+
+/* See http://www.hyperelliptic.org/EFD/g1p/auto-twisted-extended-1.html#doubling-dbl-2008-hwcd */
+static inline void ge51_p2_dbl(ge51_p1p1 *r,const ge51_p2 *p)
+{
+	fe51 t0;
+	fe51_sq(&r->X,&p->X);
+	fe51_sq(&r->Z,&p->Y);
+	fe51_sq(&r->T,&p->Z);
+	fe51_add(&r->T,&r->T,&r->T);
+	fe51_add(&r->Y,&p->X,&p->Y);
+	fe51_sq(&t0,&r->Y);
+	fe51_add(&r->Y,&r->Z,&r->X);
+	fe51_sub(&r->Z,&r->Z,&r->X);
+	fe51_sub(&r->X,&t0,&r->Y);
+	fe51_sub(&r->T,&r->T,&r->Z);
+}
+
+static inline void ge51_p3_dbl(ge51_p1p1 *r,const ge51_p3 *p)
+{
+	ge51_p2 q;
+	q.X = p->X;
+	q.Y = p->Y;
+	q.Z = p->Z;
+	ge51_p2_dbl(r,&q);
+}
+
+/* r = p + q */
+static inline void ge51_add(ge51_p1p1 *r,const ge51_p3 *p,const ge51_cached *q)
+{
+	fe51 t0;
+	fe51_add(&r->X,&p->Y,&p->X);
+	fe51_sub(&r->Y,&p->Y,&p->X);
+	fe51_mul(&r->Z,&r->X,&q->YplusX);
+	fe51_mul(&r->Y,&r->Y,&q->YminusX);
+	fe51_mul(&r->T,&q->T2d,&p->T);
+	fe51_mul(&r->X,&p->Z,&q->Z);
+	fe51_add(&t0,&r->X,&r->X);
+	fe51_sub(&r->X,&r->Z,&r->Y);
+	fe51_add(&r->Y,&r->Z,&r->Y);
+	fe51_add(&r->Z,&t0,&r->T);
+	fe51_sub(&r->T,&t0,&r->T);
+}
+
+/* r = p - q */
+static inline void ge51_sub(ge51_p1p1 *r,const ge51_p3 *p,const ge51_cached *q)
+{
+	fe51 t0;
+	fe51_add(&r->X,&p->Y,&p->X);
+	fe51_sub(&r->Y,&p->Y,&p->X);
+	fe51_mul(&r->Z,&r->X,&q->YminusX);
+	fe51_mul(&r->Y,&r->Y,&q->YplusX);
+	fe51_mul(&r->T,&q->T2d,&p->T);
+	fe51_mul(&r->X,&p->Z,&q->Z);
+	fe51_add(&t0,&r->X,&r->X);
+	fe51_sub(&r->X,&r->Z,&r->Y);
+	fe51_add(&r->Y,&r->Z,&r->Y);
+	fe51_sub(&r->Z,&t0,&r->T);
+	fe51_add(&r->T,&t0,&r->T);
+}
+
+/* r = p + q */
+static inline void ge51_madd(ge51_p1p1 *r,const ge51_p3 *p,const ge51_precomp *q)
+{
+	fe51 t0;
+	fe51_add(&r->X,&p->Y,&p->X);
+	fe51_sub(&r->Y,&p->Y,&p->X);
+	fe51_mul(&r->Z,&r->X,&q->yplusx);
+	fe51_mul(&r->Y,&r->Y,&q->yminusx);
+	fe51_mul(&r->T,&q->xy2d,&p->T);
+	fe51_add(&t0,&p->Z,&p->Z);
+	fe51_sub(&r->X,&r->Z,&r->Y);
+	fe51_add(&r->Y,&r->Z,&r->Y);
+	fe51_add(&r->Z,&t0,&r->T);
+	fe51_sub(&r->T,&t0,&r->T);
+}
+
+/* r = p - q */
+static inline void ge51_msub(ge51_p1p1 *r,const ge51_p3 *p,const ge51_precomp *q)
+{
+	fe51 t0;
+	fe51_add(&r->X,&p->Y,&p->X);
+	fe51_sub(&r->Y,&p->Y,&p->X);
+	fe51_mul(&r->Z,&r->X,&q->yminusx);
+	fe51_mul(&r->Y,&r->Y,&q->yplusx);
+	fe51_mul(&r->T,&q->xy2d,&p->T);
+	fe51_add(&t0,&p->Z,&p->Z);
+	fe51_sub(&r->X,&r->Z,&r->Y);
+	fe51_add(&r->Y,&r->Z,&r->Y);
+	fe51_sub(&r->Z,&t0,&r->T);
+	fe51_add(&r->T,&t0,&r->T);
+}
+
+static inline void ge51_p3_to_precomp(ge51_precomp *r,const ge51_p3 *p,const fe51 *d2)
+{
+	fe51 zi,x,y;
+	fe51_invert(&zi,&p->Z);
+	fe51_mul(&x,&p->X,&zi);
+	fe51_mul(&y,&p->Y,&zi);
+	fe51_add(&r->yplusx,&y,&x);
+	fe51_sub(&r->yminusx,&y,&x);
+	fe51_mul(&r->xy2d,&x,&y);
+	fe51_mul(&r->xy2d,&r->xy2d,d2);
+}
+
+static inline void ge51_tobytes(unsigned char s[32],const ge51_p2 *p)
+{
+	fe51 zi,x,y;
+	fe51_invert(&zi,&p->Z);
+	fe51_mul(&x,&p->X,&zi);
+	fe51_mul(&y,&p->Y,&zi);
+	fe51_tobytes(s,&y);
+	s[31] ^= (unsigned char)(fe51_isnegative(&x) << 7);
+}
+
+static inline void ge51_p3_tobytes(unsigned char s[32],const ge51_p3 *p)
+{
+	ge51_p2 q;
+	q.X = p->X;
+	q.Y = p->Y;
+	q.Z = p->Z;
+	ge51_tobytes(s,&q);
+}
+
+// Scalars mod l as four 64-bit limbs with Montgomery multiplication (R = 2^256),
+// for batch verification where sc25519's byte-sized limbs would cost as much
+// as the curve arithmetic.
+typedef struct
+{
+	uint64_t v[4];
+} sc64;
+
+static const sc64 sc64_l = {{ 0x5812631a5cf5d3edULL,0x14def9dea2f79cd6ULL,0ULL,0x1000000000000000ULL }};
+
+static inline void sc64_frombytes(sc64 *r,const unsigned char s[32])
+{
+	for(unsigned int i=0;i<4;++i)
+		r->v[i] = fe51_load64(s + (i * 8));
+}
+
+static inline void sc64_tobytes(unsigned char s[32],const sc64 *a)
+{
+	for(unsigned int i=0;i<4;++i)
+		fe51_store64(s + (i * 8),a->v[i]);
+}
+
+/* r = t - l if t >= l, else t, where t has a fifth limb t4 */
+static inline void sc64_reduce_once(sc64 *r,const uint64_t t[4],const uint64_t t4)
+{
+	uint64_t d[4],borrow = 0;
+	for(unsigned int i=0;i<4;++i) {
+		const fe51_uint128 x = (fe51_uint128)t[i] - sc64_l.v[i] - borrow;
+		d[i] = (uint64_t)x;
+		borrow = (uint64_t)(x >> 64) & 1;
+	}
+	const uint64_t keep = (uint64_t)0 - (uint64_t)((borrow > t4) ? 1 : 0); // all ones if t < l
+	for(unsigned int i=0;i<4;++i)
+		r->v[i] = (t[i] & keep) | (d[i] & ~keep);
+}
+
+/* r = a + b mod l, for a and b below l */
+static inline void sc64_add(sc64 *r,const sc64 *a,const sc64 *b)
+{
+	uint64_t t[4];
+	fe51_uint128 c = 0;
+	for(unsigned int i=0;i<4;++i) {
+		c += (fe51_uint128)a->v[i] + b->v[i];
+		t[i] = (uint64_t)c;
+		c >>= 64;
+	}
+	sc64_reduce_once(r,t,(uint64_t)c);
+}
+
+/* r = a * b / 2^256 mod l, for any a below 2^256 and b below l (CIOS) */
+static inline void sc64_montmul(sc64 *r,const sc64 *a,const sc64 *b,const uint64_t lp)
+{
+	uint64_t t[6] = { 0,0,0,0,0,0 };
+	for(unsigned int i=0;i<4;++i) {
+		fe51_uint128 c = 0;
+		for(unsigned int j=0;j<4;++j) {
+			c += ((fe51_uint128)a->v[j] * b->v[i]) + t[j];
+			t[j] = (uint64_t)c;
+			c >>= 64;
+		}
+		c += t[4];
+		t[4] = (uint64_t)c;
+		t[5] = (uint64_t)(c >> 64);
+
+		const uint64_t m = t[0] * lp;
+		c = (((fe51_uint128)m * sc64_l.v[0]) + t[0]) >> 64;
+		for(unsigned int j=1;j<4;++j) {
+			c += ((fe51_uint128)m * sc64_l.v[j]) + t[j];
+			t[j - 1] = (uint64_t)c;
+			c >>= 64;
+		}
+		c += t[4];
+		t[3] = (uint64_t)c;
+		t[4] = t[5] + (uint64_t)(c >> 64);
+	}
+	sc64_reduce_once(r,t,t[4]);
+}
+
+// Constants and base point tables, built from the reference backend's own on first use
+struct _Ge51Constants
+{
+	_Ge51Constants()
+	{
+		// -1/l mod 2^64 by Newton's method, each step doubles the correct low bits
+		uint64_t inv = sc64_l.v[0];
+		for(unsigned int i=0;i<5;++i)
+			inv *= 2 - (sc64_l.v[0] * inv);
+		lp = (uint64_t)0 - inv;
+		// 2^512 mod l by doubling, then 2^768 mod l = montmul(2^512,2^512)
+		memset(&r2,0,sizeof(r2));
+		r2.v[0] = 1;
+		for(unsigned int i=0;i<512;++i)
+			sc64_add(&r2,&r2,&r2);
+		sc64_montmul(&r3,&r2,&r2,lp);
+
+		fe51_from25519(&d,&ge25519_ecd);
+		fe51_from25519(&d2,&ge25519_ec2d);
+		fe51_from25519(&sqrtm1,&ge25519_sqrtm1);
+
+		// 0..4 times 8^i times B for the signed radix 8 digits of sc25519_window3()
+		for(unsigned int i=0;i<425;++i) {
+			fe51 x,y;
+			fe51_from25519(&x,&ge25519_base_multiples_affine[i].x);
+			fe51_from25519(&y,&ge25519_base_multiples_affine[i].y);
+			fe51_add(&base[i].yplusx,&y,&x);
+			fe51_sub(&base[i].yminusx,&y,&x);
+			fe51_mul(&base[i].xy2d,&x,&y);
+			fe51_mul(&base[i].xy2d,&base[i].xy2d,&d2);
+		}
+
+		// B, 3B, 5B ... 15B for the sliding windows in variable time multiplication
+		ge51_p3 b,b2,u;
+		ge51_p1p1 t;
+		ge51_cached c;
+		fe51_from25519(&b.X,&ge25519_base.x);
+		fe51_from25519(&b.Y,&ge25519_base.y);
+		fe51_from25519(&b.Z,&ge25519_base.z);
+		fe51_from25519(&b.T,&ge25519_base.t);
+		ge51_p3_dbl(&t,&b);
+		ge51_p1p1_to_p3(&b2,&t);
+		u = b;
+		ge51_p3_to_precomp(&baseOdd[0],&u,&d2);
+		for(unsigned int i=1;i<8;++i) {
+			ge51_p3_to_cached(&c,&u,&d2);
+			ge51_add(&t,&b2,&c);
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_p3_to_precomp(&baseOdd[i],&u,&d2);
+		}
+	}
+
+	fe51 d,d2,sqrtm1;
+	uint64_t lp;
+	sc64 r2,r3;
+	ge51_precomp base[425];
+	ge51_precomp baseOdd[8];
+};
+
+static inline const _Ge51Constants &ge51_constants()
+{
+	static const _Ge51Constants k;
+	return k;
+}
+
+/* Decodes -P, 0 on success or -1 if the encoding isn't a point */
+static int ge51_frombytes_negate_vartime(ge51_p3 *h,const unsigned char s[32],const _Ge51Constants &k)
+{
+	fe51 u,v,v3,vxx,check;
+
+	fe51_frombytes(&h->Y,s);
+	fe51_1(&h->Z);
+	fe51_sq(&u,&h->Y);
+	fe51_mul(&v,&u,&k.d);
+	fe51_sub(&u,&u,&h->Z);        /* u = y^2-1 */
+	fe51_add(&v,&v,&h->Z);        /* v = dy^2+1 */
+
+	fe51_sq(&v3,&v);
+	fe51_mul(&v3,&v3,&v);         /* v3 = v^3 */
+	fe51_sq(&h->X,&v3);
+	fe51_mul(&h->X,&h->X,&v);
+	fe51_mul(&h->X,&h->X,&u);     /* x = uv^7 */
+
+	fe51_pow22523(&h->X,&h->X);   /* x = (uv^7)^((q-5)/8) */
+	fe51_mul(&h->X,&h->X,&v3);
+	fe51_mul(&h->X,&h->X,&u);     /* x = uv^3(uv^7)^((q-5)/8) */
+
+	fe51_sq(&vxx,&h->X);
+	fe51_mul(&vxx,&vxx,&v);
+	fe51_sub(&check,&vxx,&u);     /* vx^2-u */
+	if (!fe51_iszero(&check)) {
+		fe51_add(&check,&vxx,&u);   /* vx^2+u */
+		if (!fe51_iszero(&check))
+			return -1;
+		fe51_mul(&h->X,&h->X,&k.sqrtm1);
+	}
+
+	if (fe51_isnegative(&h->X) == (s[31] >> 7))
+		fe51_neg(&h->X,&h->X);
+
+	fe51_mul(&h->T,&h->X,&h->Y);
+	return 0;
+}
+
+/* Constant-time version of: if(b) t = u */
+static inline void ge51_precomp_cmov(ge51_precomp *t,const ge51_precomp *u,unsigned char b)
+{
+	fe51_cmov(&t->yplusx,&u->yplusx,b);
+	fe51_cmov(&t->yminusx,&u->yminusx,b);
+	fe51_cmov(&t->xy2d,&u->xy2d,b);
+}
+
+static inline void ge51_select(ge51_precomp *t,const ge51_precomp *pos,signed char b)
+{
+	/* constant time */
+	ge51_precomp minust;
+	const unsigned char bnegative = negative(b);
+	const unsigned char babs = (unsigned char)(b - (((-bnegative) & b) << 1));
+	*t = pos[0];
+	ge51_precomp_cmov(t,&pos[1],equal((signed char)babs,1));
+	ge51_precomp_cmov(t,&pos[2],equal((signed char)babs,2));
+	ge51_precomp_cmov(t,&pos[3],equal((signed char)babs,3));
+	ge51_precomp_cmov(t,&pos[4],equal((signed char)babs,4));
+	minust.yplusx = t->yminusx;
+	minust.yminusx = t->yplusx;
+	fe51_neg(&minust.xy2d,&t->xy2d);
+	ge51_precomp_cmov(t,&minust,bnegative);
+}
+
+/* r = [s]B, constant time, using the same recoding as ge25519_scalarmult_base() */
+static void ge51_scalarmult_base(ge51_p3 *r,const sc25519 *s)
+{
+	const _Ge51Constants &k = ge51_constants();
+	signed char b[85];
+	ge51_precomp t;
+	ge51_p1p1 p;
+	sc25519_window3(b,s);
+	ge51_p3_0(r);
+	for(int i=0;i<85;++i) {
+		ge51_select(&t,k.base + (5 * i),b[i]);
+		ge51_madd(&p,r,&t);
+		ge51_p1p1_to_p3(r,&p);
+	}
+}
+
+/* Signed sliding window recoding of a 256-bit little-endian scalar, odd digits -15..15 */
+static void ge51_slide(signed char *r,const unsigned char *a)
+{
+	for(int i=0;i<256;++i)
+		r[i] = 1 & (a[i >> 3] >> (i & 7));
+	for(int i=0;i<256;++i) {
+		if (r[i]) {
+			for(int b=1;(b<=6)&&((i + b)<256);++b) {
+				if (r[i + b]) {
+					if ((r[i] + (r[i + b] << b)) <= 15) {
+						r[i] += r[i + b] << b;
+						r[i + b] = 0;
+					} else if ((r[i] - (r[i + b] << b)) >= -15) {
+						r[i] -= r[i + b] << b;
+						for(int k=i+b;k<256;++k) {
+							if (!r[k]) {
+								r[k] = 1;
+								break;
+							}
+							r[k] = 0;
+						}
+					} else break;
+				}
+			}
+		}
+	}
+}
+
+/* P, 3P, 5P ... 15P */
+static inline void ge51_odd_multiples(ge51_cached *out,const ge51_p3 *p,const fe51 *d2)
+{
+	ge51_p1p1 t;
+	ge51_p3 p2,u;
+	ge51_p3_to_cached(&out[0],p,d2);
+	ge51_p3_dbl(&t,p);
+	ge51_p1p1_to_p3(&p2,&t);
+	for(unsigned int i=0;i<7;++i) {
+		ge51_add(&t,&p2,&out[i]);
+		ge51_p1p1_to_p3(&u,&t);
+		ge51_p3_to_cached(&out[i + 1],&u,d2);
+	}
+}
+
+/* Packs [a]A + [b]B, variable time, for the same job as ge25519_double_scalarmult_vartime() */
+static void ge51_double_scalarmult_vartime(unsigned char out[32],const ge51_p3 *A,const unsigned char a[32],const unsigned char b[32])
+{
+	const _Ge51Constants &k = ge51_constants();
+	signed char aslide[256],bslide[256];
+	ge51_cached ai[8];
+	ge51_p1p1 t;
+	ge51_p3 u;
+	ge51_p2 r;
+	int i;
+
+	ge51_slide(aslide,a);
+	ge51_slide(bslide,b);
+	ge51_odd_multiples(ai,A,&k.d2);
+
+	ge51_p2_0(&r);
+	for(i=255;i>=0;--i) {
+		if ((aslide[i])||(bslide[i]))
+			break;
+	}
+	for(;i>=0;--i) {
+		ge51_p2_dbl(&t,&r);
+		if (aslide[i] > 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_add(&t,&u,&ai[aslide[i] / 2]);
+		} else if (aslide[i] < 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_sub(&t,&u,&ai[(-aslide[i]) / 2]);
+		}
+		if (bslide[i] > 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_madd(&t,&u,&k.baseOdd[bslide[i] / 2]);
+		} else if (bslide[i] < 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_msub(&t,&u,&k.baseOdd[(-bslide[i]) / 2]);
+		}
+		ge51_p1p1_to_p2(&r,&t);
+	}
+
+	ge51_tobytes(out,&r);
+}
+
+// True if y in a packed point is below p, i.e. it is what packing would produce
+static inline bool ge51_canonical(const unsigned char s[32])
+{
+	if ((s[31] & 0x7f) != 0x7f)
+		return true;
+	for(int i=30;i>0;--i) {
+		if (s[i] != 0xff)
+			return true;
+	}
+	return (s[0] < 0xed);
+}
+
+/* r = x mod l for a 64-byte little-endian x */
+static inline void sc64_from64bytes(sc64 *r,const unsigned char x[64],const _Ge51Constants &k)
+{
+	static const sc64 one = {{ 1ULL,0ULL,0ULL,0ULL }};
+	sc64 lo,hi;
+	sc64_frombytes(&lo,x);
+	sc64_frombytes(&hi,x + 32);
+	sc64_montmul(&lo,&lo,&k.r2,k.lp); /* lo * 2^256 */
+	sc64_montmul(&hi,&hi,&k.r3,k.lp); /* hi * 2^512 */
+	sc64_add(&lo,&lo,&hi);            /* x * 2^256 */
+	sc64_montmul(r,&lo,&one,k.lp);
+}
+
+/*
+ * Checks up to ZT_C25519_BATCH_MAX signatures at once
+ *
+ * Each signature satisfies R = [S]B - [h]A. Picking random 128-bit z for each
+ * and checking that the sum of z(SB - hA - R) over all of them is the neutral
+ * element takes one shared run of doublings for the whole batch and a single
+ * multiple of B, instead of a full double scalar multiplication each. Terms
+ * for the same key are added up first, so a batch from one signer costs
+ * little more than its R points. It is true if every signature would pass
+ * verify(), and false, except with negligible probability, if any would not.
+ * The one exception is a signer whose own key has a small order component,
+ * who could craft signatures that pass here some of the time but never in
+ * verify().
+ */
+static bool ge51_verify_batch(const unsigned int n,const C25519::Public *const *their,const void *const *msgs,const unsigned int *lens,const void *const *signatures)
+{
+	const _Ge51Constants &k = ge51_constants();
+	std::vector<ge51_cached> tables((n * 2) * 8); // distinct -A first, then -R for each signature
+	std::vector<signed char> slides(((n * 2) + 1) * 256);
+	sc64 ah[ZT_C25519_BATCH_MAX]; // sum of zh for each distinct key
+	const unsigned char *keys[ZT_C25519_BATCH_MAX];
+	unsigned int nkeys = 0;
+	unsigned char z[ZT_C25519_BATCH_MAX * 16];
+	unsigned char digest[64],hram[crypto_hash_sha512_BYTES],m[96],scalar[32];
+	sc64 sb,zs,s,h;
+	ge51_p3 p;
+
+	Utils::getSecureRandom(z,n * 16);
+	memset(&sb,0,sizeof(sb));
+	memset(scalar,0,sizeof(scalar));
+
+	for(unsigned int i=0;i<n;++i) {
+		const unsigned char *const sig = (const unsigned char *)signatures[i];
+		const unsigned char *const pk = their[i]->data + 32;
+
+		SHA512::hash(digest,msgs[i],lens[i]);
+		if (!Utils::secureEq(sig + 64,digest,32))
+			return false;
+
+		unsigned int ki = 0;
+		while ((ki < nkeys)&&(memcmp(keys[ki],pk,32)))
+			++ki;
+		if (ki == nkeys) {
+			if (ge51_frombytes_negate_vartime(&p,pk,k))
+				return false;
+			ge51_odd_multiples(&(tables[ki * 8]),&p,&k.d2);
+			keys[ki] = pk;
+			memset(&(ah[ki]),0,sizeof(sc64));
+			++nkeys;
+		}
+
+		if ((!ge51_canonical(sig))||(ge51_frombytes_negate_vartime(&p,sig,k)))
+			return false;
+		if ((sig[31] & 0x80)&&(fe51_iszero(&p.X)))
+			return false; // x = 0 packs with a clear sign bit
+		ge51_odd_multiples(&(tables[(n + i) * 8]),&p,&k.d2);
+		memcpy(scalar,z + (i * 16),16);
+		ge51_slide(&(slides[(n + i) * 256]),scalar); // z(-R)
+
+		sc64_frombytes(&zs,scalar);
+		sc64_montmul(&zs,&zs,&k.r2,k.lp); // z * 2^256, so montmul() by it is a plain multiply by z
+
+		get_hram(hram,sig,pk,m,96);
+		sc64_from64bytes(&h,hram,k);
+		sc64_montmul(&h,&h,&zs,k.lp);
+		sc64_add(&(ah[ki]),&(ah[ki]),&h); // zh(-A)
+
+		sc64_frombytes(&s,sig + 32); // not reduced, as sc25519_from32bytes() would, but the product is
+		sc64_montmul(&s,&s,&zs,k.lp);
+		sc64_add(&sb,&sb,&s);
+	}
+	for(unsigned int ki=0;ki<nkeys;++ki) {
+		sc64_tobytes(scalar,&(ah[ki]));
+		ge51_slide(&(slides[ki * 256]),scalar);
+	}
+	sc64_tobytes(scalar,&sb);
+	signed char *const bslide = &(slides[(n * 2) * 256]);
+	ge51_slide(bslide,scalar); // (sum of zS)B
+
+	// Only the distinct keys and then every R
+	unsigned int pts[ZT_C25519_BATCH_MAX * 2];
+	unsigned int np = 0;
+	for(unsigned int ki=0;ki<nkeys;++ki)
+		pts[np++] = ki;
+	for(unsigned int i=0;i<n;++i)
+		pts[np++] = n + i;
+
+	ge51_p1p1 t;
+	ge51_p3 u;
+	ge51_p2 r;
+	ge51_p2_0(&r);
+	int i = 255;
+	for(;i>=0;--i) {
+		bool any = (bslide[i] != 0);
+		for(unsigned int j=0;((!any)&&(j<np));++j)
+			any = (slides[(pts[j] * 256) + i] != 0);
+		if (any)
+			break;
+	}
+	for(;i>=0;--i) {
+		ge51_p2_dbl(&t,&r);
+		for(unsigned int j=0;j<np;++j) {
+			const signed char d = slides[(pts[j] * 256) + i];
+			if (d > 0) {
+				ge51_p1p1_to_p3(&u,&t);
+				ge51_add(&t,&u,&(tables[(pts[j] * 8) + (d / 2)]));
+			} else if (d < 0) {
+				ge51_p1p1_to_p3(&u,&t);
+				ge51_sub(&t,&u,&(tables[(pts[j] * 8) + ((-d) / 2)]));
+			}
+		}
+		if (bslide[i] > 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_madd(&t,&u,&k.baseOdd[bslide[i] / 2]);
+		} else if (bslide[i] < 0) {
+			ge51_p1p1_to_p3(&u,&t);
+			ge51_msub(&t,&u,&k.baseOdd[(-bslide[i]) / 2]);
+		}
+		ge51_p1p1_to_p2(&r,&t);
+	}
+
+	// Neutral is X = 0 and Y = Z
+	fe51 yz;
+	fe51_sub(&yz,&r.Y,&r.Z);
+	return ((fe51_iszero(&r.X))&&(fe51_iszero(&yz)));
+}
+
+#endif // ZT_C25519_FIELD51
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// Backend dispatch for the public methods below
+
+#ifdef ZT_C25519_FIELD51
+C25519::Backend C25519::_backend = C25519::BACKEND_FIELD51;
+#else
+C25519::Backend C25519::_backend = C25519::BACKEND_REFERENCE;
+#endif
+
+bool C25519::setBackend(const C25519::Backend b)
+{
+#ifndef ZT_C25519_FIELD51
+	if (b == BACKEND_FIELD51)
+		return false;
+#endif
+	_backend = b;
+	return true;
+}
+
+static inline void c25519_scalarmult(unsigned char *q,const unsigned char *n,const unsigned char *p)
+{
+#ifdef ZT_C25519_FIELD51
+	if (C25519::backend() == C25519::BACKEND_FIELD51) {
+		x25519_51(q,n,p);
+		return;
+	}
+#endif
+	crypto_scalarmult(q,n,p);
+}
+
+/* Packs [s]B */
+static inline void ed25519_scalarmult_base(unsigned char r[32],const sc25519 *s)
+{
+#ifdef ZT_C25519_FIELD51
+	if (C25519::backend() == C25519::BACKEND_FIELD51) {
+		ge51_p3 p;
+		ge51_scalarmult_base(&p,s);
+		ge51_p3_tobytes(r,&p);
+		return;
+	}
+#endif
+	ge25519 p;
+	ge25519_scalarmult_base(&p,s);
+	ge25519_pack(r,&p);
+}
+
+/* Packs [s1](-A) + [s2]B for the encoded point A, 0 on success or -1 if A isn't a point */
+static inline int ed25519_verify_point(unsigned char r[32],const unsigned char a[32],const sc25519 *s1,const sc25519 *s2)
+{
+#ifdef ZT_C25519_FIELD51
+	if (C25519::backend() == C25519::BACKEND_FIELD51) {
+		unsigned char b1[32],b2[32];
+		ge51_p3 p;
+		if (ge51_frombytes_negate_vartime(&p,a,ge51_constants()))
+			return -1;
+		sc25519_to32bytes(b1,s1);
+		sc25519_to32bytes(b2,s2);
+		ge51_double_scalarmult_vartime(r,&p,b1,b2);
+		return 0;
+	}
+#endif
+	ge25519 get1,get2;
+	if (ge25519_unpackneg_vartime(&get1,a))
+		return -1;
+	ge25519_double_scalarmult_vartime(&get2,&get1,s1,&ge25519_base,s2);
+	ge25519_pack(r,&get2);
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
 void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void *keybuf,unsigned int keylen)
   throw()
 {
 	unsigned char rawkey[32];
 	unsigned char digest[64];
 
-	crypto_scalarmult(rawkey,mine.data,their.data);
+	c25519_scalarmult(rawkey,mine.data,their.data);
 	SHA512::hash(digest,rawkey,32);
 	for(unsigned int i=0,k=0;i<keylen;) {
 		if (k == 64) {
@@ -2288,7 +3340,6 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
   throw()
 {
   sc25519 sck, scs, scsk;
-  ge25519 ger;
   unsigned char r[32];
   unsigned char s[32];
   unsigned char extsk[64];
@@ -2314,8 +3365,7 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 
   /* Computation of R */
   sc25519_from64bytes(&sck, hmg);
-  ge25519_scalarmult_base(&ger, &sck);
-  ge25519_pack(r, &ger);
+  ed25519_scalarmult_base(r, &sck);
   
   /* Computation of s */
   for(unsigned int i=0;i<32;i++)
@@ -2338,7 +3388,6 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   throw()
 {
   unsigned char t2[32];
-  ge25519 get1, get2;
   sc25519 schram, scs;
   unsigned char hram[crypto_hash_sha512_BYTES];
   unsigned char m[96];
@@ -2350,27 +3399,62 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   if (!Utils::secureEq(sig + 64,digest,32))
     return false;
 
-  if (ge25519_unpackneg_vartime(&get1,their.data + 32))
-    return false;
-
   get_hram(hram,sig,their.data + 32,m,96);
 
   sc25519_from64bytes(&schram, hram);
 
   sc25519_from32bytes(&scs, sig+32);
 
-  ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &ge25519_base, &scs);
-  ge25519_pack(t2, &get2);
+  if (ed25519_verify_point(t2, their.data + 32, &schram, &scs))
+    return false;
 
   return Utils::secureEq(sig,t2,32);
 }
 
+bool C25519::verifyBatch(unsigned int n,const C25519::Public *const *their,const void *const *msgs,const unsigned int *lens,const void *const *signatures,bool *valid)
+  throw()
+{
+	bool all = true;
+#ifdef ZT_C25519_FIELD51
+	if (_backend == BACKEND_FIELD51) {
+		for(unsigned int i=0;i<n;) {
+			const unsigned int cnt = ((n - i) < ZT_C25519_BATCH_MAX) ? (n - i) : ZT_C25519_BATCH_MAX;
+			if ((cnt > 1)&&(ge51_verify_batch(cnt,their + i,msgs + i,lens + i,signatures + i))) {
+				if (valid) {
+					for(unsigned int j=i;j<(i + cnt);++j)
+						valid[j] = true;
+				}
+			} else {
+				// Something in here is bad, or there's only one, so find out which one by one
+				if ((!valid)&&(cnt > 1))
+					return false;
+				for(unsigned int j=i;j<(i + cnt);++j) {
+					const bool v = verify(*(their[j]),msgs[j],lens[j],signatures[j]);
+					if (valid)
+						valid[j] = v;
+					all &= v;
+				}
+			}
+			i += cnt;
+		}
+		return all;
+	}
+#endif
+	for(unsigned int i=0;i<n;++i) {
+		const bool v = verify(*(their[i]),msgs[i],lens[i],signatures[i]);
+		if (valid)
+			valid[i] = v;
+		all &= v;
+	}
+	return all;
+}
+
 void C25519::_calcPubDH(C25519::Pair &kp)
   throw()
 {
   // First 32 bytes of pub and priv are the keys for ECDH key
   // agreement. This generates the public portion from the private.
-  crypto_scalarmult_base(kp.pub.data,kp.priv.data);
+  c25519_scalarmult(kp.pub.data,kp.priv.data,base);
 }
 
 void C25519::_calcPubED(C25519::Pair &kp)
@@ -2378,7 +3462,6 @@ void C25519::_calcPubED(C25519::Pair &kp)
 {
   unsigned char extsk[64];
   sc25519 scsk;
-  ge25519 gepk;
 
   // Second 32 bytes of pub and priv are the keys for ed25519
   // signing and verification.
@@ -2387,8 +3470,7 @@ void C25519::_calcPubED(C25519::Pair &kp)
   extsk[31] &= 127;
   extsk[31] |= 64;
   sc25519_from32bytes(&scsk,extsk);
-  ge25519_scalarmult_base(&gepk,&scsk);
-  ge25519_pack(kp.pub.data + 32,&gepk);
+  ed25519_scalarmult_base(kp.pub.data + 32,&scsk);
   // In NaCl, the public key is crammed into the next 32 bytes
   // of the private key for signing since both keys are required
   // to sign. In this version we just get it from kp.pub, so we
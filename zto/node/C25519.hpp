@@ -34,6 +34,40 @@ namespace ZeroTier {
 class C25519
 {
 public:
+	/**
+	 * Implementations of the underlying field and group arithmetic
+	 *
+	 * Both give identical results. The fastest one built in is selected at
+	 * startup, setBackend() is mostly for testing and benchmarking.
+	 */
+	enum Backend
+	{
+		/**
+		 * NaCl/SUPERCOP reference code, 32-bit limbs, always available
+		 */
+		BACKEND_REFERENCE = 0,
+
+		/**
+		 * Radix 2^51 field arithmetic on 64-bit limbs (needs a 128-bit integer type)
+		 */
+		BACKEND_FIELD51 = 1
+	};
+
+	/**
+	 * @return Backend in use
+	 */
+	static inline Backend backend() throw() { return _backend; }
+
+	/**
+	 * Select a backend
+	 *
+	 * This is not thread safe and should be done before keys are in use.
+	 *
+	 * @param b Backend
+	 * @return False if this backend isn't available in this build
+	 */
+	static bool setBackend(const Backend b);
+
 	/**
 	 * Public key (both crypto and signing)
 	 */
@@ -196,6 +230,32 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * Verify several messages' signatures at once
+	 *
+	 * With the 64-bit backend, signatures are checked in batches that cost
+	 * about half as much per signature as verify(). Should a batch fail, its
+	 * signatures are checked one by one to find which are bad, so this is
+	 * fastest when failures are rare.
+	 *
+	 * Results match verify() for signatures whose R and public key have no
+	 * small order component, which includes everything sign() produces with a
+	 * generated key. A signer can craft R or its own key so that verify()
+	 * rejects a signature but its batch still passes about one time in eight.
+	 * Use verify() wherever every node must reach the same answer, such as
+	 * credential checks.
+	 *
+	 * @param n Number of signatures
+	 * @param their Public keys to verify against
+	 * @param msgs Messages
+	 * @param lens Lengths of messages in bytes
+	 * @param signatures 96-byte signatures
+	 * @param valid If non-NULL, set to whether each signature is valid
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(unsigned int n,const Public *const *their,const void *const *msgs,const unsigned int *lens,const void *const *signatures,bool *valid)
+		throw();
+
 private:
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
@@ -206,6 +266,8 @@ private:
 	// this is the Ed25519 sign/verify key
 	static void _calcPubED(Pair &kp)
 		throw();
+
+	static Backend _backend;
 };
 
 } // namespace ZeroTier
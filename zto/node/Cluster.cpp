@@ -210,10 +210,21 @@ Cluster::Cluster(
 	_id(id),
 	_zeroTierPhysicalEndpoints(zeroTierPhysicalEndpoints),
 	_members(new _Member[ZT_CLUSTER_MAX_MEMBERS]),
+	_wantPeerFilterCurrent(0),
+	_wantPeerFilterRotated(0),
+	_bytesSent(0),
+	_bytesReceived(0),
+	_bytesSentPerSecond(0),
+	_bytesReceivedPerSecond(0),
+	_lastStatsBytesSent(0),
+	_lastStatsBytesReceived(0),
+	_lastStats(0),
 	_lastFlushed(0),
 	_lastCleanedRemotePeers(0),
 	_lastCleanedQueue(0)
 {
+	memset(_wantPeerFilter,0,sizeof(_wantPeerFilter));
+
 	uint16_t stmp[ZT_SHA512_DIGEST_LEN / sizeof(uint16_t)];
 
 	// Generate master secret by hashing the secret from our Identity key pair
@@ -270,6 +281,11 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 		s20.crypt12(reinterpret_cast<const char *>(msg) + 24,const_cast<void *>(dmsg.data()),dmsg.size());
 	}
 
+	{
+		Mutex::Lock _l(_stats_m);
+		_bytesReceived += len;
+	}
+
 	if (dmsg.size() < 4)
 		return;
 	const uint16_t fromMemberId = dmsg.at<uint16_t>(0);
@@ -310,7 +326,7 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						ptr += 8; // skip local clock, not used
 						m.load = dmsg.at<uint64_t>(ptr); ptr += 8;
 						m.peers = dmsg.at<uint64_t>(ptr); ptr += 8;
-						ptr += 8; // skip flags, unused
+						m.batchedPeerMessages = ((dmsg.at<uint64_t>(ptr) & ZT_CLUSTER_ALIVE_FLAG_BATCHED_PEER_MESSAGES) != 0); ptr += 8;
 #ifdef ZT_TRACE
 						std::string addrs;
 #endif
@@ -352,13 +368,35 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 								rp.lastHavePeerReceived = RR->node->now();
 							}
 
-							_ClusterSendQueueEntry *q[16384]; // 16384 is "tons"
-							unsigned int qc = _sendQueue->getByDest(id.address(),q,16384);
-							for(unsigned int i=0;i<qc;++i)
-								this->relayViaCluster(q[i]->fromPeerAddress,q[i]->toPeerAddress,q[i]->data,q[i]->len,q[i]->unite);
-							_sendQueue->returnToPool(q,qc);
+							_retryQueuedSends(id.address());
 
-							TRACE("[%u] has %s (retried %u queued sends)",(unsigned int)fromMemberId,id.address().toString().c_str(),qc);
+							TRACE("[%u] has %s",(unsigned int)fromMemberId,id.address().toString().c_str());
+						}
+					}	break;
+
+					case CLUSTER_MESSAGE_HAVE_PEERS: {
+						const unsigned int count = dmsg.at<uint16_t>(ptr); ptr += 2;
+						const uint64_t now = RR->node->now();
+						std::vector<Address> unknown;
+						for(unsigned int i=0;i<count;++i) {
+							const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+							bool known = false;
+							{
+								Mutex::Lock _l(_remotePeers_m);
+								std::map< std::pair<Address,unsigned int>,_RemotePeer >::iterator rp(_remotePeers.find(std::pair<Address,unsigned int>(zeroTierAddress,(unsigned int)fromMemberId)));
+								if ((rp != _remotePeers.end())&&(rp->second.lastHavePeerReceived)) {
+									rp->second.lastHavePeerReceived = now;
+									known = true;
+								}
+							}
+							if (known)
+								_retryQueuedSends(zeroTierAddress);
+							else unknown.push_back(zeroTierAddress);
+						}
+						if (!unknown.empty()) {
+							// We don't have identities for these, so ask for full HAVE_PEERs
+							Mutex::Lock _l2(_members[fromMemberId].lock);
+							_sendAddresses(fromMemberId,CLUSTER_MESSAGE_WANT_PEERS,unknown);
 						}
 					}	break;
 
@@ -373,6 +411,22 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						}
 					}	break;
 
+					case CLUSTER_MESSAGE_WANT_PEERS: {
+						const unsigned int count = dmsg.at<uint16_t>(ptr); ptr += 2;
+						const uint64_t now = RR->node->now();
+						Buffer<1024> buf;
+						for(unsigned int i=0;i<count;++i) {
+							const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+							SharedPtr<Peer> peer(RR->topology->getPeerNoCache(zeroTierAddress));
+							if ( (peer) && (peer->hasLocalClusterOptimalPath(now)) ) {
+								buf.clear();
+								peer->identity().serialize(buf);
+								Mutex::Lock _l2(_members[fromMemberId].lock);
+								_send(fromMemberId,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+							}
+						}
+					}	break;
+
 					case CLUSTER_MESSAGE_REMOTE_PACKET: {
 						const unsigned int plen = dmsg.at<uint16_t>(ptr); ptr += 2;
 						if (plen) {
@@ -498,13 +552,15 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 
 void Cluster::broadcastHavePeer(const Identity &id)
 {
-	Buffer<1024> buf;
-	id.serialize(buf);
-	Mutex::Lock _l(_memberIds_m);
-	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-		Mutex::Lock _l2(_members[*mid].lock);
-		_send(*mid,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
-	}
+	const uint64_t now = RR->node->now();
+	Mutex::Lock _l(_pending_m);
+	uint64_t &la = _lastAnnounced[id.address()];
+	if ((now - la) < ZT_CLUSTER_HAVE_PEER_EVERY)
+		return; // already pending or just sent
+	if ((now - la) >= ZT_PEER_ACTIVITY_TIMEOUT)
+		_pendingHavePeers.push_back(id); // other members will have forgotten it by now
+	else _pendingHavePeerRefreshes.push_back(id);
+	la = now;
 }
 
 void Cluster::broadcastNetworkConfigChunk(const void *chunk,unsigned int len)
@@ -540,28 +596,7 @@ int Cluster::checkSendViaCluster(const Address &toPeerAddress,uint64_t &mostRece
 	if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
 		if (ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)
 			mostRecentMemberId = -1;
-
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
+		_wantPeer(now,toPeerAddress);
 	}
 
 	return mostRecentMemberId;
@@ -614,27 +649,7 @@ void Cluster::relayViaCluster(const Address &fromPeerAddress,const Address &toPe
 
 		// Poll everyone with WANT_PEER if the age of our most recent entry is
 		// approaching expiration (or has expired, or does not exist).
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
+		_wantPeer(now,toPeerAddress);
 
 		// If there isn't a good place to send via, then enqueue this for retrying
 		// later and return after having broadcasted a WANT_PEER.
@@ -709,10 +724,53 @@ void Cluster::doPeriodicTasks()
 	if ((now - _lastFlushed) >= ZT_CLUSTER_FLUSH_PERIOD) {
 		_lastFlushed = now;
 
+		// Grab everything announced or wanted since the last flush so it can be
+		// sent to each member in as few messages as possible
+		std::vector<Identity> havePeers,havePeerRefreshes;
+		std::vector<Address> wantPeers;
+		{
+			Mutex::Lock _l(_pending_m);
+			havePeers.swap(_pendingHavePeers);
+			havePeerRefreshes.swap(_pendingHavePeerRefreshes);
+			wantPeers.swap(_pendingWantPeers);
+		}
+		std::vector<std::string> havePeerIds;
+		std::vector<Address> havePeerRefreshAddresses;
+		{
+			Buffer<1024> buf;
+			for(std::vector<Identity>::const_iterator i(havePeers.begin());i!=havePeers.end();++i) {
+				buf.clear();
+				i->serialize(buf);
+				havePeerIds.push_back(std::string(reinterpret_cast<const char *>(buf.data()),buf.size()));
+			}
+			for(std::vector<Identity>::const_iterator i(havePeerRefreshes.begin());i!=havePeerRefreshes.end();++i)
+				havePeerRefreshAddresses.push_back(i->address());
+		}
+
 		Mutex::Lock _l(_memberIds_m);
 		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
 			Mutex::Lock _l2(_members[*mid].lock);
 
+			for(std::vector<std::string>::const_iterator i(havePeerIds.begin());i!=havePeerIds.end();++i)
+				_send(*mid,CLUSTER_MESSAGE_HAVE_PEER,i->data(),(unsigned int)i->length());
+			if (_members[*mid].batchedPeerMessages) {
+				_sendAddresses(*mid,CLUSTER_MESSAGE_HAVE_PEERS,havePeerRefreshAddresses);
+				_sendAddresses(*mid,CLUSTER_MESSAGE_WANT_PEERS,wantPeers);
+			} else {
+				// Older members only understand one peer per message
+				Buffer<1024> buf;
+				for(std::vector<Identity>::const_iterator i(havePeerRefreshes.begin());i!=havePeerRefreshes.end();++i) {
+					buf.clear();
+					i->serialize(buf);
+					_send(*mid,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+				}
+				for(std::vector<Address>::const_iterator a(wantPeers.begin());a!=wantPeers.end();++a) {
+					char tmp[ZT_ADDRESS_LENGTH];
+					a->copyTo(tmp,ZT_ADDRESS_LENGTH);
+					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
+				}
+			}
+
 			if ((now - _members[*mid].lastAnnouncedAliveTo) >= ((ZT_CLUSTER_TIMEOUT / 2) - 1000)) {
 				_members[*mid].lastAnnouncedAliveTo = now;
 
@@ -733,7 +791,7 @@ void Cluster::doPeriodicTasks()
 				alive.append((uint64_t)now);
 				alive.append((uint64_t)0); // TODO: compute and send load average
 				alive.append((uint64_t)RR->topology->countActive(now));
-				alive.append((uint64_t)0); // unused/reserved flags
+				alive.append((uint64_t)ZT_CLUSTER_ALIVE_FLAG_BATCHED_PEER_MESSAGES);
 				alive.append((uint8_t)_zeroTierPhysicalEndpoints.size());
 				for(std::vector<InetAddress>::const_iterator pe(_zeroTierPhysicalEndpoints.begin());pe!=_zeroTierPhysicalEndpoints.end();++pe)
 					pe->serialize(alive);
@@ -747,11 +805,24 @@ void Cluster::doPeriodicTasks()
 	if ((now - _lastCleanedRemotePeers) >= (ZT_PEER_ACTIVITY_TIMEOUT * 2)) {
 		_lastCleanedRemotePeers = now;
 
-		Mutex::Lock _l(_remotePeers_m);
-		for(std::map< std::pair<Address,unsigned int>,_RemotePeer >::iterator rp(_remotePeers.begin());rp!=_remotePeers.end();) {
-			if ((now - rp->second.lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)
-				_remotePeers.erase(rp++);
-			else ++rp;
+		{
+			Mutex::Lock _l(_remotePeers_m);
+			for(std::map< std::pair<Address,unsigned int>,_RemotePeer >::iterator rp(_remotePeers.begin());rp!=_remotePeers.end();) {
+				if ((now - rp->second.lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)
+					_remotePeers.erase(rp++);
+				else ++rp;
+			}
+		}
+
+		{
+			Mutex::Lock _l(_pending_m);
+			Hashtable< Address,uint64_t >::Iterator i(_lastAnnounced);
+			Address *k = (Address *)0;
+			uint64_t *v = (uint64_t *)0;
+			while (i.next(k,v)) {
+				if ((now - *v) >= ZT_PEER_ACTIVITY_TIMEOUT)
+					_lastAnnounced.erase(*k);
+			}
 		}
 	}
 
@@ -759,6 +830,18 @@ void Cluster::doPeriodicTasks()
 		_lastCleanedQueue = now;
 		_sendQueue->expire(now);
 	}
+
+	if ((now - _lastStats) >= ZT_CLUSTER_STATS_PERIOD) {
+		Mutex::Lock _l(_stats_m);
+		if (_lastStats) {
+			const uint64_t elapsed = now - _lastStats;
+			_bytesSentPerSecond = ((_bytesSent - _lastStatsBytesSent) * 1000ULL) / elapsed;
+			_bytesReceivedPerSecond = ((_bytesReceived - _lastStatsBytesReceived) * 1000ULL) / elapsed;
+		}
+		_lastStatsBytesSent = _bytesSent;
+		_lastStatsBytesReceived = _bytesReceived;
+		_lastStats = now;
+	}
 }
 
 void Cluster::addMember(uint16_t memberId)
@@ -923,6 +1006,14 @@ void Cluster::status(ZT_ClusterStatus &status) const
 			}
 		}
 	}
+
+	{
+		Mutex::Lock _l2(_stats_m);
+		status.backplaneBytesSent = _bytesSent;
+		status.backplaneBytesReceived = _bytesReceived;
+		status.backplaneBytesSentPerSecond = _bytesSentPerSecond;
+		status.backplaneBytesReceivedPerSecond = _bytesReceivedPerSecond;
+	}
 }
 
 void Cluster::_send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len)
@@ -938,6 +1029,24 @@ void Cluster::_send(uint16_t memberId,StateMessageType type,const void *msg,unsi
 	m.q.append(msg,len);
 }
 
+void Cluster::_sendAddresses(uint16_t memberId,StateMessageType type,const std::vector<Address> &addresses)
+{
+	// assumes _members[memberId].lock is locked!
+	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> buf;
+	for(std::vector<Address>::const_iterator a(addresses.begin());a!=addresses.end();) {
+		buf.clear();
+		buf.addSize(2); // space for count
+		unsigned int count = 0;
+		while ((a != addresses.end())&&(count < ZT_CLUSTER_MAX_ADDRESSES_PER_MESSAGE)) {
+			a->appendTo(buf);
+			++count;
+			++a;
+		}
+		buf.setAt<uint16_t>(0,(uint16_t)count);
+		_send(memberId,type,buf.data(),buf.size());
+	}
+}
+
 void Cluster::_flush(uint16_t memberId)
 {
 	_Member &m = _members[memberId];
@@ -966,6 +1075,10 @@ void Cluster::_flush(uint16_t memberId)
 
 		// Send!
 		_sendFunction(_sendFunctionArg,memberId,m.q.data(),m.q.size());
+		{
+			Mutex::Lock _l(_stats_m);
+			_bytesSent += m.q.size();
+		}
 
 		// Prepare for more
 		m.q.clear();
@@ -978,6 +1091,48 @@ void Cluster::_flush(uint16_t memberId)
 	}
 }
 
+void Cluster::_wantPeer(uint64_t now,const Address &peerAddress)
+{
+	const uint64_t a = peerAddress.toInt();
+	uint64_t h[3];
+	h[0] = (a * 0x9e3779b97f4a7c15ULL) >> 32;
+	h[1] = (a * 0xc2b2ae3d27d4eb4fULL) >> 32;
+	h[2] = (a * 0x165667b19e3779f9ULL) >> 32;
+
+	Mutex::Lock _l(_pending_m);
+
+	if ((now - _wantPeerFilterRotated) >= ZT_CLUSTER_WANT_PEER_EVERY) {
+		_wantPeerFilterRotated = now;
+		_wantPeerFilterCurrent ^= 1;
+		memset(_wantPeerFilter[_wantPeerFilterCurrent],0,sizeof(_wantPeerFilter[_wantPeerFilterCurrent]));
+	}
+
+	bool inCurrent = true,inPrevious = true;
+	for(unsigned int i=0;i<3;++i) {
+		const unsigned long bit = (unsigned long)(h[i] & (ZT_CLUSTER_WANT_PEER_FILTER_BITS - 1));
+		const uint64_t mask = 1ULL << (bit & 63);
+		if (!(_wantPeerFilter[_wantPeerFilterCurrent][bit >> 6] & mask)) {
+			inCurrent = false;
+			_wantPeerFilter[_wantPeerFilterCurrent][bit >> 6] |= mask;
+		}
+		if (!(_wantPeerFilter[_wantPeerFilterCurrent ^ 1][bit >> 6] & mask))
+			inPrevious = false;
+	}
+	if ((inCurrent)||(inPrevious))
+		return; // don't flood WANT_PEER
+
+	_pendingWantPeers.push_back(peerAddress);
+}
+
+void Cluster::_retryQueuedSends(const Address &toPeerAddress)
+{
+	_ClusterSendQueueEntry *q[16384]; // 16384 is "tons"
+	unsigned int qc = _sendQueue->getByDest(toPeerAddress,q,16384);
+	for(unsigned int i=0;i<qc;++i)
+		this->relayViaCluster(q[i]->fromPeerAddress,q[i]->toPeerAddress,q[i]->data,q[i]->len,q[i]->unite);
+	_sendQueue->returnToPool(q,qc);
+}
+
 void Cluster::_doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep)
 {
 	if (remotep.payloadLength() >= ZT_ADDRESS_LENGTH) {
@@ -22,6 +22,7 @@
 #ifdef ZT_ENABLE_CLUSTER
 
 #include <map>
+#include <vector>
 
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
@@ -34,7 +35,7 @@
 #include "SharedPtr.hpp"
 #include "Hashtable.hpp"
 #include "Packet.hpp"
-#include "SharedPtr.hpp"
+#include "Identity.hpp"
 
 /**
  * Timeout for cluster members being considered "alive"
@@ -93,6 +94,31 @@
  */
 #define ZT_CLUSTER_WANT_PEER_EVERY 1000
 
+/**
+ * We won't announce the same peer to other members more than every (ms)
+ */
+#define ZT_CLUSTER_HAVE_PEER_EVERY 1000
+
+/**
+ * Size in bits of each generation of the recently wanted peer filter (must be a power of two)
+ */
+#define ZT_CLUSTER_WANT_PEER_FILTER_BITS 1048576
+
+/**
+ * Maximum number of addresses in one HAVE_PEERS or WANT_PEERS message
+ */
+#define ZT_CLUSTER_MAX_ADDRESSES_PER_MESSAGE ((ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2 + 3 + 2)) / ZT_ADDRESS_LENGTH)
+
+/**
+ * How often to update backplane bandwidth statistics
+ */
+#define ZT_CLUSTER_STATS_PERIOD 1000
+
+/**
+ * ALIVE flag: member understands HAVE_PEERS and WANT_PEERS
+ */
+#define ZT_CLUSTER_ALIVE_FLAG_BATCHED_PEER_MESSAGES 0x0000000000000001ULL
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -145,7 +171,7 @@ public:
 		 *   <[8] local clock at this member>
 		 *   <[8] load average>
 		 *   <[8] number of peers>
-		 *   <[8] flags (currently unused, must be zero)>
+		 *   <[8] flags>
 		 *   <[1] number of preferred ZeroTier endpoints>
 		 *   <[...] InetAddress(es) of preferred ZeroTier endpoint(s)>
 		 *
@@ -229,7 +255,29 @@ public:
 		 * The first field of a network config chunk is the network ID,
 		 * so this can be checked to look up the network on receipt.
 		 */
-		CLUSTER_MESSAGE_NETWORK_CONFIG = 7
+		CLUSTER_MESSAGE_NETWORK_CONFIG = 7,
+
+		/**
+		 * Cluster member still has these already announced peers:
+		 *   <[2] number of addresses>
+		 *   <[...] series of 5-byte ZeroTier addresses of peers>
+		 *
+		 * This refreshes an earlier HAVE_PEER without resending identities.
+		 * Recipients that don't know one of these peers reply with WANT_PEERS
+		 * to get its full HAVE_PEER. Only sent to members whose ALIVE has the
+		 * ZT_CLUSTER_ALIVE_FLAG_BATCHED_PEER_MESSAGES flag.
+		 */
+		CLUSTER_MESSAGE_HAVE_PEERS = 8,
+
+		/**
+		 * Cluster member wants these peers:
+		 *   <[2] number of addresses>
+		 *   <[...] series of 5-byte ZeroTier addresses of peers>
+		 *
+		 * Batched WANT_PEER. Only sent to members whose ALIVE has the
+		 * ZT_CLUSTER_ALIVE_FLAG_BATCHED_PEER_MESSAGES flag.
+		 */
+		CLUSTER_MESSAGE_WANT_PEERS = 9
 	};
 
 	/**
@@ -265,7 +313,9 @@ public:
 	/**
 	 * Broadcast that we have a given peer
 	 *
-	 * This should be done when new peers are first contacted.
+	 * This should be done when new peers are first contacted. Announcements
+	 * are coalesced and sent on the next flush, and peers announced recently
+	 * are only refreshed by address.
 	 *
 	 * @param id Identity of peer
 	 */
@@ -373,7 +423,10 @@ public:
 
 private:
 	void _send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len);
+	void _sendAddresses(uint16_t memberId,StateMessageType type,const std::vector<Address> &addresses);
 	void _flush(uint16_t memberId);
+	void _wantPeer(uint64_t now,const Address &peerAddress);
+	void _retryQueuedSends(const Address &toPeerAddress);
 
 	void _doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep);
 	void _doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &remotep);
@@ -404,6 +457,7 @@ private:
 		uint64_t load;
 		uint64_t peers;
 		int32_t x,y,z;
+		bool batchedPeerMessages;
 
 		std::vector<InetAddress> zeroTierPhysicalEndpoints;
 
@@ -420,6 +474,7 @@ private:
 			x = 0;
 			y = 0;
 			z = 0;
+			batchedPeerMessages = false;
 			zeroTierPhysicalEndpoints.clear();
 			q.clear();
 		}
@@ -434,15 +489,37 @@ private:
 
 	struct _RemotePeer
 	{
-		_RemotePeer() : lastHavePeerReceived(0),lastSentWantPeer(0) {}
+		_RemotePeer() : lastHavePeerReceived(0) {}
 		~_RemotePeer() { Utils::burn(key,ZT_PEER_SECRET_KEY_LENGTH); }
 		uint64_t lastHavePeerReceived;
-		uint64_t lastSentWantPeer;
 		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH]; // secret key from identity agreement
 	};
 	std::map< std::pair<Address,unsigned int>,_RemotePeer > _remotePeers; // we need ordered behavior and lower_bound here
 	Mutex _remotePeers_m;
 
+	// Peer announcements and queries waiting to be sent on the next flush
+	std::vector<Identity> _pendingHavePeers; // first announcements, sent with full identity
+	std::vector<Identity> _pendingHavePeerRefreshes; // sent by address to members that support it
+	std::vector<Address> _pendingWantPeers;
+	Hashtable< Address,uint64_t > _lastAnnounced; // when each of our peers was last announced
+	// Two generations of a Bloom filter of addresses we recently sent WANT_PEER
+	// for, so rate limiting WANT_PEER takes fixed memory no matter how many
+	// peers are wanted
+	uint64_t _wantPeerFilter[2][ZT_CLUSTER_WANT_PEER_FILTER_BITS / 64];
+	unsigned int _wantPeerFilterCurrent;
+	uint64_t _wantPeerFilterRotated;
+	Mutex _pending_m;
+
+	// Backplane traffic statistics
+	uint64_t _bytesSent;
+	uint64_t _bytesReceived;
+	uint64_t _bytesSentPerSecond;
+	uint64_t _bytesReceivedPerSecond;
+	uint64_t _lastStatsBytesSent;
+	uint64_t _lastStatsBytesReceived;
+	uint64_t _lastStats;
+	Mutex _stats_m;
+
 	uint64_t _lastFlushed;
 	uint64_t _lastCleanedRemotePeers;
 	uint64_t _lastCleanedQueue;
@@ -226,6 +226,16 @@
  */
 #define ZT_RELAY_MAX_HOPS 3
 
+/**
+ * Number of destinations whose relay path is remembered (must be a power of two)
+ */
+#define ZT_RELAY_CACHE_SIZE 4096
+
+/**
+ * How long a remembered relay path is used before the destination's best path is looked up again
+ */
+#define ZT_RELAY_CACHE_TTL 1000
+
 /**
  * Maximum number of upstreams to use (far more than we should ever need)
  */
@@ -263,6 +273,21 @@
  */
 #define ZT_PING_CHECK_INVERVAL 5000
 
+/**
+ * Slots in the timer wheel peers are scheduled on for pings and expiry
+ */
+#define ZT_PEER_TIMER_WHEEL_SLOTS 1024
+
+/**
+ * Time covered by each slot of the peer timer wheel (ms)
+ */
+#define ZT_PEER_TIMER_WHEEL_GRANULARITY 1000
+
+/**
+ * Maximum age of the sorted address index used to page through peers (ms)
+ */
+#define ZT_PEER_INDEX_MAX_AGE 10000
+
 /**
  * How frequently to send heartbeats over in-use paths
  */
@@ -283,6 +308,31 @@
  */
 #define ZT_PATH_HELLO_RATE_LIMIT 1000
 
+/**
+ * Round trip time of a path that has not been measured yet
+ */
+#define ZT_PATH_RTT_UNKNOWN 0xffffffff
+
+/**
+ * A probe (ECHO or HELLO) sent over a path counts as lost if not answered within this time
+ */
+#define ZT_PATH_PROBE_TIMEOUT 2000
+
+/**
+ * Most a path's cost (see Path::cost()) can take off its score, less than being alive adds
+ */
+#define ZT_PATH_MAX_COST_PENALTY (ZT_PEER_PING_PERIOD / 4)
+
+/**
+ * A bonded path that is being sent over but has heard nothing for this long is sent a HELLO
+ */
+#define ZT_PATH_BOND_PROBE_INTERVAL 1000
+
+/**
+ * A bonded path leaves the bond if a HELLO goes unanswered this long, until it hears something again
+ */
+#define ZT_PATH_BOND_FAILOVER_TIMEOUT 1000
+
 /**
  * Delay between full-fledge pings of directly connected peers
  */
@@ -308,6 +358,21 @@
  */
 #define ZT_PEER_ACTIVITY_TIMEOUT 500000
 
+/**
+ * Oldest age Peer's 32-bit timestamps can hold (ms, about 12 days)
+ *
+ * Peers keep the low 32 bits of their timestamps and read them back as ages.
+ * Anything older than this is pulled forward to this age by refreshTimes(),
+ * which Topology's timer wheel calls much more often than this, so older
+ * timestamps never wrap around to look recent.
+ */
+#define ZT_PEER_TIME_HORIZON 0x40000000
+
+/**
+ * Number of peers allocated at once
+ */
+#define ZT_PEER_SLAB_SIZE 256
+
 /**
  * General rate limit timeout for multiple packet types (HELLO, etc.)
  */
@@ -420,6 +485,24 @@
 #endif
 #endif
 
+/**
+ * Number of identities that passed validation to remember (must be a power of two)
+ *
+ * Identities found here skip the memory-hard hash and the rate limit above
+ * when they HELLO us again, e.g. after their peer entry has expired.
+ */
+#define ZT_IDENTITY_VALIDATION_CACHE_SIZE 8192
+
+/**
+ * Maximum number of HELLOs waiting on background threads to validate their identities
+ */
+#define ZT_IDENTITY_VALIDATION_QUEUE_MAX 32
+
+/**
+ * Maximum number of those that may come from one source (as hashed by InetAddress::rateGateHash())
+ */
+#define ZT_IDENTITY_VALIDATION_SOURCE_QUEUE_MAX 2
+
 /**
  * How long is a path or peer considered to have a trust relationship with us (for e.g. relay policy) since last trusted established packet?
  */
@@ -0,0 +1,218 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "IdentityValidator.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Node.hpp"
+#include "Topology.hpp"
+#include "Peer.hpp"
+#include "Path.hpp"
+#include "SHA512.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+IdentityValidator::IdentityValidator(const RuntimeEnvironment *renv) :
+	RR(renv),
+	_jobs(0),
+	_inside(0),
+	_background(false),
+	_stopping(false)
+{
+	memset(_cache,0,sizeof(_cache));
+	Utils::getSecureRandom(_salt,sizeof(_salt));
+	memset(_sourceJobs,0,sizeof(_sourceJobs));
+}
+
+IdentityValidator::~IdentityValidator()
+{
+	stop();
+	for(;;) { // threads in process() should have been joined by now, but don't pull the rug out from under them
+		{
+			Mutex::Lock _l(_lock);
+			if (!_inside)
+				break;
+		}
+		_wake.post();
+	}
+}
+
+IdentityValidator::Result IdentityValidator::validate(const uint64_t now,IncomingPacket &hello,const Identity &id,SharedPtr<Peer> &peer)
+{
+	uint64_t fp[2];
+	_fingerprint(id,fp);
+	const bool known = _cached(fp);
+	const InetAddress &from = hello.path()->address();
+
+	{
+		Mutex::Lock _l(_lock);
+		if ((_background)&&(!_stopping)) {
+			const unsigned long source = from.rateGateHash();
+			if ((_jobs >= ZT_IDENTITY_VALIDATION_QUEUE_MAX)||(_sourceJobs[source] >= ZT_IDENTITY_VALIDATION_SOURCE_QUEUE_MAX))
+				return RESULT_REFUSED;
+			for(std::list<_Job>::const_iterator j(_queue.begin());j!=_queue.end();++j) {
+				if ((j->fp[0] == fp[0])&&(j->fp[1] == fp[1]))
+					return RESULT_REFUSED; // already waiting, and the peer will say HELLO again
+			}
+			if ((!known)&&(!RR->node->rateGateIdentityVerification(now,from)))
+				return RESULT_REFUSED;
+
+			_queue.push_back(_Job());
+			_Job &j = _queue.back();
+			j.hello = hello;
+			j.id = id;
+			j.fp[0] = fp[0];
+			j.fp[1] = fp[1];
+			j.source = source;
+			++_jobs;
+			++_sourceJobs[source];
+			_wake.post();
+			return RESULT_DEFERRED;
+		}
+	}
+
+	if ((!known)&&(!RR->node->rateGateIdentityVerification(now,from)))
+		return RESULT_REFUSED;
+	return (_check(hello,id,fp,peer)) ? RESULT_VALID : RESULT_INVALID;
+}
+
+bool IdentityValidator::process()
+{
+	std::list<_Job> job;
+
+	{
+		Mutex::Lock _l(_lock);
+		_background = true;
+		++_inside;
+	}
+	for(;;) {
+		{
+			Mutex::Lock _l(_lock);
+			if (_stopping) {
+				--_inside;
+				_wake.post(); // pass it on to the next waiting thread
+				return false;
+			}
+			if (!_queue.empty()) {
+				job.splice(job.end(),_queue,_queue.begin());
+				if (!_queue.empty())
+					_wake.post();
+				break;
+			}
+		}
+		_wake.wait();
+	}
+
+	_Job &j = job.front();
+	j.valid = _check(j.hello,j.id,j.fp,j.peer);
+
+	Mutex::Lock _l(_lock);
+	_done.splice(_done.end(),job);
+	++_doneCount;
+	--_inside;
+	return true;
+}
+
+void IdentityValidator::stop()
+{
+	Mutex::Lock _l(_lock);
+	_stopping = true;
+	_wake.post();
+}
+
+void IdentityValidator::finish()
+{
+	if (_doneCount.load() <= 0) // called for every packet, so don't take _lock for nothing
+		return;
+
+	std::list<_Job> done;
+	{
+		Mutex::Lock _l(_lock);
+		if (_done.empty())
+			return;
+		done.swap(_done);
+		for(std::list<_Job>::const_iterator j(done.begin());j!=done.end();++j) {
+			--_doneCount;
+			--_jobs;
+			--_sourceJobs[j->source];
+		}
+	}
+
+	for(std::list<_Job>::iterator j(done.begin());j!=done.end();++j) {
+		if (j->valid) {
+			RR->topology->addPeer(j->peer);
+			j->hello.tryDecode(RR); // now from a known peer, so this picks up where _doHELLO() left off
+		} else {
+			TRACE("dropped HELLO from %s(%s): identity or packet invalid",j->id.address().toString().c_str(),j->hello.path()->address().toString().c_str());
+		}
+	}
+}
+
+bool IdentityValidator::validated(const Identity &id) const
+{
+	uint64_t fp[2];
+	_fingerprint(id,fp);
+	return _cached(fp);
+}
+
+void IdentityValidator::_fingerprint(const Identity &id,uint64_t fp[2]) const
+{
+	// Salted so nobody can go looking for an identity that lands on one already cached
+	uint8_t tmp[sizeof(_salt) + ZT_ADDRESS_LENGTH + ZT_C25519_PUBLIC_KEY_LEN];
+	uint8_t digest[64];
+	memcpy(tmp,_salt,sizeof(_salt));
+	id.address().copyTo(tmp + sizeof(_salt),ZT_ADDRESS_LENGTH);
+	memcpy(tmp + sizeof(_salt) + ZT_ADDRESS_LENGTH,id.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+	SHA512::hash(digest,tmp,sizeof(tmp));
+	memcpy(fp,digest,16);
+}
+
+bool IdentityValidator::_cached(const uint64_t fp[2]) const
+{
+	Mutex::Lock _l(_cache_m);
+	const uint64_t *const slot = _cache[fp[0] & (ZT_IDENTITY_VALIDATION_CACHE_SIZE - 1)];
+	return ((slot[0] == fp[0])&&(slot[1] == fp[1]));
+}
+
+bool IdentityValidator::_check(Packet &hello,const Identity &id,const uint64_t fp[2],SharedPtr<Peer> &peer)
+{
+	try {
+		peer = SharedPtr<Peer>(new Peer(RR,RR->identity,id));
+	} catch ( ... ) {
+		return false; // key agreement failed
+	}
+
+	// Check packet integrity and MAC first, since that is far cheaper than locallyValidate()
+	if (!hello.dearmor(peer->key()))
+		return false;
+
+	if (!_cached(fp)) {
+		if (!id.locallyValidate())
+			return false;
+		Mutex::Lock _l(_cache_m);
+		uint64_t *const slot = _cache[fp[0] & (ZT_IDENTITY_VALIDATION_CACHE_SIZE - 1)];
+		slot[0] = fp[0];
+		slot[1] = fp[1];
+	}
+
+	return true;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,160 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_IDENTITYVALIDATOR_HPP
+#define ZT_IDENTITYVALIDATOR_HPP
+
+#include <stdint.h>
+
+#include <list>
+
+#include "Constants.hpp"
+#include "Identity.hpp"
+#include "IncomingPacket.hpp"
+#include "SharedPtr.hpp"
+#include "Mutex.hpp"
+#include "AtomicCounter.hpp"
+#include "BinarySemaphore.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Validates the identities of peers that HELLO us for the first time
+ *
+ * Learning a new peer costs a key agreement and Identity::locallyValidate(),
+ * whose memory-hard hash is by far the most expensive thing a node does per
+ * packet. Identities that have passed are remembered in a bounded cache so
+ * that returning peers skip the hash.
+ *
+ * If the host calls process() from threads of its own, HELLOs from unknown
+ * identities are copied into a bounded queue and checked there instead of in
+ * the thread that received them. Each source gets a small share of the queue
+ * and anything over that is dropped, as the per-source rate limit already
+ * did. finish() then learns the peers that passed and decodes their HELLOs
+ * again, now from a known peer, in the thread that calls it. Without any
+ * such threads everything happens in validate() as before.
+ */
+class IdentityValidator : NonCopyable
+{
+public:
+	enum Result
+	{
+		/**
+		 * Identity and packet are valid, peer has been created
+		 */
+		RESULT_VALID = 0,
+
+		/**
+		 * Identity or packet failed validation
+		 */
+		RESULT_INVALID = 1,
+
+		/**
+		 * HELLO was queued for a background thread and will be decoded again from finish()
+		 */
+		RESULT_DEFERRED = 2,
+
+		/**
+		 * Over the queue or rate limits, packet should be dropped
+		 */
+		RESULT_REFUSED = 3
+	};
+
+	IdentityValidator(const RuntimeEnvironment *renv);
+	~IdentityValidator();
+
+	/**
+	 * Validate the identity in a HELLO from a peer we do not know yet
+	 *
+	 * @param now Current time
+	 * @param hello HELLO packet, sent in the clear with a MAC
+	 * @param id Identity from the HELLO
+	 * @param peer Result: new peer if RESULT_VALID, not yet added to topology
+	 * @return Result
+	 */
+	Result validate(const uint64_t now,IncomingPacket &hello,const Identity &id,SharedPtr<Peer> &peer);
+
+	/**
+	 * Wait for a queued HELLO and validate it in the calling thread
+	 *
+	 * Once this has been called the node assumes it will keep being called,
+	 * and queues validation work instead of doing it inline.
+	 *
+	 * @return True if a HELLO was handled and finish() should be called soon, false after stop()
+	 */
+	bool process();
+
+	/**
+	 * Make current and future calls to process() return false
+	 */
+	void stop();
+
+	/**
+	 * Learn peers validated by process() and decode their HELLOs again
+	 *
+	 * This is called from processWirePacket() and processBackgroundTasks().
+	 */
+	void finish();
+
+	/**
+	 * @param id Identity
+	 * @return True if this identity has passed locallyValidate() recently
+	 */
+	bool validated(const Identity &id) const;
+
+private:
+	struct _Job
+	{
+		_Job() : source(0),valid(false) {}
+		IncomingPacket hello;
+		Identity id;
+		SharedPtr<Peer> peer;
+		uint64_t fp[2];
+		unsigned long source;
+		bool valid;
+	};
+
+	void _fingerprint(const Identity &id,uint64_t fp[2]) const;
+	bool _cached(const uint64_t fp[2]) const;
+	bool _check(Packet &hello,const Identity &id,const uint64_t fp[2],SharedPtr<Peer> &peer);
+
+	const RuntimeEnvironment *const RR;
+
+	// Fingerprints of identities that have passed, indexed by fp[0]; newest wins a slot
+	uint64_t _cache[ZT_IDENTITY_VALIDATION_CACHE_SIZE][2];
+	uint8_t _salt[32];
+	Mutex _cache_m;
+
+	std::list<_Job> _queue; // waiting for a thread in process()
+	std::list<_Job> _done; // waiting for finish()
+	AtomicCounter _doneCount; // _done.size(), so finish() can skip _lock when it's empty
+	unsigned int _jobs; // in _queue, in process() or in _done
+	uint8_t _sourceJobs[16384]; // _jobs by InetAddress::rateGateHash()
+	unsigned int _inside; // threads currently in process()
+	bool _background; // process() has been called
+	bool _stopping;
+	Mutex _lock;
+	BinarySemaphore _wake;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -31,6 +31,7 @@
 #include "Peer.hpp"
 #include "NetworkController.hpp"
 #include "SelfAwareness.hpp"
+#include "IdentityValidator.hpp"
 #include "Salsa20.hpp"
 #include "SHA512.hpp"
 #include "World.hpp"
@@ -273,21 +274,16 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,const bool alreadyAut
 				return true;
 			}
 
-			// Check rate limits
-			if (!RR->node->rateGateIdentityVerification(now,_path->address()))
-				return true;
-
-			// Check packet integrity and MAC (this is faster than locallyValidate() so do it first to filter out total crap)
-			SharedPtr<Peer> newPeer(new Peer(RR,RR->identity,id));
-			if (!dearmor(newPeer->key())) {
-				TRACE("rejected HELLO from %s(%s): packet failed authentication",id.address().toString().c_str(),_path->address().toString().c_str());
-				return true;
-			}
-
-			// Check that identity's address is valid as per the derivation function
-			if (!id.locallyValidate()) {
-				TRACE("dropped HELLO from %s(%s): identity invalid",id.address().toString().c_str(),_path->address().toString().c_str());
-				return true;
+			// Check packet MAC and identity, possibly in a background thread that will send this packet back through here once it's done
+			SharedPtr<Peer> newPeer;
+			switch(RR->iv->validate(now,*this,id,newPeer)) {
+				case IdentityValidator::RESULT_VALID:
+					break;
+				case IdentityValidator::RESULT_INVALID:
+					TRACE("dropped HELLO from %s(%s): identity or packet invalid",id.address().toString().c_str(),_path->address().toString().c_str());
+					return true;
+				default: // deferred or over rate limits
+					return true;
 			}
 
 			peer = RR->topology->addPeer(newPeer);
@@ -408,7 +404,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,const bool alreadyAut
 		outp.armor(peer->key(),true,_path->nextOutgoingCounter());
 		_path->send(RR,outp.data(),outp.size(),now);
 
-		peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision); // important for this to go first so received() knows the version
+		peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision,now); // important for this to go first so received() knows the version
 		peer->received(_path,hops(),pid,Packet::VERB_HELLO,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped HELLO from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
@@ -479,14 +475,26 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,const SharedPtr<Peer> &p
 
 				TRACE("%s(%s): OK(HELLO), version %u.%u.%u, latency %u, reported external address %s",source().toString().c_str(),_path->address().toString().c_str(),vMajor,vMinor,vRevision,latency,((externalSurfaceAddress) ? externalSurfaceAddress.toString().c_str() : "(none)"));
 
-				if (!hops())
+				if (!hops()) {
 					peer->addDirectLatencyMeasurment((unsigned int)latency);
-				peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision);
+					_path->probeAnswered(at<uint64_t>(ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP),RR->node->now());
+				}
+				peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision,RR->node->now());
 
 				if ((externalSurfaceAddress)&&(hops() == 0))
 					RR->sa->iam(peer->address(),_path->localAddress(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(peer->identity()),RR->node->now());
 			}	break;
 
+			case Packet::VERB_ECHO:
+				// Our ECHOs carry the time they were sent, see Peer::attemptToContactAt()
+				if ((!hops())&&(size() >= (ZT_PROTO_VERB_OK_IDX_PAYLOAD + 8))) {
+					const uint64_t now = RR->node->now();
+					const uint64_t sentAt = at<uint64_t>(ZT_PROTO_VERB_OK_IDX_PAYLOAD);
+					if ((now >= sentAt)&&((now - sentAt) <= ZT_HELLO_MAX_ALLOWABLE_LATENCY))
+						_path->probeAnswered(sentAt,now);
+				}
+				break;
+
 			case Packet::VERB_WHOIS:
 				if (RR->topology->isUpstream(peer->identity())) {
 					const Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
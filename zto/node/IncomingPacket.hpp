@@ -111,6 +111,11 @@ public:
 	 */
 	inline uint64_t receiveTime() const throw() { return _receiveTime; }
 
+	/**
+	 * @return Path packet arrived on
+	 */
+	inline const SharedPtr<Path> &path() const throw() { return _path; }
+
 private:
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
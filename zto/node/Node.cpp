@@ -36,6 +36,7 @@
 #include "Address.hpp"
 #include "Identity.hpp"
 #include "SelfAwareness.hpp"
+#include "IdentityValidator.hpp"
 #include "Cluster.hpp"
 
 const struct sockaddr_storage ZT_SOCKADDR_NULL = {0};
@@ -53,7 +54,8 @@ Node::Node(void *uptr,const struct ZT_Node_Callbacks *callbacks,uint64_t now) :
 	_prngStreamPtr(0),
 	_now(now),
 	_lastPingCheck(0),
-	_lastHousekeepingRun(0)
+	_lastHousekeepingRun(0),
+	_bondingPolicy(ZT_BONDING_POLICY_NONE)
 {
 	if (callbacks->version != 0)
 		throw std::runtime_error("callbacks struct version mismatch");
@@ -93,7 +95,9 @@ Node::Node(void *uptr,const struct ZT_Node_Callbacks *callbacks,uint64_t now) :
 		RR->mc = new Multicaster(RR);
 		RR->topology = new Topology(RR);
 		RR->sa = new SelfAwareness(RR);
+		RR->iv = new IdentityValidator(RR);
 	} catch ( ... ) {
+		delete RR->iv;
 		delete RR->sa;
 		delete RR->topology;
 		delete RR->mc;
@@ -110,6 +114,7 @@ Node::~Node()
 
 	_networks.clear(); // ensure that networks are destroyed before shutdow
 
+	delete RR->iv;
 	delete RR->sa;
 	delete RR->topology;
 	delete RR->mc;
@@ -129,6 +134,7 @@ ZT_ResultCode Node::processWirePacket(
 	volatile uint64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
+	RR->iv->finish();
 	RR->sw->onRemotePacket(*(reinterpret_cast<const InetAddress *>(localAddress)),*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
 	return ZT_RESULT_OK;
 }
@@ -152,7 +158,23 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
-// Closure used to ping upstream and active/online peers
+ZT_ResultCode Node::processVirtualNetworkFrames(
+	uint64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	SharedPtr<Network> nw(this->network(nwid));
+	if (nw) {
+		for(unsigned int i=0;i<frameCount;++i)
+			RR->sw->onLocalEthernet(nw,MAC(frames[i].sourceMac),MAC(frames[i].destMac),frames[i].etherType,frames[i].vlanId,frames[i].data,frames[i].len);
+		return ZT_RESULT_OK;
+	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
+}
+
+// Closure used to ping upstream peers
 class _PingPeersThatNeedPing
 {
 public:
@@ -205,8 +227,6 @@ public:
 
 			lastReceiveFromUpstream = std::max(p->lastReceive(),lastReceiveFromUpstream);
 			_upstreamsToContact.erase(p->address()); // erase from upstreams to contact so that we can WHOIS those that remain
-		} else if (p->isActive(_now)) {
-			p->doPingAndKeepalive(_now,-1);
 		}
 	}
 
@@ -217,11 +237,39 @@ private:
 	const SharedPtr<Peer> _bestCurrentUpstream;
 };
 
+// Closure used to ping active/online peers and expire idle ones as their timers come due
+class _PingDuePeers
+{
+public:
+	_PingDuePeers(uint64_t now) :
+		_now(now)
+	{
+	}
+
+	inline uint64_t operator()(Topology &t,const SharedPtr<Peer> &p)
+	{
+		p->refreshTimes(_now); // every peer comes due at least every ZT_PEER_ACTIVITY_TIMEOUT
+		if (!p->isAlive(_now))
+			return 0;
+		if (p->isActive(_now)) {
+			p->doPingAndKeepalive(_now,-1);
+			return p->nextPingCheck(_now);
+		}
+		// Left alone until it expires, or until Peer::received() hears real traffic from it
+		return p->lastReceive() + ZT_PEER_ACTIVITY_TIMEOUT;
+	}
+
+private:
+	const uint64_t _now;
+};
+
 ZT_ResultCode Node::processBackgroundTasks(uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
 	Mutex::Lock bl(_backgroundTasksLock);
 
+	RR->iv->finish();
+
 	unsigned long timeUntilNextPingCheck = ZT_PING_CHECK_INVERVAL;
 	const uint64_t timeSinceLastPingCheck = now - _lastPingCheck;
 	if (timeSinceLastPingCheck >= ZT_PING_CHECK_INVERVAL) {
@@ -241,11 +289,19 @@ ZT_ResultCode Node::processBackgroundTasks(uint64_t now,volatile uint64_t *nextB
 			for(std::vector< SharedPtr<Network> >::const_iterator n(needConfig.begin());n!=needConfig.end();++n)
 				(*n)->requestConfiguration();
 
-			// Do pings and keepalives
+			// Do pings and keepalives, upstreams every time and everyone else when due
 			Hashtable< Address,std::vector<InetAddress> > upstreamsToContact;
 			RR->topology->getUpstreamsToContact(upstreamsToContact);
 			_PingPeersThatNeedPing pfunc(RR,upstreamsToContact,now);
-			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
+			{
+				const std::vector<Address> upstreams(upstreamsToContact.keys());
+				for(std::vector<Address>::const_iterator a(upstreams.begin());a!=upstreams.end();++a) {
+					const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+					if (p)
+						pfunc(*RR->topology,p);
+				}
+			}
+			RR->topology->eachDuePeer(now,_PingDuePeers(now));
 
 			// Run WHOIS to create Peer for any upstreams we could not contact (including pending moon seeds)
 			Hashtable< Address,std::vector<InetAddress> >::Iterator i(upstreamsToContact);
@@ -297,6 +353,16 @@ ZT_ResultCode Node::processBackgroundTasks(uint64_t now,volatile uint64_t *nextB
 	return ZT_RESULT_OK;
 }
 
+int Node::processBackgroundWork()
+{
+	return (RR->iv->process()) ? 1 : 0;
+}
+
+void Node::stopBackgroundWork()
+{
+	RR->iv->stop();
+}
+
 ZT_ResultCode Node::join(uint64_t nwid,void *uptr)
 {
 	Mutex::Lock _l(_networks_m);
@@ -379,35 +445,26 @@ ZT_PeerList *Node::peers() const
 	pl->peers = (ZT_Peer *)(buf + sizeof(ZT_PeerList));
 
 	pl->peerCount = 0;
-	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::iterator pi(peers.begin());pi!=peers.end();++pi) {
-		ZT_Peer *p = &(pl->peers[pl->peerCount++]);
-		p->address = pi->second->address().toInt();
-		if (pi->second->remoteVersionKnown()) {
-			p->versionMajor = pi->second->remoteVersionMajor();
-			p->versionMinor = pi->second->remoteVersionMinor();
-			p->versionRev = pi->second->remoteVersionRevision();
-		} else {
-			p->versionMajor = -1;
-			p->versionMinor = -1;
-			p->versionRev = -1;
-		}
-		p->latency = pi->second->latency();
-		p->role = RR->topology->role(pi->second->identity().address());
-
-		std::vector< std::pair< SharedPtr<Path>,bool > > paths(pi->second->paths(_now));
-		SharedPtr<Path> bestp(pi->second->getBestPath(_now,false));
-		p->pathCount = 0;
-		for(std::vector< std::pair< SharedPtr<Path>,bool > >::iterator path(paths.begin());path!=paths.end();++path) {
-			memcpy(&(p->paths[p->pathCount].address),&(path->first->address()),sizeof(struct sockaddr_storage));
-			p->paths[p->pathCount].lastSend = path->first->lastOut();
-			p->paths[p->pathCount].lastReceive = path->first->lastIn();
-			p->paths[p->pathCount].trustedPathId = RR->topology->getOutboundPathTrust(path->first->address());
-			p->paths[p->pathCount].linkQuality = (int)path->first->linkQuality();
-			p->paths[p->pathCount].expired = path->second;
-			p->paths[p->pathCount].preferred = (path->first == bestp) ? 1 : 0;
-			++p->pathCount;
-		}
-	}
+	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::iterator pi(peers.begin());pi!=peers.end();++pi)
+		pi->second->externalStatus(_now,&(pl->peers[pl->peerCount++]));
+
+	return pl;
+}
+
+ZT_PeerList *Node::queryPeers(uint64_t start,uint64_t end,unsigned long maxPeers,uint64_t changedSince) const
+{
+	std::vector< SharedPtr<Peer> > peers;
+	RR->topology->queryPeers(start,end,maxPeers,changedSince,peers);
+
+	char *buf = (char *)::malloc(sizeof(ZT_PeerList) + (sizeof(ZT_Peer) * peers.size()));
+	if (!buf)
+		return (ZT_PeerList *)0;
+	ZT_PeerList *pl = (ZT_PeerList *)buf;
+	pl->peers = (ZT_Peer *)(buf + sizeof(ZT_PeerList));
+
+	pl->peerCount = 0;
+	for(std::vector< SharedPtr<Peer> >::iterator p(peers.begin());p!=peers.end();++p)
+		(*p)->externalStatus(_now,&(pl->peers[pl->peerCount++]));
 
 	return pl;
 }
@@ -732,40 +789,8 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 	} else {
 		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 		try {
-			if (nc.toDictionary(*dconf,sendLegacyFormatConfig)) {
-				uint64_t configUpdateId = prng();
-				if (!configUpdateId) ++configUpdateId;
-
-				const unsigned int totalSize = dconf->sizeBytes();
-				unsigned int chunkIndex = 0;
-				while (chunkIndex < totalSize) {
-					const unsigned int chunkLen = std::min(totalSize - chunkIndex,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 256)));
-					Packet outp(destination,RR->identity.address(),(requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
-					if (requestPacketId) {
-						outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
-						outp.append(requestPacketId);
-					}
-
-					const unsigned int sigStart = outp.size();
-					outp.append(nwid);
-					outp.append((uint16_t)chunkLen);
-					outp.append((const void *)(dconf->data() + chunkIndex),chunkLen);
-
-					outp.append((uint8_t)0); // no flags
-					outp.append((uint64_t)configUpdateId);
-					outp.append((uint32_t)totalSize);
-					outp.append((uint32_t)chunkIndex);
-
-					C25519::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t *>(outp.data()) + sigStart,outp.size() - sigStart));
-					outp.append((uint8_t)1);
-					outp.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
-					outp.append(sig.data,ZT_C25519_SIGNATURE_LEN);
-
-					outp.compress();
-					RR->sw->send(outp,true);
-					chunkIndex += chunkLen;
-				}
-			}
+			if (nc.toDictionary(*dconf,sendLegacyFormatConfig))
+				ncSendConfig(nwid,requestPacketId,destination,*dconf);
 			delete dconf;
 		} catch ( ... ) {
 			delete dconf;
@@ -774,6 +799,56 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 	}
 }
 
+void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &dconf)
+{
+	if (destination == RR->identity.address()) {
+		SharedPtr<Network> n(network(nwid));
+		if (!n) return;
+		NetworkConfig *nc = new NetworkConfig();
+		try {
+			if (nc->fromDictionary(dconf))
+				n->setConfiguration(*nc,true);
+			delete nc;
+		} catch ( ... ) {
+			delete nc;
+			throw;
+		}
+	} else {
+		uint64_t configUpdateId = prng();
+		if (!configUpdateId) ++configUpdateId;
+
+		const unsigned int totalSize = dconf.sizeBytes();
+		unsigned int chunkIndex = 0;
+		while (chunkIndex < totalSize) {
+			const unsigned int chunkLen = std::min(totalSize - chunkIndex,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 256)));
+			Packet outp(destination,RR->identity.address(),(requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
+			if (requestPacketId) {
+				outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
+				outp.append(requestPacketId);
+			}
+
+			const unsigned int sigStart = outp.size();
+			outp.append(nwid);
+			outp.append((uint16_t)chunkLen);
+			outp.append((const void *)(dconf.data() + chunkIndex),chunkLen);
+
+			outp.append((uint8_t)0); // no flags
+			outp.append((uint64_t)configUpdateId);
+			outp.append((uint32_t)totalSize);
+			outp.append((uint32_t)chunkIndex);
+
+			C25519::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t *>(outp.data()) + sigStart,outp.size() - sigStart));
+			outp.append((uint8_t)1);
+			outp.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
+			outp.append(sig.data,ZT_C25519_SIGNATURE_LEN);
+
+			outp.compress();
+			RR->sw->send(outp,true);
+			chunkIndex += chunkLen;
+		}
+	}
+}
+
 void Node::ncSendRevocation(const Address &destination,const Revocation &rev)
 {
 	if (destination == RR->identity.address()) {
@@ -896,6 +971,23 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	uint64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processVirtualNetworkFrames(now,nwid,frames,frameCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline)
 {
 	try {
@@ -907,6 +999,22 @@ enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,uint64_t now,vol
 	}
 }
 
+int ZT_Node_processBackgroundWork(ZT_Node *node)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processBackgroundWork();
+	} catch ( ... ) {
+		return 1; // keep the thread, the next call will pick up the next job
+	}
+}
+
+void ZT_Node_stopBackgroundWork(ZT_Node *node)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->stopBackgroundWork();
+	} catch ( ... ) {}
+}
+
 enum ZT_ResultCode ZT_Node_join(ZT_Node *node,uint64_t nwid,void *uptr)
 {
 	try {
@@ -990,6 +1098,15 @@ ZT_PeerList *ZT_Node_peers(ZT_Node *node)
 	}
 }
 
+ZT_PeerList *ZT_Node_queryPeers(ZT_Node *node,uint64_t start,uint64_t end,unsigned long maxPeers,uint64_t changedSince)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->queryPeers(start,end,maxPeers,changedSince);
+	} catch ( ... ) {
+		return (ZT_PeerList *)0;
+	}
+}
+
 ZT_VirtualNetworkConfig *ZT_Node_networkConfig(ZT_Node *node,uint64_t nwid)
 {
 	try {
@@ -1120,6 +1237,13 @@ void ZT_Node_setTrustedPaths(ZT_Node *node,const struct sockaddr_storage *networ
 	} catch ( ... ) {}
 }
 
+void ZT_Node_setBondingPolicy(ZT_Node *node,enum ZT_BondingPolicy policy)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setBondingPolicy(policy);
+	} catch ( ... ) {}
+}
+
 void ZT_version(int *major,int *minor,int *revision)
 {
 	if (major) *major = ZEROTIER_ONE_VERSION_MAJOR;
@@ -112,6 +112,12 @@ public:
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
 		_outgoingPacketCounter(0),
+		_lastBondProbe(0),
+		_bondProbeOutstanding(0),
+		_probePending(0),
+		_rtt(ZT_PATH_RTT_UNKNOWN),
+		_jitter(0),
+		_loss(0),
 		_addr(),
 		_localAddress(),
 		_ipScope(InetAddress::IP_SCOPE_NONE)
@@ -129,6 +135,12 @@ public:
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
 		_outgoingPacketCounter(0),
+		_lastBondProbe(0),
+		_bondProbeOutstanding(0),
+		_probePending(0),
+		_rtt(ZT_PATH_RTT_UNKNOWN),
+		_jitter(0),
+		_loss(0),
 		_addr(addr),
 		_localAddress(localAddress),
 		_ipScope(addr.ipScope())
@@ -177,6 +189,108 @@ public:
 		return (unsigned int)((lq >= 255) ? 255 : lq);
 	}
 
+	/**
+	 * Update round trip time and jitter with a new measurement
+	 *
+	 * These are smoothed as TCP does (RFC 6298): round trip time by 1/8 of
+	 * each new sample and jitter, the mean deviation from it, by 1/4.
+	 *
+	 * @param l Measured round trip time in milliseconds
+	 */
+	inline void updateLatency(const unsigned int l)
+	{
+		const int32_t m = (int32_t)std::min(l,(unsigned int)65535) << 4; // 1/16 ms
+		const uint32_t rtt = _rtt;
+		if (rtt == ZT_PATH_RTT_UNKNOWN) {
+			_rtt = (uint32_t)m;
+		} else {
+			const int32_t d = m - (int32_t)rtt;
+			_jitter = (uint32_t)((int32_t)_jitter + ((((d < 0) ? -d : d) - (int32_t)_jitter) / 4));
+			_rtt = (uint32_t)((int32_t)rtt + (d / 8));
+		}
+	}
+
+	/**
+	 * Note that a probe (ECHO or HELLO carrying this time) was just sent over this path
+	 *
+	 * The last probe is counted as lost if it has gone unanswered for
+	 * ZT_PATH_PROBE_TIMEOUT. Until then it stays the one being waited for,
+	 * and replies to newer ones only measure round trip time.
+	 *
+	 * @param now Current time, as sent in the probe
+	 */
+	inline void probeSent(const uint64_t now)
+	{
+		const uint64_t pending = _probePending;
+		if (pending) {
+			if ((now - pending) < ZT_PATH_PROBE_TIMEOUT)
+				return;
+			_loss = _loss - (_loss >> 4) + 4096;
+		}
+		_probePending = now;
+	}
+
+	/**
+	 * Handle the reply to a probe sent over this path
+	 *
+	 * @param sentAt Time carried in the probe and echoed back
+	 * @param now Current time
+	 */
+	inline void probeAnswered(const uint64_t sentAt,const uint64_t now)
+	{
+		if (now >= sentAt)
+			updateLatency((unsigned int)std::min(now - sentAt,(uint64_t)65535));
+		if ((_probePending)&&(_probePending == sentAt)) {
+			_probePending = 0;
+			_loss = _loss - (_loss >> 4);
+		}
+	}
+
+	/**
+	 * @return True if there has been at least one round trip time measurement
+	 */
+	inline bool latencyKnown() const { return (_rtt != ZT_PATH_RTT_UNKNOWN); }
+
+	/**
+	 * @return Smoothed round trip time in milliseconds or 0 if unknown
+	 */
+	inline unsigned int latency() const { const uint32_t rtt = _rtt; return (rtt == ZT_PATH_RTT_UNKNOWN) ? 0 : ((rtt + 8) >> 4); }
+
+	/**
+	 * @return Mean deviation of round trip time in milliseconds
+	 */
+	inline unsigned int jitter() const { return ((_jitter + 8) >> 4); }
+
+	/**
+	 * @return Share of probes lost from 0 to 1000, recent ones counting most
+	 */
+	inline unsigned int packetLoss() const { return (unsigned int)(((uint64_t)_loss * 1000) >> 16); }
+
+	/**
+	 * @return Cost of this path in milliseconds: round trip time and four times jitter, plus a second for each 10% of probes lost
+	 */
+	inline unsigned int cost() const { return (latency() + (jitter() * 4) + (packetLoss() * 10)); }
+
+	/**
+	 * @return True if this path is in a bond, has heard nothing lately, and has not been probed lately either
+	 */
+	inline bool bondProbeDue(const uint64_t now) const { return (((now - _lastIn) >= ZT_PATH_BOND_PROBE_INTERVAL)&&((now - _lastBondProbe) >= ZT_PATH_BOND_PROBE_INTERVAL)); }
+
+	/**
+	 * Note that a HELLO was just sent to see if this path is still there
+	 */
+	inline void bondProbed(const uint64_t now)
+	{
+		if (_bondProbeOutstanding <= _lastIn)
+			_bondProbeOutstanding = now; // first probe since we last heard anything
+		_lastBondProbe = now;
+	}
+
+	/**
+	 * @return True if a probe has gone unanswered for ZT_PATH_BOND_FAILOVER_TIMEOUT and nothing has been heard since
+	 */
+	inline bool bondFailed(const uint64_t now) const { return ((_bondProbeOutstanding > _lastIn)&&((now - _bondProbeOutstanding) >= ZT_PATH_BOND_FAILOVER_TIMEOUT)); }
+
 	/**
 	 * Set time last trusted packet was received (done in Peer::received())
 	 */
@@ -306,6 +420,12 @@ private:
 	volatile signed int _incomingLinkQualitySlowLogCounter;
 	volatile unsigned int _incomingLinkQualityPreviousPacketCounter;
 	volatile unsigned int _outgoingPacketCounter;
+	volatile uint64_t _lastBondProbe;
+	volatile uint64_t _bondProbeOutstanding; // time of the oldest probe not yet answered by anything
+	volatile uint64_t _probePending; // time of the last probe if it has not been answered yet
+	volatile uint32_t _rtt; // 1/16 ms
+	volatile uint32_t _jitter; // 1/16 ms
+	volatile uint32_t _loss; // lost probes, out of 65536
 	InetAddress _addr;
 	InetAddress _localAddress;
 	InetAddress::IpScope _ipScope; // memoize this since it's a computed value checked often
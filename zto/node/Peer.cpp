@@ -37,36 +37,76 @@
 
 namespace ZeroTier {
 
+// Never destroyed, since peers may still be around when static destructors run
+SlabAllocator<Peer,ZT_PEER_SLAB_SIZE> &Peer::_slab()
+{
+	static SlabAllocator<Peer,ZT_PEER_SLAB_SIZE> *const slab = new SlabAllocator<Peer,ZT_PEER_SLAB_SIZE>();
+	return *slab;
+}
+
 Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
 	RR(renv),
-	_lastReceive(0),
-	_lastNontrivialReceive(0),
-	_lastTriedMemorizedPath(0),
-	_lastDirectPathPushSent(0),
-	_lastDirectPathPushReceive(0),
-	_lastCredentialRequestSent(0),
-	_lastWhoisRequestReceived(0),
-	_lastEchoRequestReceived(0),
-	_lastComRequestReceived(0),
-	_lastComRequestSent(0),
-	_lastCredentialsReceived(0),
-	_lastTrustEstablishedPacketReceived(0),
-	_remoteClusterOptimal4(0),
+	_latency(0),
+	_numPaths(0),
 	_vProto(0),
+	_timerDeadline(0),
+	_lastReceive((uint32_t)(renv->node->now() - ZT_PEER_TIME_HORIZON)), // never is as long ago as we can say
+	_lastNontrivialReceive(_lastReceive),
+	_lastTriedMemorizedPath(_lastReceive),
+	_lastDirectPathPushSent(_lastReceive),
+	_lastDirectPathPushReceive(_lastReceive),
+	_lastCredentialRequestSent(_lastReceive),
+	_lastWhoisRequestReceived(_lastReceive),
+	_lastEchoRequestReceived(_lastReceive),
+	_lastComRequestReceived(_lastReceive),
+	_lastComRequestSent(_lastReceive),
+	_lastCredentialsReceived(_lastReceive),
+	_lastTrustEstablishedPacketReceived(_lastReceive),
+	_lastChanged((uint32_t)renv->node->now()),
+	_directPathPushCutoffCount(0),
+	_credentialsCutoffCount(0),
 	_vMajor(0),
 	_vMinor(0),
 	_vRevision(0),
-	_id(peerIdentity),
-	_numPaths(0),
-	_latency(0),
-	_directPathPushCutoffCount(0),
-	_credentialsCutoffCount(0)
+	_remoteClusterOptimal4(0),
+	_id(peerIdentity)
 {
 	memset(_remoteClusterOptimal6,0,sizeof(_remoteClusterOptimal6));
 	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
 		throw std::runtime_error("new peer identity key agreement failed");
 }
 
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const void *key) :
+	RR(renv),
+	_latency(0),
+	_numPaths(0),
+	_vProto(0),
+	_timerDeadline(0),
+	_lastReceive((uint32_t)(renv->node->now() - ZT_PEER_TIME_HORIZON)), // never is as long ago as we can say
+	_lastNontrivialReceive(_lastReceive),
+	_lastTriedMemorizedPath(_lastReceive),
+	_lastDirectPathPushSent(_lastReceive),
+	_lastDirectPathPushReceive(_lastReceive),
+	_lastCredentialRequestSent(_lastReceive),
+	_lastWhoisRequestReceived(_lastReceive),
+	_lastEchoRequestReceived(_lastReceive),
+	_lastComRequestReceived(_lastReceive),
+	_lastComRequestSent(_lastReceive),
+	_lastCredentialsReceived(_lastReceive),
+	_lastTrustEstablishedPacketReceived(_lastReceive),
+	_lastChanged((uint32_t)renv->node->now()),
+	_directPathPushCutoffCount(0),
+	_credentialsCutoffCount(0),
+	_vMajor(0),
+	_vMinor(0),
+	_vRevision(0),
+	_remoteClusterOptimal4(0),
+	_id(peerIdentity)
+{
+	memset(_remoteClusterOptimal6,0,sizeof(_remoteClusterOptimal6));
+	memcpy(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+}
+
 void Peer::received(
 	const SharedPtr<Path> &path,
 	const unsigned int hops,
@@ -124,20 +164,23 @@ void Peer::received(
 	}
 #endif
 
-	_lastReceive = now;
+	_lastReceive = (uint32_t)now;
 	switch (verb) {
 		case Packet::VERB_FRAME:
 		case Packet::VERB_EXT_FRAME:
 		case Packet::VERB_NETWORK_CONFIG_REQUEST:
 		case Packet::VERB_NETWORK_CONFIG:
 		case Packet::VERB_MULTICAST_FRAME:
-			_lastNontrivialReceive = now;
+			// An idle peer's timer is as far off as its expiry, bring it in to start pinging
+			if (_age(now,_lastNontrivialReceive) >= ZT_PEER_ACTIVITY_TIMEOUT)
+				RR->topology->schedulePeer(SharedPtr<Peer>(this),now + ZT_PING_CHECK_INVERVAL);
+			_lastNontrivialReceive = (uint32_t)now;
 			break;
 		default: break;
 	}
 
 	if (trustEstablished) {
-		_lastTrustEstablishedPacketReceived = now;
+		_lastTrustEstablishedPacketReceived = (uint32_t)now;
 		path->trustedPacketReceived(now);
 	}
 
@@ -150,7 +193,7 @@ void Peer::received(
 			Mutex::Lock _l(_paths_m);
 			for(unsigned int p=0;p<_numPaths;++p) {
 				if (_paths[p].path->address() == path->address()) {
-					_paths[p].lastReceive = now;
+					_paths[p].lastReceive = (uint32_t)now;
 					_paths[p].path = path; // local address may have changed!
 #ifdef ZT_ENABLE_CLUSTER
 					_paths[p].localClusterSuboptimal = suboptimalPath;
@@ -197,8 +240,10 @@ void Peer::received(
 					}
 				}
 
-				_paths[slot].lastReceive = now;
+				_paths[slot].lastReceive = (uint32_t)now;
 				_paths[slot].path = path;
+				_paths[slot].bondCredit = 0;
+				_lastChanged = (uint32_t)now;
 #ifdef ZT_ENABLE_CLUSTER
 				_paths[slot].localClusterSuboptimal = suboptimalPath;
 				if (RR->cluster)
@@ -218,8 +263,8 @@ void Peer::received(
 #else
 			const bool haveCluster = false;
 #endif
-		if ( ((now - _lastDirectPathPushSent) >= ZT_DIRECT_PATH_PUSH_INTERVAL) && (!haveCluster) ) {
-			_lastDirectPathPushSent = now;
+		if ( (_age(now,_lastDirectPathPushSent) >= ZT_DIRECT_PATH_PUSH_INTERVAL) && (!haveCluster) ) {
+			_lastDirectPathPushSent = (uint32_t)now;
 
 			std::vector<InetAddress> pathsToPush;
 
@@ -293,20 +338,20 @@ bool Peer::hasActivePathTo(uint64_t now,const InetAddress &addr) const
 {
 	Mutex::Lock _l(_paths_m);
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if ( (_paths[p].path->address() == addr) && ((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)) )
+		if ( (_paths[p].path->address() == addr) && (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)) )
 			return true; 
 	}
 	return false;
 }
 
-bool Peer::sendDirect(const void *data,unsigned int len,uint64_t now,bool forceEvenIfDead)
+bool Peer::sendDirect(const void *data,unsigned int len,uint64_t now,bool forceEvenIfDead,SharedPtr<Path> *via)
 {
 	Mutex::Lock _l(_paths_m);
 
 	int bestp = -1;
 	uint64_t best = 0ULL;
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if ( ((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)||(forceEvenIfDead)) ) {
+		if ( (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)||(forceEvenIfDead)) ) {
 			const uint64_t s = _pathScore(p,now);
 			if (s >= best) {
 				best = s;
@@ -316,6 +361,8 @@ bool Peer::sendDirect(const void *data,unsigned int len,uint64_t now,bool forceE
 	}
 
 	if (bestp >= 0) {
+		if (via)
+			*via = _paths[bestp].path;
 		return _paths[bestp].path->send(RR,data,len,now);
 	} else {
 		return false;
@@ -329,7 +376,7 @@ SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
 	int bestp = -1;
 	uint64_t best = 0ULL;
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if ( ((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) || (includeExpired) ) {
+		if ( (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) || (includeExpired) ) {
 			const uint64_t s = _pathScore(p,now);
 			if (s >= best) {
 				best = s;
@@ -345,6 +392,98 @@ SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
 	}
 }
 
+SharedPtr<Path> Peer::getBondedPath(const uint64_t now,const uint32_t flowId)
+{
+	const enum ZT_BondingPolicy policy = RR->node->bondingPolicy();
+	if (policy == ZT_BONDING_POLICY_NONE)
+		return SharedPtr<Path>();
+
+	// This is on the send path for every frame, so probe HELLOs go out after _paths_m is released
+	InetAddress probeFrom[ZT_MAX_PEER_NETWORK_PATHS],probeTo[ZT_MAX_PEER_NETWORK_PATHS];
+	unsigned int probeCounter[ZT_MAX_PEER_NETWORK_PATHS];
+	unsigned int probes = 0;
+	SharedPtr<Path> bestPath;
+
+	{
+		Mutex::Lock _l(_paths_m);
+
+		unsigned int bond[ZT_MAX_PEER_NETWORK_PATHS];
+		unsigned int bondSize = 0;
+		for(unsigned int p=0;p<_numPaths;++p) {
+			Path *const path = _paths[p].path.ptr();
+			if ( (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (path->alive(now)) ) {
+				if (path->bondProbeDue(now)) {
+					probeFrom[probes] = path->localAddress();
+					probeTo[probes] = path->address();
+					probeCounter[probes++] = path->nextOutgoingCounter();
+					path->bondProbed(now);
+					path->probeSent(now);
+				}
+				if (!path->bondFailed(now)) {
+					bond[bondSize++] = p;
+					continue;
+				}
+			}
+			_paths[p].bondCredit = 0;
+		}
+
+		if (bondSize) {
+			int bestp = -1;
+			if ((!flowId)||(bondSize == 1)) {
+				uint64_t best = 0ULL;
+				for(unsigned int b=0;b<bondSize;++b) {
+					const uint64_t s = _pathScore(bond[b],now);
+					if (s >= best) {
+						best = s;
+						bestp = (int)bond[b];
+					}
+				}
+			} else if (policy == ZT_BONDING_POLICY_BALANCE_FLOW) {
+				// Highest random weight, so a failed path only moves its own flows
+				uint64_t best = 0ULL;
+				for(unsigned int b=0;b<bondSize;++b) {
+					uint64_t h = ((uint64_t)flowId << 32) ^ (uint64_t)_paths[bond[b]].path->address().hashCode();
+					h ^= h >> 33;
+					h *= 0xff51afd7ed558ccdULL;
+					h ^= h >> 33;
+					h *= 0xc4ceb9fe1a85ec53ULL;
+					h ^= h >> 33;
+					if (h >= best) {
+						best = h;
+						bestp = (int)bond[b];
+					}
+				}
+			} else {
+				// Weight is link quality scaled by how much slower than the fastest path this one is
+				unsigned int minLatency = 0;
+				for(unsigned int b=0;b<bondSize;++b) {
+					const unsigned int l = _paths[bond[b]].path->latency();
+					if ((l)&&((!minLatency)||(l < minLatency)))
+						minLatency = l;
+				}
+				int32_t total = 0;
+				for(unsigned int b=0;b<bondSize;++b) {
+					const Path *const path = _paths[bond[b]].path.ptr();
+					int32_t w = (int32_t)path->linkQuality() + 1;
+					if ((minLatency)&&(path->latency() > minLatency))
+						w = std::max((int32_t)((w * minLatency) / path->latency()),(int32_t)1);
+					total += w;
+					_paths[bond[b]].bondCredit += w;
+					if ((bestp < 0)||(_paths[bond[b]].bondCredit > _paths[bestp].bondCredit))
+						bestp = (int)bond[b];
+				}
+				_paths[bestp].bondCredit -= total;
+			}
+			bestPath = _paths[bestp].path;
+		}
+	}
+
+	for(unsigned int p=0;p<probes;++p)
+		sendHELLO(probeFrom[p],probeTo[p],now,probeCounter[p]);
+
+	return bestPath;
+}
+
 void Peer::sendHELLO(const InetAddress &localAddr,const InetAddress &atAddress,uint64_t now,unsigned int counter)
 {
 	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_HELLO);
@@ -397,6 +536,7 @@ void Peer::attemptToContactAt(const InetAddress &localAddr,const InetAddress &at
 {
 	if ( (!sendFullHello) && (_vProto >= 5) && (!((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) ) {
 		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+		outp.append((uint64_t)now); // echoed back in OK(ECHO) to measure round trip time
 		RR->node->expectReplyTo(outp.packetId());
 		outp.armor(_key,true,counter);
 		RR->node->putPacket(localAddr,atAddress,outp.data(),outp.size());
@@ -407,8 +547,8 @@ void Peer::attemptToContactAt(const InetAddress &localAddr,const InetAddress &at
 
 void Peer::tryMemorizedPath(uint64_t now)
 {
-	if ((now - _lastTriedMemorizedPath) >= ZT_TRY_MEMORIZED_PATH_INTERVAL) {
-		_lastTriedMemorizedPath = now;
+	if (_age(now,_lastTriedMemorizedPath) >= ZT_TRY_MEMORIZED_PATH_INTERVAL) {
+		_lastTriedMemorizedPath = (uint32_t)now;
 		InetAddress mp;
 		if (RR->node->externalPathLookup(_id.address(),-1,mp))
 			attemptToContactAt(InetAddress(),mp,now,true,0);
@@ -422,7 +562,7 @@ bool Peer::doPingAndKeepalive(uint64_t now,int inetAddressFamily)
 	int bestp = -1;
 	uint64_t best = 0ULL;
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if ( ((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && ((inetAddressFamily < 0)||((int)_paths[p].path->address().ss_family == inetAddressFamily)) ) {
+		if ( (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && ((inetAddressFamily < 0)||((int)_paths[p].path->address().ss_family == inetAddressFamily)) ) {
 			const uint64_t s = _pathScore(p,now);
 			if (s >= best) {
 				best = s;
@@ -432,21 +572,128 @@ bool Peer::doPingAndKeepalive(uint64_t now,int inetAddressFamily)
 	}
 
 	if (bestp >= 0) {
-		if ( ((now - _paths[bestp].lastReceive) >= ZT_PEER_PING_PERIOD) || (_paths[bestp].path->needsHeartbeat(now)) ) {
-			attemptToContactAt(_paths[bestp].path->localAddress(),_paths[bestp].path->address(),now,false,_paths[bestp].path->nextOutgoingCounter());
+		if ( (_age(now,_paths[bestp].lastReceive) >= ZT_PEER_PING_PERIOD) || (_paths[bestp].path->needsHeartbeat(now)) ) {
+			attemptToContactAt(_paths[bestp].path->localAddress(),_paths[bestp].path->address(),now,_echoLimited((unsigned int)bestp,now),_paths[bestp].path->nextOutgoingCounter());
 			_paths[bestp].path->sent(now);
+			_paths[bestp].path->probeSent(now);
+		}
+
+		// Keep measuring one other path per call too, so that a better one can be noticed
+		for(unsigned int p=0;p<_numPaths;++p) {
+			if ( ((int)p != bestp) && (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && ((inetAddressFamily < 0)||((int)_paths[p].path->address().ss_family == inetAddressFamily)) && (_paths[p].path->needsHeartbeat(now)) ) {
+				attemptToContactAt(_paths[p].path->localAddress(),_paths[p].path->address(),now,_echoLimited(p,now),_paths[p].path->nextOutgoingCounter());
+				_paths[p].path->sent(now);
+				_paths[p].path->probeSent(now);
+				break;
+			}
 		}
+
 		return true;
 	} else {
 		return false;
 	}
 }
 
+uint64_t Peer::nextPingCheck(uint64_t now) const
+{
+	uint64_t next = (now - _age(now,_lastNontrivialReceive)) + ZT_PEER_ACTIVITY_TIMEOUT;
+	{
+		Mutex::Lock _l(_paths_m);
+		for(unsigned int p=0;p<_numPaths;++p) {
+			if (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) {
+				next = std::min(next,(now - _age(now,_paths[p].lastReceive)) + ZT_PEER_PING_PERIOD);
+				next = std::min(next,_paths[p].path->lastOut() + ZT_PATH_HEARTBEAT_PERIOD);
+			}
+		}
+	}
+	return std::min(std::max(next,now + ZT_PING_CHECK_INVERVAL),now + ZT_PATH_HEARTBEAT_PERIOD);
+}
+
+uint64_t Peer::lastReceive() const
+{
+	const uint64_t now = RR->node->now();
+	return (now - _age(now,_lastReceive));
+}
+
+uint64_t Peer::lastChanged() const
+{
+	const uint64_t now = RR->node->now();
+	return (now - _age(now,_lastChanged));
+}
+
+void Peer::externalStatus(const uint64_t now,ZT_Peer *ep) const
+{
+	ep->address = _id.address().toInt();
+	if (remoteVersionKnown()) {
+		ep->versionMajor = _vMajor;
+		ep->versionMinor = _vMinor;
+		ep->versionRev = _vRevision;
+	} else {
+		ep->versionMajor = -1;
+		ep->versionMinor = -1;
+		ep->versionRev = -1;
+	}
+	ep->latency = _latency;
+	ep->role = RR->topology->role(_id.address());
+
+	Mutex::Lock _l(_paths_m);
+	int bestp = -1; // as getBestPath(now,false) picks it
+	uint64_t best = 0ULL;
+	for(unsigned int p=0;p<_numPaths;++p) {
+		if (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) {
+			const uint64_t s = _pathScore(p,now);
+			if (s >= best) {
+				best = s;
+				bestp = (int)p;
+			}
+		}
+	}
+	for(unsigned int p=0;p<_numPaths;++p) {
+		ZT_PeerPhysicalPath &pp = ep->paths[p];
+		memcpy(&(pp.address),&(_paths[p].path->address()),sizeof(struct sockaddr_storage));
+		pp.lastSend = _paths[p].path->lastOut();
+		pp.lastReceive = _paths[p].path->lastIn();
+		pp.trustedPathId = RR->topology->getOutboundPathTrust(_paths[p].path->address());
+		pp.linkQuality = (int)_paths[p].path->linkQuality();
+		if (_paths[p].path->latencyKnown()) {
+			pp.latency = (int)_paths[p].path->latency();
+			pp.jitter = (int)_paths[p].path->jitter();
+		} else {
+			pp.latency = -1;
+			pp.jitter = -1;
+		}
+		pp.packetLoss = (int)_paths[p].path->packetLoss();
+		pp.expired = (_age(now,_paths[p].lastReceive) > ZT_PEER_PATH_EXPIRATION) ? 1 : 0;
+		pp.preferred = ((int)p == bestp) ? 1 : 0;
+	}
+	ep->pathCount = _numPaths;
+}
+
+void Peer::refreshTimes(const uint64_t now)
+{
+	_refreshTime(now,_lastReceive);
+	_refreshTime(now,_lastNontrivialReceive);
+	_refreshTime(now,_lastTriedMemorizedPath);
+	_refreshTime(now,_lastDirectPathPushSent);
+	_refreshTime(now,_lastDirectPathPushReceive);
+	_refreshTime(now,_lastCredentialRequestSent);
+	_refreshTime(now,_lastWhoisRequestReceived);
+	_refreshTime(now,_lastEchoRequestReceived);
+	_refreshTime(now,_lastComRequestReceived);
+	_refreshTime(now,_lastComRequestSent);
+	_refreshTime(now,_lastCredentialsReceived);
+	_refreshTime(now,_lastTrustEstablishedPacketReceived);
+	_refreshTime(now,_lastChanged);
+	Mutex::Lock _l(_paths_m);
+	for(unsigned int p=0;p<_numPaths;++p)
+		_refreshTime(now,_paths[p].lastReceive);
+}
+
 bool Peer::hasActiveDirectPath(uint64_t now) const
 {
 	Mutex::Lock _l(_paths_m);
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if (((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION)&&(_paths[p].path->alive(now)))
+		if ((_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION)&&(_paths[p].path->alive(now)))
 			return true;
 	}
 	return false;
@@ -459,7 +706,8 @@ void Peer::resetWithinScope(InetAddress::IpScope scope,int inetAddressFamily,uin
 		if ( (_paths[p].path->address().ss_family == inetAddressFamily) && (_paths[p].path->address().ipScope() == scope) ) {
 			attemptToContactAt(_paths[p].path->localAddress(),_paths[p].path->address(),now,false,_paths[p].path->nextOutgoingCounter());
 			_paths[p].path->sent(now);
-			_paths[p].lastReceive = 0; // path will not be used unless it speaks again
+			_paths[p].lastReceive = (uint32_t)(now - ZT_PEER_TIME_HORIZON); // path will not be used unless it speaks again
+			_lastChanged = (uint32_t)now;
 		}
 	}
 }
@@ -471,7 +719,7 @@ void Peer::getRendezvousAddresses(uint64_t now,InetAddress &v4,InetAddress &v6)
 	int bestp4 = -1,bestp6 = -1;
 	uint64_t best4 = 0ULL,best6 = 0ULL;
 	for(unsigned int p=0;p<_numPaths;++p) {
-		if ( ((now - _paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)) ) {
+		if ( (_age(now,_paths[p].lastReceive) <= ZT_PEER_PATH_EXPIRATION) && (_paths[p].path->alive(now)) ) {
 			if (_paths[p].path->address().ss_family == AF_INET) {
 				const uint64_t s = _pathScore(p,now);
 				if (s >= best4) {
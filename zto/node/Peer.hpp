@@ -41,12 +41,19 @@
 #include "AtomicCounter.hpp"
 #include "Hashtable.hpp"
 #include "Mutex.hpp"
+#include "SlabAllocator.hpp"
 #include "NonCopyable.hpp"
 
 namespace ZeroTier {
 
 /**
  * Peer on P2P Network (virtual layer 1)
+ *
+ * Roots may know millions of these, so they are kept small. Peers come from
+ * a slab instead of one malloc() each. What is touched for every packet and
+ * every ping check is at the front: the key, receive times and timer in the
+ * first 64 bytes, paths in the next. Rate gates and the identity come last.
+ * Timestamps are kept as 32-bit ages relative to now (see refreshTimes()).
  */
 class Peer : NonCopyable
 {
@@ -68,6 +75,23 @@ public:
 	 */
 	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
 
+	/**
+	 * Construct a new peer whose key has already been agreed
+	 *
+	 * @param renv Runtime environment
+	 * @param peerIdentity Identity of peer
+	 * @param key Secret key of ZT_PEER_SECRET_KEY_LENGTH bytes
+	 */
+	Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const void *key);
+
+	static inline void *operator new(size_t sz) { return _slab().get(); }
+	static inline void operator delete(void *p) { _slab().put(p); }
+
+	/**
+	 * @return Bytes taken from the heap for peers, including free slots
+	 */
+	static inline unsigned long allocatedBytes() { return _slab().bytes(); }
+
 	/**
 	 * @return This peer's ZT address (short for identity().address())
 	 */
@@ -129,9 +153,10 @@ public:
 	 * @param len Packet length
 	 * @param now Current time
 	 * @param forceEvenIfDead If true, send even if the path is not 'alive'
+	 * @param via If not NULL, set to the path that was used
 	 * @return True if we actually sent something
 	 */
-	bool sendDirect(const void *data,unsigned int len,uint64_t now,bool forceEvenIfDead);
+	bool sendDirect(const void *data,unsigned int len,uint64_t now,bool forceEvenIfDead,SharedPtr<Path> *via = (SharedPtr<Path> *)0);
 
 	/**
 	 * Get the best current direct path
@@ -142,6 +167,22 @@ public:
 	 */
 	SharedPtr<Path> getBestPath(uint64_t now,bool includeExpired);
 
+	/**
+	 * Get the path to send a frame over under the node's bonding policy
+	 *
+	 * Alive direct paths that have not failed a probe form the bond. Quiet
+	 * ones are probed with HELLO here as they are used. Frames of a flow go
+	 * to one path by rendezvous hashing under ZT_BONDING_POLICY_BALANCE_FLOW,
+	 * or to every path in turn in proportion to link quality over latency
+	 * under ZT_BONDING_POLICY_BALANCE_RR. Anything else goes to the best path
+	 * in the bond.
+	 *
+	 * @param now Current time
+	 * @param flowId Flow the frame belongs to, or 0 if not a frame
+	 * @return Path or NULL if bonding is off or no path is fit, in which case use getBestPath()
+	 */
+	SharedPtr<Path> getBondedPath(const uint64_t now,const uint32_t flowId);
+
 	/**
 	 * Send a HELLO to this peer at a specified physical address
 	 *
@@ -183,6 +224,20 @@ public:
 	 */
 	bool doPingAndKeepalive(uint64_t now,int inetAddressFamily);
 
+	/**
+	 * Get the next time doPingAndKeepalive() might have something to do
+	 *
+	 * This is the earliest of a direct path needing a ping or a heartbeat and
+	 * this peer going idle. It errs early: traffic sent in the meantime only
+	 * pushes heartbeats back. It is never sooner than ZT_PING_CHECK_INVERVAL
+	 * or later than ZT_PATH_HEARTBEAT_PERIOD from now, so newly learned paths
+	 * are looked at in time.
+	 *
+	 * @param now Current time
+	 * @return Time of next check
+	 */
+	uint64_t nextPingCheck(uint64_t now) const;
+
 	/**
 	 * @param now Current time
 	 * @return True if this peer has at least one active and alive direct path
@@ -222,24 +277,60 @@ public:
 		std::vector< std::pair< SharedPtr<Path>,bool > > pp;
 		Mutex::Lock _l(_paths_m);
 		for(unsigned int p=0,np=_numPaths;p<np;++p)
-			pp.push_back(std::pair< SharedPtr<Path>,bool >(_paths[p].path,(now - _paths[p].lastReceive) > ZT_PEER_PATH_EXPIRATION));
+			pp.push_back(std::pair< SharedPtr<Path>,bool >(_paths[p].path,_age(now,_paths[p].lastReceive) > ZT_PEER_PATH_EXPIRATION));
 		return pp;
 	}
 
 	/**
-	 * @return Time of last receive of anything, whether direct or relayed
+	 * @return Time of last receive of anything, whether direct or relayed, no more than ZT_PEER_TIME_HORIZON ago
+	 */
+	uint64_t lastReceive() const;
+
+	/**
+	 * @return Time this peer was created or its remote version or set of direct paths last changed, no more than ZT_PEER_TIME_HORIZON ago
 	 */
-	inline uint64_t lastReceive() const { return _lastReceive; }
+	uint64_t lastChanged() const;
+
+	/**
+	 * Fill in a peer status structure for the public API
+	 *
+	 * @param now Current time
+	 * @param ep Structure to fill
+	 */
+	void externalStatus(const uint64_t now,ZT_Peer *ep) const;
 
 	/**
 	 * @return True if we've heard from this peer in less than ZT_PEER_ACTIVITY_TIMEOUT
 	 */
-	inline bool isAlive(const uint64_t now) const { return ((now - _lastReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
+	inline bool isAlive(const uint64_t now) const { return (_age(now,_lastReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
 
 	/**
 	 * @return True if this peer has sent us real network traffic recently
 	 */
-	inline uint64_t isActive(uint64_t now) const { return ((now - _lastNontrivialReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
+	inline uint64_t isActive(uint64_t now) const { return (_age(now,_lastNontrivialReceive) < ZT_PEER_ACTIVITY_TIMEOUT); }
+
+	/**
+	 * Pull timestamps older than ZT_PEER_TIME_HORIZON forward to that age
+	 *
+	 * Timestamps are 32 bits and would otherwise wrap around to look recent
+	 * after about 49 days. This must be called at least once per horizon,
+	 * which Topology's timer wheel does for every peer it knows.
+	 *
+	 * @param now Current time
+	 */
+	void refreshTimes(const uint64_t now);
+
+	/**
+	 * @return Deadline of this peer's entry on Topology's timer wheel, 0 if none
+	 */
+	inline uint64_t timerDeadline() const { return _timerDeadline; }
+
+	/**
+	 * Only for TimerWheel, under Topology's lock
+	 *
+	 * @param t New deadline or 0 for none
+	 */
+	inline void setTimerDeadline(const uint64_t t) { _timerDeadline = t; }
 
 	/**
 	 * @return Latency in milliseconds or 0 if unknown
@@ -259,7 +350,7 @@ public:
 	 */
 	inline unsigned int relayQuality(const uint64_t now) const
 	{
-		const uint64_t tsr = now - _lastReceive;
+		const uint64_t tsr = _age(now,_lastReceive);
 		if (tsr >= ZT_PEER_ACTIVITY_TIMEOUT)
 			return (~(unsigned int)0);
 		unsigned int l = _latency;
@@ -308,12 +399,15 @@ public:
 	 * @param vmaj Major version
 	 * @param vmin Minor version
 	 * @param vrev Revision
+	 * @param now Current time
 	 */
-	inline void setRemoteVersion(unsigned int vproto,unsigned int vmaj,unsigned int vmin,unsigned int vrev)
+	inline void setRemoteVersion(unsigned int vproto,unsigned int vmaj,unsigned int vmin,unsigned int vrev,const uint64_t now)
 	{
-		_vProto = (uint16_t)vproto;
-		_vMajor = (uint16_t)vmaj;
-		_vMinor = (uint16_t)vmin;
+		if ((_vProto != (uint8_t)vproto)||(_vMajor != (uint8_t)vmaj)||(_vMinor != (uint8_t)vmin)||(_vRevision != (uint16_t)vrev))
+			_lastChanged = (uint32_t)now;
+		_vProto = (uint8_t)vproto;
+		_vMajor = (uint8_t)vmaj;
+		_vMinor = (uint8_t)vmin;
 		_vRevision = (uint16_t)vrev;
 	}
 
@@ -327,17 +421,18 @@ public:
 	/**
 	 * @return True if peer has received a trust established packet (e.g. common network membership) in the past ZT_TRUST_EXPIRATION ms
 	 */
-	inline bool trustEstablished(const uint64_t now) const { return ((now - _lastTrustEstablishedPacketReceived) < ZT_TRUST_EXPIRATION); }
+	inline bool trustEstablished(const uint64_t now) const { return (_age(now,_lastTrustEstablishedPacketReceived) < ZT_TRUST_EXPIRATION); }
 
 	/**
 	 * Rate limit gate for VERB_PUSH_DIRECT_PATHS
 	 */
 	inline bool rateGatePushDirectPaths(const uint64_t now)
 	{
-		if ((now - _lastDirectPathPushReceive) <= ZT_PUSH_DIRECT_PATHS_CUTOFF_TIME)
-			++_directPathPushCutoffCount;
-		else _directPathPushCutoffCount = 0;
-		_lastDirectPathPushReceive = now;
+		if (_age(now,_lastDirectPathPushReceive) <= ZT_PUSH_DIRECT_PATHS_CUTOFF_TIME) {
+			if (_directPathPushCutoffCount < 0xff)
+				++_directPathPushCutoffCount;
+		} else _directPathPushCutoffCount = 0;
+		_lastDirectPathPushReceive = (uint32_t)now;
 		return (_directPathPushCutoffCount < ZT_PUSH_DIRECT_PATHS_CUTOFF_LIMIT);
 	}
 
@@ -346,10 +441,11 @@ public:
 	 */
 	inline bool rateGateCredentialsReceived(const uint64_t now)
 	{
-		if ((now - _lastCredentialsReceived) <= ZT_PEER_CREDENTIALS_CUTOFF_TIME)
-			++_credentialsCutoffCount;
-		else _credentialsCutoffCount = 0;
-		_lastCredentialsReceived = now;
+		if (_age(now,_lastCredentialsReceived) <= ZT_PEER_CREDENTIALS_CUTOFF_TIME) {
+			if (_credentialsCutoffCount < 0xff)
+				++_credentialsCutoffCount;
+		} else _credentialsCutoffCount = 0;
+		_lastCredentialsReceived = (uint32_t)now;
 		return (_directPathPushCutoffCount < ZT_PEER_CREDEITIALS_CUTOFF_LIMIT);
 	}
 
@@ -358,8 +454,8 @@ public:
 	 */
 	inline bool rateGateRequestCredentials(const uint64_t now)
 	{
-		if ((now - _lastCredentialRequestSent) >= ZT_PEER_GENERAL_RATE_LIMIT) {
-			_lastCredentialRequestSent = now;
+		if (_age(now,_lastCredentialRequestSent) >= ZT_PEER_GENERAL_RATE_LIMIT) {
+			_lastCredentialRequestSent = (uint32_t)now;
 			return true;
 		}
 		return false;
@@ -370,8 +466,8 @@ public:
 	 */
 	inline bool rateGateInboundWhoisRequest(const uint64_t now)
 	{
-		if ((now - _lastWhoisRequestReceived) >= ZT_PEER_WHOIS_RATE_LIMIT) {
-			_lastWhoisRequestReceived = now;
+		if (_age(now,_lastWhoisRequestReceived) >= ZT_PEER_WHOIS_RATE_LIMIT) {
+			_lastWhoisRequestReceived = (uint32_t)now;
 			return true;
 		}
 		return false;
@@ -382,8 +478,8 @@ public:
 	 */
 	inline bool rateGateEchoRequest(const uint64_t now)
 	{
-		if ((now - _lastEchoRequestReceived) >= ZT_PEER_GENERAL_RATE_LIMIT) {
-			_lastEchoRequestReceived = now;
+		if (_age(now,_lastEchoRequestReceived) >= ZT_PEER_GENERAL_RATE_LIMIT) {
+			_lastEchoRequestReceived = (uint32_t)now;
 			return true;
 		}
 		return false;
@@ -394,8 +490,8 @@ public:
 	 */
 	inline bool rateGateIncomingComRequest(const uint64_t now)
 	{
-		if ((now - _lastComRequestReceived) >= ZT_PEER_GENERAL_RATE_LIMIT) {
-			_lastComRequestReceived = now;
+		if (_age(now,_lastComRequestReceived) >= ZT_PEER_GENERAL_RATE_LIMIT) {
+			_lastComRequestReceived = (uint32_t)now;
 			return true;
 		}
 		return false;
@@ -406,17 +502,29 @@ public:
 	 */
 	inline bool rateGateOutgoingComRequest(const uint64_t now)
 	{
-		if ((now - _lastComRequestSent) >= ZT_PEER_GENERAL_RATE_LIMIT) {
-			_lastComRequestSent = now;
+		if (_age(now,_lastComRequestSent) >= ZT_PEER_GENERAL_RATE_LIMIT) {
+			_lastComRequestSent = (uint32_t)now;
 			return true;
 		}
 		return false;
 	}
 
 private:
+	// Age of a timestamp kept as the low 32 bits of the time it was taken
+	static inline uint64_t _age(const uint64_t now,const uint32_t t) { return (uint64_t)((uint32_t)now - t); }
+
+	static inline void _refreshTime(const uint64_t now,uint32_t &t)
+	{
+		const uint32_t a = (uint32_t)now - t;
+		if ((a > ZT_PEER_TIME_HORIZON)&&(a < 0x80000000)) // past the horizon, but not ahead of now
+			t = (uint32_t)now - ZT_PEER_TIME_HORIZON;
+	}
+
+	static SlabAllocator<Peer,ZT_PEER_SLAB_SIZE> &_slab();
+
 	inline uint64_t _pathScore(const unsigned int p,const uint64_t now) const
 	{
-		uint64_t s = ZT_PEER_PING_PERIOD + _paths[p].lastReceive + (uint64_t)(_paths[p].path->preferenceRank() * (ZT_PEER_PING_PERIOD / ZT_PATH_MAX_PREFERENCE_RANK));
+		uint64_t s = ZT_PEER_PING_PERIOD + (now - _age(now,_paths[p].lastReceive)) + (uint64_t)(_paths[p].path->preferenceRank() * (ZT_PEER_PING_PERIOD / ZT_PATH_MAX_PREFERENCE_RANK));
 
 		if (_paths[p].path->address().ss_family == AF_INET) {
 			s +=  (uint64_t)(ZT_PEER_PING_PERIOD * (unsigned long)(reinterpret_cast<const struct sockaddr_in *>(&(_paths[p].path->address()))->sin_addr.s_addr == _remoteClusterOptimal4));
@@ -433,6 +541,7 @@ private:
 		}
 
 		s += (ZT_PEER_PING_PERIOD / 2) * (uint64_t)_paths[p].path->alive(now);
+		s -= std::min((uint64_t)_paths[p].path->cost(),(uint64_t)ZT_PATH_MAX_COST_PENALTY);
 
 #ifdef ZT_ENABLE_CLUSTER
 		s -= ZT_PEER_PING_PERIOD * (uint64_t)_paths[p].localClusterSuboptimal;
@@ -441,48 +550,67 @@ private:
 		return s;
 	}
 
-	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
+	// Peers answer one ECHO per ZT_PEER_GENERAL_RATE_LIMIT however many paths it came over, so
+	// a probe should be a HELLO if another path to this peer has just been sent to
+	inline bool _echoLimited(const unsigned int p,const uint64_t now) const
+	{
+		for(unsigned int q=0;q<_numPaths;++q) {
+			if ((q != p)&&((now - _paths[q].path->lastOut()) < ZT_PEER_GENERAL_RATE_LIMIT))
+				return true;
+		}
+		return false;
+	}
+
+	// Hot: looked at for every packet and every ping check
 
 	const RuntimeEnvironment *RR;
 
-	uint64_t _lastReceive; // direct or indirect
-	uint64_t _lastNontrivialReceive; // frames, things like netconf, etc.
-	uint64_t _lastTriedMemorizedPath;
-	uint64_t _lastDirectPathPushSent;
-	uint64_t _lastDirectPathPushReceive;
-	uint64_t _lastCredentialRequestSent;
-	uint64_t _lastWhoisRequestReceived;
-	uint64_t _lastEchoRequestReceived;
-	uint64_t _lastComRequestReceived;
-	uint64_t _lastComRequestSent;
-	uint64_t _lastCredentialsReceived;
-	uint64_t _lastTrustEstablishedPacketReceived;
+	AtomicCounter __refCount; // not first, or it would need its own bytes apart from Peer's NonCopyable base
+	uint16_t _latency;
+	uint8_t _numPaths;
+	uint8_t _vProto;
 
-	uint8_t _remoteClusterOptimal6[16];
-	uint32_t _remoteClusterOptimal4;
+	uint64_t _timerDeadline;
 
-	uint16_t _vProto;
-	uint16_t _vMajor;
-	uint16_t _vMinor;
-	uint16_t _vRevision;
+	uint32_t _lastReceive; // direct or indirect
+	uint32_t _lastNontrivialReceive; // frames, things like netconf, etc.
 
-	Identity _id;
+	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
 
 	struct {
-		uint64_t lastReceive;
 		SharedPtr<Path> path;
+		uint32_t lastReceive;
+		int32_t bondCredit; // for smooth weighted round robin in getBondedPath()
 #ifdef ZT_ENABLE_CLUSTER
 		bool localClusterSuboptimal;
 #endif
 	} _paths[ZT_MAX_PEER_NETWORK_PATHS];
 	Mutex _paths_m;
 
-	unsigned int _numPaths;
-	unsigned int _latency;
-	unsigned int _directPathPushCutoffCount;
-	unsigned int _credentialsCutoffCount;
+	// Cold: rate gates, versions, redirects and the identity
+
+	uint32_t _lastTriedMemorizedPath;
+	uint32_t _lastDirectPathPushSent;
+	uint32_t _lastDirectPathPushReceive;
+	uint32_t _lastCredentialRequestSent;
+	uint32_t _lastWhoisRequestReceived;
+	uint32_t _lastEchoRequestReceived;
+	uint32_t _lastComRequestReceived;
+	uint32_t _lastComRequestSent;
+	uint32_t _lastCredentialsReceived;
+	uint32_t _lastTrustEstablishedPacketReceived;
+	uint32_t _lastChanged; // see lastChanged()
+
+	uint8_t _directPathPushCutoffCount;
+	uint8_t _credentialsCutoffCount;
+	uint8_t _vMajor;
+	uint8_t _vMinor;
+	uint16_t _vRevision;
+
+	uint32_t _remoteClusterOptimal4;
+	uint8_t _remoteClusterOptimal6[16];
 
-	AtomicCounter __refCount;
+	Identity _id;
 };
 
 } // namespace ZeroTier
@@ -34,6 +34,7 @@ class Node;
 class Multicaster;
 class NetworkController;
 class SelfAwareness;
+class IdentityValidator;
 class Cluster;
 
 /**
@@ -50,6 +51,7 @@ public:
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
 		,sa((SelfAwareness *)0)
+		,iv((IdentityValidator *)0)
 #ifdef ZT_ENABLE_CLUSTER
 		,cluster((Cluster *)0)
 #endif
@@ -79,6 +81,7 @@ public:
 	Multicaster *mc;
 	Topology *topology;
 	SelfAwareness *sa;
+	IdentityValidator *iv;
 #ifdef ZT_ENABLE_CLUSTER
 	Cluster *cluster;
 #endif
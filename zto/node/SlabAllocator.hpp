@@ -0,0 +1,133 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_SLABALLOCATOR_HPP
+#define ZT_SLABALLOCATOR_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Fixed size memory for objects of one type, carved out of slabs of N
+ *
+ * Objects packed into slabs don't each pay for a malloc() header and don't
+ * end up scattered across the heap. Freed memory is reused before another
+ * slab is taken, and slabs are never given back, so this stays as big as
+ * the most objects ever allocated at once. Slabs start on a 64-byte cache
+ * line, so if sizeof(T) is a multiple of 64 every object does too. Classes
+ * use it by routing their operator new and delete here.
+ *
+ * This class is thread safe.
+ *
+ * @tparam T Type of object
+ * @tparam N Objects per slab
+ */
+template<typename T,unsigned int N>
+class SlabAllocator : NonCopyable
+{
+public:
+	SlabAllocator() : _free((_Slot *)0),_inUse(0) {}
+
+	~SlabAllocator()
+	{
+		for(std::vector<void *>::iterator s(_slabs.begin());s!=_slabs.end();++s)
+			::free(*s);
+	}
+
+	/**
+	 * @return Memory for one T
+	 * @throws std::bad_alloc Out of memory
+	 */
+	inline void *get()
+	{
+		Mutex::Lock _l(_lock);
+		if (!_free) {
+			void *const m = ::malloc((sizeof(_Slot) * N) + 64);
+			if (!m)
+				throw std::bad_alloc();
+			_slabs.push_back(m);
+			_Slot *const slab = reinterpret_cast<_Slot *>((reinterpret_cast<uintptr_t>(m) + 63) & ~((uintptr_t)63));
+			for(unsigned int i=N;i>0;--i) {
+				slab[i - 1].next = _free;
+				_free = &(slab[i - 1]);
+			}
+		}
+		_Slot *const s = _free;
+		_free = s->next;
+		++_inUse;
+		return reinterpret_cast<void *>(s);
+	}
+
+	/**
+	 * @param p Memory from get(), or NULL to do nothing
+	 */
+	inline void put(void *p)
+	{
+		if (!p)
+			return;
+		Mutex::Lock _l(_lock);
+		_Slot *const s = reinterpret_cast<_Slot *>(p);
+		s->next = _free;
+		_free = s;
+		--_inUse;
+	}
+
+	/**
+	 * @return Number of objects currently allocated
+	 */
+	inline unsigned long inUse() const
+	{
+		Mutex::Lock _l(_lock);
+		return _inUse;
+	}
+
+	/**
+	 * @return Total bytes taken from the heap
+	 */
+	inline unsigned long bytes() const
+	{
+		Mutex::Lock _l(_lock);
+		return (unsigned long)(_slabs.size() * ((sizeof(_Slot) * N) + 64));
+	}
+
+private:
+	union _Slot
+	{
+		_Slot *next; // while free
+		uint64_t align;
+		unsigned char obj[sizeof(T)];
+	};
+
+	std::vector<void *> _slabs;
+	_Slot *_free;
+	unsigned long _inUse;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -56,6 +56,33 @@ static const char *etherTypeName(const unsigned int etherType)
 }
 #endif // ZT_TRACE
 
+// Hash of what identifies an IP flow (addresses, protocol and ports if there are any), never 0
+static uint32_t _flowId(const unsigned int etherType,const uint8_t *const data,const unsigned int len)
+{
+	uint32_t h = 2166136261U; // FNV-1a
+	unsigned int proto = 0,ports = 0;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		for(unsigned int i=12;i<20;++i)
+			h = (h ^ (uint32_t)data[i]) * 16777619U;
+		proto = data[9];
+		if (((data[6] & 0x3f)|data[7]) == 0) // fragments don't all have ports, so leave them out for every fragment
+			ports = (data[0] & 0xf) * 4;
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		for(unsigned int i=8;i<40;++i)
+			h = (h ^ (uint32_t)data[i]) * 16777619U;
+		proto = data[6];
+		ports = 40;
+	} else {
+		h = (h ^ etherType) * 16777619U;
+	}
+	h = (h ^ proto) * 16777619U;
+	if ( ((proto == 6)||(proto == 17)||(proto == 132)) && (ports) && (len >= (ports + 4)) ) { // TCP, UDP, SCTP
+		for(unsigned int i=ports;i<(ports + 4);++i)
+			h = (h ^ (uint32_t)data[i]) * 16777619U;
+	}
+	return (h) ? h : 1;
+}
+
 Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
@@ -94,7 +121,11 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 			}
 
 		} else if (len > ZT_PROTO_MIN_FRAGMENT_LENGTH) { // SECURITY: min length check is important since we do some C-style stuff below!
-			if (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
+			const bool isFragment = (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR);
+			if ( ((isFragment)||(len >= ZT_PROTO_MIN_PACKET_LENGTH)) && (_relayFast(now,path,reinterpret_cast<const uint8_t *>(data),len,isFragment)) )
+				return;
+
+			if (isFragment) {
 				// Handle fragment ----------------------------------------------------
 
 				Packet::Fragment fragment(data,len);
@@ -116,7 +147,10 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
 						// It wouldn't hurt anything, just redundant and unnecessary.
 						SharedPtr<Peer> relayTo = RR->topology->getPeer(destination);
-						if ((!relayTo)||(!relayTo->sendDirect(fragment.data(),fragment.size(),now,false))) {
+						SharedPtr<Path> via;
+						if ((relayTo)&&(relayTo->sendDirect(fragment.data(),fragment.size(),now,false,&via))) {
+							_cacheRelayPath(now,destination,via);
+						} else {
 #ifdef ZT_ENABLE_CLUSTER
 							if ((RR->cluster)&&(!isClusterFrontplane)) {
 								RR->cluster->relayViaCluster(Address(),destination,fragment.data(),fragment.size(),false);
@@ -213,62 +247,11 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 #endif
 
 						SharedPtr<Peer> relayTo = RR->topology->getPeer(destination);
-						if ((relayTo)&&(relayTo->sendDirect(packet.data(),packet.size(),now,false))) {
-							if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) { // don't send RENDEZVOUS for cluster frontplane relays
-								const InetAddress *hintToSource = (InetAddress *)0;
-								const InetAddress *hintToDest = (InetAddress *)0;
-
-								InetAddress destV4,destV6;
-								InetAddress sourceV4,sourceV6;
-								relayTo->getRendezvousAddresses(now,destV4,destV6);
-
-								const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(source));
-								if (sourcePeer) {
-									sourcePeer->getRendezvousAddresses(now,sourceV4,sourceV6);
-									if ((destV6)&&(sourceV6)) {
-										hintToSource = &destV6;
-										hintToDest = &sourceV6;
-									} else if ((destV4)&&(sourceV4)) {
-										hintToSource = &destV4;
-										hintToDest = &sourceV4;
-									}
-
-									if ((hintToSource)&&(hintToDest)) {
-										unsigned int alt = (unsigned int)RR->node->prng() & 1; // randomize which hint we send first for obscure NAT-t reasons
-										const unsigned int completed = alt + 2;
-										while (alt != completed) {
-											if ((alt & 1) == 0) {
-												Packet outp(source,RR->identity.address(),Packet::VERB_RENDEZVOUS);
-												outp.append((uint8_t)0);
-												destination.appendTo(outp);
-												outp.append((uint16_t)hintToSource->port());
-												if (hintToSource->ss_family == AF_INET6) {
-													outp.append((uint8_t)16);
-													outp.append(hintToSource->rawIpData(),16);
-												} else {
-													outp.append((uint8_t)4);
-													outp.append(hintToSource->rawIpData(),4);
-												}
-												send(outp,true);
-											} else {
-												Packet outp(destination,RR->identity.address(),Packet::VERB_RENDEZVOUS);
-												outp.append((uint8_t)0);
-												source.appendTo(outp);
-												outp.append((uint16_t)hintToDest->port());
-												if (hintToDest->ss_family == AF_INET6) {
-													outp.append((uint8_t)16);
-													outp.append(hintToDest->rawIpData(),16);
-												} else {
-													outp.append((uint8_t)4);
-													outp.append(hintToDest->rawIpData(),4);
-												}
-												send(outp,true);
-											}
-											++alt;
-										}
-									}
-								}
-							}
+						SharedPtr<Path> via;
+						if ((relayTo)&&(relayTo->sendDirect(packet.data(),packet.size(),now,false,&via))) {
+							_cacheRelayPath(now,destination,via);
+							if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) // don't send RENDEZVOUS for cluster frontplane relays
+								_unite(now,source,destination,relayTo);
 						} else {
 #ifdef ZT_ENABLE_CLUSTER
 							if ((RR->cluster)&&(source != RR->identity.address())) {
@@ -536,7 +519,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 			outp.append(data,len);
 			if (!network->config().disableCompression())
 				outp.compress();
-			send(outp,true);
+			send(outp,true,_flowId(etherType,(const uint8_t *)data,len));
 		} else {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
 			outp.append(network->id());
@@ -544,7 +527,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 			outp.append(data,len);
 			if (!network->config().disableCompression())
 				outp.compress();
-			send(outp,true);
+			send(outp,true,_flowId(etherType,(const uint8_t *)data,len));
 		}
 
 		//TRACE("%.16llx: UNICAST: %s -> %s etherType==%s(%.4x) vlanId==%u len==%u fromBridged==%d includeCom==%d",network->id(),from.toString().c_str(),to.toString().c_str(),etherTypeName(etherType),etherType,vlanId,len,(int)fromBridged,(int)includeCom);
@@ -602,7 +585,7 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 				outp.append(data,len);
 				if (!network->config().disableCompression())
 					outp.compress();
-				send(outp,true);
+				send(outp,true,_flowId(etherType,(const uint8_t *)data,len));
 			} else {
 				TRACE("%.16llx: %s -> %s %s packet not sent: filterOutgoingPacket() returned false",network->id(),from.toString().c_str(),to.toString().c_str(),etherTypeName(etherType));
 			}
@@ -610,16 +593,16 @@ void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,c
 	}
 }
 
-void Switch::send(Packet &packet,bool encrypt)
+void Switch::send(Packet &packet,bool encrypt,uint32_t flowId)
 {
 	if (packet.destination() == RR->identity.address()) {
 		TRACE("BUG: caught attempt to send() to self, ignored");
 		return;
 	}
 
-	if (!_trySend(packet,encrypt)) {
+	if (!_trySend(packet,encrypt,flowId)) {
 		Mutex::Lock _l(_txQueue_m);
-		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt));
+		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt,flowId));
 	}
 }
 
@@ -663,7 +646,7 @@ void Switch::doAnythingWaitingForPeer(const SharedPtr<Peer> &peer)
 		Mutex::Lock _l(_txQueue_m);
 		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
 			if (txi->dest == peer->address()) {
-				if (_trySend(txi->packet,txi->encrypt))
+				if (_trySend(txi->packet,txi->encrypt,txi->flowId))
 					_txQueue.erase(txi++);
 				else ++txi;
 			} else ++txi;
@@ -702,7 +685,7 @@ unsigned long Switch::doTimerTasks(uint64_t now)
 	{	// Time out TX queue packets that never got WHOIS lookups or other info.
 		Mutex::Lock _l(_txQueue_m);
 		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(txi->packet,txi->encrypt))
+			if (_trySend(txi->packet,txi->encrypt,txi->flowId))
 				_txQueue.erase(txi++);
 			else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
 				TRACE("TX %s -> %s timed out",txi->packet.source().toString().c_str(),txi->packet.destination().toString().c_str());
@@ -725,6 +708,60 @@ unsigned long Switch::doTimerTasks(uint64_t now)
 	return nextDelay;
 }
 
+bool Switch::_relayFast(const uint64_t now,const SharedPtr<Path> &path,const uint8_t *data,const unsigned int len,const bool fragment)
+{
+#ifdef ZT_ENABLE_CLUSTER
+	if (RR->cluster) // relays between cluster members need the full treatment below
+		return false;
+#endif
+
+	// Heads and fragments both carry the destination at the same place
+	const Address destination(data + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+	if (destination == RR->identity.address())
+		return false;
+	const unsigned int hopsIdx = (fragment) ? ZT_PACKET_FRAGMENT_IDX_HOPS : ZT_PACKET_IDX_FLAGS;
+	if ( ((data[hopsIdx] & ZT_PROTO_MAX_HOPS) >= ZT_RELAY_MAX_HOPS) || (len > ZT_PROTO_MAX_PACKET_LENGTH) )
+		return false;
+	if ( (!RR->topology->amRoot()) && (!path->trustEstablished(now)) )
+		return false;
+
+	const uint64_t source = (fragment) ? 0 : Address(data + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH).toInt();
+	if (source == RR->identity.address().toInt()) // our own packet come back, dropped below
+		return false;
+	SharedPtr<Path> via;
+	bool unite = false;
+	{
+		Mutex::Lock _l(_relayCache_m); // shared by every relayed packet, so only look here and send below
+		_RelayCacheEntry &e = _relayCache[_relayCacheIndex(destination.toInt())];
+		if ((e.destination != destination.toInt())||(e.expires <= now))
+			return false;
+		via = e.path;
+		if ((source)&&(source != e.united)) {
+			e.united = source;
+			unite = true;
+		}
+	}
+	if (!via->alive(now))
+		return false;
+
+	uint8_t buf[ZT_PROTO_MAX_PACKET_LENGTH];
+	memcpy(buf,data,len);
+	if (fragment)
+		buf[hopsIdx] = (buf[hopsIdx] + 1) & ZT_PROTO_MAX_HOPS;
+	else buf[hopsIdx] = (buf[hopsIdx] & 0xf8) | ((buf[hopsIdx] + 1) & 0x07);
+	if (!via->send(RR,buf,len,now))
+		return false;
+
+	// Entries are refilled every ZT_RELAY_CACHE_TTL, so a steady sender is still looked at now and then
+	if ((unite)&&(_shouldUnite(now,Address(source),destination))) {
+		const SharedPtr<Peer> relayTo(RR->topology->getPeer(destination));
+		if (relayTo)
+			_unite(now,Address(source),destination,relayTo);
+	}
+
+	return true;
+}
+
 bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address &destination)
 {
 	Mutex::Lock _l(_lastUniteAttempt_m);
@@ -736,6 +773,63 @@ bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address
 	return false;
 }
 
+void Switch::_unite(const uint64_t now,const Address &source,const Address &destination,const SharedPtr<Peer> &relayTo)
+{
+	const InetAddress *hintToSource = (InetAddress *)0;
+	const InetAddress *hintToDest = (InetAddress *)0;
+
+	InetAddress destV4,destV6;
+	InetAddress sourceV4,sourceV6;
+	relayTo->getRendezvousAddresses(now,destV4,destV6);
+
+	const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(source));
+	if (sourcePeer) {
+		sourcePeer->getRendezvousAddresses(now,sourceV4,sourceV6);
+		if ((destV6)&&(sourceV6)) {
+			hintToSource = &destV6;
+			hintToDest = &sourceV6;
+		} else if ((destV4)&&(sourceV4)) {
+			hintToSource = &destV4;
+			hintToDest = &sourceV4;
+		}
+
+		if ((hintToSource)&&(hintToDest)) {
+			unsigned int alt = (unsigned int)RR->node->prng() & 1; // randomize which hint we send first for obscure NAT-t reasons
+			const unsigned int completed = alt + 2;
+			while (alt != completed) {
+				if ((alt & 1) == 0) {
+					Packet outp(source,RR->identity.address(),Packet::VERB_RENDEZVOUS);
+					outp.append((uint8_t)0);
+					destination.appendTo(outp);
+					outp.append((uint16_t)hintToSource->port());
+					if (hintToSource->ss_family == AF_INET6) {
+						outp.append((uint8_t)16);
+						outp.append(hintToSource->rawIpData(),16);
+					} else {
+						outp.append((uint8_t)4);
+						outp.append(hintToSource->rawIpData(),4);
+					}
+					send(outp,true);
+				} else {
+					Packet outp(destination,RR->identity.address(),Packet::VERB_RENDEZVOUS);
+					outp.append((uint8_t)0);
+					source.appendTo(outp);
+					outp.append((uint16_t)hintToDest->port());
+					if (hintToDest->ss_family == AF_INET6) {
+						outp.append((uint8_t)16);
+						outp.append(hintToDest->rawIpData(),16);
+					} else {
+						outp.append((uint8_t)4);
+						outp.append(hintToDest->rawIpData(),4);
+					}
+					send(outp,true);
+				}
+				++alt;
+			}
+		}
+	}
+}
+
 Address Switch::_sendWhoisRequest(const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted)
 {
 	SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer(peersAlreadyConsulted,numPeersAlreadyConsulted,false));
@@ -748,7 +842,7 @@ Address Switch::_sendWhoisRequest(const Address &addr,const Address *peersAlread
 	return Address();
 }
 
-bool Switch::_trySend(Packet &packet,bool encrypt)
+bool Switch::_trySend(Packet &packet,bool encrypt,uint32_t flowId)
 {
 	SharedPtr<Path> viaPath;
 	const uint64_t now = RR->node->now();
@@ -771,7 +865,9 @@ bool Switch::_trySend(Packet &packet,bool encrypt)
 		 * to send heartbeats "down" and because we have to at least try to
 		 * go somewhere. */
 
-		viaPath = peer->getBestPath(now,false);
+		viaPath = peer->getBondedPath(now,flowId);
+		if (!viaPath)
+			viaPath = peer->getBestPath(now,false);
 		if ( (viaPath) && (!viaPath->alive(now)) && (!RR->topology->isUpstream(peer->identity())) ) {
 #ifdef ZT_ENABLE_CLUSTER
 			if ((clusterMostRecentMemberId < 0)||(viaPath->lastIn() > clusterMostRecentTs)) {
@@ -59,6 +59,10 @@ public:
 	/**
 	 * Called when a packet is received from the real network
 	 *
+	 * Packets and fragments for other nodes are relayed straight from their
+	 * headers over the path last used for their destination, remembered for
+	 * ZT_RELAY_CACHE_TTL, without looking the destination peer up again.
+	 *
 	 * @param localAddr Local interface address
 	 * @param fromAddr Internet IP address of origin
 	 * @param data Packet data
@@ -93,8 +97,9 @@ public:
 	 *
 	 * @param packet Packet to send (buffer may be modified)
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param flowId Flow of the frame in this packet for bonding (see Peer::getBondedPath()), or 0 if not a frame
 	 */
-	void send(Packet &packet,bool encrypt);
+	void send(Packet &packet,bool encrypt,uint32_t flowId = 0);
 
 	/**
 	 * Request WHOIS on a given address
@@ -124,9 +129,12 @@ public:
 	unsigned long doTimerTasks(uint64_t now);
 
 private:
+	// Relay a packet or fragment that isn't for us over a cached path, false if it needs the long way
+	bool _relayFast(const uint64_t now,const SharedPtr<Path> &path,const uint8_t *data,const unsigned int len,const bool fragment);
 	bool _shouldUnite(const uint64_t now,const Address &source,const Address &destination);
+	void _unite(const uint64_t now,const Address &source,const Address &destination,const SharedPtr<Peer> &relayTo);
 	Address _sendWhoisRequest(const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted);
-	bool _trySend(Packet &packet,bool encrypt); // packet is modified if return is true
+	bool _trySend(Packet &packet,bool encrypt,uint32_t flowId); // packet is modified if return is true
 
 	const RuntimeEnvironment *const RR;
 	uint64_t _lastBeaconResponse;
@@ -180,20 +188,46 @@ private:
 	struct TXQueueEntry
 	{
 		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
+		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc,uint32_t fid) :
 			dest(d),
 			creationTime(ct),
 			packet(p),
-			encrypt(enc) {}
+			encrypt(enc),
+			flowId(fid) {}
 
 		Address dest;
 		uint64_t creationTime;
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
+		uint32_t flowId;
 	};
 	std::list< TXQueueEntry > _txQueue;
 	Mutex _txQueue_m;
 
+	// Path relayed packets for a destination were last sent over, by destination
+	struct _RelayCacheEntry
+	{
+		_RelayCacheEntry() : destination(0),expires(0),united(0) {}
+		uint64_t destination;
+		uint64_t expires;
+		uint64_t united; // last source _shouldUnite() was asked about, so it isn't asked for every packet
+		SharedPtr<Path> path;
+	};
+	_RelayCacheEntry _relayCache[ZT_RELAY_CACHE_SIZE];
+	Mutex _relayCache_m;
+
+	static inline unsigned long _relayCacheIndex(const uint64_t a) { return (unsigned long)((a ^ (a >> 20)) & (ZT_RELAY_CACHE_SIZE - 1)); }
+
+	inline void _cacheRelayPath(const uint64_t now,const Address &destination,const SharedPtr<Path> &via)
+	{
+		Mutex::Lock _l(_relayCache_m);
+		_RelayCacheEntry &e = _relayCache[_relayCacheIndex(destination.toInt())];
+		e.destination = destination.toInt();
+		e.united = 0;
+		e.expires = now + ZT_RELAY_CACHE_TTL;
+		e.path = via;
+	}
+
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
 	struct _LastUniteKey
 	{
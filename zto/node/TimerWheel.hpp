@@ -0,0 +1,132 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_TIMERWHEEL_HPP
+#define ZT_TIMERWHEEL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <utility>
+
+#include "Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * A hashed timing wheel of objects keyed by deadline
+ *
+ * The wheel has S slots of G ms each. An object is filed in the slot its
+ * deadline falls in and looked at again only when that slot comes around,
+ * so collecting due objects costs in proportion to how many are due rather
+ * than how many are scheduled. Deadlines more than one turn away stay in
+ * their slot until the turn they belong to.
+ *
+ * Each object carries its own deadline, through timerDeadline() and
+ * setTimerDeadline(), with 0 meaning not scheduled. Moving a deadline
+ * earlier files the object again and leaves the old entry behind to be
+ * dropped when its slot comes up.
+ *
+ * This class is not thread safe.
+ *
+ * @tparam T Pointer or SharedPtr to objects with timerDeadline() and setTimerDeadline()
+ * @tparam S Number of slots
+ * @tparam G Granularity of a slot in ms
+ */
+template<typename T,unsigned int S,unsigned int G>
+class TimerWheel
+{
+public:
+	TimerWheel() : _tick(0) {}
+
+	/**
+	 * Make sure an object comes due no later than a given time
+	 *
+	 * Does nothing if the object is already scheduled at or before deadline.
+	 *
+	 * @param t Object
+	 * @param deadline Time in ms, may already have passed
+	 */
+	inline void schedule(const T &t,uint64_t deadline)
+	{
+		if (!deadline)
+			deadline = 1;
+		const uint64_t current = t->timerDeadline();
+		if ((current)&&(current <= deadline))
+			return;
+		t->setTimerDeadline(deadline);
+		const uint64_t tick = ((deadline / G) > _tick) ? (deadline / G) : _tick;
+		_slots[tick % S].push_back(std::pair<uint64_t,T>(deadline,t));
+	}
+
+	/**
+	 * Take objects whose deadlines have passed out of the wheel
+	 *
+	 * Their deadlines are reset to 0. Schedule them again to keep them.
+	 *
+	 * @param now Current time
+	 * @param due Vector to append due objects to
+	 */
+	inline void due(const uint64_t now,std::vector<T> &due)
+	{
+		const uint64_t until = now / G;
+		if (until < _tick)
+			return;
+		if ((until - _tick) >= S)
+			_tick = until - (S - 1); // a whole turn or more passed, every slot is looked at once
+		for(;;) {
+			std::vector< std::pair<uint64_t,T> > &slot = _slots[_tick % S];
+			unsigned long k = 0;
+			for(unsigned long i=0;i<slot.size();++i) {
+				if (slot[i].first != slot[i].second->timerDeadline())
+					continue; // rescheduled since
+				if (slot[i].first > now) {
+					if (k != i)
+						slot[k] = slot[i];
+					++k;
+				} else {
+					slot[i].second->setTimerDeadline(0);
+					due.push_back(slot[i].second);
+				}
+			}
+			slot.resize(k);
+			if (_tick == until)
+				break; // not over yet, entries later in this slot are looked at again next time
+			++_tick;
+		}
+	}
+
+	/**
+	 * @return Number of entries filed, including ones left behind by rescheduling
+	 */
+	inline unsigned long entries() const
+	{
+		unsigned long n = 0;
+		for(unsigned int i=0;i<S;++i)
+			n += (unsigned long)_slots[i].size();
+		return n;
+	}
+
+private:
+	std::vector< std::pair<uint64_t,T> > _slots[S];
+	uint64_t _tick; // first slot to look at next time, in units of G
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -58,6 +58,7 @@ static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {0x01,0x0
 Topology::Topology(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_trustedPathCount(0),
+	_peerIndexBuilt(0),
 	_amRoot(false)
 {
 	try {
@@ -93,8 +94,10 @@ SharedPtr<Peer> Topology::addPeer(const SharedPtr<Peer> &peer)
 	{
 		Mutex::Lock _l(_peers_m);
 		SharedPtr<Peer> &hp = _peers[peer->address()];
-		if (!hp)
+		if (!hp) {
 			hp = peer;
+			schedulePeer(hp,RR->node->now() + ZT_PING_CHECK_INVERVAL);
+		}
 		np = hp;
 	}
 
@@ -103,6 +106,48 @@ SharedPtr<Peer> Topology::addPeer(const SharedPtr<Peer> &peer)
 	return np;
 }
 
+void Topology::queryPeers(const uint64_t start,const uint64_t end,const unsigned long maxPeers,const uint64_t changedSince,std::vector< SharedPtr<Peer> > &peers) const
+{
+	if (!maxPeers)
+		return;
+
+	if (start == end) {
+		Mutex::Lock _l(_peers_m);
+		const SharedPtr<Peer> *const p = _peers.get(Address(start));
+		if ((p)&&((!changedSince)||((*p)->lastChanged() >= changedSince)))
+			peers.push_back(*p);
+		return;
+	}
+
+	Mutex::Lock _il(_peerIndex_m);
+	const uint64_t now = RR->node->now();
+	if ((start == 0)||((now - _peerIndexBuilt) >= ZT_PEER_INDEX_MAX_AGE)) {
+		_peerIndex.clear();
+		{
+			Mutex::Lock _l(_peers_m);
+			_peerIndex.reserve(_peers.size());
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p))
+				_peerIndex.push_back(a->toInt());
+		}
+		std::sort(_peerIndex.begin(),_peerIndex.end()); // without holding up packets waiting on _peers_m
+		_peerIndexBuilt = now;
+	}
+
+	unsigned long found = 0;
+	Mutex::Lock _l(_peers_m);
+	for(std::vector<uint64_t>::const_iterator a(std::lower_bound(_peerIndex.begin(),_peerIndex.end(),start));((a!=_peerIndex.end())&&(*a <= end));++a) {
+		const SharedPtr<Peer> *const p = _peers.get(Address(*a));
+		if ((!p)||((changedSince)&&((*p)->lastChanged() < changedSince)))
+			continue; // forgotten since the index was built, or unchanged
+		peers.push_back(*p);
+		if (++found >= maxPeers)
+			break;
+	}
+}
+
 SharedPtr<Peer> Topology::getPeer(const Address &zta)
 {
 	if (zta == RR->identity.address()) {
@@ -124,8 +169,10 @@ SharedPtr<Peer> Topology::getPeer(const Address &zta)
 			{
 				Mutex::Lock _l(_peers_m);
 				SharedPtr<Peer> &ap = _peers[zta];
-				if (!ap)
+				if (!ap) {
 					ap.swap(np);
+					schedulePeer(ap,RR->node->now() + ZT_PING_CHECK_INVERVAL);
+				}
 				return ap;
 			}
 		}
@@ -392,17 +439,6 @@ void Topology::removeMoon(const uint64_t id)
 
 void Topology::clean(uint64_t now)
 {
-	{
-		Mutex::Lock _l1(_peers_m);
-		Mutex::Lock _l2(_upstreams_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) )
-				_peers.erase(*a);
-		}
-	}
 	{
 		Mutex::Lock _l(_paths_m);
 		Hashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_paths);
@@ -415,6 +451,18 @@ void Topology::clean(uint64_t now)
 	}
 }
 
+bool Topology::_forgetPeer(const SharedPtr<Peer> &peer)
+{
+	Mutex::Lock _l1(_peers_m);
+	Mutex::Lock _l2(_upstreams_m);
+	if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),peer->address()) != _upstreamAddresses.end())
+		return false;
+	const SharedPtr<Peer> *const ap = _peers.get(peer->address());
+	if ((ap)&&(*ap == peer))
+		_peers.erase(peer->address());
+	return true;
+}
+
 Identity Topology::_getIdentity(const Address &zta)
 {
 	char p[128];
@@ -442,6 +490,7 @@ void Topology::_memoizeUpstreams()
 			SharedPtr<Peer> &hp = _peers[i->identity.address()];
 			if (!hp) {
 				hp = new Peer(RR,RR->identity,i->identity);
+				schedulePeer(hp,RR->node->now() + ZT_PING_CHECK_INVERVAL);
 				saveIdentity(i->identity);
 			}
 		}
@@ -456,6 +505,7 @@ void Topology::_memoizeUpstreams()
 				SharedPtr<Peer> &hp = _peers[i->identity.address()];
 				if (!hp) {
 					hp = new Peer(RR,RR->identity,i->identity);
+					schedulePeer(hp,RR->node->now() + ZT_PING_CHECK_INVERVAL);
 					saveIdentity(i->identity);
 				}
 			}
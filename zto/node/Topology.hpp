@@ -39,6 +39,7 @@
 #include "Hashtable.hpp"
 #include "World.hpp"
 #include "CertificateOfRepresentation.hpp"
+#include "TimerWheel.hpp"
 
 namespace ZeroTier {
 
@@ -289,9 +290,59 @@ public:
 
 	/**
 	 * Clean and flush database
+	 *
+	 * Peers aren't swept here, they expire off the timer wheel in eachDuePeer().
 	 */
 	void clean(uint64_t now);
 
+	/**
+	 * Make sure a peer's timer comes due no later than a given time
+	 *
+	 * @param peer Peer
+	 * @param deadline Time in ms
+	 */
+	inline void schedulePeer(const SharedPtr<Peer> &peer,const uint64_t deadline)
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_peerTimers.schedule(peer,deadline);
+	}
+
+	/**
+	 * Apply a function or function object to peers whose timers have come due
+	 *
+	 * Every peer sits on a timer wheel until the next time anything may need
+	 * doing for it, so this costs in proportion to the number of peers due and
+	 * not the number known. The function returns the time the peer is next
+	 * due, or 0 if it has expired. Expired peers are forgotten unless they are
+	 * upstreams. No locks are held while the function runs.
+	 *
+	 * @param now Current time
+	 * @param f Function to apply
+	 * @tparam F Function or function object type
+	 */
+	template<typename F>
+	inline void eachDuePeer(const uint64_t now,F f)
+	{
+		std::vector< SharedPtr<Peer> > due;
+		{
+			Mutex::Lock _l(_peerTimers_m);
+			_peerTimers.due(now,due);
+		}
+		if (due.empty())
+			return;
+		std::vector<uint64_t> next(due.size());
+		for(unsigned long i=0;i<due.size();++i) {
+			next[i] = f(*this,due[i]);
+			if ((!next[i])&&(!_forgetPeer(due[i])))
+				next[i] = now + ZT_PEER_ACTIVITY_TIMEOUT;
+		}
+		Mutex::Lock _l(_peerTimers_m);
+		for(unsigned long i=0;i<due.size();++i) {
+			if (next[i])
+				_peerTimers.schedule(due[i],next[i]);
+		}
+	}
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -333,6 +384,22 @@ public:
 		}
 	}
 
+	/**
+	 * Get peers with addresses in a range, lowest first
+	 *
+	 * Pages come from a sorted index of addresses that is rebuilt when a walk
+	 * starts at zero or the index is more than ZT_PEER_INDEX_MAX_AGE old, so
+	 * a walk copies and sorts the table once and each page after that only
+	 * looks up its own peers. A lookup of one address skips the index.
+	 *
+	 * @param start Lowest address to include
+	 * @param end Highest address to include
+	 * @param maxPeers Maximum number of peers to get
+	 * @param changedSince If nonzero, only peers whose lastChanged() is at or after this
+	 * @param peers Vector to append peers to
+	 */
+	void queryPeers(const uint64_t start,const uint64_t end,const unsigned long maxPeers,const uint64_t changedSince,std::vector< SharedPtr<Peer> > &peers) const;
+
 	/**
 	 * @return All currently active peers by address (unsorted)
 	 */
@@ -418,6 +485,7 @@ public:
 private:
 	Identity _getIdentity(const Address &zta);
 	void _memoizeUpstreams();
+	bool _forgetPeer(const SharedPtr<Peer> &peer);
 
 	const RuntimeEnvironment *const RR;
 
@@ -429,6 +497,15 @@ private:
 	Hashtable< Address,SharedPtr<Peer> > _peers;
 	Mutex _peers_m;
 
+	// Sorted addresses for queryPeers(), lock before _peers_m if both are needed
+	mutable std::vector<uint64_t> _peerIndex;
+	mutable uint64_t _peerIndexBuilt;
+	Mutex _peerIndex_m;
+
+	// Every peer in _peers is on here, lock after _peers_m if both are needed
+	TimerWheel< SharedPtr<Peer>,ZT_PEER_TIMER_WHEEL_SLOTS,ZT_PEER_TIMER_WHEEL_GRANULARITY > _peerTimers;
+	Mutex _peerTimers_m;
+
 	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
 	Mutex _paths_m;
 
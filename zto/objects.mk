@@ -7,6 +7,7 @@ OBJS=\
 	node/CertificateOfOwnership.o \
 	node/Cluster.o \
 	node/Identity.o \
+	node/IdentityValidator.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
 	node/Membership.o \
@@ -75,6 +75,8 @@
 
 #include "service/OneService.hpp"
 
+#include "controller/JSONDB.hpp"
+
 #include "ext/json/json.hpp"
 
 #define ZT_PID_PATH "zerotier-one.pid"
@@ -627,6 +629,8 @@ static void idtoolPrintHelp(FILE *out,const char *pn)
 	fprintf(out,"  verify <identity.secret/public> <file> <signature>" ZT_EOL_S);
 	fprintf(out,"  initmoon <identity.public of first seed>" ZT_EOL_S);
 	fprintf(out,"  genmoon <moon json>" ZT_EOL_S);
+	fprintf(out,"  dbimport <controller.d>" ZT_EOL_S);
+	fprintf(out,"  dbexport <controller.d>" ZT_EOL_S);
 }
 
 static Identity getIdFromArg(char *arg)
@@ -858,6 +862,47 @@ static int idtool(int argc,char **argv)
 			OSUtils::writeFile(fn,wbuf.data(),wbuf.size());
 			printf("wrote %s (signed world with timestamp %llu)" ZT_EOL_S,fn,(unsigned long long)now);
 		}
+	} else if ((!strcmp(argv[1],"dbimport"))||(!strcmp(argv[1],"dbexport"))) {
+		if (argc < 3) {
+			idtoolPrintHelp(stdout,argv[0]);
+		} else {
+			// Convert a controller database between one file per object and the
+			// append-only log. Write behind is used so that the destination is
+			// written in one batch at the end instead of synced once per object.
+			const bool toLog = (!strcmp(argv[1],"dbimport"));
+			if ((toLog)&&(JSONDB::hasLog(argv[2]))) {
+				fprintf(stderr,"%s already contains a log database" ZT_EOL_S,argv[2]);
+				return 1;
+			}
+			if ((!toLog)&&(!JSONDB::hasLog(argv[2]))) {
+				fprintf(stderr,"%s does not contain a log database" ZT_EOL_S,argv[2]);
+				return 1;
+			}
+			unsigned long count = 0;
+			{
+				JSONDB src(argv[2],0,!toLog);
+				JSONDB dst(argv[2],3600000,toLog);
+				src.filter("",0,[&dst,&count](const std::string &n,const nlohmann::json &obj) {
+					dst.put(n,obj);
+					++count;
+					return true;
+				});
+				dst.flush();
+				if (dst.pending() > 0) {
+					fprintf(stderr,"unable to write %lu objects to %s" ZT_EOL_S,dst.pending(),argv[2]);
+					return 1;
+				}
+				if (toLog)
+					dst.compact();
+			}
+			// The controller uses the log whenever one exists, so exporting isn't
+			// finished until it's gone
+			if ((!toLog)&&(!JSONDB::removeLog(argv[2]))) {
+				fprintf(stderr,"exported %lu objects but unable to remove log database from %s" ZT_EOL_S,count,argv[2]);
+				return 1;
+			}
+			printf("%s %lu objects in %s" ZT_EOL_S,(toLog ? "imported" : "exported"),count,argv[2]);
+		}
 	} else {
 		idtoolPrintHelp(stdout,argv[0]);
 		return 1;
@@ -426,6 +426,27 @@ public:
 		}
 	}
 
+	/**
+	 * Send several UDP packets from the same local interface address
+	 *
+	 * @param local Local interface address (must not be null)
+	 * @param remotes Remote address of each packet
+	 * @param data Data of each packet
+	 * @param lens Length of each packet
+	 * @param count Number of packets
+	 * @return Number of packets that appear to have been sent
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline unsigned int udpSendBatch(Phy<PHY_HANDLER_TYPE> &phy,const InetAddress &local,const struct sockaddr *const *remotes,const void *const *data,const unsigned int *lens,unsigned int count) const
+	{
+		Mutex::Lock _l(_lock);
+		for(typename std::vector<_Binding>::const_iterator i(_bindings.begin());i!=_bindings.end();++i) {
+			if (i->address == local)
+				return phy.udpSendBatch(i->udpSock,remotes,data,lens,count);
+		}
+		return 0;
+	}
+
 	/**
 	 * @return All currently bound local interface addresses
 	 */
@@ -0,0 +1,146 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_LINUXNETLINKMONITOR_HPP
+#define ZT_LINUXNETLINKMONITOR_HPP
+
+#include "../node/Constants.hpp"
+
+#ifdef __LINUX__
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+// Kernels since 6.11 announce IP multicast memberships; older headers don't know these yet
+#define ZT_NETLINK_RTM_NEWMULTICAST 56
+#define ZT_NETLINK_RTM_DELMULTICAST 57
+#define ZT_NETLINK_RTNLGRP_IPV4_MCADDR 37
+#define ZT_NETLINK_RTNLGRP_IPV6_MCADDR 38
+
+namespace ZeroTier {
+
+/**
+ * Subscribes to rtnetlink for changes to links, addresses and multicast memberships
+ *
+ * The socket is meant to be handed to Phy<>::wrapSocket(), which then owns
+ * it and delivers each datagram read from it to phyOnUnixData(), where
+ * parse() says what changed. If the kernel drops events because the socket
+ * fell behind the read fails and Phy<> closes it, after which the caller
+ * should look at everything again and open a new one.
+ */
+class LinuxNetlinkMonitor
+{
+public:
+	enum Event
+	{
+		EVENT_LINK = 0x1,
+		EVENT_ADDRESS = 0x2,
+		EVENT_MULTICAST = 0x4
+	};
+
+	/**
+	 * Open a non-blocking rtnetlink socket subscribed to interface events
+	 *
+	 * @param multicast Set to true if the kernel will also announce multicast memberships
+	 * @return File descriptor or -1 on failure
+	 */
+	static inline int open(bool &multicast)
+	{
+		multicast = false;
+		const int fd = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC|SOCK_NONBLOCK,NETLINK_ROUTE);
+		if (fd < 0)
+			return -1;
+		struct sockaddr_nl sa;
+		memset(&sa,0,sizeof(sa));
+		sa.nl_family = AF_NETLINK;
+		sa.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+		if (::bind(fd,reinterpret_cast<const struct sockaddr *>(&sa),sizeof(sa))) {
+			::close(fd);
+			return -1;
+		}
+		int g = ZT_NETLINK_RTNLGRP_IPV4_MCADDR;
+		if (::setsockopt(fd,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g,sizeof(g)) == 0) {
+			g = ZT_NETLINK_RTNLGRP_IPV6_MCADDR;
+			multicast = (::setsockopt(fd,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g,sizeof(g)) == 0);
+		}
+		return fd;
+	}
+
+	/**
+	 * Parse one datagram from the socket
+	 *
+	 * @param data Datagram
+	 * @param len Length of datagram
+	 * @param ifindexes Indexes of interfaces that changed are added here if not already present
+	 * @return Events seen, OR'd together
+	 */
+	static inline unsigned int parse(const void *data,unsigned long len,std::vector<unsigned int> &ifindexes)
+	{
+		unsigned int events = 0;
+		int rem = (int)len;
+		for(const struct nlmsghdr *h=reinterpret_cast<const struct nlmsghdr *>(data);NLMSG_OK(h,rem);h=NLMSG_NEXT(h,rem)) {
+			unsigned int ifindex;
+			switch(h->nlmsg_type) {
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+						continue;
+					ifindex = (unsigned int)reinterpret_cast<const struct ifinfomsg *>(NLMSG_DATA(h))->ifi_index;
+					events |= EVENT_LINK;
+					break;
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+					if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+						continue;
+					ifindex = reinterpret_cast<const struct ifaddrmsg *>(NLMSG_DATA(h))->ifa_index;
+					events |= EVENT_ADDRESS;
+					break;
+				case ZT_NETLINK_RTM_NEWMULTICAST:
+				case ZT_NETLINK_RTM_DELMULTICAST:
+					if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+						continue;
+					ifindex = reinterpret_cast<const struct ifaddrmsg *>(NLMSG_DATA(h))->ifa_index;
+					events |= EVENT_MULTICAST;
+					break;
+				default:
+					continue;
+			}
+			if (std::find(ifindexes.begin(),ifindexes.end(),ifindex) == ifindexes.end())
+				ifindexes.push_back(ifindex);
+		}
+		return events;
+	}
+};
+
+} // namespace ZeroTier
+
+#endif // __LINUX__
+
+#endif
@@ -47,6 +47,14 @@
 #include <ifaddrs.h>
 #endif
 
+#ifdef __LINUX__
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
 #include <vector>
 #include <algorithm>
 #include <utility>
@@ -54,8 +62,13 @@
 #include "ManagedRoute.hpp"
 
 #define ZT_BSD_ROUTE_CMD "/sbin/route"
-#define ZT_LINUX_IP_COMMAND "/sbin/ip"
-#define ZT_LINUX_IP_COMMAND_2 "/usr/sbin/ip"
+
+// Most bytes of route changes sent to rtnetlink at once; each ack costs the
+// receive buffer about 1KB, so a batch is about 150 changes
+#define ZT_LINUX_NETLINK_BATCH_BYTES 8192
+
+// Receive buffer asked for, capped by net.core.rmem_max
+#define ZT_LINUX_NETLINK_RCVBUF 1048576
 
 // NOTE: BSD is mostly tested on Apple/Mac but is likely to work on other BSD too
 
@@ -270,24 +283,13 @@ static void _routeCmd(const char *op,const InetAddress &target,const InetAddress
 #ifdef __LINUX__ // ----------------------------------------------------------
 #define ZT_ROUTING_SUPPORT_FOUND 1
 
-static void _routeCmd(const char *op,const InetAddress &target,const InetAddress &via,const char *localInterface)
+static void _nlAppend(char *buf,unsigned long &len,const unsigned short type,const void *data,const unsigned short dlen)
 {
-	long p = (long)fork();
-	if (p > 0) {
-		int exitcode = -1;
-		::waitpid(p,&exitcode,0);
-	} else if (p == 0) {
-		::close(STDOUT_FILENO);
-		::close(STDERR_FILENO);
-		if (via) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString().c_str(),"via",via.toIpString().c_str(),(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString().c_str(),"via",via.toIpString().c_str(),(const char *)0);
-		} else if ((localInterface)&&(localInterface[0])) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString().c_str(),"dev",localInterface,(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString().c_str(),"dev",localInterface,(const char *)0);
-		}
-		::_exit(-1);
-	}
+	struct rtattr *const rta = reinterpret_cast<struct rtattr *>(buf + len);
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(dlen);
+	memcpy(RTA_DATA(rta),data,dlen);
+	len += RTA_SPACE(dlen);
 }
 
 #endif // __LINUX__ ----------------------------------------------------------
@@ -356,6 +358,219 @@ static bool _winRoute(bool del,const NET_LUID &interfaceLuid,const NET_IFINDEX &
 
 } // anonymous namespace
 
+ManagedRouteTable *ManagedRouteTable::system()
+{
+#ifdef __LINUX__
+	static LinuxRouteTable *const t = new LinuxRouteTable(RT_TABLE_MAIN); // never destroyed, routes are removed by destructors that may run late
+	return t;
+#else
+	return (ManagedRouteTable *)0;
+#endif
+}
+
+#ifdef __LINUX__ // ----------------------------------------------------------
+
+LinuxRouteTable::LinuxRouteTable(const unsigned int table) :
+	_table(table),
+	_seq(0)
+{
+	_fd = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC,NETLINK_ROUTE);
+	if (_fd < 0)
+		return;
+	struct sockaddr_nl sa;
+	memset(&sa,0,sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (::bind(_fd,reinterpret_cast<const struct sockaddr *>(&sa),sizeof(sa))) {
+		::close(_fd);
+		_fd = -1;
+		return;
+	}
+#ifdef NETLINK_CAP_ACK
+	int one = 1;
+	::setsockopt(_fd,SOL_NETLINK,NETLINK_CAP_ACK,&one,sizeof(one)); // don't echo requests back in error acks
+#endif
+	int rcvbuf = ZT_LINUX_NETLINK_RCVBUF;
+	::setsockopt(_fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+	struct timeval tv;
+	tv.tv_sec = 2; // the kernel always answers, this only guards against a bug leaving us waiting forever
+	tv.tv_usec = 0;
+	::setsockopt(_fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	_seq = (uint32_t)::time((time_t *)0);
+}
+
+LinuxRouteTable::~LinuxRouteTable()
+{
+	if (_fd >= 0)
+		::close(_fd);
+}
+
+std::vector<ManagedRouteTable::Route> LinuxRouteTable::routes()
+{
+	std::vector<Route> r;
+	struct {
+		struct nlmsghdr n;
+		struct rtmsg r;
+	} req;
+	memset(&req,0,sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.n.nlmsg_type = RTM_GETROUTE;
+	req.n.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.r.rtm_family = AF_UNSPEC;
+
+	Mutex::Lock _l(_fd_m);
+	req.n.nlmsg_seq = ++_seq;
+	_talk(reinterpret_cast<const char *>(&req),req.n.nlmsg_len,req.n.nlmsg_seq,req.n.nlmsg_seq,&r);
+	return r;
+}
+
+unsigned long LinuxRouteTable::_apply(const std::vector<Change> &changes)
+{
+	char buf[ZT_LINUX_NETLINK_BATCH_BYTES];
+	unsigned long len = 0,failed = 0;
+
+	Mutex::Lock _l(_fd_m);
+	uint32_t firstSeq = _seq + 1;
+	for(std::vector<Change>::const_iterator c(changes.begin());c!=changes.end();++c) {
+		const InetAddress &t = c->route.target;
+		const InetAddress &v = c->route.via;
+		if ( ((t.ss_family != AF_INET)&&(t.ss_family != AF_INET6)) || ((v)&&(v.ss_family != t.ss_family)) ) {
+			++failed;
+			continue;
+		}
+		const unsigned short alen = (t.ss_family == AF_INET) ? 4 : 16;
+		uint32_t oif = 0;
+		if (!v) {
+			oif = (uint32_t)if_nametoindex(c->route.device.c_str());
+			if (!oif) {
+				++failed;
+				continue;
+			}
+		}
+
+		if ((len + NLMSG_SPACE(sizeof(struct rtmsg) + (RTA_SPACE(16) * 2) + RTA_SPACE(4))) > sizeof(buf)) {
+			failed += _talk(buf,len,firstSeq,_seq,(std::vector<Route> *)0);
+			len = 0;
+			firstSeq = _seq + 1;
+		}
+
+		struct nlmsghdr *const n = reinterpret_cast<struct nlmsghdr *>(buf + len);
+		memset(n,0,NLMSG_SPACE(sizeof(struct rtmsg)));
+		n->nlmsg_type = (c->set) ? RTM_NEWROUTE : RTM_DELROUTE;
+		n->nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|((c->set) ? (NLM_F_CREATE|NLM_F_REPLACE) : 0);
+		n->nlmsg_seq = ++_seq;
+		struct rtmsg *const r = reinterpret_cast<struct rtmsg *>(NLMSG_DATA(n));
+		r->rtm_family = (unsigned char)t.ss_family;
+		r->rtm_dst_len = (unsigned char)t.netmaskBits();
+		r->rtm_table = (_table < 256) ? (unsigned char)_table : (unsigned char)RT_TABLE_UNSPEC;
+		if (c->set) { // as "ip route replace" does
+			r->rtm_protocol = RTPROT_BOOT;
+			r->rtm_scope = (v) ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+			r->rtm_type = RTN_UNICAST;
+		} else {
+			r->rtm_scope = RT_SCOPE_NOWHERE;
+		}
+		unsigned long mlen = NLMSG_SPACE(sizeof(struct rtmsg));
+		char *const m = reinterpret_cast<char *>(n);
+		if (r->rtm_dst_len)
+			_nlAppend(m,mlen,RTA_DST,t.rawIpData(),alen);
+		if (v)
+			_nlAppend(m,mlen,RTA_GATEWAY,v.rawIpData(),alen);
+		else _nlAppend(m,mlen,RTA_OIF,&oif,sizeof(oif));
+		const uint32_t table = (uint32_t)_table;
+		_nlAppend(m,mlen,RTA_TABLE,&table,sizeof(table));
+		n->nlmsg_len = (uint32_t)mlen;
+		len += NLMSG_ALIGN(mlen);
+	}
+	if (len)
+		failed += _talk(buf,len,firstSeq,_seq,(std::vector<Route> *)0);
+
+	return failed;
+}
+
+unsigned long LinuxRouteTable::_talk(const char *req,const unsigned long len,const uint32_t firstSeq,const uint32_t lastSeq,std::vector<Route> *dump)
+{
+	const unsigned long expected = (unsigned long)(lastSeq - firstSeq) + 1;
+	if (_fd < 0)
+		return expected;
+
+	struct sockaddr_nl kernel;
+	memset(&kernel,0,sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+	if (::sendto(_fd,req,len,0,reinterpret_cast<const struct sockaddr *>(&kernel),sizeof(kernel)) != (ssize_t)len)
+		return expected;
+
+	// Every change gets an ack, zero or an error; a dump ends with NLMSG_DONE
+	unsigned long acked = 0,failed = 0;
+	char buf[65536];
+	while (acked < expected) {
+		const ssize_t n = ::recv(_fd,buf,sizeof(buf),0);
+		if (n <= 0) {
+			if ((n < 0)&&(errno == EINTR))
+				continue;
+			return failed + (expected - acked);
+		}
+		int rem = (int)n;
+		for(struct nlmsghdr *h=reinterpret_cast<struct nlmsghdr *>(buf);NLMSG_OK(h,rem);h=NLMSG_NEXT(h,rem)) {
+			if ((uint32_t)(h->nlmsg_seq - firstSeq) >= (uint32_t)expected)
+				continue; // left over from an earlier exchange that timed out
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				if (reinterpret_cast<const struct nlmsgerr *>(NLMSG_DATA(h))->error != 0)
+					++failed;
+				++acked;
+			} else if (h->nlmsg_type == NLMSG_DONE) {
+				++acked;
+			} else if ((h->nlmsg_type == RTM_NEWROUTE)&&(dump)) {
+				const struct rtmsg *const r = reinterpret_cast<const struct rtmsg *>(NLMSG_DATA(h));
+				if ( ((r->rtm_family != AF_INET)&&(r->rtm_family != AF_INET6)) || (r->rtm_type != RTN_UNICAST) )
+					continue;
+				Route rt;
+				unsigned int table = r->rtm_table,oif = 0;
+				uint8_t dst[16],gw[16];
+				bool haveGw = false;
+				memset(dst,0,sizeof(dst));
+				int alen = (int)RTM_PAYLOAD(h);
+				for(const struct rtattr *a=RTM_RTA(r);RTA_OK(a,alen);a=RTA_NEXT(a,alen)) {
+					const unsigned int dlen = RTA_PAYLOAD(a);
+					switch(a->rta_type) {
+						case RTA_TABLE:
+							if (dlen >= 4)
+								memcpy(&table,RTA_DATA(a),4);
+							break;
+						case RTA_DST:
+							if (dlen <= 16)
+								memcpy(dst,RTA_DATA(a),dlen);
+							break;
+						case RTA_GATEWAY:
+							if (dlen <= 16) {
+								memcpy(gw,RTA_DATA(a),dlen);
+								haveGw = true;
+							}
+							break;
+						case RTA_OIF:
+							if (dlen >= 4)
+								memcpy(&oif,RTA_DATA(a),4);
+							break;
+					}
+				}
+				if (table != _table)
+					continue;
+				const unsigned int ralen = (r->rtm_family == AF_INET) ? 4 : 16;
+				rt.target.set(dst,ralen,r->rtm_dst_len);
+				if (haveGw)
+					rt.via.set(gw,ralen,0);
+				char dev[IF_NAMESIZE + 1];
+				if ((oif)&&(if_indextoname(oif,dev)))
+					rt.device = dev;
+				dump->push_back(rt);
+			}
+		}
+	}
+
+	return failed;
+}
+
+#endif // __LINUX__ ----------------------------------------------------------
+
 /* Linux NOTE: for default route override, some Linux distributions will
  * require a change to the rp_filter parameter. A value of '1' will prevent
  * default route override from working properly.
@@ -370,6 +585,22 @@ static bool _winRoute(bool del,const NET_LUID &interfaceLuid,const NET_IFINDEX &
 
 bool ManagedRoute::sync()
 {
+	// Generate two more specific routes than target with one extra bit
+	InetAddress leftt,rightt;
+	_forkTarget(_target,leftt,rightt);
+
+	if (_table) {
+		if (!_applied.count(leftt)) {
+			_applied[leftt] = false; // boolean unused
+			_table->set(leftt,_via,(_via) ? (const char *)0 : _device);
+		}
+		if ((rightt)&&(!_applied.count(rightt))) {
+			_applied[rightt] = false; // boolean unused
+			_table->set(rightt,_via,(_via) ? (const char *)0 : _device);
+		}
+		return true;
+	}
+
 #ifdef __WINDOWS__
 	NET_LUID interfaceLuid;
 	interfaceLuid.Value = (ULONG64)Utils::hexStrToU64(_device); // on Windows we use the hex LUID as the "interface name" for ManagedRoute
@@ -378,10 +609,6 @@ bool ManagedRoute::sync()
 		return false;
 #endif
 
-	// Generate two more specific routes than target with one extra bit
-	InetAddress leftt,rightt;
-	_forkTarget(_target,leftt,rightt);
-
 #ifdef __BSD__ // ------------------------------------------------------------
 
 	// Find lowest metric system route that this route should override (if any)
@@ -469,19 +696,6 @@ bool ManagedRoute::sync()
 
 #endif // __BSD__ ------------------------------------------------------------
 
-#ifdef __LINUX__ // ----------------------------------------------------------
-
-	if (!_applied.count(leftt)) {
-		_applied[leftt] = false; // boolean unused
-		_routeCmd("replace",leftt,_via,(_via) ? (const char *)0 : _device);
-	}
-	if ((rightt)&&(!_applied.count(rightt))) {
-		_applied[rightt] = false; // boolean unused
-		_routeCmd("replace",rightt,_via,(_via) ? (const char *)0 : _device);
-	}
-
-#endif // __LINUX__ ----------------------------------------------------------
-
 #ifdef __WINDOWS__ // --------------------------------------------------------
 
 	if (!_applied.count(leftt)) {
@@ -500,6 +714,13 @@ bool ManagedRoute::sync()
 
 void ManagedRoute::remove()
 {
+	if (_table) {
+		for(std::map<InetAddress,bool>::iterator r(_applied.begin());r!=_applied.end();++r)
+			_table->remove(r->first,_via,(_via) ? (const char *)0 : _device);
+		_clear();
+		return;
+	}
+
 #ifdef __WINDOWS__
 	NET_LUID interfaceLuid;
 	interfaceLuid.Value = (ULONG64)Utils::hexStrToU64(_device); // on Windows we use the hex LUID as the "interface name" for ManagedRoute
@@ -523,15 +744,16 @@ void ManagedRoute::remove()
 		_routeCmd("delete",r->first,_via,r->second ? _device : (const char *)0,(_via) ? (const char *)0 : _device);
 #endif // __BSD__ ------------------------------------------------------------
 
-#ifdef __LINUX__ // ----------------------------------------------------------
-		_routeCmd("del",r->first,_via,(_via) ? (const char *)0 : _device);
-#endif // __LINUX__ ----------------------------------------------------------
-
 #ifdef __WINDOWS__ // --------------------------------------------------------
 		_winRoute(true,interfaceLuid,interfaceIndex,r->first,_via);
 #endif // __WINDOWS__ --------------------------------------------------------
 	}
 
+	_clear();
+}
+
+void ManagedRoute::_clear()
+{
 	_target.zero();
 	_via.zero();
 	_systemVia.zero();
@@ -9,13 +9,217 @@
 #include "../node/SharedPtr.hpp"
 #include "../node/AtomicCounter.hpp"
 #include "../node/NonCopyable.hpp"
+#include "../node/Mutex.hpp"
 
 #include <stdexcept>
 #include <vector>
 #include <map>
+#include <string>
 
 namespace ZeroTier {
 
+/**
+ * A routing table that ManagedRoute can add routes to and remove them from
+ *
+ * Changes are applied right away unless a Batch is open on the table, in
+ * which case they are queued and applied together when the last Batch
+ * closes. On Linux the system's table is reached through rtnetlink, and
+ * a whole batch goes to the kernel in a single message. BSD and Windows
+ * have no table object; ManagedRoute changes their routes itself.
+ *
+ * This class is thread safe.
+ */
+class ManagedRouteTable : NonCopyable
+{
+public:
+	struct Route
+	{
+		InetAddress target; // with netmask bits in the port field
+		InetAddress via; // NULL for a route to a device
+		std::string device;
+	};
+
+	/**
+	 * Queues changes while in scope, and applies them when the last Batch on a table closes
+	 */
+	class Batch : NonCopyable
+	{
+	public:
+		/**
+		 * @param t Table, or NULL to do nothing
+		 */
+		Batch(ManagedRouteTable *t) :
+			_t(t)
+		{
+			if (t) {
+				Mutex::Lock _l(t->_lock);
+				++t->_batches;
+			}
+		}
+
+		~Batch()
+		{
+			if (_t) {
+				Mutex::Lock _l(_t->_lock);
+				if (!--_t->_batches)
+					_t->_flush();
+			}
+		}
+
+	private:
+		ManagedRouteTable *const _t;
+	};
+
+	ManagedRouteTable() : _batches(0) {}
+	virtual ~ManagedRouteTable() {}
+
+	/**
+	 * Add a route, or replace one to the same target
+	 *
+	 * @param target Target with netmask bits in port field
+	 * @param via Gateway or NULL address to route to device
+	 * @param device Device name, used if via is NULL
+	 * @return False if applied right away and this failed
+	 */
+	inline bool set(const InetAddress &target,const InetAddress &via,const char *device) { return _change(true,target,via,device); }
+
+	/**
+	 * Remove a route
+	 *
+	 * @param target Target with netmask bits in port field
+	 * @param via Gateway or NULL address
+	 * @param device Device name, used if via is NULL
+	 * @return False if applied right away and this failed
+	 */
+	inline bool remove(const InetAddress &target,const InetAddress &via,const char *device) { return _change(false,target,via,device); }
+
+	/**
+	 * @return Routes currently in this table, not counting queued changes
+	 */
+	virtual std::vector<Route> routes() = 0;
+
+	/**
+	 * @return Table for the system's main routing table, or NULL if this platform has none
+	 */
+	static ManagedRouteTable *system();
+
+protected:
+	struct Change
+	{
+		Route route;
+		bool set;
+	};
+
+	/**
+	 * Apply changes, called with the table locked
+	 *
+	 * @param changes Changes in the order they were made
+	 * @return Number of changes that failed
+	 */
+	virtual unsigned long _apply(const std::vector<Change> &changes) = 0;
+
+private:
+	inline bool _change(const bool set,const InetAddress &target,const InetAddress &via,const char *device)
+	{
+		Mutex::Lock _l(_lock);
+		_queue.push_back(Change());
+		_queue.back().route.target = target;
+		_queue.back().route.via = via;
+		if ((!via)&&(device))
+			_queue.back().route.device = device;
+		_queue.back().set = set;
+		return ((_batches) ? true : (_flush() == 0));
+	}
+
+	inline unsigned long _flush()
+	{
+		if (_queue.empty())
+			return 0;
+		const unsigned long failed = _apply(_queue);
+		_queue.clear();
+		return failed;
+	}
+
+	std::vector<Change> _queue;
+	unsigned int _batches;
+	Mutex _lock;
+};
+
+/**
+ * A routing table that only exists in memory, for dry runs and tests
+ */
+class MemoryRouteTable : public ManagedRouteTable
+{
+public:
+	MemoryRouteTable() : _applies(0) {}
+
+	virtual std::vector<Route> routes()
+	{
+		Mutex::Lock _l(_routes_m);
+		std::vector<Route> r;
+		for(std::map<InetAddress,Route>::const_iterator i(_routes.begin());i!=_routes.end();++i)
+			r.push_back(i->second);
+		return r;
+	}
+
+	/**
+	 * @return Number of times changes have been applied, one per Batch or unbatched change
+	 */
+	inline unsigned long applies() const { return _applies; }
+
+protected:
+	virtual unsigned long _apply(const std::vector<Change> &changes)
+	{
+		Mutex::Lock _l(_routes_m);
+		unsigned long failed = 0;
+		for(std::vector<Change>::const_iterator c(changes.begin());c!=changes.end();++c) {
+			if (c->set) {
+				_routes[c->route.target] = c->route;
+			} else {
+				std::map<InetAddress,Route>::iterator r(_routes.find(c->route.target));
+				if ((r != _routes.end())&&(r->second.via.ipsEqual(c->route.via))&&(r->second.device == c->route.device))
+					_routes.erase(r);
+				else ++failed;
+			}
+		}
+		++_applies;
+		return failed;
+	}
+
+private:
+	std::map<InetAddress,Route> _routes; // one per target, like the main table with all metrics equal
+	unsigned long _applies;
+	Mutex _routes_m;
+};
+
+#ifdef __LINUX__
+/**
+ * A Linux routing table, changed and read through rtnetlink
+ */
+class LinuxRouteTable : public ManagedRouteTable
+{
+public:
+	/**
+	 * @param table Kernel routing table ID e.g. RT_TABLE_MAIN (254)
+	 */
+	LinuxRouteTable(const unsigned int table);
+	virtual ~LinuxRouteTable();
+
+	virtual std::vector<Route> routes();
+
+protected:
+	virtual unsigned long _apply(const std::vector<Change> &changes);
+
+private:
+	unsigned long _talk(const char *req,const unsigned long len,const uint32_t firstSeq,const uint32_t lastSeq,std::vector<Route> *dump);
+
+	const unsigned int _table;
+	int _fd;
+	uint32_t _seq;
+	Mutex _fd_m;
+};
+#endif
+
 /**
  * A ZT-managed route that used C++ RAII semantics to automatically clean itself up on deallocate
  */
@@ -24,7 +228,14 @@ class ManagedRoute : NonCopyable
 	friend class SharedPtr<ManagedRoute>;
 
 public:
-	ManagedRoute(const InetAddress &target,const InetAddress &via,const char *device)
+	/**
+	 * @param target Target with netmask bits in port field
+	 * @param via Gateway or NULL address to route to device
+	 * @param device Device name (hex LUID on Windows)
+	 * @param table Table to put routes in, or NULL for the system's (default)
+	 */
+	ManagedRoute(const InetAddress &target,const InetAddress &via,const char *device,ManagedRouteTable *table = (ManagedRouteTable *)0) :
+		_table((table) ? table : ManagedRouteTable::system())
 	{
 		_target = target;
 		_via = via;
@@ -65,6 +276,9 @@ public:
 	inline const char *device() const { return _device; }
 
 private:
+	void _clear();
+
+	ManagedRouteTable *const _table; // NULL if routes are changed without a table, as on BSD and Windows
 	InetAddress _target;
 	InetAddress _via;
 	InetAddress _systemVia; // for route overrides
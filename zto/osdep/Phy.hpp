@@ -71,6 +71,9 @@
 
 #endif // Windows or not
 
+// Most packets udpSendBatch() hands the kernel in one call
+#define ZT_PHY_MAX_SEND_BATCH 64
+
 namespace ZeroTier {
 
 /**
@@ -451,6 +454,55 @@ public:
 #endif
 	}
 
+	/**
+	 * Send several UDP packets from the same socket
+	 *
+	 * On Linux this is a single sendmmsg() call per ZT_PHY_MAX_SEND_BATCH
+	 * packets, elsewhere it's a sendto() per packet.
+	 *
+	 * @param sock UDP socket
+	 * @param remoteAddresses Destination address of each packet (must be correct type for socket)
+	 * @param data Data of each packet
+	 * @param lens Length of each packet
+	 * @param count Number of packets
+	 * @return Number of packets that appear to have been sent successfully
+	 */
+	inline unsigned int udpSendBatch(PhySocket *sock,const struct sockaddr *const *remoteAddresses,const void *const *data,const unsigned int *lens,unsigned int count)
+	{
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		struct mmsghdr msgs[ZT_PHY_MAX_SEND_BATCH];
+		struct iovec iovs[ZT_PHY_MAX_SEND_BATCH];
+		unsigned int sent = 0,ok = 0;
+		while (sent < count) {
+			const unsigned int n = ((count - sent) > ZT_PHY_MAX_SEND_BATCH) ? ZT_PHY_MAX_SEND_BATCH : (count - sent);
+			memset(msgs,0,sizeof(struct mmsghdr) * n);
+			for(unsigned int i=0;i<n;++i) {
+				iovs[i].iov_base = const_cast<void *>(data[sent + i]);
+				iovs[i].iov_len = lens[sent + i];
+				msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr *>(remoteAddresses[sent + i]);
+				msgs[i].msg_hdr.msg_namelen = (remoteAddresses[sent + i]->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+				msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			const int r = ::sendmmsg(sws.sock,msgs,n,0);
+			if (r <= 0) {
+				// Skip the packet that failed, as a run of sendto() calls would
+				++sent;
+				continue;
+			}
+			sent += (unsigned int)r;
+			ok += (unsigned int)r;
+		}
+		return ok;
+#else
+		unsigned int ok = 0;
+		for(unsigned int i=0;i<count;++i)
+			ok += (udpSend(sock,remoteAddresses[i],data[i],lens[i])) ? 1 : 0;
+		return ok;
+#endif
+	}
+
 #ifdef __UNIX_LIKE__
 	/**
 	 * Listen for connections on a Unix domain socket
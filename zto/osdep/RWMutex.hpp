@@ -0,0 +1,152 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_RWMUTEX_HPP
+#define ZT_RWMUTEX_HPP
+
+#include "../node/Constants.hpp"
+#include "../node/NonCopyable.hpp"
+
+#ifdef __WINDOWS__
+#include <stdlib.h>
+#include <Windows.h>
+#else
+#include <stdlib.h>
+#include <pthread.h>
+#endif
+
+namespace ZeroTier {
+
+/**
+ * Reader-writer lock allowing many concurrent readers or one writer
+ */
+class RWMutex : NonCopyable
+{
+public:
+	RWMutex()
+		throw()
+	{
+#ifdef __WINDOWS__
+		InitializeSRWLock(&_l);
+#else
+		pthread_rwlock_init(&_l,(const pthread_rwlockattr_t *)0);
+#endif
+	}
+
+	~RWMutex()
+	{
+#ifndef __WINDOWS__
+		pthread_rwlock_destroy(&_l);
+#endif
+	}
+
+	inline void readLock()
+		throw()
+	{
+#ifdef __WINDOWS__
+		AcquireSRWLockShared(&_l);
+#else
+		pthread_rwlock_rdlock(&_l);
+#endif
+	}
+
+	inline void readUnlock()
+		throw()
+	{
+#ifdef __WINDOWS__
+		ReleaseSRWLockShared(&_l);
+#else
+		pthread_rwlock_unlock(&_l);
+#endif
+	}
+
+	inline void writeLock()
+		throw()
+	{
+#ifdef __WINDOWS__
+		AcquireSRWLockExclusive(&_l);
+#else
+		pthread_rwlock_wrlock(&_l);
+#endif
+	}
+
+	inline void writeUnlock()
+		throw()
+	{
+#ifdef __WINDOWS__
+		ReleaseSRWLockExclusive(&_l);
+#else
+		pthread_rwlock_unlock(&_l);
+#endif
+	}
+
+	/**
+	 * Holds a shared (read) lock for the duration of its scope
+	 */
+	class ReadLock : NonCopyable
+	{
+	public:
+		ReadLock(RWMutex &m)
+			throw() :
+			_m(&m)
+		{
+			m.readLock();
+		}
+
+		~ReadLock()
+		{
+			_m->readUnlock();
+		}
+
+	private:
+		RWMutex *const _m;
+	};
+
+	/**
+	 * Holds an exclusive (write) lock for the duration of its scope
+	 */
+	class WriteLock : NonCopyable
+	{
+	public:
+		WriteLock(RWMutex &m)
+			throw() :
+			_m(&m)
+		{
+			m.writeLock();
+		}
+
+		~WriteLock()
+		{
+			_m->writeUnlock();
+		}
+
+	private:
+		RWMutex *const _m;
+	};
+
+private:
+#ifdef __WINDOWS__
+	SRWLOCK _l;
+#else
+	pthread_rwlock_t _l;
+#endif
+};
+
+} // namespace ZeroTier
+
+#endif
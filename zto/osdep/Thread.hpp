@@ -142,6 +142,8 @@ public:
 		throw()
 	{
 		memcpy(&_tid,&(t._tid),sizeof(_tid));
+		pthread_attr_init(&_tattr); // destroyed by ~Thread(), so copies need their own
+		pthread_attr_setstacksize(&_tattr,ZT_THREAD_MIN_STACK_SIZE);
 		_started = t._started;
 	}
 
@@ -25,6 +25,9 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
@@ -38,6 +41,7 @@
 #include "node/MAC.hpp"
 #include "node/NetworkConfig.hpp"
 #include "node/Peer.hpp"
+#include "node/Topology.hpp"
 #include "node/Dictionary.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
@@ -45,14 +49,19 @@
 #include "node/CertificateOfMembership.hpp"
 #include "node/Node.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/Switch.hpp"
+#include "node/TimerWheel.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/Http.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
+#include "osdep/ManagedRoute.hpp"
+#include "osdep/LinuxNetlinkMonitor.hpp"
 
 #include "controller/JSONDB.hpp"
+#include "controller/EmbeddedNetworkController.hpp"
 
 #ifdef __WINDOWS__
 #include <tchar.h>
@@ -373,6 +382,152 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	const C25519::Backend defaultBackend = C25519::backend();
+	if (C25519::setBackend(C25519::BACKEND_FIELD51)) {
+		std::cout << "[crypto] Cross-checking C25519 backends... "; std::cout.flush();
+		for(unsigned int i=0;i<200;++i) {
+			C25519::setBackend((i & 1) ? C25519::BACKEND_FIELD51 : C25519::BACKEND_REFERENCE);
+			C25519::Pair p1 = C25519::generate();
+			C25519::Pair p2 = C25519::generate();
+			C25519::Public junk;
+			Utils::getSecureRandom(junk.data,(unsigned int)junk.size()); // not necessarily on the curve or canonical
+			for(unsigned int k=0;k<sizeof(buf1);++k)
+				buf1[k] = (unsigned char)rand();
+			C25519::Signature sig1,sig2,sigJunk;
+			Utils::getSecureRandom(sigJunk.data,(unsigned int)sigJunk.size());
+
+			C25519::setBackend(C25519::BACKEND_REFERENCE);
+			C25519::agree(p1,p2.pub,buf2,64);
+			C25519::agree(p1,junk,buf3,32);
+			sig1 = C25519::sign(p1,buf1,sizeof(buf1));
+			const bool rv1 = C25519::verify(p2.pub,buf1,sizeof(buf1),C25519::sign(p2,buf1,sizeof(buf1)));
+			const bool rj1 = C25519::verify(junk,buf1,sizeof(buf1),sig1);
+
+			C25519::setBackend(C25519::BACKEND_FIELD51);
+			C25519::agree(p2,p1.pub,buf3 + 32,64);
+			if (memcmp(buf2,buf3 + 32,64)) {
+				std::cout << "FAIL (agree)" << std::endl;
+				return -1;
+			}
+			C25519::agree(p1,junk,buf3 + 32,32);
+			if (memcmp(buf3,buf3 + 32,32)) {
+				std::cout << "FAIL (agree with junk)" << std::endl;
+				return -1;
+			}
+			sig2 = C25519::sign(p1,buf1,sizeof(buf1));
+			if (sig1 != sig2) {
+				std::cout << "FAIL (sign)" << std::endl;
+				return -1;
+			}
+			if ((!rv1)||(!C25519::verify(p1.pub,buf1,sizeof(buf1),sig1))) {
+				std::cout << "FAIL (verify)" << std::endl;
+				return -1;
+			}
+			if (rj1 != C25519::verify(junk,buf1,sizeof(buf1),sig1)) {
+				std::cout << "FAIL (verify against junk key)" << std::endl;
+				return -1;
+			}
+			SHA512::hash(sigJunk.data + 32,buf1,sizeof(buf1)); // gets past the digest check
+			memmove(sigJunk.data + 64,sigJunk.data + 32,32);
+			Utils::getSecureRandom(sigJunk.data + 32,32);
+			const bool rj2 = C25519::verify(p1.pub,buf1,sizeof(buf1),sigJunk);
+			C25519::setBackend(C25519::BACKEND_REFERENCE);
+			if ((rj2)||(rj2 != C25519::verify(p1.pub,buf1,sizeof(buf1),sigJunk))) {
+				std::cout << "FAIL (junk signature)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[crypto] Testing Ed25519 batch verification... "; std::cout.flush();
+	{
+		C25519::Pair bk[8];
+		for(unsigned int k=0;k<8;++k)
+			bk[k] = C25519::generate();
+		std::vector<C25519::Signature> sigs(70);
+		const C25519::Public *keys[70];
+		const void *msgs[70],*sigp[70];
+		unsigned int lens[70];
+		bool valid[70];
+		for(unsigned int i=0;i<70;++i) {
+			keys[i] = &(bk[i & 7].pub);
+			msgs[i] = buf1 + (i % 16);
+			lens[i] = (unsigned int)sizeof(buf1) - 16;
+			sigs[i] = C25519::sign(bk[i & 7],msgs[i],lens[i]);
+			sigp[i] = sigs[i].data;
+		}
+		for(int b=0;b<2;++b) {
+			if (!C25519::setBackend(b ? C25519::BACKEND_FIELD51 : C25519::BACKEND_REFERENCE))
+				continue;
+			if ((!C25519::verifyBatch(70,keys,msgs,lens,sigp,valid))||(!C25519::verifyBatch(1,keys,msgs,lens,sigp,(bool *)0))) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+			for(unsigned int i=0;i<70;++i) {
+				if (!valid[i]) {
+					std::cout << "FAIL (2)" << std::endl;
+					return -1;
+				}
+			}
+			sigs[3].data[rand() % 32] ^= 0x10; // R
+			sigs[40].data[32 + (rand() % 32)] ^= 0x01; // S
+			keys[41] = &(bk[0].pub); // wrong key
+			if ((C25519::verifyBatch(70,keys,msgs,lens,sigp,valid))||(C25519::verifyBatch(70,keys,msgs,lens,sigp,(bool *)0))) {
+				std::cout << "FAIL (3)" << std::endl;
+				return -1;
+			}
+			for(unsigned int i=0;i<70;++i) {
+				if (valid[i] != ((i != 3)&&(i != 40)&&(i != 41))) {
+					std::cout << "FAIL (4)" << std::endl;
+					return -1;
+				}
+			}
+			sigs[3] = C25519::sign(bk[3],msgs[3],lens[3]); // restore for the next backend
+			sigs[40] = C25519::sign(bk[0],msgs[40],lens[40]);
+			keys[41] = &(bk[1].pub);
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	for(int b=0;b<2;++b) {
+		if (!C25519::setBackend(b ? C25519::BACKEND_FIELD51 : C25519::BACKEND_REFERENCE))
+			continue;
+		std::cout << "[crypto] Benchmarking C25519/Ed25519 (" << (b ? "field51" : "reference") << ")... "; std::cout.flush();
+		C25519::Pair bk[8];
+		for(unsigned int k=0;k<8;++k)
+			bk[k] = C25519::generate();
+		C25519::Signature bsigs[64];
+		const C25519::Public *keys[64];
+		const void *msgs[64],*sigp[64];
+		unsigned int lens[64];
+		const unsigned int ops = b ? 2000 : 200;
+		uint64_t st = OSUtils::now();
+		for(unsigned int k=0;k<ops;++k)
+			C25519::agree(bk[~k & 7],bk[k & 7].pub,buf2,64);
+		const double agreeTime = (double)(OSUtils::now() - st);
+		st = OSUtils::now();
+		for(unsigned int k=0;k<ops;++k)
+			bsigs[k & 63] = C25519::sign(bk[k & 7],buf1,128);
+		const double signTime = (double)(OSUtils::now() - st);
+		st = OSUtils::now();
+		for(unsigned int k=0;k<ops;++k)
+			C25519::verify(bk[k & 7].pub,buf1,128,bsigs[k & 63]);
+		const double verifyTime = (double)(OSUtils::now() - st);
+		for(unsigned int k=0;k<64;++k) {
+			keys[k] = &(bk[k & 7].pub);
+			msgs[k] = buf1;
+			lens[k] = 128; // about the size of a credential
+			sigp[k] = bsigs[k].data;
+		}
+		st = OSUtils::now();
+		for(unsigned int k=0;k<ops;k+=64)
+			C25519::verifyBatch(64,keys,msgs,lens,sigp,(bool *)0);
+		const double batchTime = (double)(OSUtils::now() - st);
+		std::cout << ((double)ops * 1000.0 / agreeTime) << " agree/sec, " << ((double)ops * 1000.0 / signTime) << " sign/sec, " << ((double)ops * 1000.0 / verifyTime) << " verify/sec, " << ((double)(((ops + 63) / 64) * 64) * 1000.0 / batchTime) << " batch verify/sec" << std::endl;
+	}
+	C25519::setBackend(defaultBackend);
+
 	return 0;
 }
 
@@ -477,6 +632,729 @@ static int testIdentity()
 	return 0;
 }
 
+// A Node with everything it stores kept in memory and everything it sends kept for a look
+class TestHelloHost
+{
+public:
+	TestHelloHost() : node((Node *)0),jobsDone(0),sentCount(0),keepSent(true) {}
+
+	inline unsigned long sentTo(const Address &a)
+	{
+		Mutex::Lock _l(lock);
+		unsigned long n = 0;
+		for(std::vector<std::string>::const_iterator s(sent.begin());s!=sent.end();++s) {
+			if (Address(s->data() + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH) == a)
+				++n;
+		}
+		return n;
+	}
+
+	// Number of OK(HELLO)s sent to a peer with this key
+	inline unsigned long helloReplies(const Address &a,const void *key)
+	{
+		Mutex::Lock _l(lock);
+		unsigned long n = 0;
+		for(std::vector<std::string>::const_iterator s(sent.begin());s!=sent.end();++s) {
+			Packet p(s->data(),(unsigned int)s->length());
+			if ((p.destination() == a)&&(p.dearmor(key))&&(p.uncompress())&&(p.verb() == Packet::VERB_OK)&&(p[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB] == Packet::VERB_HELLO))
+				++n;
+		}
+		return n;
+	}
+
+	inline unsigned long done()
+	{
+		Mutex::Lock _l(lock);
+		return jobsDone;
+	}
+
+	// Background thread, as a host like OneService runs it
+	void threadMain()
+		throw()
+	{
+		while (node->processBackgroundWork()) {
+			Mutex::Lock _l(lock);
+			++jobsDone;
+		}
+	}
+
+	Node *node;
+	std::map<std::string,std::string> store;
+	std::vector<std::string> sent;
+	unsigned long jobsDone;
+	unsigned long sentCount;
+	bool keepSent; // if false only count what is sent, for benchmarks
+	Mutex lock;
+};
+static long TestHelloDataStoreGet(ZT_Node *,void *uptr,const char *name,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize)
+{
+	TestHelloHost *const h = reinterpret_cast<TestHelloHost *>(uptr);
+	Mutex::Lock _l(h->lock);
+	std::map<std::string,std::string>::const_iterator o(h->store.find(name));
+	if ((o == h->store.end())||(readIndex >= o->second.length()))
+		return -1;
+	*totalSize = (unsigned long)o->second.length();
+	const unsigned long n = std::min(bufSize,(unsigned long)o->second.length() - readIndex);
+	memcpy(buf,o->second.data() + readIndex,n);
+	return (long)n;
+}
+static int TestHelloDataStorePut(ZT_Node *,void *uptr,const char *name,const void *data,unsigned long len,int)
+{
+	TestHelloHost *const h = reinterpret_cast<TestHelloHost *>(uptr);
+	Mutex::Lock _l(h->lock);
+	if (data)
+		h->store[name] = std::string(reinterpret_cast<const char *>(data),len);
+	else h->store.erase(name);
+	return 0;
+}
+static int TestHelloWirePacketSend(ZT_Node *,void *uptr,const struct sockaddr_storage *,const struct sockaddr_storage *,const void *data,unsigned int len,unsigned int)
+{
+	TestHelloHost *const h = reinterpret_cast<TestHelloHost *>(uptr);
+	if (!h->keepSent) {
+		++h->sentCount;
+		return 0;
+	}
+	if (len >= ZT_PROTO_MIN_PACKET_LENGTH) {
+		Mutex::Lock _l(h->lock);
+		h->sent.push_back(std::string(reinterpret_cast<const char *>(data),len));
+	}
+	return 0;
+}
+static void TestHelloVirtualNetworkFrame(ZT_Node *,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int) {}
+static int TestHelloVirtualNetworkConfig(ZT_Node *,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation,const ZT_VirtualNetworkConfig *) { return 0; }
+static void TestHelloEvent(ZT_Node *,void *,enum ZT_Event,const void *) {}
+
+static Node *testHelloNode(TestHelloHost &h,const Identity &id)
+{
+	h.store["identity.secret"] = id.toString(true);
+	struct ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.dataStoreGetFunction = TestHelloDataStoreGet;
+	cb.dataStorePutFunction = TestHelloDataStorePut;
+	cb.wirePacketSendFunction = TestHelloWirePacketSend;
+	cb.virtualNetworkFrameFunction = TestHelloVirtualNetworkFrame;
+	cb.virtualNetworkConfigFunction = TestHelloVirtualNetworkConfig;
+	cb.eventCallback = TestHelloEvent;
+	return (h.node = new Node(&h,&cb,OSUtils::now()));
+}
+
+// A HELLO as Peer::sendHELLO() would send it, minus the optional fields at the end
+static void testHelloPacket(const Identity &from,const Identity &to,uint64_t now,Packet &outp)
+{
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	from.agree(to,key,sizeof(key));
+	outp.reset(to.address(),from.address(),Packet::VERB_HELLO);
+	outp.append((unsigned char)ZT_PROTO_VERSION);
+	outp.append((unsigned char)1);
+	outp.append((unsigned char)2);
+	outp.append((uint16_t)0);
+	outp.append(now);
+	from.serialize(outp,false);
+	outp.armor(key,false,0);
+}
+
+// A fresh key pair under a made up address: costs the sender next to nothing, and the receiver a full locallyValidate() to reject
+static Identity testHelloStormIdentity(uint32_t n)
+{
+	const C25519::Pair kp(C25519::generate());
+	Buffer<256> b;
+	b.append((uint8_t)0x10);
+	b.append(n);
+	b.append((uint8_t)0);
+	b.append(kp.pub.data,ZT_C25519_PUBLIC_KEY_LEN);
+	b.append((uint8_t)ZT_C25519_PRIVATE_KEY_LEN);
+	b.append(kp.priv.data,ZT_C25519_PRIVATE_KEY_LEN);
+	Identity id;
+	id.deserialize(b);
+	return id;
+}
+
+static InetAddress testHelloSource(uint32_t n)
+{
+	// A different /24 for every source, so the per-source rate limit doesn't get a chance to help
+	struct sockaddr_in sa;
+	memset(&sa,0,sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = Utils::hton((uint32_t)(0x14000001 + (n << 8)));
+	sa.sin_port = Utils::hton((uint16_t)9993);
+	return InetAddress(sa);
+}
+
+#define ZT_TEST_HELLO_STORM_SIZE 96
+#define ZT_TEST_HELLO_STORM_PER_LEGIT 4
+#define ZT_TEST_HELLO_THREADS 2
+#define ZT_TEST_HELLO_TIMEOUT_MS 30000
+
+static int testHello()
+{
+	Identity rootId,legitId;
+	rootId.fromString(KNOWN_GOOD_IDENTITY);
+	legitId.generate();
+	const InetAddress legitAddr("30.1.1.1/9993");
+	uint8_t legitKey[ZT_PEER_SECRET_KEY_LENGTH];
+	legitId.agree(rootId,legitKey,sizeof(legitKey));
+	Packet p;
+	volatile uint64_t dl = 0;
+
+	{
+		std::cout << "[hello] Testing HELLO validation in background threads... "; std::cout.flush();
+		TestHelloHost h;
+		Node *const node = testHelloNode(h,rootId);
+		std::vector<Thread> threads;
+		for(unsigned int i=0;i<ZT_TEST_HELLO_THREADS;++i)
+			threads.push_back(Thread::start(&h));
+		Thread::sleep(100); // let them get into processBackgroundWork()
+
+		const Identity bad(testHelloStormIdentity(1));
+		const InetAddress badAddr(testHelloSource(1));
+		testHelloPacket(bad,rootId,OSUtils::now(),p);
+		node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&badAddr),p.data(),p.size(),&dl);
+		testHelloPacket(legitId,rootId,OSUtils::now(),p);
+		node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&legitAddr),p.data(),p.size(),&dl);
+		node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&legitAddr),p.data(),p.size(),&dl); // repeats are not queued twice
+		if (h.helloReplies(legitId.address(),legitKey)) {
+			std::cout << "FAILED (HELLO answered before validation)" << std::endl;
+			return -1;
+		}
+		const uint64_t start = OSUtils::now();
+		while (h.done() < 2) {
+			if ((OSUtils::now() - start) > ZT_TEST_HELLO_TIMEOUT_MS) {
+				std::cout << "FAILED (timed out)" << std::endl;
+				return -1;
+			}
+			Thread::sleep(10);
+		}
+		node->processBackgroundTasks(OSUtils::now(),&dl);
+		if ((h.helloReplies(legitId.address(),legitKey) != 1)||(h.sentTo(bad.address()))||(h.done() != 2)) {
+			std::cout << "FAILED (" << h.helloReplies(legitId.address(),legitKey) << " replies to valid HELLO, " << h.sentTo(bad.address()) << " to invalid, " << h.done() << " validations)" << std::endl;
+			return -1;
+		}
+		testHelloPacket(legitId,rootId,OSUtils::now(),p);
+		node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&legitAddr),p.data(),p.size(),&dl);
+		if (h.helloReplies(legitId.address(),legitKey) != 2) {
+			std::cout << "FAILED (HELLO from known peer not answered at once)" << std::endl;
+			return -1;
+		}
+
+		node->stopBackgroundWork();
+		for(std::vector<Thread>::iterator t(threads.begin());t!=threads.end();++t)
+			Thread::join(*t);
+		delete node;
+		std::cout << "PASS" << std::endl;
+	}
+
+	// Every ZT_TEST_HELLO_STORM_PER_LEGIT HELLOs from fresh identities, a packet from a peer we know arrives and
+	// has to wait for them to be handled. Its latency is the time from when that batch arrived until it's done.
+	std::vector<Identity> storm;
+	for(uint32_t i=0;i<ZT_TEST_HELLO_STORM_SIZE;++i)
+		storm.push_back(testHelloStormIdentity(i + 2));
+	for(unsigned int threadCount=0;threadCount<=ZT_TEST_HELLO_THREADS;threadCount+=ZT_TEST_HELLO_THREADS) {
+		std::cout << "[hello] Benchmarking known peer latency during a storm of " << ZT_TEST_HELLO_STORM_SIZE << " HELLOs from new identities (" << threadCount << " background threads)... "; std::cout.flush();
+		TestHelloHost h;
+		Node *const node = testHelloNode(h,rootId);
+		std::vector<Thread> threads;
+		for(unsigned int i=0;i<threadCount;++i)
+			threads.push_back(Thread::start(&h));
+		if (threadCount)
+			Thread::sleep(100);
+
+		testHelloPacket(legitId,rootId,OSUtils::now(),p);
+		node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&legitAddr),p.data(),p.size(),&dl);
+		const uint64_t start = OSUtils::now();
+		while (!h.helloReplies(legitId.address(),legitKey)) {
+			if ((OSUtils::now() - start) > ZT_TEST_HELLO_TIMEOUT_MS) {
+				std::cout << "FAILED (timed out)" << std::endl;
+				return -1;
+			}
+			Thread::sleep(10);
+			node->processBackgroundTasks(OSUtils::now(),&dl);
+		}
+		std::vector<double> latencies;
+		const double stormStart = OSUtils::nowf();
+		for(unsigned int i=0;i<ZT_TEST_HELLO_STORM_SIZE;) {
+			const double arrived = OSUtils::nowf();
+			for(unsigned int k=0;k<ZT_TEST_HELLO_STORM_PER_LEGIT;++k,++i) {
+				const InetAddress from(testHelloSource(i + 2));
+				testHelloPacket(storm[i],rootId,OSUtils::now(),p);
+				node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&from),p.data(),p.size(),&dl);
+			}
+			p.reset(rootId.address(),legitId.address(),Packet::VERB_NOP);
+			p.armor(legitKey,true,0);
+			node->processWirePacket(OSUtils::now(),&ZT_SOCKADDR_NULL,reinterpret_cast<const struct sockaddr_storage *>(&legitAddr),p.data(),p.size(),&dl);
+			latencies.push_back(OSUtils::nowf() - arrived);
+		}
+		const double stormEnd = OSUtils::nowf();
+		std::sort(latencies.begin(),latencies.end());
+
+		node->stopBackgroundWork();
+		for(std::vector<Thread>::iterator t(threads.begin());t!=threads.end();++t)
+			Thread::join(*t);
+		std::cout << "p50 " << (latencies[latencies.size() / 2] * 1000.0) << "ms, max " << (latencies.back() * 1000.0) << "ms, storm took " << ((stormEnd - stormStart) * 1000.0) << "ms, " << h.done() << " validated in background" << std::endl;
+		delete node;
+	}
+
+	return 0;
+}
+
+#define ZT_TEST_PEER_COUNT 1000000
+#define ZT_TEST_PEER_PATHS 256
+#define ZT_TEST_PEER_QUERY_COUNT 500000
+#define ZT_TEST_PEER_QUERY_PAGE 4096
+#define ZT_TEST_PEER_QUERY_CHANGED 100
+#define ZT_TEST_BOND_DURATION 10000
+#define ZT_TEST_BOND_FAIL_AT 5000
+#define ZT_TEST_BOND_SETTLED_AT 7500
+#define ZT_TEST_BOND_FLOWS 64
+#define ZT_TEST_BOND_QUEUE 128
+#define ZT_TEST_PROBE_COUNT 1000
+
+// A simulated lossy link that answers the probes sent over a path
+struct TestProbeLink
+{
+	TestProbeLink(unsigned int r,unsigned int j,unsigned int l) : rtt(r),jitter(j),loss(l) {}
+	unsigned int rtt; // ms
+	unsigned int jitter; // round trip times are spread evenly over rtt +/- jitter
+	unsigned int loss; // per mille
+};
+
+// Probe a path over a simulated link once per heartbeat; returns the average of the loss estimates over the second half
+static unsigned int testProbeSimulate(Path &path,const TestProbeLink &link,uint64_t &now,uint32_t &rand)
+{
+	unsigned long lossSum = 0;
+	for(unsigned int i=0;i<ZT_TEST_PROBE_COUNT;++i) {
+		now += ZT_PATH_HEARTBEAT_PERIOD;
+		path.probeSent(now);
+		rand = (rand * 1103515245U) + 12345U; // fixed seed, so the run is the same every time
+		if (((rand >> 8) % 1000) >= link.loss) {
+			rand = (rand * 1103515245U) + 12345U;
+			path.probeAnswered(now,now + (link.rtt - link.jitter) + ((rand >> 8) % ((link.jitter * 2) + 1)));
+		}
+		if (i >= (ZT_TEST_PROBE_COUNT / 2))
+			lossSum += path.packetLoss();
+	}
+	return (unsigned int)(lossSum / (ZT_TEST_PROBE_COUNT / 2));
+}
+
+// One simulated uplink: carries so many packets per ms and drops what doesn't fit in its queue
+struct TestBondLink
+{
+	TestBondLink(const char *a,unsigned int r,unsigned int l) : addr(a),rate(r),latency(l),queued(0),delivered(0),lastUsed(0),up(true) {}
+	InetAddress addr;
+	unsigned int rate;
+	unsigned int latency; // round trip in ms
+	unsigned long queued;
+	unsigned long delivered;
+	uint64_t lastUsed;
+	bool up;
+};
+
+// Offer as much traffic as both links can carry to a peer with a path over each, and fail the second link half way through
+static void testBondSimulate(Node *node,const RuntimeEnvironment *rr,const Identity &peerId,const uint8_t *key,enum ZT_BondingPolicy policy,TestBondLink *links,double &before,double &after)
+{
+	const uint64_t t0 = OSUtils::now();
+	volatile uint64_t dl = 0;
+	node->processBackgroundTasks(t0,&dl);
+	node->setBondingPolicy(policy);
+	SharedPtr<Peer> peer(new Peer(rr,peerId,key));
+	SharedPtr<Path> paths[2];
+	for(unsigned int l=0;l<2;++l) {
+		paths[l] = SharedPtr<Path>(new Path(InetAddress("10.0.0.1/9993"),links[l].addr));
+		paths[l]->received(t0);
+		paths[l]->updateLatency(links[l].latency); // as OK(HELLO) would
+		peer->received(paths[l],0,l + 1,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+	}
+
+	unsigned long deliveredAtFailure = 0,deliveredAtSettled = 0;
+	for(uint64_t t=1;t<=ZT_TEST_BOND_DURATION;++t) {
+		const uint64_t now = t0 + t;
+		if (t == ZT_TEST_BOND_FAIL_AT) {
+			links[1].up = false;
+			links[1].queued = 0;
+			deliveredAtFailure = links[0].delivered + links[1].delivered;
+		} else if (t == ZT_TEST_BOND_SETTLED_AT) {
+			deliveredAtSettled = links[0].delivered + links[1].delivered;
+		}
+		for(unsigned int i=0,n=links[0].rate+links[1].rate;i<n;++i) {
+			const uint32_t flowId = ((uint32_t)(((t * n) + i) % ZT_TEST_BOND_FLOWS) * 2654435761U) | 1;
+			SharedPtr<Path> p(peer->getBondedPath(now,flowId));
+			if (!p)
+				p = peer->getBestPath(now,false);
+			const unsigned int l = (p == paths[0]) ? 0 : 1;
+			if ((links[l].up)&&(links[l].queued < ZT_TEST_BOND_QUEUE))
+				++links[l].queued;
+			links[l].lastUsed = t;
+		}
+		for(unsigned int l=0;l<2;++l) {
+			if ((links[l].up)&&(links[l].queued)) {
+				const unsigned long d = std::min(links[l].queued,(unsigned long)links[l].rate);
+				links[l].queued -= d;
+				links[l].delivered += d;
+				paths[l]->received(now); // the far end's replies come back the same way
+			}
+		}
+	}
+
+	before = (double)deliveredAtFailure / (double)ZT_TEST_BOND_FAIL_AT;
+	after = (double)((links[0].delivered + links[1].delivered) - deliveredAtSettled) / (double)(ZT_TEST_BOND_DURATION - ZT_TEST_BOND_SETTLED_AT);
+	node->setBondingPolicy(ZT_BONDING_POLICY_NONE);
+}
+
+static int testPeer()
+{
+	Identity rootId;
+	rootId.fromString(KNOWN_GOOD_IDENTITY);
+	const Identity peerId(testHelloStormIdentity(1));
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	rootId.agree(peerId,key,sizeof(key));
+
+	TestHelloHost h;
+	Node *const node = testHelloNode(h,rootId);
+	const RuntimeEnvironment rr(node);
+	volatile uint64_t dl = 0;
+	const InetAddress localAddr("10.0.0.1/9993");
+
+	{
+		std::cout << "[peer] Testing 32-bit peer timestamps across wraparound... "; std::cout.flush();
+		const uint64_t t0 = (OSUtils::now() | 0xffffffffULL) - 1000; // low 32 bits wrap a second from now
+		node->processBackgroundTasks(t0,&dl);
+		SharedPtr<Path> path(new Path(localAddr,InetAddress("20.0.0.1/9993")));
+		SharedPtr<Peer> p(new Peer(&rr,peerId,key));
+		if ((p->isAlive(t0))||(p->trustEstablished(t0))||(!p->rateGateEchoRequest(t0))||(p->rateGateEchoRequest(t0 + 500))) {
+			std::cout << "FAILED (new peer does not look like it was never heard from)" << std::endl;
+			return -1;
+		}
+		p->received(path,0,1,Packet::VERB_OK,0,Packet::VERB_HELLO,true);
+		const uint64_t t1 = t0 + 5000;
+		if ((!p->isAlive(t1))||(!p->trustEstablished(t1))||(p->paths(t1).size() != 1)||(p->paths(t1)[0].second)||(p->lastReceive() != t0)||(!p->rateGateEchoRequest(t1))) {
+			std::cout << "FAILED (peer heard from just before wraparound looks idle after it)" << std::endl;
+			return -1;
+		}
+		uint64_t t = t1;
+		for(unsigned int day=0;day<60;++day) { // quiet for longer than 32 bits of ms, with a ping check every day
+			t += 86400000ULL;
+			p->refreshTimes(t);
+		}
+		node->processBackgroundTasks(t,&dl);
+		if ((p->isAlive(t))||(p->trustEstablished(t))||(!p->paths(t)[0].second)||(p->lastReceive() != (t - ZT_PEER_TIME_HORIZON))||(!p->rateGateEchoRequest(t))) {
+			std::cout << "FAILED (peer quiet for 60 days looks recently heard from)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[peer] Benchmarking " << ZT_TEST_PEER_COUNT << " peers... "; std::cout.flush();
+		const uint64_t now = OSUtils::now();
+		node->processBackgroundTasks(now,&dl);
+		std::vector< SharedPtr<Path> > paths;
+		for(unsigned int i=0;i<ZT_TEST_PEER_PATHS;++i) {
+			paths.push_back(SharedPtr<Path>(new Path(localAddr,testHelloSource(i))));
+			paths.back()->sent(now);
+			paths.back()->received(now);
+		}
+
+		// All with the same key and public key, made up addresses are all the peers care about
+		const unsigned long bytesBefore = Peer::allocatedBytes();
+		Hashtable< Address,SharedPtr<Peer> > peers;
+		std::vector< SharedPtr<Peer> > all;
+		all.reserve(ZT_TEST_PEER_COUNT);
+		for(uint32_t i=0;i<ZT_TEST_PEER_COUNT;++i) {
+			Buffer<256> b;
+			b.append((uint8_t)0x20);
+			b.append(i);
+			b.append((uint8_t)0);
+			b.append(peerId.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+			b.append((uint8_t)0);
+			Identity id;
+			id.deserialize(b);
+			all.push_back(SharedPtr<Peer>(new Peer(&rr,id,key)));
+			all.back()->received(paths[i % ZT_TEST_PEER_PATHS],0,i,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+			peers.set(id.address(),all.back());
+		}
+		const unsigned long bytes = Peer::allocatedBytes() - bytesBefore;
+
+		std::vector<Address> lookups;
+		lookups.reserve(ZT_TEST_PEER_COUNT);
+		uint64_t x = now;
+		for(unsigned long i=0;i<ZT_TEST_PEER_COUNT;++i) {
+			x = (x * 6364136223846793005ULL) + 1442695040888963407ULL;
+			lookups.push_back(Address(0x2000000000ULL | ((x >> 33) % ZT_TEST_PEER_COUNT)));
+		}
+		unsigned long found = 0;
+		double start = OSUtils::nowf();
+		for(std::vector<Address>::const_iterator a(lookups.begin());a!=lookups.end();++a) {
+			const SharedPtr<Peer> *const p = peers.get(*a);
+			if ((p)&&((*p)->isAlive(now)))
+				++found;
+		}
+		const double lookupTime = OSUtils::nowf() - start;
+
+		// What Node's ping check does for each peer that comes due, with nothing to send
+		uint64_t sum = 0;
+		start = OSUtils::nowf();
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(all.begin());p!=all.end();++p) {
+			(*p)->refreshTimes(now);
+			if ((*p)->isAlive(now)) {
+				(*p)->doPingAndKeepalive(now,-1);
+				sum += (*p)->nextPingCheck(now);
+			}
+		}
+		const double sweepTime = OSUtils::nowf() - start;
+
+		if ((found != ZT_TEST_PEER_COUNT)||(sum < (now * ZT_TEST_PEER_COUNT))||(h.sentTo(peerId.address()))) {
+			std::cout << "FAILED (" << found << " of " << ZT_TEST_PEER_COUNT << " found alive)" << std::endl;
+			return -1;
+		}
+		std::cout << (bytes / ZT_TEST_PEER_COUNT) << " bytes per peer (sizeof(Peer) == " << sizeof(Peer) << "), "
+			<< (unsigned long)((double)ZT_TEST_PEER_COUNT / lookupTime) << " lookups/second, "
+			<< (unsigned long)((double)ZT_TEST_PEER_COUNT / sweepTime) << " ping checks/second" << std::endl;
+	}
+
+	{
+		std::cout << "[peer] Benchmarking paged queries of " << ZT_TEST_PEER_QUERY_COUNT << " peers... "; std::cout.flush();
+		const uint64_t t0 = OSUtils::now();
+		node->processBackgroundTasks(t0,&dl);
+
+		// A topology of its own, as Node::queryPeers() sees it
+		RuntimeEnvironment qrr(node);
+		qrr.identity = rootId;
+		Topology topo(&qrr);
+		qrr.topology = &topo;
+		SharedPtr<Path> path(new Path(localAddr,InetAddress("20.0.0.1/9993")));
+		std::vector< SharedPtr<Peer> > changed;
+		for(uint32_t i=0;i<ZT_TEST_PEER_QUERY_COUNT;++i) {
+			Buffer<256> b;
+			b.append((uint8_t)0x30);
+			b.append((uint32_t)(i * 2654435761U)); // scattered, so the table isn't in address order
+			b.append((uint8_t)0);
+			b.append(peerId.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+			b.append((uint8_t)0);
+			Identity id;
+			id.deserialize(b);
+			SharedPtr<Peer> p(new Peer(&qrr,id,key));
+			p->received(path,0,i,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+			topo.addPeer(p);
+			if ((i % (ZT_TEST_PEER_QUERY_COUNT / ZT_TEST_PEER_QUERY_CHANGED)) == 0)
+				changed.push_back(p);
+		}
+		{
+			Mutex::Lock _l(h.lock);
+			h.store.clear(); // identities saved by addPeer()
+		}
+
+		ZT_Peer *const page = new ZT_Peer[ZT_TEST_PEER_QUERY_PAGE];
+		std::vector< SharedPtr<Peer> > got;
+		unsigned long walked = 0,pages = 0;
+		uint64_t next = 0x3000000000ULL,last = 0; // the planet's roots are in here too
+		bool ordered = true;
+		double slowest = 0.0;
+		const double start = OSUtils::nowf();
+		for(;;) {
+			const double pageStart = OSUtils::nowf();
+			got.clear();
+			topo.queryPeers(next,0x30ffffffffULL,ZT_TEST_PEER_QUERY_PAGE,0,got);
+			for(unsigned long i=0;i<got.size();++i)
+				got[i]->externalStatus(t0,&(page[i]));
+			slowest = std::max(slowest,OSUtils::nowf() - pageStart);
+			++pages;
+			for(unsigned long i=0;i<got.size();++i) {
+				if ((walked++)&&(page[i].address <= last))
+					ordered = false;
+				last = page[i].address;
+			}
+			if (got.size() < ZT_TEST_PEER_QUERY_PAGE)
+				break;
+			next = last + 1;
+		}
+		const double walkTime = OSUtils::nowf() - start;
+		delete [] page;
+
+		// Some peers say they have been upgraded, and only they show up as changed
+		const uint64_t t1 = t0 + 10000;
+		node->processBackgroundTasks(t1,&dl);
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(changed.begin());p!=changed.end();++p)
+			(*p)->setRemoteVersion(ZT_PROTO_VERSION,9,9,9,t1);
+		got.clear();
+		topo.queryPeers(0,0xffffffffffULL,ZT_TEST_PEER_QUERY_COUNT,t0 + 5000,got);
+		bool changedOk = (got.size() == changed.size());
+		for(unsigned long i=0;(changedOk)&&(i<got.size());++i)
+			changedOk = (got[i]->remoteVersionMajor() == 9);
+		got.clear();
+		topo.queryPeers(changed[1]->address().toInt(),changed[1]->address().toInt(),1,0,got);
+		const bool oneOk = ((got.size() == 1)&&(got[0] == changed[1]));
+
+		if ((walked != ZT_TEST_PEER_QUERY_COUNT)||(!ordered)||(!changedOk)||(!oneOk)) {
+			std::cout << "FAILED (walked " << walked << " of " << ZT_TEST_PEER_QUERY_COUNT << (ordered ? "" : " out of order") << (changedOk ? "" : ", wrong changed peers") << (oneOk ? "" : ", single peer lookup failed") << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "slowest page of " << ZT_TEST_PEER_QUERY_PAGE << " " << (slowest * 1000.0) << "ms, " << pages << " pages in " << (walkTime * 1000.0) << "ms, "
+			<< ((sizeof(ZT_Peer) * ZT_TEST_PEER_QUERY_PAGE) / 1024) << "KiB per page vs " << ((sizeof(ZT_Peer) * ZT_TEST_PEER_QUERY_COUNT) / 1048576) << "MiB for all at once" << std::endl;
+	}
+
+	{
+		std::cout << "[peer] Simulating bonding over a 6 packet/ms 10ms uplink and a 3 packet/ms 20ms uplink that fails..." << std::endl;
+		RuntimeEnvironment brr(node);
+		brr.identity = rootId;
+		Topology topo(&brr); // for the HELLOs that probe quiet paths
+		brr.topology = &topo;
+		static const char *const names[3] = { "none","balance-flow","balance-rr" };
+		double before[3],after[3];
+		uint64_t failover[3];
+		for(unsigned int policy=0;policy<3;++policy) {
+			TestBondLink links[2] = { TestBondLink("20.0.0.1/9993",6,10),TestBondLink("30.0.0.1/9993",3,20) };
+			testBondSimulate(node,&brr,peerId,key,(enum ZT_BondingPolicy)policy,links,before[policy],after[policy]);
+			failover[policy] = (links[1].lastUsed > ZT_TEST_BOND_FAIL_AT) ? (links[1].lastUsed - ZT_TEST_BOND_FAIL_AT) : 0;
+			std::cout << "[peer]   " << names[policy] << ": " << before[policy] << " packets/ms, " << after[policy] << " packets/ms once failed over, second link abandoned after " << failover[policy] << "ms" << std::endl;
+		}
+		if ( (before[ZT_BONDING_POLICY_BALANCE_FLOW] <= before[ZT_BONDING_POLICY_NONE]) || (before[ZT_BONDING_POLICY_BALANCE_RR] < (before[ZT_BONDING_POLICY_NONE] * 1.4)) ||
+		     (failover[ZT_BONDING_POLICY_BALANCE_FLOW] > (ZT_PATH_BOND_PROBE_INTERVAL + ZT_PATH_BOND_FAILOVER_TIMEOUT)) || (failover[ZT_BONDING_POLICY_BALANCE_RR] > (ZT_PATH_BOND_PROBE_INTERVAL + ZT_PATH_BOND_FAILOVER_TIMEOUT)) ||
+		     (after[ZT_BONDING_POLICY_BALANCE_FLOW] < 5.9) || (after[ZT_BONDING_POLICY_BALANCE_RR] < 5.9) ) {
+			std::cout << "[peer] Bonding: FAILED (did not aggregate or fail over)" << std::endl;
+			return -1;
+		}
+		std::cout << "[peer] Bonding: PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[peer] Probing a 30ms +/-10ms link losing 20% and a 40ms +/-2ms link losing nothing..." << std::endl;
+		RuntimeEnvironment prr(node);
+		prr.identity = rootId;
+		Topology topo(&prr);
+		prr.topology = &topo;
+		const TestProbeLink links[2] = { TestProbeLink(30,10,200),TestProbeLink(40,2,0) };
+		SharedPtr<Path> paths[2];
+		unsigned int loss[2];
+		uint64_t now = OSUtils::now();
+		uint32_t rand = 0x5eed;
+		for(unsigned int l=0;l<2;++l) {
+			uint64_t pnow = now;
+			paths[l] = SharedPtr<Path>(new Path(InetAddress("10.0.0.1/9993"),InetAddress((l) ? "40.0.0.1/9993" : "20.0.0.1/9993")));
+			loss[l] = testProbeSimulate(*(paths[l]),links[l],pnow,rand);
+			std::cout << "[peer]   " << links[l].rtt << "ms +/-" << links[l].jitter << "ms, " << (links[l].loss / 10) << "% loss: measured " << paths[l]->latency() << "ms, jitter " << paths[l]->jitter() << "ms, " << ((double)loss[l] / 10.0) << "% loss, cost " << paths[l]->cost() << std::endl;
+		}
+		now += ZT_PATH_HEARTBEAT_PERIOD * ZT_TEST_PROBE_COUNT;
+
+		// Both paths just heard from, so only what was measured tells them apart
+		volatile uint64_t dl = 0;
+		node->processBackgroundTasks(now,&dl);
+		SharedPtr<Peer> peer(new Peer(&prr,peerId,key));
+		for(unsigned int l=0;l<2;++l) {
+			paths[l]->received(now);
+			peer->received(paths[l],0,l + 1,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+		}
+		const bool lossyAvoided = (peer->getBestPath(now,false) == paths[1]);
+		SharedPtr<Path> clean(new Path(InetAddress("10.0.0.1/9993"),InetAddress("50.0.0.1/9993")));
+		uint64_t cnow = now - (ZT_PATH_HEARTBEAT_PERIOD * ZT_TEST_PROBE_COUNT);
+		testProbeSimulate(*clean,TestProbeLink(30,2,0),cnow,rand);
+		clean->received(now);
+		peer->received(clean,0,3,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+		const bool fastestChosen = (peer->getBestPath(now,false) == clean);
+
+		for(unsigned int l=0;l<2;++l) {
+			if ( (abs((int)paths[l]->latency() - (int)links[l].rtt) > 3) || (abs((int)paths[l]->jitter() - (int)(links[l].jitter / 2)) > 3) || (abs((int)loss[l] - (int)links[l].loss) > 50) ) {
+				std::cout << "[peer] Probing: FAILED (estimates did not converge)" << std::endl;
+				return -1;
+			}
+		}
+		if ((!lossyAvoided)||(!fastestChosen)) {
+			std::cout << "[peer] Probing: FAILED (" << ((lossyAvoided) ? "faster clean path not preferred" : "lossy path preferred") << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "[peer] Probing: PASS" << std::endl;
+	}
+
+	delete node;
+	return 0;
+}
+
+#define ZT_TEST_RELAY_PACKETS 1000000
+
+static int testRelay()
+{
+	Identity relayId;
+	relayId.fromString(KNOWN_GOOD_IDENTITY);
+	const Identity toId(testHelloStormIdentity(2));
+	const Identity otherId(testHelloStormIdentity(2 + ZT_RELAY_CACHE_SIZE)); // remembered in the same place as toId
+	const Address fromZt(0x0102030405ULL); // unknown to the relay, so it never tries to introduce the two
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH],otherKey[ZT_PEER_SECRET_KEY_LENGTH];
+	relayId.agree(toId,key,sizeof(key));
+	relayId.agree(otherId,otherKey,sizeof(otherKey));
+
+	TestHelloHost h;
+	Node *const node = testHelloNode(h,relayId);
+	RuntimeEnvironment rr(node);
+	rr.identity = relayId;
+	Topology topo(&rr);
+	rr.topology = &topo;
+	Switch *const sw = new Switch(&rr); // too big for the stack
+	rr.sw = sw;
+	uint64_t now = OSUtils::now();
+	volatile uint64_t dl = 0;
+	node->processBackgroundTasks(now,&dl);
+
+	const InetAddress localAddr("10.0.0.1/9993"),fromAddr("20.0.0.1/9993"),toAddr("40.0.0.1/9993"),otherAddr("50.0.0.1/9993");
+	const SharedPtr<Peer> to(topo.addPeer(SharedPtr<Peer>(new Peer(&rr,toId,key))));
+	const SharedPtr<Path> toPath(topo.getPath(localAddr,toAddr));
+	toPath->received(now);
+	to->received(toPath,0,1,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+	const SharedPtr<Peer> other(topo.addPeer(SharedPtr<Peer>(new Peer(&rr,otherId,otherKey))));
+	const SharedPtr<Path> otherPath(topo.getPath(localAddr,otherAddr));
+	otherPath->received(now);
+	other->received(otherPath,0,1,Packet::VERB_OK,0,Packet::VERB_HELLO,false);
+	topo.getPath(localAddr,fromAddr)->trustedPacketReceived(now); // as if the sender shares a network with us
+
+	// A frame sized packet, and one too big for a single UDP packet split into a head and a fragment
+	Packet small(toId.address(),fromZt,Packet::VERB_FRAME);
+	for(unsigned int i=0;i<128;++i)
+		small.append((uint8_t)i);
+	Packet smallOther(small);
+	smallOther.setDestination(otherId.address());
+	Packet big(toId.address(),fromZt,Packet::VERB_FRAME);
+	for(unsigned int i=0;i<2000;++i)
+		big.append((uint8_t)i);
+	big.setFragmented(true);
+	const Packet::Fragment frag(big,ZT_UDP_DEFAULT_PAYLOAD_MTU,big.size() - ZT_UDP_DEFAULT_PAYLOAD_MTU,1,2);
+
+	std::cout << "[relay] Relaying a packet head and fragment... "; std::cout.flush();
+	h.sent.clear(); // pings to the roots
+	sw->onRemotePacket(localAddr,fromAddr,big.data(),ZT_UDP_DEFAULT_PAYLOAD_MTU); // looks the destination up
+	sw->onRemotePacket(localAddr,fromAddr,frag.data(),frag.size()); // uses the path remembered for it
+	if ( (h.sent.size() != 2) || (h.sent[0].length() != ZT_UDP_DEFAULT_PAYLOAD_MTU) || ((h.sent[0][ZT_PACKET_IDX_FLAGS] & 0x07) != 1) ||
+	     (memcmp(h.sent[0].data(),big.data(),ZT_PACKET_IDX_FLAGS)) || (h.sent[1].length() != frag.size()) || (h.sent[1][ZT_PACKET_FRAGMENT_IDX_HOPS] != 1) ) {
+		std::cout << "FAILED (relayed " << h.sent.size() << " of 2, or hops not incremented)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[relay] Benchmarking relay of " << ZT_TEST_RELAY_PACKETS << " " << small.size() << " byte packets... "; std::cout.flush();
+	h.keepSent = false;
+	double start = OSUtils::nowf();
+	for(unsigned long i=0;i<ZT_TEST_RELAY_PACKETS;++i)
+		sw->onRemotePacket(localAddr,fromAddr,small.data(),small.size());
+	const double fast = (double)ZT_TEST_RELAY_PACKETS / (OSUtils::nowf() - start);
+	const unsigned long relayed = h.sentCount;
+
+	// Taking turns at the same cache entry, every packet goes the long way
+	h.sentCount = 0;
+	start = OSUtils::nowf();
+	for(unsigned long i=0;i<ZT_TEST_RELAY_PACKETS;++i) {
+		const Packet &p = (i & 1) ? smallOther : small;
+		sw->onRemotePacket(localAddr,fromAddr,p.data(),p.size());
+	}
+	const double slow = (double)ZT_TEST_RELAY_PACKETS / (OSUtils::nowf() - start);
+
+	if ((relayed != ZT_TEST_RELAY_PACKETS)||(h.sentCount != ZT_TEST_RELAY_PACKETS)||(fast <= slow)) {
+		std::cout << "FAILED (relayed " << relayed << " of " << ZT_TEST_RELAY_PACKETS << ", " << (unsigned long)fast << " vs " << (unsigned long)slow << " packets/second)" << std::endl;
+		return -1;
+	}
+	std::cout << (unsigned long)fast << " packets/second, " << (unsigned long)slow << " without the remembered path" << std::endl;
+
+	delete sw;
+	delete node;
+	return 0;
+}
+
 static int testCertificate()
 {
 	Identity authority;
@@ -582,6 +1460,34 @@ static int testPacket()
 	return 0;
 }
 
+// Stands in for a Peer on the timer wheel in testOther()
+struct TimerWheelTestPeer
+{
+	TimerWheelTestPeer() : deadline(0),expected(0),lastIn(0),active(false),seen(0) {}
+	inline uint64_t timerDeadline() const { return deadline; }
+	inline void setTimerDeadline(const uint64_t t) { deadline = t; }
+
+	// The work a ping check does on a peer, a lock and a look at its times. Active
+	// peers have always just heard something, an idle one that times out is taken
+	// to be replaced by a new peer so the count stays the same.
+	inline uint64_t check(const uint64_t now)
+	{
+		Mutex::Lock _l(lock);
+		if (active) {
+			lastIn = now;
+			return now + ZT_PATH_HEARTBEAT_PERIOD;
+		}
+		if ((lastIn + ZT_PEER_ACTIVITY_TIMEOUT) <= now)
+			lastIn = now;
+		return lastIn + ZT_PEER_ACTIVITY_TIMEOUT;
+	}
+
+	uint64_t deadline,expected,lastIn;
+	bool active;
+	unsigned int seen;
+	Mutex lock;
+};
+
 static int testOther()
 {
 	std::cout << "[other] Testing Hashtable... "; std::cout.flush();
@@ -823,6 +1729,81 @@ static int testOther()
 	}
 	std::cout << "PASS (junk value to prevent optimization-out of test: " << foo << ")" << std::endl;
 
+	std::cout << "[other] Testing TimerWheel... "; std::cout.flush();
+	{
+		TimerWheel<TimerWheelTestPeer *,ZT_PEER_TIMER_WHEEL_SLOTS,ZT_PEER_TIMER_WHEEL_GRANULARITY> tw;
+		std::vector<TimerWheelTestPeer> peers(10000);
+		for(unsigned long i=0;i<peers.size();++i) {
+			// Several turns of the wheel out
+			peers[i].expected = 1000 + ((uint64_t)rand() % (ZT_PEER_TIMER_WHEEL_SLOTS * ZT_PEER_TIMER_WHEEL_GRANULARITY * 3));
+			tw.schedule(&(peers[i]),peers[i].expected + 10000);
+			tw.schedule(&(peers[i]),peers[i].expected); // earlier wins, the first entry goes stale
+			tw.schedule(&(peers[i]),peers[i].expected + 20000); // later is ignored
+		}
+		unsigned long done = 0;
+		std::vector<TimerWheelTestPeer *> due;
+		for(uint64_t now=0;done<peers.size();now+=ZT_PING_CHECK_INVERVAL) {
+			due.clear();
+			tw.due(now,due);
+			for(unsigned long i=0;i<due.size();++i) {
+				if ((due[i]->expected > now)||((now - due[i]->expected) >= ZT_PING_CHECK_INVERVAL)||(due[i]->seen++)) {
+					std::cout << "FAILED (peer due at " << due[i]->expected << " returned at " << now << ", " << due[i]->seen << " times)" << std::endl;
+					return -1;
+				}
+			}
+			done += (unsigned long)due.size();
+			if (now > (ZT_PEER_TIMER_WHEEL_SLOTS * ZT_PEER_TIMER_WHEEL_GRANULARITY * 4)) {
+				std::cout << "FAILED (" << (peers.size() - done) << " peers never came due)" << std::endl;
+				return -1;
+			}
+		}
+		if (tw.entries() != 0) {
+			std::cout << "FAILED (" << tw.entries() << " entries left over)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Benchmarking background ping checks vs. peer count (10% active)..." << std::endl;
+	for(unsigned long n=1000;n<=100000;n*=10) {
+		std::vector<TimerWheelTestPeer> peers(n);
+		const uint64_t start = 1000000000ULL;
+		for(unsigned long i=0;i<n;++i) {
+			peers[i].active = ((i % 10) == 0);
+			peers[i].lastIn = start - ((uint64_t)rand() % ZT_PEER_ACTIVITY_TIMEOUT);
+		}
+		const unsigned int checks = 120; // ten minutes' worth
+		uint64_t visited = 0,junk = 0;
+
+		TimerWheel<TimerWheelTestPeer *,ZT_PEER_TIMER_WHEEL_SLOTS,ZT_PEER_TIMER_WHEEL_GRANULARITY> tw;
+		for(unsigned long i=0;i<n;++i)
+			tw.schedule(&(peers[i]),peers[i].lastIn + (peers[i].active ? ZT_PATH_HEARTBEAT_PERIOD : ZT_PEER_ACTIVITY_TIMEOUT));
+
+		// What Node did before: every peer, every ZT_PING_CHECK_INVERVAL
+		clock_t c0 = clock();
+		for(unsigned int c=0;c<checks;++c) {
+			const uint64_t now = start + (uint64_t)c * ZT_PING_CHECK_INVERVAL;
+			for(unsigned long i=0;i<n;++i)
+				junk += peers[i].check(now);
+		}
+		const double sweepUs = ((double)(clock() - c0) / (double)CLOCKS_PER_SEC) * 1000000.0 / (double)checks;
+
+		// Only the peers that are due
+		std::vector<TimerWheelTestPeer *> due;
+		c0 = clock();
+		for(unsigned int c=0;c<checks;++c) {
+			const uint64_t now = start + (uint64_t)c * ZT_PING_CHECK_INVERVAL;
+			due.clear();
+			tw.due(now,due);
+			for(unsigned long i=0;i<due.size();++i)
+				tw.schedule(due[i],due[i]->check(now));
+			visited += due.size();
+		}
+		const double wheelUs = ((double)(clock() - c0) / (double)CLOCKS_PER_SEC) * 1000000.0 / (double)checks;
+
+		std::cout << "[other]   " << n << " peers: full sweep " << sweepUs << " us/check, timer wheel " << wheelUs << " us/check (" << (visited / checks) << " peers due per check, junk: " << (junk & 0xff) << ")" << std::endl;
+	}
+
 	/*
 	std::cout << "[other] Testing controller/JSONDB..."; std::cout.flush();
 	{
@@ -869,6 +1850,170 @@ static int testOther()
 #define ZT_TEST_PHY_NUM_INVALID_TCP_CONNECTS 2
 #define ZT_TEST_PHY_TCP_MESSAGE_SIZE 1000000
 #define ZT_TEST_PHY_TIMEOUT_MS 20000
+#define ZT_TEST_ROUTE_COUNT 1000
+#define ZT_TEST_ROUTE_TABLE 0x5a7e // no rule looks at this table, so routes put there don't change how anything is routed
+
+static InetAddress testRouteTarget(unsigned int n)
+{
+	struct sockaddr_in sa;
+	memset(&sa,0,sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = Utils::hton((uint32_t)(0x0a000000 + ((n + 1) << 8))); // 10.0.1.0/24 and up
+	sa.sin_port = Utils::hton((uint16_t)24);
+	return InetAddress(sa);
+}
+
+static const ManagedRouteTable::Route *testRouteFind(const std::vector<ManagedRouteTable::Route> &routes,const char *target)
+{
+	for(std::vector<ManagedRouteTable::Route>::const_iterator r(routes.begin());r!=routes.end();++r) {
+		if (r->target == InetAddress(target))
+			return &(*r);
+	}
+	return (const ManagedRouteTable::Route *)0;
+}
+
+// Syncs count routes to a device in one batch, returns seconds taken and then again to remove them
+static bool testRouteSync(ManagedRouteTable &table,const char *device,unsigned int count,double &syncTime,double &removeTime)
+{
+	std::vector< SharedPtr<ManagedRoute> > routes;
+	double start = OSUtils::nowf();
+	{
+		ManagedRouteTable::Batch batch(&table);
+		for(unsigned int i=0;i<count;++i) {
+			routes.push_back(SharedPtr<ManagedRoute>(new ManagedRoute(testRouteTarget(i),InetAddress(),device,&table)));
+			routes.back()->sync();
+		}
+	}
+	syncTime = OSUtils::nowf() - start;
+	const bool synced = (table.routes().size() == (count * 2));
+	start = OSUtils::nowf();
+	{
+		ManagedRouteTable::Batch batch(&table);
+		routes.clear();
+	}
+	removeTime = OSUtils::nowf() - start;
+	return ((synced)&&(table.routes().empty()));
+}
+
+#ifdef __LINUX__
+// Appends an rtnetlink message with an ifinfomsg or ifaddrmsg for an interface, or just a header if ifindex is 0
+static void testNetlinkMessage(std::string &buf,unsigned short type,unsigned int ifindex)
+{
+	char m[NLMSG_SPACE(sizeof(struct ifinfomsg) + sizeof(struct ifaddrmsg))];
+	memset(m,0,sizeof(m));
+	struct nlmsghdr *const h = reinterpret_cast<struct nlmsghdr *>(m);
+	h->nlmsg_type = type;
+	h->nlmsg_len = NLMSG_LENGTH(0);
+	if ((type == RTM_NEWLINK)||(type == RTM_DELLINK)) {
+		reinterpret_cast<struct ifinfomsg *>(NLMSG_DATA(h))->ifi_index = (int)ifindex;
+		h->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	} else if (ifindex) {
+		reinterpret_cast<struct ifaddrmsg *>(NLMSG_DATA(h))->ifa_index = ifindex;
+		h->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	}
+	buf.append(m,NLMSG_ALIGN(h->nlmsg_len));
+}
+#endif
+
+static int testRoute()
+{
+	{
+		std::cout << "[route] Testing ManagedRoute against an in-memory table... "; std::cout.flush();
+		MemoryRouteTable t;
+		{
+			SharedPtr<ManagedRoute> def(new ManagedRoute(InetAddress("0.0.0.0/0"),InetAddress("10.0.0.1/0"),"zt0",&t));
+			def->sync();
+			SharedPtr<ManagedRoute> dev(new ManagedRoute(InetAddress("10.1.0.0/16"),InetAddress(),"zt0",&t));
+			dev->sync();
+			const std::vector<ManagedRouteTable::Route> r(t.routes());
+			const ManagedRouteTable::Route *const r0 = testRouteFind(r,"0.0.0.0/1");
+			const ManagedRouteTable::Route *const r1 = testRouteFind(r,"128.0.0.0/1");
+			const ManagedRouteTable::Route *const r2 = testRouteFind(r,"10.1.0.0/17");
+			const ManagedRouteTable::Route *const r3 = testRouteFind(r,"10.1.128.0/17");
+			if ( (r.size() != 4) || (!r0) || (!r1) || (!r2) || (!r3) ||
+			     (!r0->via.ipsEqual(InetAddress("10.0.0.1/0"))) || (r0->device.length()) ||
+			     (!r1->via.ipsEqual(InetAddress("10.0.0.1/0"))) || (r1->device.length()) ||
+			     (r2->via) || (r2->device != "zt0") || (r3->via) || (r3->device != "zt0") ) {
+				std::cout << "FAILED (wrong routes after sync)" << std::endl;
+				return -1;
+			}
+			const unsigned long applies = t.applies();
+			def->sync();
+			dev->sync();
+			if (t.applies() != applies) {
+				std::cout << "FAILED (sync of unchanged routes changed the table)" << std::endl;
+				return -1;
+			}
+			dev->remove();
+			if (t.routes().size() != 2) {
+				std::cout << "FAILED (remove left routes behind)" << std::endl;
+				return -1;
+			}
+		}
+		if (!t.routes().empty()) {
+			std::cout << "FAILED (routes left behind after ManagedRoute destroyed)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[route] Benchmarking sync of " << ZT_TEST_ROUTE_COUNT << " routes in memory... "; std::cout.flush();
+		MemoryRouteTable t;
+		double syncTime,removeTime;
+		if ((!testRouteSync(t,"zt0",ZT_TEST_ROUTE_COUNT,syncTime,removeTime))||(t.applies() != 2)) {
+			std::cout << "FAILED (" << t.applies() << " batches applied)" << std::endl;
+			return -1;
+		}
+		std::cout << (syncTime * 1000.0) << "ms to sync, " << (removeTime * 1000.0) << "ms to remove" << std::endl;
+	}
+
+#ifdef __LINUX__
+	{
+		std::cout << "[route] Benchmarking sync of " << ZT_TEST_ROUTE_COUNT << " routes over rtnetlink into table " << ZT_TEST_ROUTE_TABLE << "... "; std::cout.flush();
+		LinuxRouteTable t(ZT_TEST_ROUTE_TABLE);
+		if (!t.set(testRouteTarget(ZT_TEST_ROUTE_COUNT),InetAddress(),"lo")) {
+			std::cout << "SKIPPED (need CAP_NET_ADMIN)" << std::endl;
+		} else {
+			t.remove(testRouteTarget(ZT_TEST_ROUTE_COUNT),InetAddress(),"lo");
+			double syncTime,removeTime;
+			if (!testRouteSync(t,"lo",ZT_TEST_ROUTE_COUNT,syncTime,removeTime)) {
+				std::cout << "FAILED (routes in the kernel's table don't match)" << std::endl;
+				return -1;
+			}
+			std::cout << (syncTime * 1000.0) << "ms to sync, " << (removeTime * 1000.0) << "ms to remove" << std::endl;
+		}
+	}
+
+	{
+		std::cout << "[route] Testing LinuxNetlinkMonitor::parse() with synthetic rtnetlink messages... "; std::cout.flush();
+		std::string buf;
+		testNetlinkMessage(buf,RTM_NEWLINK,7);
+		testNetlinkMessage(buf,RTM_NEWADDR,7);
+		testNetlinkMessage(buf,RTM_NEWROUTE,8); // not subscribed to, ignored
+		testNetlinkMessage(buf,RTM_DELADDR,9);
+		testNetlinkMessage(buf,RTM_NEWADDR,0); // too short to hold an ifaddrmsg, ignored
+		testNetlinkMessage(buf,ZT_NETLINK_RTM_NEWMULTICAST,11);
+		std::vector<unsigned int> ifindexes;
+		unsigned int events = LinuxNetlinkMonitor::parse(buf.data(),(unsigned long)buf.length(),ifindexes);
+		if ( (events != (LinuxNetlinkMonitor::EVENT_LINK|LinuxNetlinkMonitor::EVENT_ADDRESS|LinuxNetlinkMonitor::EVENT_MULTICAST)) ||
+		     (ifindexes.size() != 3) || (ifindexes[0] != 7) || (ifindexes[1] != 9) || (ifindexes[2] != 11) ) {
+			std::cout << "FAILED (wrong events or interfaces)" << std::endl;
+			return -1;
+		}
+		ifindexes.clear();
+		events = LinuxNetlinkMonitor::parse(buf.data(),(unsigned long)(NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct ifinfomsg))) + 4),ifindexes); // cut off inside the second message
+		if ((events != LinuxNetlinkMonitor::EVENT_LINK)||(ifindexes.size() != 1)) {
+			std::cout << "FAILED (truncated datagram misread)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+#endif
+
+	return 0;
+}
+
 static unsigned long phyTestUdpPacketCount = 0;
 static unsigned long phyTestTcpByteCount = 0;
 static unsigned long phyTestTcpConnectSuccessCount = 0;
@@ -909,7 +2054,7 @@ struct TestPhyHandlers
 		phyTestTcpByteCount += len;
 	}
 
-	inline void phyOnTcpWritable(PhySocket *sock,void **uptr)
+	inline void phyOnTcpWritable(PhySocket *sock,void **uptr,bool stack_invoked)
 	{
 		std::string *testMessage = (std::string *)*uptr;
 		if ((testMessage)&&(testMessage->length() > 0)) {
@@ -1011,6 +2156,273 @@ static int testPhy()
 	return 0;
 }
 
+#define ZT_TEST_CONTROLLER_NETWORKS 4
+#define ZT_TEST_CONTROLLER_MEMBERS 8
+#define ZT_TEST_CONTROLLER_REQUESTS 2000
+#define ZT_TEST_CONTROLLER_TIMEOUT_MS 60000
+struct TestControllerSender : public NetworkController::Sender
+{
+	TestControllerSender() : configs(0),errors(0) {}
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig) { Mutex::Lock _l(lock); ++configs; }
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &dconf)
+	{
+		// Cached configs are re-stamped, so check that the timestamp and COM always agree
+		NetworkConfig *nc = new NetworkConfig();
+		const bool ok = ((nc->fromDictionary(dconf))&&(nc->com)&&(nc->com.timestamp().first == nc->timestamp)&&(nc->issuedTo == destination)&&(nc->staticIpCount == 1));
+		Mutex::Lock _l(lock);
+		lastName = nc->name;
+		delete nc;
+		if (ok) ++configs; else ++errors;
+	}
+	virtual void ncSendRevocation(const Address &destination,const Revocation &rev) {}
+	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode) { Mutex::Lock _l(lock); ++errors; }
+	inline unsigned long count() { Mutex::Lock _l(lock); return (configs + errors); }
+	Mutex lock;
+	unsigned long configs,errors;
+	std::string lastName;
+};
+static int testController()
+{
+	Identity signingId;
+	signingId.generate();
+	std::vector<Identity> members;
+	for(unsigned int i=0;i<ZT_TEST_CONTROLLER_MEMBERS;++i) {
+		members.push_back(Identity());
+		members.back().generate();
+	}
+	const InetAddress fromAddr("127.0.0.1/9993");
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+	metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+
+	std::cout << "[controller] Testing JSONDB write-behind... "; std::cout.flush();
+	{
+		const std::string dbPath("jsondb-test.d");
+		OSUtils::rmDashRf(dbPath.c_str());
+		{
+			JSONDB db(dbPath,3600000); // never flushes on its own during the test
+			for(unsigned int i=0;i<100;++i) {
+				db.put("network","a",nlohmann::json({{"i",i}}));
+				db.put("network","b",nlohmann::json({{"i",i}}));
+			}
+			db.erase("network","b");
+			if ((db.pending() != 2)||(OSUtils::fileExists((dbPath + ZT_PATH_SEPARATOR_S "network" ZT_PATH_SEPARATOR_S "a.json").c_str()))) {
+				std::cout << "FAILED (changes not coalesced, " << db.pending() << " pending)" << std::endl;
+				return -1;
+			}
+			if (db.get("network","a")["i"] != 99) {
+				std::cout << "FAILED (pending change not visible)" << std::endl;
+				return -1;
+			}
+			db.put("network","c",nlohmann::json({{"i",1}}));
+		}
+		JSONDB db(dbPath);
+		if ((db.get("network","a")["i"] != 99)||(db.get("network","c")["i"] != 1)||(db.get("network","b").size() != 0)) {
+			std::cout << "FAILED (pending changes lost on shutdown)" << std::endl;
+			return -1;
+		}
+		OSUtils::rmDashRf(dbPath.c_str());
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[controller] Testing JSONDB log replay, checkpoint and compaction... "; std::cout.flush();
+	{
+		const std::string dbPath("jsondb-test.d");
+		const std::string logPath(dbPath + ZT_PATH_SEPARATOR_S "jsondb.log");
+		const std::string cpPath(dbPath + ZT_PATH_SEPARATOR_S "jsondb.checkpoint");
+		OSUtils::rmDashRf(dbPath.c_str());
+		{
+			JSONDB db(dbPath,0,true);
+			for(unsigned int i=0;i<10;++i)
+				db.put("network","a",nlohmann::json({{"i",i}}));
+			db.put("network","b",nlohmann::json({{"i",1}}));
+			db.erase("network","b");
+			if (db.logSyncs() != 0) {
+				std::cout << "FAILED (synchronous writes synced the log " << db.logSyncs() << " times)" << std::endl;
+				return -1;
+			}
+		}
+		FILE *f = fopen(logPath.c_str(),"ab"); // a torn record, as if we crashed while appending
+		fwrite("\0\0\1\0P",1,5,f);
+		fclose(f);
+		{
+			JSONDB db(dbPath,0,true);
+			if ((db.get("network","a")["i"] != 9)||(db.get("network","b").size() != 0)) {
+				std::cout << "FAILED (log not replayed)" << std::endl;
+				return -1;
+			}
+			db.put("network","c",nlohmann::json({{"i",3}}));
+			if ((!db.compact())||(OSUtils::getFileSize(logPath.c_str()) != 0)||(OSUtils::getFileSize(cpPath.c_str()) <= 0)) {
+				std::cout << "FAILED (log not checkpointed)" << std::endl;
+				return -1;
+			}
+			db.put("network","d",nlohmann::json({{"i",4}}));
+		}
+		{
+			JSONDB db(dbPath,0,true);
+			if ((db.get("network","a")["i"] != 9)||(db.get("network","c")["i"] != 3)||(db.get("network","d")["i"] != 4)||(db.get("network","b").size() != 0)) {
+				std::cout << "FAILED (checkpoint and log not replayed)" << std::endl;
+				return -1;
+			}
+		}
+		{
+			// Outgrow the checkpoint in one batch and let the background thread compact it
+			JSONDB db(dbPath,3600000,true);
+			const std::string big(16384,'x');
+			for(unsigned int i=0;i<1100;++i)
+				db.put("network","e",std::to_string(i),nlohmann::json({{"i",i},{"x",big}}));
+			db.flush();
+			db.put("network","a",nlohmann::json({{"i",10}}));
+			db.flush();
+			if (db.logSyncs() != 2) {
+				std::cout << "FAILED (two flushes synced the log " << db.logSyncs() << " times)" << std::endl;
+				return -1;
+			}
+			const uint64_t start = OSUtils::now();
+			while ((OSUtils::getFileSize(cpPath.c_str()) < (int64_t)(1100 * 16384))||(OSUtils::fileExists((dbPath + ZT_PATH_SEPARATOR_S "jsondb.log.compacting").c_str()))) {
+				if ((OSUtils::now() - start) > 10000) {
+					std::cout << "FAILED (log not compacted in background)" << std::endl;
+					return -1;
+				}
+				Thread::sleep(10);
+			}
+			db.put("network","f",nlohmann::json({{"i",6}}));
+		}
+		{
+			JSONDB db(dbPath,0,true);
+			if ((db.get("network","a")["i"] != 10)||(db.get("network","e","1099")["i"] != 1099)||(db.get("network","f")["i"] != 6)||(OSUtils::getFileSize(logPath.c_str()) >= (int64_t)(1100 * 16384))) {
+				std::cout << "FAILED (compacted database incomplete)" << std::endl;
+				return -1;
+			}
+		}
+		if ((!JSONDB::removeLog(dbPath))||(JSONDB::hasLog(dbPath))) {
+			std::cout << "FAILED (could not remove log database)" << std::endl;
+			return -1;
+		}
+		OSUtils::rmDashRf(dbPath.c_str());
+	}
+	std::cout << "PASS" << std::endl;
+
+	for(unsigned int threads=1;threads<=8;threads<<=1) {
+		const std::string dbPath("controller-test.d");
+		OSUtils::rmDashRf(dbPath.c_str());
+
+		std::cout << "[controller] Testing " << ZT_TEST_CONTROLLER_REQUESTS << " requests with " << threads << " thread(s)... "; std::cout.flush();
+		TestControllerSender sender;
+		{
+			EmbeddedNetworkController controller((Node *)0,dbPath.c_str(),1000); // write-behind so this measures the request path and not fsync()
+			controller.init(signingId,&sender);
+			controller.setThreadCount(threads);
+
+			std::vector<uint64_t> networks;
+			for(unsigned int i=0;i<ZT_TEST_CONTROLLER_NETWORKS;++i) {
+				const uint64_t nwid = (signingId.address().toInt() << 24) | (uint64_t)(i + 1);
+				char nwids[24];
+				Utils::snprintf(nwids,sizeof(nwids),"%.16llx",nwid);
+				std::vector<std::string> path;
+				path.push_back("network");
+				path.push_back(nwids);
+				std::string responseBody,responseContentType;
+				if (controller.handleControlPlaneHttpPOST(path,std::map<std::string,std::string>(),std::map<std::string,std::string>(),"{\"private\":false,\"v4AssignMode\":{\"zt\":true},\"routes\":[{\"target\":\"10.0.0.0/16\"}],\"ipAssignmentPools\":[{\"ipRangeStart\":\"10.0.0.1\",\"ipRangeEnd\":\"10.0.255.254\"}]}",responseBody,responseContentType) != 200) {
+					std::cout << "FAILED (could not create network " << nwids << ")" << std::endl;
+					return -1;
+				}
+				networks.push_back(nwid);
+			}
+
+			const uint64_t start = OSUtils::now();
+			for(unsigned int i=0;i<ZT_TEST_CONTROLLER_REQUESTS;++i)
+				controller.request(networks[i % networks.size()],fromAddr,0,members[(i / networks.size()) % members.size()],metaData);
+			while (sender.count() < ZT_TEST_CONTROLLER_REQUESTS) {
+				if ((OSUtils::now() - start) > ZT_TEST_CONTROLLER_TIMEOUT_MS) {
+					std::cout << "FAILED (timed out with " << sender.count() << " replies)" << std::endl;
+					return -1;
+				}
+				Thread::sleep(10);
+			}
+			const uint64_t end = OSUtils::now();
+
+			if (sender.errors) {
+				std::cout << "FAILED (" << sender.errors << " errors)" << std::endl;
+				return -1;
+			}
+
+			for(std::vector<uint64_t>::iterator nw(networks.begin());nw!=networks.end();++nw) {
+				std::set<std::string> assigned;
+				for(std::vector<Identity>::iterator m(members.begin());m!=members.end();++m) {
+					char nwids[24];
+					Utils::snprintf(nwids,sizeof(nwids),"%.16llx",*nw);
+					std::vector<std::string> path;
+					path.push_back("network");
+					path.push_back(nwids);
+					path.push_back("member");
+					path.push_back(m->address().toString());
+					std::string responseBody,responseContentType;
+					controller.handleControlPlaneHttpGET(path,std::map<std::string,std::string>(),std::map<std::string,std::string>(),std::string(),responseBody,responseContentType);
+					nlohmann::json ips(OSUtils::jsonParse(responseBody)["ipAssignments"]);
+					if ((!ips.is_array())||(ips.size() != 1)||(!assigned.insert(ips[0].get<std::string>()).second)) {
+						std::cout << "FAILED (bad or duplicate IP assignment for " << m->address().toString() << " on " << nwids << ")" << std::endl;
+						return -1;
+					}
+				}
+			}
+
+			// After its first two requests (assign an IP, then render and cache) a
+			// member's configs should come from the cache until something changes
+			uint64_t hits = 0,misses = 0;
+			controller.configCacheStats(hits,misses);
+			if ((hits < (ZT_TEST_CONTROLLER_REQUESTS / 2))||((hits + misses) > ZT_TEST_CONTROLLER_REQUESTS)) {
+				std::cout << "FAILED (config cache: " << hits << " hits, " << misses << " misses)" << std::endl;
+				return -1;
+			}
+			char nwids[24];
+			Utils::snprintf(nwids,sizeof(nwids),"%.16llx",networks[0]);
+			const auto settled = [&](const unsigned long replies,const uint64_t expectHits,const uint64_t expectMisses) -> bool {
+				const uint64_t t = OSUtils::now();
+				while (sender.count() < replies) {
+					if ((OSUtils::now() - t) > ZT_TEST_CONTROLLER_TIMEOUT_MS)
+						return false;
+					Thread::sleep(1);
+				}
+				uint64_t h = 0,m = 0;
+				controller.configCacheStats(h,m);
+				return ((sender.count() == replies)&&(sender.errors == 0)&&(h == expectHits)&&(m == expectMisses));
+			};
+			unsigned long replies = sender.count();
+			std::vector<std::string> path;
+			path.push_back("network");
+			path.push_back(nwids);
+			std::string responseBody,responseContentType;
+			controller.request(networks[0],fromAddr,0,members[0],metaData);
+			if (!settled(++replies,++hits,misses)) {
+				std::cout << "FAILED (unchanged member not served from config cache)" << std::endl;
+				return -1;
+			}
+			path.push_back("member");
+			path.push_back(members[0].address().toString());
+			controller.handleControlPlaneHttpPOST(path,std::map<std::string,std::string>(),std::map<std::string,std::string>(),"{\"noAutoAssignIps\":true}",responseBody,responseContentType);
+			controller.request(networks[0],fromAddr,0,members[0],metaData);
+			bool ok = settled(++replies,hits,++misses);
+			controller.request(networks[0],fromAddr,0,members[0],metaData);
+			if ((!ok)||(!settled(++replies,++hits,misses))) {
+				std::cout << "FAILED (config cache not invalidated by member change)" << std::endl;
+				return -1;
+			}
+			path.resize(2);
+			controller.handleControlPlaneHttpPOST(path,std::map<std::string,std::string>(),std::map<std::string,std::string>(),"{\"name\":\"renamed\"}",responseBody,responseContentType);
+			controller.request(networks[0],fromAddr,0,members[0],metaData);
+			if ((!settled(++replies,hits,++misses))||(sender.lastName != "renamed")) {
+				std::cout << "FAILED (config cache not invalidated by network change)" << std::endl;
+				return -1;
+			}
+
+			std::cout << ((double)ZT_TEST_CONTROLLER_REQUESTS / ((double)(end - start) / 1000.0)) << " requests/second, " << hits << " config cache hits" << std::endl;
+		}
+		OSUtils::rmDashRf(dbPath.c_str());
+	}
+
+	return 0;
+}
+
 /*
 static int testHttp()
 {
@@ -1116,8 +2528,13 @@ int main(int argc,char **argv)
 	r |= testCrypto();
 	r |= testPacket();
 	r |= testIdentity();
+	r |= testHello();
+	r |= testPeer();
+	r |= testRelay();
 	r |= testCertificate();
+	r |= testRoute();
 	r |= testPhy();
+	r |= testController();
 	//r |= testHttp();
 	//*/
 
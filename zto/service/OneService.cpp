@@ -103,8 +103,11 @@ namespace ZeroTier { typedef NetconEthernetTap EthernetTap; }
 namespace ZeroTier { typedef OSXEthernetTap EthernetTap; }
 #endif // __APPLE__
 #ifdef __LINUX__
+#include <net/if.h>
 #include "../osdep/LinuxEthernetTap.hpp"
+#include "../osdep/LinuxNetlinkMonitor.hpp"
 namespace ZeroTier { typedef LinuxEthernetTap EthernetTap; }
+#define ZT_USE_NETLINK_MONITOR
 #endif // __LINUX__
 #ifdef __WINDOWS__
 #include "../osdep/WindowsEthernetTap.hpp"
@@ -125,6 +128,13 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 #define ZT_MAX_HTTP_MESSAGE_SIZE (1024 * 1024 * 64)
 #define ZT_MAX_HTTP_CONNECTIONS 64
 
+// Peers asked of the core at a time while streaming /peer, and most that /peer?limit= returns
+#define ZT_HTTP_PEER_PAGE_SIZE 4096
+#define ZT_HTTP_PEER_PAGE_MAX 16384
+
+// Stream more of a response once less than this is waiting to be written
+#define ZT_HTTP_STREAM_LOW_WATER 65536
+
 // Interface metric for ZeroTier taps -- this ensures that if we are on WiFi and also
 // bridged via ZeroTier to the same LAN traffic will (if the OS is sane) prefer WiFi.
 #define ZT_IF_METRIC 5000
@@ -132,6 +142,15 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // How often to check for new multicast subscriptions on a tap device
 #define ZT_TAP_CHECK_MULTICAST_INTERVAL 5000
 
+// How often to check anyway if the OS announces multicast subscriptions as they change
+#define ZT_TAP_CHECK_MULTICAST_FALLBACK_INTERVAL 60000
+
+// How often to refresh bindings anyway if the OS announces interface and address changes
+#define ZT_BINDER_REFRESH_FALLBACK_PERIOD 300000
+
+// Least time between binding refreshes caused by interface and address changes, since they come in bursts
+#define ZT_BINDER_EVENT_REFRESH_DELAY 1000
+
 // Path under ZT1 home for controller database if controller is enabled
 #define ZT_CONTROLLER_DB_PATH "controller.d"
 
@@ -150,6 +169,10 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // Clean files from iddb.d that are older than this (60 days)
 #define ZT_IDDB_CLEANUP_AGE 5184000000ULL
 
+// Default and maximum number of threads validating new peers' identities (local.conf identityValidationThreads)
+#define ZT_IDENTITY_VALIDATION_THREADS 1
+#define ZT_IDENTITY_VALIDATION_THREADS_MAX 64
+
 namespace ZeroTier {
 
 namespace {
@@ -259,6 +282,9 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["lastReceive"] = peer->paths[i].lastReceive;
 		j["trustedPathId"] = peer->paths[i].trustedPathId;
 		j["linkQuality"] = (double)peer->paths[i].linkQuality / (double)ZT_PATH_LINK_QUALITY_MAX;
+		j["latency"] = peer->paths[i].latency;
+		j["jitter"] = peer->paths[i].jitter;
+		j["packetLoss"] = (double)peer->paths[i].packetLoss / 1000.0;
 		j["active"] = (bool)(peer->paths[i].expired == 0);
 		j["expired"] = (bool)(peer->paths[i].expired != 0);
 		j["preferred"] = (bool)(peer->paths[i].preferred != 0);
@@ -306,6 +332,9 @@ static int SclusterGeoIpFunction(void *uptr,const struct sockaddr_storage *addr,
 #endif
 
 static void StapFrameHandler(void *uptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+#ifdef ZT_SDK
+static void StapFrameBatchHandler(void *uptr,uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count);
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser);
 static int ShttpOnUrl(http_parser *parser,const char *ptr,size_t length);
@@ -369,8 +398,31 @@ struct TcpConnection
 
 	std::string writeBuf;
 	Mutex writeBuf_m;
+
+	// GET /peer is written a page at a time as the socket drains, see streamPeers()
+	bool streamingPeers;
+	uint64_t streamNext; // lowest address not yet looked at
+	uint64_t streamChangedSince;
+	unsigned long streamCount; // peers written so far
+	bool streamFailed; // close without the closing ] so a partial array can't pass for a whole one
+};
+
+// Wire packets generated while the core processes a burst of frames from a tap
+// or what one _phy.poll() found, sent with one udpSendBatch() per local address
+// once that is done
+struct WireBatch
+{
+	unsigned int count;
+	unsigned int bindingNo[ZT_PHY_MAX_SEND_BATCH];
+	InetAddress local[ZT_PHY_MAX_SEND_BATCH];
+	InetAddress remote[ZT_PHY_MAX_SEND_BATCH];
+	unsigned int len[ZT_PHY_MAX_SEND_BATCH];
+	char data[ZT_PHY_MAX_SEND_BATCH][ZT_UDP_DEFAULT_PAYLOAD_MTU];
 };
 
+// Batch being filled by the current thread, if it's inside tapFrameBatchHandler() or _phy.poll()
+static thread_local WireBatch *_wireBatch = (WireBatch *)0;
+
 // Used to pseudo-randomize local source port picking
 static volatile unsigned int _udpPortPickerCounter = 0;
 
@@ -431,6 +483,9 @@ public:
 	// Deadline for the next background task service function
 	volatile uint64_t _nextBackgroundTaskDeadline;
 
+	// Threads doing the core's background work, see threadMain()
+	std::vector<Thread> _backgroundThreads;
+
 	// Configured networks
 	struct NetworkState
 	{
@@ -452,6 +507,10 @@ public:
 	std::map<uint64_t,NetworkState> _nets;
 	Mutex _nets_m;
 
+	// Idle wire packet batches, one is taken for each burst of tap frames
+	std::vector<WireBatch *> _wireBatches;
+	Mutex _wireBatches_m;
+
 	// Active TCP/IP connections
 	std::set< TcpConnection * > _tcpConnections; // no mutex for this since it's done in the main loop thread only
 	TcpConnection *_tcpFallbackTunnel;
@@ -467,6 +526,14 @@ public:
 	PortMapper *_portMapper;
 #endif
 
+	// rtnetlink subscription to interface changes, NULL while polling for them instead
+#ifdef ZT_USE_NETLINK_MONITOR
+	PhySocket *_netlinkSocket;
+	bool _netlinkMulticast; // kernel announces multicast subscriptions too
+	unsigned int _netlinkEvents; // LinuxNetlinkMonitor::Event bits not yet acted upon
+	std::vector<unsigned int> _netlinkInterfaces; // indexes of interfaces changed since the main loop last looked
+#endif
+
 	// Cluster management instance if enabled
 #ifdef ZT_ENABLE_CLUSTER
 	PhySocket *_clusterMessageSocket;
@@ -500,6 +567,11 @@ public:
 #ifdef ZT_USE_MINIUPNPC
 		,_portMapper((PortMapper *)0)
 #endif
+#ifdef ZT_USE_NETLINK_MONITOR
+		,_netlinkSocket((PhySocket *)0)
+		,_netlinkMulticast(false)
+		,_netlinkEvents(0)
+#endif
 #ifdef ZT_ENABLE_CLUSTER
 		,_clusterMessageSocket((PhySocket *)0)
 		,_clusterDefinition((ClusterDefinition *)0)
@@ -519,6 +591,9 @@ public:
 
 		_phy.close(_v4TcpControlSocket);
 		_phy.close(_v6TcpControlSocket);
+#ifdef ZT_USE_NETLINK_MONITOR
+		_phy.close(_netlinkSocket,false);
+#endif
 
 #ifdef ZT_ENABLE_CLUSTER
 		_phy.close(_clusterMessageSocket);
@@ -527,6 +602,8 @@ public:
 #ifdef ZT_USE_MINIUPNPC
 		delete _portMapper;
 #endif
+		for(std::vector<WireBatch *>::iterator wb(_wireBatches.begin());wb!=_wireBatches.end();++wb)
+			delete *wb;
 		delete _controller;
 #ifdef ZT_ENABLE_CLUSTER
 		delete _clusterDefinition;
@@ -646,6 +723,14 @@ public:
 			}
 			applyLocalConfig();
 
+			// Validate new peers' identities off the main thread so a flood of them can't stall it
+			{
+				Mutex::Lock _l2(_localConfig_m);
+				const unsigned long n = std::min((unsigned long)OSUtils::jsonInt(_localConfig["settings"]["identityValidationThreads"],(uint64_t)ZT_IDENTITY_VALIDATION_THREADS),(unsigned long)ZT_IDENTITY_VALIDATION_THREADS_MAX);
+				for(unsigned long i=0;i<n;++i)
+					_backgroundThreads.push_back(Thread::start(this));
+			}
+
 			// Bind TCP control socket
 			const int portTrials = (_primaryPort == 0) ? 256 : 1; // if port is 0, pick random
 			for(int k=0;k<portTrials;++k) {
@@ -753,7 +838,17 @@ public:
 				return _termReason;
 			}
 
-			_controller = new EmbeddedNetworkController(_node,(_homePath + ZT_PATH_SEPARATOR_S ZT_CONTROLLER_DB_PATH).c_str());
+			const std::string controllerDbPath(_homePath + ZT_PATH_SEPARATOR_S ZT_CONTROLLER_DB_PATH);
+			unsigned long controllerDbFlushInterval;
+			bool controllerDbLog;
+			{
+				Mutex::Lock _l(_localConfig_m);
+				controllerDbFlushInterval = (unsigned long)OSUtils::jsonInt(_localConfig["settings"]["controllerDbFlushInterval"],0ULL);
+				controllerDbLog = OSUtils::jsonBool(_localConfig["settings"]["controllerDbLog"],false);
+			}
+			if (JSONDB::hasLog(controllerDbPath)) // never silently ignore an existing log database
+				controllerDbLog = true;
+			_controller = new EmbeddedNetworkController(_node,controllerDbPath.c_str(),controllerDbFlushInterval,controllerDbLog);
 			_node->setNetconfMaster((void *)_controller);
 
 #ifdef ZT_ENABLE_CLUSTER
@@ -827,6 +922,9 @@ public:
 			_lastRestart = clockShouldBe;
 			uint64_t lastTapMulticastGroupCheck = 0;
 			uint64_t lastBindRefresh = 0;
+#ifdef ZT_USE_NETLINK_MONITOR
+			uint64_t lastNetlinkOpen = 0;
+#endif
 			uint64_t lastUpdateCheck = clockShouldBe;
 			uint64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give portmapper time to configure and other things time to settle
 			uint64_t lastCleanedIddb = 0;
@@ -864,9 +962,38 @@ public:
 						_updater->apply();
 				}
 
+				// Listen for interface changes so the polling below can be slow; reopen if the kernel dropped events
+				uint64_t bindRefreshPeriod = ZT_BINDER_REFRESH_PERIOD;
+				uint64_t tapMulticastCheckInterval = ZT_TAP_CHECK_MULTICAST_INTERVAL;
+				bool interfacesChanged = false;
+#ifdef ZT_USE_NETLINK_MONITOR
+				if ((!_netlinkSocket)&&((now - lastNetlinkOpen) >= ZT_BINDER_REFRESH_PERIOD)) {
+					lastNetlinkOpen = now;
+					const int fd = LinuxNetlinkMonitor::open(_netlinkMulticast);
+					if (fd >= 0) {
+						_netlinkSocket = _phy.wrapSocket(fd);
+						if (_netlinkSocket) {
+							lastBindRefresh = 0; // anything could have changed while nobody was listening
+							lastTapMulticastGroupCheck = 0;
+						} else {
+							::close(fd);
+						}
+					}
+				}
+				if (_netlinkSocket) {
+					bindRefreshPeriod = ZT_BINDER_REFRESH_FALLBACK_PERIOD;
+					if (_netlinkMulticast)
+						tapMulticastCheckInterval = ZT_TAP_CHECK_MULTICAST_FALLBACK_INTERVAL;
+				}
+				interfacesChanged = (((_netlinkEvents & (LinuxNetlinkMonitor::EVENT_LINK|LinuxNetlinkMonitor::EVENT_ADDRESS)) != 0)&&((now - lastBindRefresh) >= ZT_BINDER_EVENT_REFRESH_DELAY));
+#endif
+
 				// Refresh bindings in case device's interfaces have changed, and also sync routes to update any shadow routes (e.g. shadow default)
-				if (((now - lastBindRefresh) >= ZT_BINDER_REFRESH_PERIOD)||(restarted)) {
+				if (((now - lastBindRefresh) >= bindRefreshPeriod)||(restarted)||(interfacesChanged)) {
 					lastBindRefresh = now;
+#ifdef ZT_USE_NETLINK_MONITOR
+					_netlinkEvents &= ~((unsigned int)(LinuxNetlinkMonitor::EVENT_LINK|LinuxNetlinkMonitor::EVENT_ADDRESS));
+#endif
 					for(int i=0;i<3;++i) {
 						if (_ports[i]) {
 							_bindings[i].refresh(_phy,_ports[i],*this);
@@ -890,20 +1017,30 @@ public:
 				if ((_tcpFallbackTunnel)&&((now - _lastDirectReceiveFromGlobal) < (ZT_TCP_FALLBACK_AFTER / 2)))
 					_phy.close(_tcpFallbackTunnel->sock);
 
-				if ((now - lastTapMulticastGroupCheck) >= ZT_TAP_CHECK_MULTICAST_INTERVAL) {
+				if ((now - lastTapMulticastGroupCheck) >= tapMulticastCheckInterval) {
 					lastTapMulticastGroupCheck = now;
 					Mutex::Lock _l(_nets_m);
 					for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
-						if (n->second.tap) {
-							std::vector<MulticastGroup> added,removed;
-							n->second.tap->scanMulticastGroups(added,removed);
-							for(std::vector<MulticastGroup>::iterator m(added.begin());m!=added.end();++m)
-								_node->multicastSubscribe(n->first,m->mac().toInt(),m->adi());
-							for(std::vector<MulticastGroup>::iterator m(removed.begin());m!=removed.end();++m)
-								_node->multicastUnsubscribe(n->first,m->mac().toInt(),m->adi());
+						if (n->second.tap)
+							checkMulticastGroups(n->first,n->second.tap);
+					}
+				}
+#ifdef ZT_USE_NETLINK_MONITOR
+				else if (!_netlinkInterfaces.empty()) { // only taps whose links, addresses or subscriptions changed
+					Mutex::Lock _l(_nets_m);
+					for(std::vector<unsigned int>::const_iterator i(_netlinkInterfaces.begin());i!=_netlinkInterfaces.end();++i) {
+						char name[IF_NAMESIZE];
+						if (!if_indextoname(*i,name))
+							continue;
+						for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
+							if ((n->second.tap)&&(n->second.tap->deviceName() == name))
+								checkMulticastGroups(n->first,n->second.tap);
 						}
 					}
 				}
+				_netlinkInterfaces.clear();
+				_netlinkEvents &= ~((unsigned int)LinuxNetlinkMonitor::EVENT_MULTICAST);
+#endif
 
 				if ((now - lastLocalInterfaceAddressCheck) >= ZT_LOCAL_INTERFACE_CHECK_INTERVAL) {
 					lastLocalInterfaceAddressCheck = now;
@@ -923,9 +1060,20 @@ public:
 						_node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*i)));
 				}
 
-				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+				unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+#ifdef ZT_USE_NETLINK_MONITOR
+				if ((_netlinkEvents)&&(delay > ZT_BINDER_EVENT_REFRESH_DELAY))
+					delay = ZT_BINDER_EVENT_REFRESH_DELAY; // come back for a binding refresh held off above
+#endif
 				clockShouldBe = now + (uint64_t)delay;
+
+				// What handling these events sends, mostly relayed packets on a busy root, goes out in batches
+				WireBatch *const wb = _takeWireBatch();
+				_wireBatch = wb;
 				_phy.poll(delay);
+				_wireBatch = (WireBatch *)0;
+				_flushWireBatch(*wb);
+				_giveWireBatch(wb);
 			}
 		} catch (std::exception &exc) {
 			Mutex::Lock _l(_termReason_m);
@@ -944,11 +1092,18 @@ public:
 
 		{
 			Mutex::Lock _l(_nets_m);
+			ManagedRouteTable::Batch routeBatch(ManagedRouteTable::system());
 			for(std::map<uint64_t,NetworkState>::iterator n(_nets.begin());n!=_nets.end();++n)
 				delete n->second.tap;
 			_nets.clear();
 		}
 
+		if (_node)
+			_node->stopBackgroundWork();
+		for(std::vector<Thread>::iterator t(_backgroundThreads.begin());t!=_backgroundThreads.end();++t)
+			Thread::join(*t);
+		_backgroundThreads.clear();
+
 		delete _updater;
 		_updater = (SoftwareUpdater *)0;
 		delete _node;
@@ -978,6 +1133,16 @@ public:
 		else return std::string();
 	}
 
+	// Background thread main: do the core's background work and wake the main loop to act on each result
+	void threadMain()
+		throw()
+	{
+		while (_node->processBackgroundWork()) {
+			_nextBackgroundTaskDeadline = 0;
+			_phy.whack();
+		}
+	}
+
 	virtual void terminate()
 	{
 		_run_m.lock();
@@ -1061,7 +1226,8 @@ public:
 		const std::map<std::string,std::string> &headers,
 		const std::string &body,
 		std::string &responseBody,
-		std::string &responseContentType)
+		std::string &responseContentType,
+		TcpConnection *tc = (TcpConnection *)0)
 	{
 		char tmp[256];
 		unsigned int scode = 404;
@@ -1178,6 +1344,7 @@ public:
 #else
 					settings["portMappingEnabled"] = false; // not supported in build
 #endif
+					settings["bondingPolicy"] = OSUtils::jsonString(settings["bondingPolicy"],"none");
 					//settings["softwareUpdate"] = OSUtils::jsonString(settings["softwareUpdate"],ZT_SOFTWARE_UPDATE_DEFAULT);
 					//settings["softwareUpdateChannel"] = OSUtils::jsonString(settings["softwareUpdateChannel"],ZT_SOFTWARE_UPDATE_DEFAULT_CHANNEL);
 
@@ -1206,6 +1373,10 @@ public:
 						cj["members"] = cja;
 						cj["myId"] = (int)cs.myId;
 						cj["clusterSize"] = cs.clusterSize;
+						cj["backplaneBytesSent"] = cs.backplaneBytesSent;
+						cj["backplaneBytesReceived"] = cs.backplaneBytesReceived;
+						cj["backplaneBytesSentPerSecond"] = cs.backplaneBytesSentPerSecond;
+						cj["backplaneBytesReceivedPerSecond"] = cs.backplaneBytesReceivedPerSecond;
 					}
 					res["cluster"] = cj;
 #else
@@ -1273,34 +1444,74 @@ public:
 						_node->freeQueryResult((void *)nws);
 					} else scode = 500;
 				} else if (ps[0] == "peer") {
-					ZT_PeerList *pl = _node->peers();
-					if (pl) {
-						if (ps.size() == 1) {
-							// Return [array] of all peers
-
-							res = nlohmann::json::array();
+					std::map<std::string,std::string>::const_iterator since(urlArgs.find("since"));
+					const uint64_t changedSince = (since != urlArgs.end()) ? Utils::strToU64(since->second.c_str()) : 0;
+					std::map<std::string,std::string>::const_iterator limit(urlArgs.find("limit"));
+
+					if ((ps.size() == 1)&&(limit != urlArgs.end())) {
+						// Return one page of peers from ?start= (hex address) on, and where the next page starts
+
+						std::map<std::string,std::string>::const_iterator start(urlArgs.find("start"));
+						const unsigned long maxPeers = (unsigned long)std::min(Utils::strToU64(limit->second.c_str()),(unsigned long long)ZT_HTTP_PEER_PAGE_MAX);
+						ZT_PeerList *pl = _node->queryPeers((start != urlArgs.end()) ? Utils::hexStrToU64(start->second.c_str()) : 0,0xffffffffffULL,maxPeers,changedSince);
+						if (pl) {
+							json pa = json::array();
 							for(unsigned long i=0;i<pl->peerCount;++i) {
-								nlohmann::json pj;
+								json pj;
 								_peerToJson(pj,&(pl->peers[i]));
-								res.push_back(pj);
+								pa.push_back(pj);
 							}
-
+							res["peers"] = pa;
+							if ((maxPeers)&&(pl->peerCount == maxPeers)&&(pl->peers[pl->peerCount - 1].address < 0xffffffffffULL)) {
+								Utils::snprintf(tmp,sizeof(tmp),"%.10llx",pl->peers[pl->peerCount - 1].address + 1);
+								res["next"] = tmp;
+							} else res["next"] = json();
+							_node->freeQueryResult((void *)pl);
 							scode = 200;
-						} else if (ps.size() == 2) {
-							// Return a single peer by ID or 404 if not found
-
-							uint64_t wantp = Utils::hexStrToU64(ps[1].c_str());
-							for(unsigned long i=0;i<pl->peerCount;++i) {
-								if (pl->peers[i].address == wantp) {
-									_peerToJson(res,&(pl->peers[i]));
-									scode = 200;
+						} else scode = 500;
+					} else if (ps.size() == 1) {
+						// Return [array] of all peers, or those changed ?since= a time, streamed a page at a time
+
+						if ((tc)&&(urlArgs.find("jsonp") == urlArgs.end())) {
+							tc->streamingPeers = true;
+							tc->streamNext = 0;
+							tc->streamChangedSince = changedSince;
+							tc->streamCount = 0;
+							responseContentType = "application/json";
+							scode = 200;
+						} else {
+							res = json::array();
+							for(uint64_t next=0;;) {
+								ZT_PeerList *pl = _node->queryPeers(next,0xffffffffffULL,ZT_HTTP_PEER_PAGE_SIZE,changedSince);
+								if (!pl)
 									break;
+								for(unsigned long i=0;i<pl->peerCount;++i) {
+									json pj;
+									_peerToJson(pj,&(pl->peers[i]));
+									res.push_back(pj);
 								}
+								const bool more = (pl->peerCount == ZT_HTTP_PEER_PAGE_SIZE);
+								if (more)
+									next = pl->peers[pl->peerCount - 1].address + 1;
+								_node->freeQueryResult((void *)pl);
+								if (!more)
+									break;
 							}
-
-						} else scode = 404;
-						_node->freeQueryResult((void *)pl);
-					} else scode = 500;
+							scode = 200;
+						}
+					} else if (ps.size() == 2) {
+						// Return a single peer by ID or 404 if not found
+
+						const uint64_t wantp = Utils::hexStrToU64(ps[1].c_str());
+						ZT_PeerList *pl = _node->queryPeers(wantp,wantp,1,0);
+						if (pl) {
+							if (pl->peerCount) {
+								_peerToJson(res,&(pl->peers[0]));
+								scode = 200;
+							}
+							_node->freeQueryResult((void *)pl);
+						} else scode = 500;
+					} else scode = 404;
 				} else {
 					if (_controller) {
 						scode = _controller->handleControlPlaneHttpGET(std::vector<std::string>(ps.begin()+1,ps.end()),urlArgs,headers,body,responseBody,responseContentType);
@@ -1428,7 +1639,7 @@ public:
 			scode = 400;
 		}
 
-		if (responseBody.length() == 0) {
+		if ((responseBody.length() == 0)&&(!((tc)&&(tc->streamingPeers)))) {
 			if ((res.is_object())||(res.is_array()))
 				responseBody = OSUtils::jsonDump(res);
 			else responseBody = "{}";
@@ -1527,6 +1738,13 @@ public:
 
 		_primaryPort = (unsigned int)OSUtils::jsonInt(settings["primaryPort"],(uint64_t)_primaryPort) & 0xffff;
 		_portMappingEnabled = OSUtils::jsonBool(settings["portMappingEnabled"],true);
+
+		const std::string bp(OSUtils::jsonString(settings["bondingPolicy"],"none"));
+		if (bp == "balance-flow")
+			_node->setBondingPolicy(ZT_BONDING_POLICY_BALANCE_FLOW);
+		else if (bp == "balance-rr")
+			_node->setBondingPolicy(ZT_BONDING_POLICY_BALANCE_RR);
+		else _node->setBondingPolicy(ZT_BONDING_POLICY_NONE);
 /*
 		const std::string up(OSUtils::jsonString(settings["softwareUpdate"],ZT_SOFTWARE_UPDATE_DEFAULT));
 		const bool udist = OSUtils::jsonBool(settings["softwareUpdateDist"],false);
@@ -1603,6 +1821,17 @@ public:
 		return false;
 	}
 
+	// Tell the node about multicast groups a tap has joined or left since it was last checked
+	inline void checkMulticastGroups(const uint64_t nwid,EthernetTap *tap)
+	{
+		std::vector<MulticastGroup> added,removed;
+		tap->scanMulticastGroups(added,removed);
+		for(std::vector<MulticastGroup>::iterator m(added.begin());m!=added.end();++m)
+			_node->multicastSubscribe(nwid,m->mac().toInt(),m->adi());
+		for(std::vector<MulticastGroup>::iterator m(removed.begin());m!=removed.end();++m)
+			_node->multicastUnsubscribe(nwid,m->mac().toInt(),m->adi());
+	}
+
 	// Apply or update managed IPs for a configured network (be sure n.tap exists)
 	void syncManagedStuff(NetworkState &n,bool syncIps,bool syncRoutes)
 	{
@@ -1648,6 +1877,9 @@ public:
 
 			std::vector<InetAddress> myIps(n.tap->ips());
 
+			// Changes go to the system in one go when this closes, instead of one at a time
+			ManagedRouteTable::Batch routeBatch(ManagedRouteTable::system());
+
 			// Nuke applied routes that are no longer in n.config.routes[] and/or are not allowed
 			for(std::list< SharedPtr<ManagedRoute> >::iterator mr(n.managedRoutes.begin());mr!=n.managedRoutes.end();) {
 				bool haveRoute = false;
@@ -1765,6 +1997,8 @@ public:
 		tc->lastActivity = OSUtils::now();
 		// HTTP stuff is not used
 		tc->writeBuf = "";
+		tc->streamingPeers = false;
+		tc->streamFailed = false;
 		*uptr = (void *)tc;
 
 		// Send "hello" message
@@ -1806,6 +2040,8 @@ public:
 			tc->headers.clear();
 			tc->body = "";
 			tc->writeBuf = "";
+			tc->streamingPeers = false;
+			tc->streamFailed = false;
 			*uptrN = (void *)tc;
 		}
 	}
@@ -1914,6 +2150,18 @@ public:
 	inline void phyOnTcpWritable(PhySocket *sock,void **uptr, bool stack_invoked)
 	{
 		TcpConnection *tc = reinterpret_cast<TcpConnection *>(*uptr);
+		if ((tc->streamingPeers)||(tc->streamFailed)) {
+			bool failed;
+			{
+				Mutex::Lock _l(tc->writeBuf_m);
+				streamPeers(tc);
+				failed = tc->streamFailed;
+			}
+			if (failed) {
+				_phy.close(sock); // will call close handler to delete from _tcpConnections
+				return;
+			}
+		}
 		Mutex::Lock _l(tc->writeBuf_m);
 		if (tc->writeBuf.length() > 0) {
 			long sent = (long)_phy.streamSend(sock,tc->writeBuf.data(),(unsigned long)tc->writeBuf.length(),true);
@@ -1921,9 +2169,11 @@ public:
 				tc->lastActivity = OSUtils::now();
 				if ((unsigned long)sent >= (unsigned long)tc->writeBuf.length()) {
 					tc->writeBuf = "";
-					_phy.setNotifyWritable(sock,false);
-					if (!tc->shouldKeepAlive)
-						_phy.close(sock); // will call close handler to delete from _tcpConnections
+					if (!tc->streamingPeers) { // otherwise stay writable for the next page
+						_phy.setNotifyWritable(sock,false);
+						if (!tc->shouldKeepAlive)
+							_phy.close(sock); // will call close handler to delete from _tcpConnections
+					}
 				} else {
 					tc->writeBuf = tc->writeBuf.substr(sent);
 				}
@@ -1935,8 +2185,23 @@ public:
 
 	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
 	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
-	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
-	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr)
+	{
+#ifdef ZT_USE_NETLINK_MONITOR
+		if (sock == _netlinkSocket)
+			_netlinkSocket = (PhySocket *)0; // read failed, most likely because events were dropped; poll until it is open again
+#endif
+	}
+
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+#ifdef ZT_USE_NETLINK_MONITOR
+		if (sock == _netlinkSocket)
+			_netlinkEvents |= LinuxNetlinkMonitor::parse(data,len,_netlinkInterfaces);
+#endif
+	}
+
 	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked) {}
 
 	inline int nodeVirtualNetworkConfigFunction(uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwc)
@@ -1960,6 +2225,9 @@ public:
 							friendlyName,
 							StapFrameHandler,
 							(void *)this);
+#ifdef ZT_SDK
+						n.tap->_batchHandler = StapFrameBatchHandler;
+#endif
 						*nuptr = (void *)&n;
 
 						char nlcpath[256];
@@ -2210,9 +2478,40 @@ public:
 			return 0; // silently break UDP
 #endif
 
+		// Inside a burst of tap frames or a poll, hold packets from a known local address
+		// and send them together when the burst is done
+		WireBatch *const wb = _wireBatch;
+		if ((wb)&&(!ttl)&&(len <= ZT_UDP_DEFAULT_PAYLOAD_MTU)&&(*(reinterpret_cast<const InetAddress *>(localAddr)))) {
+			if (wb->count == ZT_PHY_MAX_SEND_BATCH)
+				_flushWireBatch(*wb);
+			const unsigned int i = wb->count++;
+			wb->bindingNo[i] = fromBindingNo;
+			wb->local[i] = *(reinterpret_cast<const InetAddress *>(localAddr));
+			wb->remote[i] = *(reinterpret_cast<const InetAddress *>(addr));
+			wb->len[i] = len;
+			memcpy(wb->data[i],data,len);
+			return 0;
+		}
+
 		return (_bindings[fromBindingNo].udpSend(_phy,*(reinterpret_cast<const InetAddress *>(localAddr)),*(reinterpret_cast<const InetAddress *>(addr)),data,len,ttl)) ? 0 : -1;
 	}
 
+	inline void _flushWireBatch(WireBatch &wb)
+	{
+		const struct sockaddr *remotes[ZT_PHY_MAX_SEND_BATCH];
+		const void *data[ZT_PHY_MAX_SEND_BATCH];
+		for(unsigned int i=0;i<wb.count;++i) {
+			remotes[i] = reinterpret_cast<const struct sockaddr *>(&(wb.remote[i]));
+			data[i] = wb.data[i];
+		}
+		// Each run of packets from the same local address goes out in one call
+		for(unsigned int i=0,j;i<wb.count;i=j) {
+			for(j=i+1;(j<wb.count)&&(wb.bindingNo[j] == wb.bindingNo[i])&&(wb.local[j] == wb.local[i]);++j) {}
+			_bindings[wb.bindingNo[i]].udpSendBatch(_phy,wb.local[i],remotes + i,data + i,wb.len + i,j - i);
+		}
+		wb.count = 0;
+	}
+
 	inline void nodeVirtualNetworkFrameFunction(uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
 		NetworkState *n = reinterpret_cast<NetworkState *>(*nuptr);
@@ -2294,6 +2593,38 @@ public:
 		_node->processVirtualNetworkFrame(OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
 	}
 
+	inline void tapFrameBatchHandler(uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count)
+	{
+		WireBatch *const wb = _takeWireBatch();
+		_wireBatch = wb;
+		_node->processVirtualNetworkFrames(OSUtils::now(),nwid,frames,count,&_nextBackgroundTaskDeadline);
+		_wireBatch = (WireBatch *)0;
+		_flushWireBatch(*wb);
+		_giveWireBatch(wb);
+	}
+
+	inline WireBatch *_takeWireBatch()
+	{
+		WireBatch *wb;
+		{
+			Mutex::Lock _l(_wireBatches_m);
+			if (_wireBatches.empty()) {
+				wb = new WireBatch();
+			} else {
+				wb = _wireBatches.back();
+				_wireBatches.pop_back();
+			}
+		}
+		wb->count = 0;
+		return wb;
+	}
+
+	inline void _giveWireBatch(WireBatch *wb)
+	{
+		Mutex::Lock _l(_wireBatches_m);
+		_wireBatches.push_back(wb);
+	}
+
 	inline void onHttpRequestToServer(TcpConnection *tc)
 	{
 		char tmpn[256];
@@ -2319,7 +2650,7 @@ public:
 
 		if (allow) {
 			try {
-				scode = handleControlPlaneHttpRequest(tc->from,tc->parser.method,tc->url,tc->headers,tc->body,data,contentType);
+				scode = handleControlPlaneHttpRequest(tc->from,tc->parser.method,tc->url,tc->headers,tc->body,data,contentType,tc);
 			} catch (std::exception &exc) {
 				fprintf(stderr,"WARNING: unexpected exception processing control HTTP request: %s" ZT_EOL_S,exc.what());
 				scode = 500;
@@ -2350,18 +2681,55 @@ public:
 			tc->writeBuf.assign(tmpn);
 			tc->writeBuf.append("Content-Type: ");
 			tc->writeBuf.append(contentType);
-			Utils::snprintf(tmpn,sizeof(tmpn),"\r\nContent-Length: %lu\r\n",(unsigned long)data.length());
-			tc->writeBuf.append(tmpn);
+			if (tc->streamingPeers) {
+				// Length isn't known up front, so the end of the body is the end of the connection
+				tc->shouldKeepAlive = false;
+				tc->writeBuf.append("\r\n");
+			} else {
+				Utils::snprintf(tmpn,sizeof(tmpn),"\r\nContent-Length: %lu\r\n",(unsigned long)data.length());
+				tc->writeBuf.append(tmpn);
+			}
 			if (!tc->shouldKeepAlive)
 				tc->writeBuf.append("Connection: close\r\n");
 			tc->writeBuf.append("\r\n");
-			if (tc->parser.method != HTTP_HEAD)
+			if (tc->parser.method != HTTP_HEAD) {
 				tc->writeBuf.append(data);
+				if (tc->streamingPeers) {
+					tc->writeBuf.push_back('[');
+					streamPeers(tc);
+				}
+			} else tc->streamingPeers = false;
 		}
 
 		_phy.setNotifyWritable(tc->sock,true);
 	}
 
+	// Append the next pages of a streamed /peer response until enough is waiting to be written; call with writeBuf_m locked
+	inline void streamPeers(TcpConnection *tc)
+	{
+		while ((tc->streamingPeers)&&(tc->writeBuf.length() < ZT_HTTP_STREAM_LOW_WATER)) {
+			ZT_PeerList *pl = _node->queryPeers(tc->streamNext,0xffffffffffULL,ZT_HTTP_PEER_PAGE_SIZE,tc->streamChangedSince);
+			if (pl) {
+				for(unsigned long i=0;i<pl->peerCount;++i) {
+					json pj;
+					_peerToJson(pj,&(pl->peers[i]));
+					if (tc->streamCount++)
+						tc->writeBuf.push_back(',');
+					tc->writeBuf.append(OSUtils::jsonDump(pj));
+				}
+				if (pl->peerCount == ZT_HTTP_PEER_PAGE_SIZE)
+					tc->streamNext = pl->peers[pl->peerCount - 1].address + 1;
+				else tc->streamingPeers = false;
+				_node->freeQueryResult((void *)pl);
+				if (!tc->streamingPeers)
+					tc->writeBuf.push_back(']');
+			} else {
+				tc->streamingPeers = false;
+				tc->streamFailed = true; // phyOnTcpWritable() will drop the connection
+			}
+		}
+	}
+
 	inline void onHttpResponseFromClient(TcpConnection *tc)
 	{
 		if (!tc->shouldKeepAlive)
@@ -2496,6 +2864,10 @@ static int SclusterGeoIpFunction(void *uptr,const struct sockaddr_storage *addr,
 
 static void StapFrameHandler(void *uptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameHandler(nwid,from,to,etherType,vlanId,data,len); }
+#ifdef ZT_SDK
+static void StapFrameBatchHandler(void *uptr,uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameBatchHandler(nwid,frames,count); }
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser)
 {